@@ -212,11 +212,18 @@ methclaSources variant sourceDir buildDir target versionHeader platformSources =
               --   [ SourceTree.files [ "src/Methcla/Audio/Engine.cpp" ] ],
               SourceTree.files $ under sourceDir
                 [ "src/Methcla/Audio/AudioBus.cpp"
+                , "src/Methcla/Audio/DSP.cpp"
                 , "src/Methcla/Audio/Engine.cpp"
                 , "src/Methcla/Audio/EngineImpl.cpp"
+                , "src/Methcla/Audio/ExecutionPlan.cpp"
                 , "src/Methcla/Audio/Group.cpp"
                 , "src/Methcla/Audio/IO/Driver.cpp"
+                , "src/Methcla/IO/QueryIds.cpp"
+                , "src/Methcla/IO/RequestCapture.cpp"
+                , "src/Methcla/IO/SharedMemoryServer.cpp"
+                , "src/Methcla/IO/SocketServer.cpp"
                 , "src/Methcla/Audio/Node.cpp"
+                , "src/Methcla/Audio/ParallelGroup.cpp"
                 -- , "src/Methcla/Audio/Resource.cpp"
                 , "src/Methcla/Audio/Synth.cpp"
                 , "src/Methcla/Audio/SynthDef.cpp"
@@ -225,6 +232,7 @@ methclaSources variant sourceDir buildDir target versionHeader platformSources =
                 -- Disable for now
                 -- , "src/Methcla/Plugin/Loader.cpp"
                 , "src/Methcla/Utility/Semaphore.cpp"
+                , "src/Methcla/Utility/ThreadPool.cpp"
                 ]
             , SourceTree.filesWithDeps $ map (first (combine sourceDir))
                 [ ("src/Methcla/API.cpp", [ versionHeaderPath versionHeader ]) ]
@@ -232,8 +240,6 @@ methclaSources variant sourceDir buildDir target versionHeader platformSources =
               -- platform dependent
             , platformSources
             , engineSources variant sourceDir target
-          -- , sourceTree_ (vectorBuildFlags . engineBuildFlags) $ sourceFiles $
-          --     under "src" [ "Methcla/Audio/DSP.c" ]
         ]
       , SourceTree.flags pluginBuildFlags $ SourceTree.list [
           SourceTree.files $ under sourceDir [
@@ -331,6 +337,10 @@ libm = append libraries ["m"]
 libpthread :: BuildFlags -> BuildFlags
 libpthread = append libraries ["pthread"]
 
+-- | POSIX realtime library (shared memory).
+librt :: BuildFlags -> BuildFlags
+librt = append libraries ["rt"]
+
 -- | Pass -stdlib=libc++ (clang).
 stdlib_libcpp :: ToolChain -> BuildFlags -> BuildFlags
 stdlib_libcpp toolChain = onlyIf (get variant toolChain == LLVM) $
@@ -736,6 +746,7 @@ mkRules variant options = do
                            >>> commonBuildFlags
                            >>> stdlib_libcpp toolChain
                            >>> Host.onlyOn [Host.Linux] libpthread
+                           >>> Host.onlyOn [Host.Linux] librt
                            >>> libm
                            >>> testBuildFlags target
             return $ do
@@ -756,6 +767,25 @@ mkRules variant options = do
                     system' result []
                 phony "clean-test" $ removeFilesAfter "tests/output" ["*.osc", "*.wav"]
         )
+      , (["replay"], do -- request capture replay tool
+            applyEnv <- toolChainFromEnvironment
+            (target, toolChain) <- fmap (second applyEnv) Host.getDefaultToolChain
+            let env = mkEnv' target
+                buildFlags =   applyConfiguration config configurations
+                           >>> commonBuildFlags
+                           >>> stdlib_libcpp toolChain
+                           >>> Host.onlyOn [Host.Linux] libpthread
+                           >>> Host.onlyOn [Host.Linux] librt
+                           >>> libm
+                           >>> testBuildFlags target
+            return $ do
+                versionHeader <- mkVersionHeader'
+                result <- executable env target toolChain "methcla-replay"
+                          $ SourceTree.flags buildFlags
+                          $ methclaSources' target versionHeader
+                          $ SourceTree.files [ "tools/replay.cpp" ]
+                phony "replay" $ need [result]
+        )
       , (["tags"], do -- tags
             let and_ a b = do { as <- a; bs <- b; return $! as ++ bs }
                 files clause dir = find always clause dir
@@ -79,6 +79,7 @@ typedef enum
     kMethcla_SynthDefNotFoundError = 1000,
     kMethcla_NodeIdError,
     kMethcla_NodeTypeError,
+    kMethcla_QueueFullError,
 
     /* File errors */
     kMethcla_FileNotFoundError = 2000,
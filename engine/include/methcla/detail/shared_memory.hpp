@@ -0,0 +1,399 @@
+// Copyright 2012-2014 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_DETAIL_SHARED_MEMORY_HPP_INCLUDED
+#define METHCLA_DETAIL_SHARED_MEMORY_HPP_INCLUDED
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__native_client__) && !defined(__ANDROID__)
+#   define METHCLA_HAVE_SHARED_MEMORY 1
+#else
+#   define METHCLA_HAVE_SHARED_MEMORY 0
+#endif
+
+#if METHCLA_HAVE_SHARED_MEMORY
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Methcla
+{
+    namespace detail
+    {
+        //* POSIX shared memory segment mapped into the address space of the process.
+        class SharedMemory
+        {
+        public:
+            //* Create a segment of size bytes, replacing an existing segment with the same name.
+            //
+            // The segment is removed when the creating object is destroyed.
+            SharedMemory(const std::string& name, size_t size)
+                : m_name(name)
+                , m_owner(true)
+            {
+                shm_unlink(name.c_str());
+                const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+                if (fd < 0)
+                    throwError("shm_open");
+                if (ftruncate(fd, size) < 0)
+                {
+                    close(fd);
+                    shm_unlink(name.c_str());
+                    throwError("ftruncate");
+                }
+                map(fd, size);
+            }
+
+            //* Open an existing segment.
+            SharedMemory(const std::string& name)
+                : m_name(name)
+                , m_owner(false)
+            {
+                const int fd = shm_open(name.c_str(), O_RDWR, 0);
+                if (fd < 0)
+                    throwError("shm_open");
+                struct stat info;
+                if (fstat(fd, &info) < 0)
+                {
+                    close(fd);
+                    throwError("fstat");
+                }
+                map(fd, info.st_size);
+            }
+
+            ~SharedMemory()
+            {
+                munmap(m_data, m_size);
+                if (m_owner)
+                    shm_unlink(m_name.c_str());
+            }
+
+            SharedMemory(const SharedMemory&) = delete;
+            SharedMemory& operator=(const SharedMemory&) = delete;
+
+            void* data() const
+            {
+                return m_data;
+            }
+
+            size_t size() const
+            {
+                return m_size;
+            }
+
+        private:
+            void map(int fd, size_t size)
+            {
+                m_size = size;
+                m_data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                close(fd);
+                if (m_data == MAP_FAILED)
+                {
+                    if (m_owner)
+                        shm_unlink(m_name.c_str());
+                    throwError("mmap");
+                }
+            }
+
+            void throwError(const char* what)
+            {
+                throw std::runtime_error(std::string(what) + " " + m_name + ": " + std::strerror(errno));
+            }
+
+            std::string m_name;
+            bool        m_owner;
+            void*       m_data;
+            size_t      m_size;
+        };
+
+        //* Bounded lock-free queue of packets in memory shared between processes.
+        //
+        // Uses the same algorithm as the engine's multi-producer multi-consumer
+        // request queue on fixed size cells; each packet is tagged with an
+        // integer, e.g. the request id of a reply.
+        class SharedPacketQueue
+        {
+            static const size_t kCacheLineSize = 64;
+
+            struct Header
+            {
+                uint64_t                mask;
+                uint64_t                cellSize;
+                char                    pad0[kCacheLineSize - 2 * sizeof(uint64_t)];
+                std::atomic<uint64_t>   pushPos;
+                char                    pad1[kCacheLineSize - sizeof(std::atomic<uint64_t>)];
+                std::atomic<uint64_t>   popPos;
+                char                    pad2[kCacheLineSize - sizeof(std::atomic<uint64_t>)];
+            };
+
+            struct Cell
+            {
+                std::atomic<uint64_t>   sequence;
+                int32_t                 tag;
+                uint32_t                size;
+
+                char* data()
+                {
+                    return reinterpret_cast<char*>(this) + sizeof(Cell);
+                }
+            };
+
+            static size_t cellSize(size_t maxPacketSize)
+            {
+                return (sizeof(Cell) + maxPacketSize + kCacheLineSize - 1) & ~(kCacheLineSize - 1);
+            }
+
+            static size_t roundUpToPowerOfTwo(size_t n)
+            {
+                size_t result = 1;
+                while (result < n) result <<= 1;
+                return result;
+            }
+
+        public:
+            //* Return the number of bytes needed for a queue.
+            static size_t memorySize(size_t capacity, size_t maxPacketSize)
+            {
+                return sizeof(Header) + roundUpToPowerOfTwo(capacity) * cellSize(maxPacketSize);
+            }
+
+            //* Initialize a queue in memory of memorySize(capacity, maxPacketSize) bytes.
+            //
+            // Other processes attach to the queue after it has been initialized.
+            static void init(void* memory, size_t capacity, size_t maxPacketSize)
+            {
+                static_assert(sizeof(Header) % kCacheLineSize == 0, "Queue header isn't padded to the cache line size");
+                Header* header = new (memory) Header;
+                header->mask = roundUpToPowerOfTwo(capacity) - 1;
+                header->cellSize = cellSize(maxPacketSize);
+                header->pushPos.store(0, std::memory_order_relaxed);
+                header->popPos.store(0, std::memory_order_relaxed);
+                char* cells = static_cast<char*>(memory) + sizeof(Header);
+                for (size_t i=0; i <= header->mask; i++)
+                {
+                    Cell* cell = new (cells + i * header->cellSize) Cell;
+                    cell->sequence.store(i, std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_release);
+            }
+
+            //* Attach to a queue initialized with init(memory, capacity, maxPacketSize).
+            //
+            // The queue geometry is checked against the header once and kept
+            // in the attaching object, so that a peer overwriting the shared
+            // header can't make this process access memory outside the queue.
+            SharedPacketQueue(void* memory, size_t capacity, size_t maxPacketSize)
+                : m_header(static_cast<Header*>(memory))
+                , m_cells(static_cast<char*>(memory) + sizeof(Header))
+                , m_mask(roundUpToPowerOfTwo(capacity) - 1)
+                , m_cellSize(cellSize(maxPacketSize))
+            {
+                if (!m_header->pushPos.is_lock_free())
+                    throw std::logic_error("SharedPacketQueue requires lock-free 64 bit atomics");
+                if (m_header->mask != m_mask || m_header->cellSize != m_cellSize)
+                    throw std::runtime_error("Incompatible shared memory queue");
+            }
+
+            size_t capacity() const
+            {
+                return m_mask + 1;
+            }
+
+            size_t maxPacketSize() const
+            {
+                return m_cellSize - sizeof(Cell);
+            }
+
+            //* Append a copy of packet, return false if the queue is full.
+            bool push(int32_t tag, const void* packet, size_t size)
+            {
+                if (size > maxPacketSize())
+                    throw std::invalid_argument("Packet exceeds maximum size of shared memory queue");
+                uint64_t pos = m_header->pushPos.load(std::memory_order_relaxed);
+                for (;;)
+                {
+                    Cell* c = cell(pos);
+                    const uint64_t seq = c->sequence.load(std::memory_order_acquire);
+                    const int64_t diff = (int64_t)seq - (int64_t)pos;
+                    if (diff == 0)
+                    {
+                        if (m_header->pushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        {
+                            c->tag = tag;
+                            c->size = size;
+                            std::memcpy(c->data(), packet, size);
+                            c->sequence.store(pos + 1, std::memory_order_release);
+                            return true;
+                        }
+                    }
+                    else if (diff < 0)
+                    {
+                        return false;
+                    }
+                    else
+                    {
+                        pos = m_header->pushPos.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            //* Call func(tag, packet, size) with the oldest packet and remove it, return false if the queue is empty.
+            //
+            // The packet is only valid during the call. Packets whose size
+            // exceeds maxPacketSize() can only have been written by a
+            // misbehaving peer and are removed without calling func.
+            template <class F> bool pop(F func)
+            {
+                uint64_t pos = m_header->popPos.load(std::memory_order_relaxed);
+                for (;;)
+                {
+                    Cell* c = cell(pos);
+                    const uint64_t seq = c->sequence.load(std::memory_order_acquire);
+                    const int64_t diff = (int64_t)seq - (int64_t)(pos + 1);
+                    if (diff == 0)
+                    {
+                        if (m_header->popPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        {
+                            // Hand the cell back to producers even if func throws
+                            struct Release
+                            {
+                                Cell* cell; uint64_t sequence;
+                                ~Release() { cell->sequence.store(sequence, std::memory_order_release); }
+                            } release = { c, pos + m_mask + 1 };
+                            const size_t size = c->size;
+                            if (size <= maxPacketSize())
+                                func(c->tag, static_cast<const void*>(c->data()), size);
+                            return true;
+                        }
+                    }
+                    else if (diff < 0)
+                    {
+                        return false;
+                    }
+                    else
+                    {
+                        pos = m_header->popPos.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+
+        private:
+            Cell* cell(uint64_t pos) const
+            {
+                return reinterpret_cast<Cell*>(m_cells + (pos & m_mask) * m_cellSize);
+            }
+
+            Header*         m_header;
+            char*           m_cells;
+            const uint64_t  m_mask;
+            const uint64_t  m_cellSize;
+        };
+
+        //* Layout of the shared memory segment of the engine's shared memory transport.
+        //
+        // Requests are sent by any number of client threads and read by the
+        // engine; replies and notifications are written by the engine and
+        // read by a single client.
+        class SharedMemoryTransport
+        {
+            static const uint32_t kMagic = 0x4d455448; // "METH"
+            static const uint32_t kVersion = 1;
+
+            struct Header
+            {
+                uint32_t    magic;
+                uint32_t    version;
+                uint64_t    repliesOffset;
+                char        pad[64 - 2 * sizeof(uint32_t) - sizeof(uint64_t)];
+            };
+
+        public:
+            static const size_t kMaxPacketSize = 8192;
+            static const size_t kNumRequests = 1024;
+            static const size_t kNumReplies = 512;
+
+            static size_t memorySize()
+            {
+                return repliesOffset()
+                     + SharedPacketQueue::memorySize(kNumReplies, kMaxPacketSize);
+            }
+
+            //* Initialize the transport in memory of memorySize() bytes.
+            static void init(void* memory)
+            {
+                Header* header = static_cast<Header*>(memory);
+                header->repliesOffset = repliesOffset();
+                SharedPacketQueue::init(static_cast<char*>(memory) + sizeof(Header), kNumRequests, kMaxPacketSize);
+                SharedPacketQueue::init(static_cast<char*>(memory) + repliesOffset(), kNumReplies, kMaxPacketSize);
+                header->version = kVersion;
+                std::atomic_thread_fence(std::memory_order_release);
+                header->magic = kMagic;
+            }
+
+            //* Attach to a transport initialized with init in a segment of size bytes.
+            //
+            // Throws std::runtime_error if size isn't memorySize() or the
+            // segment was initialized by an incompatible version.
+            SharedMemoryTransport(void* memory, size_t size)
+                : m_requests(checkHeader(memory, size), kNumRequests, kMaxPacketSize)
+                , m_replies(static_cast<char*>(memory) + repliesOffset(), kNumReplies, kMaxPacketSize)
+            { }
+
+            SharedPacketQueue& requests()
+            {
+                return m_requests;
+            }
+
+            SharedPacketQueue& replies()
+            {
+                return m_replies;
+            }
+
+        private:
+            static size_t repliesOffset()
+            {
+                return sizeof(Header) + SharedPacketQueue::memorySize(kNumRequests, kMaxPacketSize);
+            }
+
+            static void* checkHeader(void* memory, size_t size)
+            {
+                const Header* header = static_cast<const Header*>(memory);
+                if (size != memorySize()
+                    || header->magic != kMagic
+                    || header->version != kVersion
+                    || header->repliesOffset != repliesOffset())
+                    throw std::runtime_error("Incompatible shared memory transport");
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return static_cast<char*>(memory) + sizeof(Header);
+            }
+
+            SharedPacketQueue m_requests;
+            SharedPacketQueue m_replies;
+        };
+    }
+}
+
+#endif // METHCLA_HAVE_SHARED_MEMORY
+
+#endif // METHCLA_DETAIL_SHARED_MEMORY_HPP_INCLUDED
@@ -89,9 +89,36 @@ struct Methcla_EngineOptions
     size_t                      realtime_memory_size;
     size_t                      max_num_nodes;
     size_t                      max_num_audio_buses;
+    //* Maximum number of control buses; zero selects the default.
+    size_t                      max_num_control_buses;
+
+    //* Number of blocks bundles are scheduled ahead by the realtime scheduler; zero selects the default.
+    //  Bundles scheduled further in the future are staged by the worker thread.
+    size_t                      scheduler_horizon;
+
+    //* Number of threads used for processing parallel groups, including the audio thread.
+    //  Values smaller than two disable parallel processing.
+    size_t                      num_realtime_threads;
 
     //* NULL terminated array of plugin library functions.
     Methcla_LibraryFunction*    plugin_libraries;
+
+    //* Path of a Unix domain datagram socket for receiving OSC requests from other processes; NULL disables the socket server.
+    //  Replies are sent to the client socket a query came from and notifications to all clients;
+    //  clients need to bind their socket to an address in order to receive them.
+    //  The server is running while the engine is started.
+    const char*                 server_socket_path;
+
+    //* Name of a POSIX shared memory segment for receiving OSC requests from another process; NULL disables the shared memory transport.
+    //  The client connects with Methcla::SharedMemoryEngine (methcla/shared_memory.hpp) and receives replies and notifications.
+    //  Requests are received while the engine is started.
+    const char*                 shared_memory_name;
+
+    //* Path of a file the request packets accepted by the engine are recorded to; NULL disables capturing.
+    //  Packets are recorded in the order of the request queue, each with the index and start time of the
+    //  audio block due to process it, as a length prefixed OSC bundle
+    //  that can be printed with tools/dumposcfile and fed back through an engine with tools/replay.
+    const char*                 capture_file;
 };
 
 METHCLA_EXPORT void methcla_engine_options_init(Methcla_EngineOptions* options);
@@ -143,8 +170,84 @@ METHCLA_EXPORT Methcla_Time methcla_time_from_uint64(uint64_t time);
 METHCLA_EXPORT Methcla_Time methcla_engine_current_time(Methcla_Engine* engine);
 
 //* Send an OSC packet to the engine.
+//
+//  Returns kMethcla_QueueFullError without sending the packet when the
+//  request queue is full.
 METHCLA_EXPORT Methcla_Error methcla_engine_send(Methcla_Engine* engine, const void* packet, size_t size);
 
+//* Send an OSC packet to the engine without blocking.
+//
+//  Returns kMethcla_QueueFullError when the request queue is full; the
+//  packet can be sent again later.
+METHCLA_EXPORT Methcla_Error methcla_engine_try_send(Methcla_Engine* engine, const void* packet, size_t size);
+
+//* Send an OSC packet to the engine, waiting up to timeout seconds for space in the request queue.
+//
+//  Returns kMethcla_QueueFullError if the queue is still full after timeout.
+METHCLA_EXPORT Methcla_Error methcla_engine_send_with_timeout(Methcla_Engine* engine, const void* packet, size_t size, double timeout);
+
+//* Fill level of an engine queue.
+typedef struct Methcla_QueueStats
+{
+    //* Number of queued items.
+    size_t size;
+    //* Largest number of queued items since the engine was created.
+    size_t max_size;
+    //* Maximum number of items; zero if unbounded.
+    size_t capacity;
+} Methcla_QueueStats;
+
+typedef struct Methcla_EngineQueueStats
+{
+    //* Requests not yet picked up by the realtime thread.
+    Methcla_QueueStats requests;
+    //* Commands sent to the worker thread in the latency lane (replies, notifications and frees).
+    Methcla_QueueStats to_worker;
+    //* Commands sent to the worker thread in the bulk lane (plugin commands such as file I/O).
+    Methcla_QueueStats to_worker_bulk;
+    //* Commands sent from the worker thread to the realtime thread.
+    Methcla_QueueStats from_worker;
+    //* Bundles in the realtime scheduler, updated once per audio block.
+    Methcla_QueueStats scheduler;
+} Methcla_EngineQueueStats;
+
+//* Get the fill levels of the engine's queues.
+METHCLA_EXPORT Methcla_Error methcla_engine_queue_stats(const Methcla_Engine* engine, Methcla_EngineQueueStats* stats);
+
+//* Number of bytes reserved for the engine in front of packets sent with methcla_engine_send_buffer.
+enum
+{
+    kMethcla_PacketHeaderSize = 128
+};
+
+//* Callback function type for returning a buffer passed to methcla_engine_send_buffer.
+typedef void (*Methcla_PacketReleaseFunction)(void* data, void* buffer);
+
+//* Send an OSC packet to the engine without copying it.
+//
+//  buffer holds kMethcla_PacketHeaderSize bytes for use by the engine,
+//  followed by the packet of size bytes, and has to be aligned to 16 bytes.
+//  The engine takes ownership of the buffer, even when an error is returned,
+//  and returns it by calling release with data and buffer when the packet is
+//  no longer needed; release is called from a non-realtime thread, possibly
+//  before this function returns.
+METHCLA_EXPORT Methcla_Error methcla_engine_send_buffer(Methcla_Engine* engine, void* buffer, size_t size, Methcla_PacketReleaseFunction release, void* data);
+
+//* OSC packet passed to methcla_engine_send_batch.
+typedef struct Methcla_Packet
+{
+    const void* data;
+    size_t      size;
+} Methcla_Packet;
+
+//* Send an array of OSC packets to the engine.
+//
+//  The packets are copied into a single request and processed in order
+//  within the same audio block. Packets that fail to parse are reported
+//  and skipped. Returns kMethcla_QueueFullError without sending any packet
+//  when the request queue is full.
+METHCLA_EXPORT Methcla_Error methcla_engine_send_batch(Methcla_Engine* engine, const Methcla_Packet* packets, size_t count);
+
 //* Open a sound file.
 METHCLA_EXPORT Methcla_Error methcla_engine_soundfile_open(const Methcla_Engine* engine, const char* path, Methcla_FileMode mode, Methcla_SoundFile** file, Methcla_SoundFileInfo* info);
 
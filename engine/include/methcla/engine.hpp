@@ -104,6 +104,17 @@ namespace Methcla
         { }
     };
 
+    class ControlBusId : public detail::Id<ControlBusId,int32_t>
+    {
+    public:
+        ControlBusId(int32_t id)
+            : Id<ControlBusId,int32_t>(id)
+        { }
+        ControlBusId()
+            : ControlBusId(0)
+        { }
+    };
+
     // Node placement specification given a target.
     class NodePlacement
     {
@@ -284,6 +295,10 @@ namespace Methcla
         std::mutex        m_mutex;
     };
 
+    //* Pool of packet buffers.
+    //
+    // Buffers reserve space for the engine's request header in front of the
+    // packet, so that they can be handed to the engine without copying.
     class PacketPool
     {
     public:
@@ -296,10 +311,8 @@ namespace Methcla
         ~PacketPool()
         {
             std::lock_guard<std::mutex> lock(m_mutex);
-            while (!m_freeList.empty()) {
-                void* ptr = m_freeList.front();
+            for (void* ptr : m_freeList) {
                 delete [] (char*)ptr;
-                m_freeList.pop_front();
             }
         }
 
@@ -308,11 +321,12 @@ namespace Methcla
             return m_packetSize;
         }
 
+        //* Allocate a buffer of kMethcla_PacketHeaderSize + packetSize() bytes.
         void* alloc()
         {
             std::lock_guard<std::mutex> lock(m_mutex);
             if (m_freeList.empty())
-                return new char[m_packetSize];
+                return new char[kMethcla_PacketHeaderSize + m_packetSize];
             void* result = m_freeList.back();
             m_freeList.pop_back();
             return result;
@@ -324,10 +338,16 @@ namespace Methcla
             m_freeList.push_back(ptr);
         }
 
+        //* Methcla_PacketReleaseFunction returning a buffer to the pool passed as data.
+        static void release(void* data, void* buffer)
+        {
+            static_cast<PacketPool*>(data)->free(buffer);
+        }
+
     private:
         size_t m_packetSize;
         // TODO: Use boost::lockfree::queue for free list
-        std::list<void*> m_freeList;
+        std::vector<void*> m_freeList;
         std::mutex m_mutex;
     };
 
@@ -336,11 +356,13 @@ namespace Methcla
     public:
         Packet(PacketPool& pool)
             : m_pool(pool)
-            , m_packet(pool.alloc(), pool.packetSize())
+            , m_buffer(pool.alloc())
+            , m_packet(static_cast<char*>(m_buffer) + kMethcla_PacketHeaderSize, pool.packetSize())
         { }
         ~Packet()
         {
-            m_pool.free(m_packet.data());
+            if (m_buffer != nullptr)
+                m_pool.free(m_buffer);
         }
 
         Packet(const Packet&) = delete;
@@ -356,8 +378,32 @@ namespace Methcla
             return m_packet;
         }
 
+        PacketPool& pool()
+        {
+            return m_pool;
+        }
+
+        //* Give up ownership of the buffer holding header and packet.
+        //
+        // The buffer has to be returned to the pool with PacketPool::free.
+        // The packet is left without a buffer and can't be used afterwards.
+        void* releaseBuffer()
+        {
+            void* buffer = m_buffer;
+            m_buffer = nullptr;
+            m_packet.reset(nullptr, 0);
+            return buffer;
+        }
+
+        //* Return true if the buffer has been released.
+        bool isReleased() const
+        {
+            return m_buffer == nullptr;
+        }
+
     private:
         PacketPool&             m_pool;
+        void*                   m_buffer;
         OSCPP::Client::Packet   m_packet;
     };
 
@@ -472,7 +518,19 @@ namespace Methcla
         size_t maxNumControlBuses = 4096;
         size_t sampleRate = 44100;
         size_t blockSize = 64;
+        size_t schedulerHorizon = 16;
+        size_t numRealtimeThreads = 1;
         std::list<LibraryFunction> pluginLibraries;
+        //* Socket path for the OSC server, empty if disabled.
+        std::string serverSocketPath;
+        //* Shared memory segment name for Methcla::SharedMemoryEngine clients, empty if disabled.
+        //
+        // When set, the in-process engine allocates node ids from the lower
+        // half of maxNumNodes and leaves the upper half to the shared memory
+        // client (see Methcla::SharedMemoryEngine).
+        std::string sharedMemoryName;
+        //* Path of the request capture file, empty if disabled.
+        std::string captureFile;
 
         AudioDriverOptions audioDriver;
 
@@ -491,11 +549,17 @@ namespace Methcla
             m_options.realtime_memory_size = realtimeMemorySize;
             m_options.max_num_nodes = maxNumNodes;
             m_options.max_num_audio_buses = maxNumAudioBuses;
+            m_options.max_num_control_buses = maxNumControlBuses;
+            m_options.scheduler_horizon = schedulerHorizon;
+            m_options.num_realtime_threads = numRealtimeThreads;
 
             m_pluginLibraries.assign(pluginLibraries.begin(), pluginLibraries.end());
             m_pluginLibraries.push_back(nullptr);
 
             m_options.plugin_libraries = m_pluginLibraries.data();
+            m_options.server_socket_path = serverSocketPath.empty() ? nullptr : serverSocketPath.c_str();
+            m_options.shared_memory_name = sharedMemoryName.empty() ? nullptr : sharedMemoryName.c_str();
+            m_options.capture_file = captureFile.empty() ? nullptr : captureFile.c_str();
 
             return m_options;
         }
@@ -505,6 +569,7 @@ namespace Methcla
 
     typedef ResourceIdAllocator<NodeId,int32_t> NodeIdAllocator;
     typedef ResourceIdAllocator<AudioBusId,int32_t> AudioBusIdAllocator;
+    typedef ResourceIdAllocator<ControlBusId,int32_t> ControlBusIdAllocator;
 
     class Request;
 
@@ -526,11 +591,14 @@ namespace Methcla
         inline void bundle(Methcla_Time time, std::function<void(Request&)> func);
 
         inline GroupId group(const NodePlacement& placement);
+        inline GroupId parallelGroup(const NodePlacement& placement);
         inline void freeAll(GroupId group);
         inline SynthId synth(const char* synthDef, const NodePlacement& placement, const std::vector<float>& controls, const std::list<Value>& options=std::list<Value>());
         inline void activate(SynthId synth);
         inline void mapInput(SynthId synth, size_t index, AudioBusId bus, BusMappingFlags flags=kBusMappingInternal);
         inline void mapOutput(SynthId synth, size_t index, AudioBusId bus, BusMappingFlags flags=kBusMappingInternal);
+        inline void mapControlInput(SynthId synth, size_t index, ControlBusId bus);
+        inline void mapControlOutput(SynthId synth, size_t index, ControlBusId bus);
         inline void set(NodeId node, size_t index, double value);
         inline void free(NodeId node);
     };
@@ -542,6 +610,7 @@ namespace Methcla
             bool isMessage : 1;
             bool isBundle : 1;
             bool isClosed : 1;
+            bool isSent : 1;
         };
 
         EngineInterface*        m_engine;
@@ -550,8 +619,15 @@ namespace Methcla
         Flags                   m_flags;
 
     private:
+        void checkNotSent() const
+        {
+            if (m_flags.isSent)
+                throw std::runtime_error("Request has already been sent");
+        }
+
         void beginMessage()
         {
+            checkNotSent();
             if (m_flags.isMessage)
                 throw std::runtime_error("Cannot add more than one message to non-bundle packet");
             else if (m_flags.isBundle && m_flags.isClosed)
@@ -574,6 +650,7 @@ namespace Methcla
             m_flags.isMessage = false;
             m_flags.isBundle = false;
             m_flags.isClosed = false;
+            m_flags.isSent = false;
         }
 
         Request(EngineInterface& engine)
@@ -591,6 +668,7 @@ namespace Methcla
 
         void openBundle(Methcla_Time time=immediately)
         {
+            checkNotSent();
             if (m_flags.isMessage)
             {
                 throw std::runtime_error("Cannot open bundle within message packet");
@@ -606,6 +684,7 @@ namespace Methcla
         // Close nested bundle
         void closeBundle()
         {
+            checkNotSent();
             if (m_flags.isMessage)
             {
                 throw std::runtime_error("closeBundle called on a message request");
@@ -631,11 +710,25 @@ namespace Methcla
         }
 
         //* Finalize request and send to the engine.
+        //
+        // A request can only be sent once, even when sending fails, because
+        // the engine may take ownership of the packet buffer.
         void send()
         {
+            const std::unique_ptr<Packet>& packet = finalPacket();
+            m_flags.isSent = true;
+            m_engine->sendPacket(packet);
+        }
+
+        //* Return the finalized request packet.
+        //
+        // Used for sending several requests at once with Engine::sendBatch.
+        const std::unique_ptr<Packet>& finalPacket() const
+        {
+            checkNotSent();
             if (m_flags.isBundle && m_bundleCount > 0)
                 throw std::runtime_error("openBundle without matching closeBundle");
-            m_engine->sendPacket(m_packet);
+            return m_packet;
         }
 
         GroupId group(const NodePlacement& placement)
@@ -654,6 +747,22 @@ namespace Methcla
             return GroupId(nodeId.id());
         }
 
+        GroupId parallelGroup(const NodePlacement& placement)
+        {
+            beginMessage();
+
+            const NodeId nodeId(m_engine->nodeIdAllocator().alloc());
+
+            oscPacket()
+                .openMessage("/pargroup/new", 3)
+                    .int32(nodeId.id())
+                    .int32(placement.target().id())
+                    .int32(placement.placement())
+                .closeMessage();
+
+            return GroupId(nodeId.id());
+        }
+
         void freeAll(GroupId group)
         {
             beginMessage();
@@ -725,6 +834,32 @@ namespace Methcla
                 .closeMessage();
         }
 
+        //* Map control input to control bus; a bus id of -1 restores the synth's own control value.
+        void mapControlInput(SynthId synth, size_t index, ControlBusId bus)
+        {
+            beginMessage();
+
+            oscPacket()
+                .openMessage("/synth/map/control/input", 3)
+                    .int32(synth.id())
+                    .int32(index)
+                    .int32(bus.id())
+                .closeMessage();
+        }
+
+        //* Map control output to control bus; a bus id of -1 unmaps the output.
+        void mapControlOutput(SynthId synth, size_t index, ControlBusId bus)
+        {
+            beginMessage();
+
+            oscPacket()
+                .openMessage("/synth/map/control/output", 3)
+                    .int32(synth.id())
+                    .int32(index)
+                    .int32(bus.id())
+                .closeMessage();
+        }
+
         void set(NodeId node, size_t index, double value)
         {
             beginMessage();
@@ -758,6 +893,17 @@ namespace Methcla
                     .int32(flags)
                 .closeMessage();
         }
+
+        void setTailTime(SynthId synth, double tailTime)
+        {
+            beginMessage();
+
+            oscPacket()
+                .openMessage("/synth/property/tailTime/set", 2)
+                    .int32(synth.id())
+                    .float32(tailTime)
+                .closeMessage();
+        }
     };
 
     void EngineInterface::bundle(Methcla_Time time, std::function<void(Request&)> func)
@@ -775,6 +921,14 @@ namespace Methcla
         return result;
     }
 
+    GroupId EngineInterface::parallelGroup(const NodePlacement& placement)
+    {
+        Request request(this);
+        GroupId result = request.parallelGroup(placement);
+        request.send();
+        return result;
+    }
+
     void EngineInterface::freeAll(GroupId group)
     {
         Request request(this);
@@ -811,6 +965,20 @@ namespace Methcla
         request.send();
     }
 
+    void EngineInterface::mapControlInput(SynthId synth, size_t index, ControlBusId bus)
+    {
+        Request request(this);
+        request.mapControlInput(synth, index, bus);
+        request.send();
+    }
+
+    void EngineInterface::mapControlOutput(SynthId synth, size_t index, ControlBusId bus)
+    {
+        Request request(this);
+        request.mapControlOutput(synth, index, bus);
+        request.send();
+    }
+
     void EngineInterface::set(NodeId node, size_t index, double value)
     {
         Request request(this);
@@ -830,8 +998,9 @@ namespace Methcla
     public:
         Engine(EngineOptions inOptions=EngineOptions(), Methcla_AudioDriver* driver=nullptr)
             : m_logHandler(inOptions.logHandler)
-            , m_nodeIds(1, inOptions.maxNumNodes - 1)
+            , m_nodeIds(1, (inOptions.sharedMemoryName.empty() ? inOptions.maxNumNodes : inOptions.maxNumNodes / 2) - 1)
             , m_audioBusIds(0, inOptions.maxNumAudioBuses)
+            , m_controlBusIds(0, inOptions.maxNumControlBuses)
             , m_requestId(kMethcla_Notification+1)
             , m_packets(8192)
         {
@@ -888,6 +1057,13 @@ namespace Methcla
             return methcla_engine_current_time(m_engine);
         }
 
+        Methcla_EngineQueueStats queueStats() const
+        {
+            Methcla_EngineQueueStats stats;
+            detail::checkReturnCode(methcla_engine_queue_stats(m_engine, &stats));
+            return stats;
+        }
+
         void setLogFlags(Methcla_EngineLogFlags flags)
         {
             methcla_engine_set_log_flags(m_engine, flags);
@@ -913,6 +1089,11 @@ namespace Methcla
             return m_audioBusIds;
         }
 
+        ControlBusIdAllocator& controlBusId()
+        {
+            return m_controlBusIds;
+        }
+
         std::unique_ptr<Packet> allocPacket() override
         {
             return std::unique_ptr<Packet>(new Packet(m_packets));
@@ -920,7 +1101,34 @@ namespace Methcla
 
         void sendPacket(const std::unique_ptr<Packet>& packet) override
         {
-            send(*packet);
+            // Hand the pooled buffer to the engine, which returns it to the pool when done
+            const size_t size = packet->packet().size();
+            detail::checkReturnCode(
+                methcla_engine_send_buffer(
+                    m_engine,
+                    packet->releaseBuffer(),
+                    size,
+                    PacketPool::release,
+                    &packet->pool()));
+        }
+
+        //* Send requests to the engine with a single queue operation.
+        //
+        // The requests are processed in order within the same audio block.
+        void sendBatch(const std::vector<const Request*>& requests)
+        {
+            std::vector<Methcla_Packet> packets;
+            packets.reserve(requests.size());
+            for (const Request* request : requests)
+            {
+                const OSCPP::Client::Packet& packet = request->finalPacket()->packet();
+                Methcla_Packet p;
+                p.data = packet.data();
+                p.size = packet.size();
+                packets.push_back(p);
+            }
+            detail::checkReturnCode(
+                methcla_engine_send_batch(m_engine, packets.data(), packets.size()));
         }
 
         typedef std::function<bool(const OSCPP::Server::Message&)> NotificationHandler;
@@ -931,37 +1139,37 @@ namespace Methcla
             m_notificationHandlers.push_back(handler);
         }
 
-        NotificationHandler freeNodeIdHandler(NodeId nodeId)
+        //* Handler for the /node/ended notification of a single node.
+        struct NodeEndedHandler
         {
-            return [this,nodeId](const OSCPP::Server::Message& msg) {
-                if (msg == "/node/ended")
-                {
-                    NodeId otherNodeId = NodeId(msg.args().int32());
-                    if (nodeId == otherNodeId)
-                    {
-                        nodeIdAllocator().free(nodeId);
-                        return true;
-                    }
-                }
-                return false;
-            };
+            NodeId                      nodeId;
+            std::function<void(NodeId)> whenDone;
+        };
+
+        //* Register handler, replacing a handler for the same node.
+        //
+        // Handlers are looked up by node id for each id in a /node/ended
+        // message and removed after they have been called.
+        void addNotificationHandler(const NodeEndedHandler& handler)
+        {
+            std::lock_guard<std::mutex> lock(m_notificationHandlersMutex);
+            m_nodeEndedHandlers[handler.nodeId.id()] = handler.whenDone;
         }
 
-        NotificationHandler freeNodeIdHandler(NodeId nodeId, std::function<void(NodeId)> whenDone)
+        //* Return a handler that frees nodeId when the node has ended.
+        //
+        // /node/ended is sent after the audio block the node ended in, so
+        // it may arrive after replies to queries in the request that freed
+        // the node.
+        NodeEndedHandler freeNodeIdHandler(NodeId nodeId)
         {
-            return [this,nodeId,whenDone](const OSCPP::Server::Message& msg) {
-                if (msg == "/node/ended")
-                {
-                    NodeId otherNodeId = NodeId(msg.args().int32());
-                    if (nodeId == otherNodeId)
-                    {
-                        nodeIdAllocator().free(nodeId);
-                        whenDone(nodeId);
-                        return true;
-                    }
-                }
-                return false;
-            };
+            return NodeEndedHandler { nodeId, nullptr };
+        }
+
+        //* Return a handler that frees nodeId and calls whenDone when the node has ended.
+        NodeEndedHandler freeNodeIdHandler(NodeId nodeId, std::function<void(NodeId)> whenDone)
+        {
+            return NodeEndedHandler { nodeId, whenDone };
         }
 
         NodeTreeStatistics getNodeTreeStatistics()
@@ -1026,12 +1234,36 @@ namespace Methcla
             // Parse notification packet
             OSCPP::Server::Message message(OSCPP::Server::Packet(packet, size));
 
-            // Broadcast notification to handlers
             std::lock_guard<std::mutex> lock(m_notificationHandlersMutex);
-            for (auto it=m_notificationHandlers.begin(); it != m_notificationHandlers.end(); it++)
+
+            // The engine reports all nodes that ended during an audio block
+            // in a single message with one int32 argument per node.
+            if (!m_nodeEndedHandlers.empty() && message == "/node/ended")
+            {
+                OSCPP::Server::ArgStream args(message.args());
+                while (!args.atEnd())
+                {
+                    auto handler = m_nodeEndedHandlers.find(args.int32());
+                    if (handler != m_nodeEndedHandlers.end())
+                    {
+                        const NodeId nodeId(handler->first);
+                        const std::function<void(NodeId)> whenDone(std::move(handler->second));
+                        m_nodeEndedHandlers.erase(handler);
+                        nodeIdAllocator().free(nodeId);
+                        if (whenDone)
+                            whenDone(nodeId);
+                    }
+                }
+            }
+
+            // Broadcast notification to handlers
+            auto it = m_notificationHandlers.begin();
+            while (it != m_notificationHandlers.end())
             {
                 if ((*it)(message))
                     it = m_notificationHandlers.erase(it);
+                else
+                    it++;
             }
         }
 
@@ -1116,16 +1348,19 @@ namespace Methcla
     private:
         typedef std::unordered_map<Methcla_RequestId,ResponseHandler> ResponseHandlers;
         typedef std::list<NotificationHandler> NotificationHandlers;
+        typedef std::unordered_map<int32_t,std::function<void(NodeId)>> NodeEndedHandlers;
 
         Methcla_Engine*         m_engine;
         LogHandler              m_logHandler;
         NodeIdAllocator         m_nodeIds;
         AudioBusIdAllocator     m_audioBusIds;
+        ControlBusIdAllocator   m_controlBusIds;
         Methcla_RequestId       m_requestId;
         std::mutex              m_requestIdMutex;
         ResponseHandlers        m_responseHandlers;
         std::mutex              m_responseHandlersMutex;
         NotificationHandlers    m_notificationHandlers;
+        NodeEndedHandlers       m_nodeEndedHandlers;
         std::mutex              m_notificationHandlersMutex;
         PacketPool              m_packets;
     };
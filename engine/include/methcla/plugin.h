@@ -74,6 +74,12 @@ struct Methcla_World
 
     //* Free synth.
     void (*synth_done)(const struct Methcla_World* world, Methcla_Synth* synth);
+
+    //* Signal that the synth's audio outputs are silent in the current block.
+    //
+    // May be called from the synth's process function; the contents of the
+    // output buffers are ignored for the current block.
+    void (*synth_output_silent)(const struct Methcla_World* world, Methcla_Synth* synth);
 };
 
 static inline double methcla_world_samplerate(const Methcla_World* world)
@@ -136,6 +142,14 @@ static inline void methcla_world_synth_done(const Methcla_World* world, Methcla_
     world->synth_done(world, synth);
 }
 
+static inline void methcla_world_synth_output_silent(const Methcla_World* world, Methcla_Synth* synth)
+{
+    assert(world);
+    assert(world->synth_output_silent);
+    assert(synth);
+    world->synth_output_silent(world, synth);
+}
+
 typedef enum
 {
     kMethcla_Input,
@@ -150,8 +164,21 @@ typedef enum
 
 typedef enum
 {
-    kMethcla_PortFlags  = 0x0
-  , kMethcla_Trigger    = 0x1
+    kMethcla_PortFlags              = 0x0
+  , kMethcla_Trigger                = 0x1
+    //* Audio output is silent when all audio inputs are silent.
+    //
+    // When all audio outputs of a synth carry this flag, the engine stops
+    // processing the synth once its inputs have been silent for longer than
+    // its tail time.
+  , kMethcla_SilenceInSilenceOut    = 0x2
+    //* Audio port needs a buffer owned by the synth instance.
+    //
+    // By default the engine connects audio ports to bus memory or to scratch
+    // buffers shared between synths, whose contents don't persist between
+    // calls to `process`. Ports with this flag are always connected to the
+    // same buffer.
+  , kMethcla_PersistentBuffer       = 0x4
 } Methcla_PortFlags;
 
 typedef struct Methcla_PortDescriptor Methcla_PortDescriptor;
@@ -190,6 +217,9 @@ struct Methcla_SynthDef
     void (*construct)(const Methcla_World* world, const Methcla_SynthDef* def, const Methcla_SynthOptions* options, Methcla_Synth* synth);
 
     //* Connect port at index to data.
+    //
+    // Audio ports may be reconnected between calls to `process`, e.g. to
+    // point directly at bus memory. Audio input buffers must not be written to.
     void (*connect)(Methcla_Synth* synth, Methcla_PortCount index, void* data);
 
     //* Activate the synth instance just before starting to call `process`.
@@ -200,6 +230,31 @@ struct Methcla_SynthDef
 
     //* Destroy a synth instance.
     void (*destroy)(const Methcla_World* world, Methcla_Synth* synth);
+
+    //* Process numFrames of audio samples for several synth instances (optional).
+    //
+    // When present, the engine calls `process_batch` instead of `process`
+    // with the active instances of this definition that are adjacent in
+    // execution order. Allows processing voices in parallel with SIMD
+    // instructions.
+    void (*process_batch)(const Methcla_World* world, Methcla_Synth* const* synths, size_t numSynths, size_t numFrames);
+};
+
+typedef struct Methcla_CommandDef Methcla_CommandDef;
+
+//* Plugin defined request command.
+struct Methcla_CommandDef
+{
+    //* OSC address of the command; must not clash with engine commands.
+    const char* address;
+
+    //* Handle for implementation specific data.
+    void* data;
+
+    //* Perform the command in the realtime context.
+    //
+    // Receives the OSC type tags and arguments of the request message.
+    void (*perform)(const Methcla_World* world, const Methcla_CommandDef* def, const void* tag_buffer, size_t tag_size, const void* arg_buffer, size_t arg_size);
 };
 
 struct Methcla_Host
@@ -233,6 +288,11 @@ struct Methcla_Host
 
     //* Log a message and a newline character.
     void (*log_line)(const Methcla_Host* host, Methcla_LogLevel level, const char* message);
+
+    //* Register a request command.
+    //
+    // Commands can only be registered while the plugin library is loaded.
+    void (*register_command)(const struct Methcla_Host* host, const Methcla_CommandDef* command);
 };
 
 static inline void methcla_host_register_synthdef(const Methcla_Host* host, const Methcla_SynthDef* synthDef)
@@ -248,6 +308,13 @@ static inline void methcla_host_register_soundfile_api(const Methcla_Host* host,
     host->register_soundfile_api(host, api);
 }
 
+static inline void methcla_host_register_command(const Methcla_Host* host, const Methcla_CommandDef* command)
+{
+    assert(host && host->register_command);
+    assert(command && command->address && command->perform);
+    host->register_command(host, command);
+}
+
 static inline void* methcla_host_alloc(const Methcla_Host* context, size_t size)
 {
     assert(context);
@@ -291,7 +291,8 @@ namespace Methcla { namespace Plugin {
                 connect,
                 activate,
                 process,
-                destroy
+                destroy,
+                nullptr
             };
             methcla_host_register_synthdef(host, &kSynthDef);
         }
@@ -0,0 +1,130 @@
+// Copyright 2012-2014 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_SHARED_MEMORY_HPP_INCLUDED
+#define METHCLA_SHARED_MEMORY_HPP_INCLUDED
+
+#include <methcla/engine.hpp>
+#include <methcla/detail/shared_memory.hpp>
+
+#if METHCLA_HAVE_SHARED_MEMORY
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+
+namespace Methcla
+{
+    //* Client for an engine in another process, connected through shared memory.
+    //
+    // The engine has to be created with Methcla_EngineOptions::shared_memory_name
+    // set to the name passed to the constructor. Requests are pushed to a
+    // shared memory queue without entering the kernel; replies and
+    // notifications are read by a background thread and passed to the
+    // packet handler. Only one client should be connected to an engine.
+    //
+    // Node ids are allocated from the upper half of the engine's maximum
+    // number of nodes, which has to be passed as maxNumNodes; the lower half
+    // is used by the Methcla::Engine in the engine's process. Request ids
+    // are private to the client.
+    //
+    // The request queue is shared by all client threads without a lock: a
+    // client process that dies after claiming a cell but before publishing
+    // it leaves the cell unpublished and the engine stops reading requests,
+    // so the engine has to be restarted.
+    class SharedMemoryEngine : public EngineInterface
+    {
+    public:
+        typedef std::function<void(Methcla_RequestId, const void*, size_t)> PacketHandler;
+
+        SharedMemoryEngine(const std::string& name, PacketHandler packetHandler=PacketHandler(), size_t maxNumNodes=1024)
+            : m_memory(name)
+            , m_transport(m_memory.data(), m_memory.size())
+            , m_packetHandler(packetHandler)
+            , m_nodeIds(maxNumNodes / 2, maxNumNodes - maxNumNodes / 2)
+            , m_packets(m_transport.requests().maxPacketSize())
+            , m_running(true)
+            , m_thread(&SharedMemoryEngine::receive, this)
+        { }
+
+        ~SharedMemoryEngine()
+        {
+            m_running.store(false);
+            m_thread.join();
+        }
+
+        NodeIdAllocator& nodeIdAllocator() override
+        {
+            return m_nodeIds;
+        }
+
+        std::unique_ptr<Packet> allocPacket() override
+        {
+            return std::unique_ptr<Packet>(new Packet(m_packets));
+        }
+
+        void sendPacket(const std::unique_ptr<Packet>& packet) override
+        {
+            send(packet->packet().data(), packet->packet().size());
+        }
+
+        //* Send an OSC packet, waiting at most timeout seconds for room in the request queue.
+        //
+        // Throws std::runtime_error (kMethcla_QueueFullError) if the queue is
+        // still full after timeout.
+        void send(const void* packet, size_t size, double timeout=1.)
+        {
+            if (m_transport.requests().push(kMethcla_Notification, packet, size))
+                return;
+            const auto deadline = std::chrono::steady_clock::now()
+                                + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                    std::chrono::duration<double>(timeout));
+            while (!m_transport.requests().push(kMethcla_Notification, packet, size))
+            {
+                if (std::chrono::steady_clock::now() >= deadline)
+                    detail::checkReturnCode(methcla_error_new(kMethcla_QueueFullError));
+                std::this_thread::yield();
+            }
+        }
+
+    private:
+        void receive()
+        {
+            PacketHandler& handler = m_packetHandler;
+            auto handle = [&handler](int32_t requestId, const void* packet, size_t size) {
+                if (handler)
+                    handler(requestId, packet, size);
+            };
+            while (m_running.load(std::memory_order_relaxed))
+            {
+                if (!m_transport.replies().pop(handle))
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+
+        detail::SharedMemory            m_memory;
+        detail::SharedMemoryTransport   m_transport;
+        PacketHandler                   m_packetHandler;
+        NodeIdAllocator                 m_nodeIds;
+        PacketPool                      m_packets;
+        std::atomic<bool>               m_running;
+        std::thread                     m_thread;
+    };
+}
+
+#endif // METHCLA_HAVE_SHARED_MEMORY
+
+#endif // METHCLA_SHARED_MEMORY_HPP_INCLUDED
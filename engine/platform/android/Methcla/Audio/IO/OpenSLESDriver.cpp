@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "Methcla/Audio/DSP.hpp"
 #include "Methcla/Audio/IO/OpenSLESDriver.hpp"
 #include "Methcla/Memory.hpp"
 #include "Methcla/Platform.hpp"
@@ -114,10 +115,9 @@ void OpenSLESDriver::processCallback(
 
     // assert(buffer_size >= driver->m_outputBuffer->numSamples());
 
-    Methcla::Audio::deinterleave(
+    Methcla::Audio::DSP::deinterleave(
         driver->m_inputBuffer.data(),
         static_cast<const int16_t*>(input_buffer),
-        1.f/(float)Methcla_AudioSample(std::numeric_limits<int16_t>::max()),
         driver->m_inputBuffer.numChannels(),
         buffer_frames
     );
@@ -135,10 +135,9 @@ void OpenSLESDriver::processCallback(
     );
 
     // Interleave and scale
-    Methcla::Audio::interleave(
+    Methcla::Audio::DSP::interleave(
         static_cast<int16_t*>(output_buffer),
         driver->m_outputBuffer.data(),
-        Methcla_AudioSample(std::numeric_limits<int16_t>::max()),
         driver->m_outputBuffer.numChannels(),
         buffer_frames
     );
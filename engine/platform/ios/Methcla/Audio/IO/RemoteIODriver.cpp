@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include "Methcla/API.hpp"
+#include "Methcla/Audio/DSP.hpp"
 #include "Methcla/Audio/IO/RemoteIODriver.hpp"
 #include "Methcla/Exception.hpp"
 #include "Methcla/Memory.hpp"
@@ -456,11 +457,7 @@ OSStatus RemoteIODriver::InputCallback(
         const AudioSampleType* pcm = static_cast<AudioSampleType*>(bufferList.mBuffers[bufCount].mData);
 
         // Deinterleave and convert input
-        for (UInt32 curChan = 0; curChan < numInputs; curChan++) {
-            for (UInt32 curFrame = 0; curFrame < inNumberFrames; curFrame++) {
-                inputBuffers[curChan][curFrame] = pcm[curFrame * numInputs + curChan] / 32768.f;
-            }
-        }
+        Audio::DSP::deinterleave(inputBuffers, pcm, numInputs, inNumberFrames);
    }
 
     return noErr;
@@ -496,19 +493,19 @@ OSStatus RemoteIODriver::RenderCallback(
             );
 
         // Convert and interleave output
+#if METHCLA_AUDIO_THROUGH
         for (UInt32 curChan = 0; curChan < numOutputs; curChan++) {
             for (UInt32 curFrame = 0; curFrame < inNumberFrames; curFrame++) {
-#if METHCLA_AUDIO_THROUGH
                 if (curChan < self->m_numInputs) {
                     pcm[curFrame * numOutputs + curChan] = inputBuffers[curChan][curFrame] * 32767.f;
                 } else {
                     pcm[curFrame * numOutputs + curChan] = 0.f;
                 }
-#else
-                pcm[curFrame * numOutputs + curChan] = outputBuffers[curChan][curFrame] * 32767.f;
-#endif
             }
         }
+#else
+        Audio::DSP::interleave(pcm, outputBuffers, numOutputs, inNumberFrames);
+#endif
     }
 
     return noErr;
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include "Methcla/Audio.hpp"
+#include "Methcla/Audio/DSP.hpp"
 #include "Methcla/Audio/IO/PepperDriver.hpp"
 #include "Methcla/API.hpp"
 #include "Methcla/Exception.hpp"
@@ -24,7 +25,6 @@
 
 #include <cassert>
 #include <cstdint>
-#include <limits>
 #include <stdexcept>
 #include <string>
 
@@ -140,10 +140,9 @@ void PepperDriver::processCallback(void* samples, uint32_t buffer_size, void* da
     );
 
     // Interleave and scale
-    Methcla::Audio::interleave(
+    Methcla::Audio::DSP::interleave(
         static_cast<int16_t*>(samples),
         driver->m_outputBuffer->data(),
-        Methcla_AudioSample(std::numeric_limits<int16_t>::max()),
         driver->m_outputBuffer->numChannels(),
         numFrames
     );
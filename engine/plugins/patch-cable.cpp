@@ -92,6 +92,7 @@ static const Methcla_SynthDef descriptor =
     connect,
     NULL,
     process,
+    NULL,
     NULL
 };
 
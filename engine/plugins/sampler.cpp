@@ -86,6 +86,12 @@ extern "C"
     process( const Methcla_World*,
              Methcla_Synth*,
              size_t );
+
+    static void
+    process_batch( const Methcla_World*,
+                   Methcla_Synth* const*,
+                   size_t,
+                   size_t );
 }
 
 bool
@@ -479,9 +485,18 @@ process(const Methcla_World* world, Methcla_Synth* synth, size_t numFrames)
     }
     else
     {
-        for (size_t k = 0; k < numFrames; k++) {
-            out0[k] = out1[k] = 0.f;
-        }
+        methcla_world_synth_output_silent(world, synth);
+    }
+}
+
+static void
+process_batch(const Methcla_World* world, Methcla_Synth* const* synths, size_t numSynths, size_t numFrames)
+{
+    // Voices are mostly in different playback states, so process them one
+    // after the other; this still saves the per-voice dispatch in the engine.
+    for (size_t i = 0; i < numSynths; i++)
+    {
+        process(world, synths[i], numFrames);
     }
 }
 
@@ -496,7 +511,8 @@ static const Methcla_SynthDef descriptor =
     connect,
     nullptr,
     process,
-    destroy
+    destroy,
+    process_batch
 };
 
 static const Methcla_Library library = { NULL, NULL };
@@ -100,6 +100,58 @@ process(const Methcla_World* world, Methcla_Synth* synth, size_t numFrames)
     sine->phase = phase;
 }
 
+/* Number of voices processed in parallel by process_batch. */
+enum { kSineBatchWidth = 4 };
+
+static void
+process_batch(const Methcla_World* world, Methcla_Synth* const* synths, size_t numSynths, size_t numFrames)
+{
+    (void)world;
+
+    /* Keep the oscillator state of kSineBatchWidth voices in struct-of-arrays
+       form in local arrays, so that the state stays in registers and the
+       port pointers are only dereferenced once per block. The sin() calls
+       are not vectorized. */
+    for (size_t i = 0; i < numSynths; i += kSineBatchWidth) {
+        const size_t n = numSynths - i < kSineBatchWidth ? numSynths - i : kSineBatchWidth;
+
+        double phase[kSineBatchWidth];
+        double phaseInc[kSineBatchWidth];
+        float amp[kSineBatchWidth];
+        float* output[kSineBatchWidth];
+
+        for (size_t j = 0; j < kSineBatchWidth; j++) {
+            if (j < n) {
+                Sine* sine = (Sine*)synths[i+j];
+                phase[j] = sine->phase;
+                phaseInc[j] = *sine->ports[kSine_freq] * sine->freqToPhaseInc;
+                amp[j] = *sine->ports[kSine_amp];
+                output[j] = sine->ports[kSine_out];
+            } else {
+                /* Pad unused lanes */
+                phase[j] = phaseInc[j] = 0.;
+                amp[j] = 0.f;
+                output[j] = NULL;
+            }
+        }
+
+        for (size_t k = 0; k < numFrames; k++) {
+            float y[kSineBatchWidth];
+            for (size_t j = 0; j < kSineBatchWidth; j++) {
+                y[j] = amp[j] * sin(phase[j]);
+                phase[j] += phaseInc[j];
+            }
+            for (size_t j = 0; j < n; j++) {
+                output[j][k] = y[j];
+            }
+        }
+
+        for (size_t j = 0; j < n; j++) {
+            ((Sine*)synths[i+j])->phase = phase[j];
+        }
+    }
+}
+
 static const Methcla_SynthDef descriptor =
 {
     METHCLA_PLUGINS_SINE_URI,
@@ -110,7 +162,8 @@ static const Methcla_SynthDef descriptor =
     connect,
     NULL,
     process,
-    NULL
+    NULL,
+    process_batch
 };
 
 static const Methcla_Library library = { NULL, NULL };
@@ -21,9 +21,12 @@
 #include "Methcla/Audio/IO/Driver.hpp"
 #include "Methcla/Audio/SynthDef.hpp"
 #include "Methcla/Exception.hpp"
+#include "Methcla/IO/SharedMemoryServer.hpp"
+#include "Methcla/IO/SocketServer.hpp"
 #include "Methcla/Platform.hpp"
 #include "Methcla/Version.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <functional>
@@ -68,6 +71,13 @@ Methcla::Audio::Environment::Options Methcla::API::convertOptions(const Methcla_
     result.realtimeMemorySize = options->realtime_memory_size;
     result.maxNumNodes = options->max_num_nodes;
     result.maxNumAudioBuses = options->max_num_audio_buses;
+    if (options->max_num_control_buses > 0)
+        result.maxNumControlBuses = options->max_num_control_buses;
+    if (options->scheduler_horizon > 0)
+        result.schedulerHorizon = options->scheduler_horizon;
+    result.numRealtimeThreads = std::max((size_t)1, options->num_realtime_threads);
+    if (options->capture_file != nullptr)
+        result.captureFile = options->capture_file;
 
     if (options->plugin_libraries != nullptr)
     {
@@ -91,6 +101,17 @@ Methcla::Audio::IO::Driver::Options Methcla::API::convertOptions(const Methcla_A
     return result;
 }
 
+//* Forward replies and notifications to server in addition to handler.
+template <class Server> static Methcla::Audio::PacketHandler forwardPackets(
+    Methcla::Audio::PacketHandler handler,
+    Server* server)
+{
+    return [handler,server](Methcla_RequestId requestId, const void* packet, size_t size) {
+        handler(requestId, packet, size);
+        server->handlePacket(requestId, packet, size);
+    };
+}
+
 struct Methcla_Engine
 {
 public:
@@ -110,10 +131,35 @@ public:
         engineOptions.numHardwareOutputChannels = m_driver->driver()->numOutputs();
 
         using namespace std::placeholders;
+        Methcla::Audio::PacketHandler packetHandler =
+            std::bind(options->packet_handler.handle_packet, options->packet_handler.handle, _1, _2, _3);
+
+        if (options->server_socket_path != nullptr)
+        {
+#if METHCLA_HAVE_SOCKET_SERVER
+            m_server = std::unique_ptr<Methcla::IO::SocketServer>(
+                new Methcla::IO::SocketServer(options->server_socket_path));
+            packetHandler = forwardPackets(packetHandler, m_server.get());
+#else
+            throw Methcla::Error(kMethcla_UnimplementedError, "Socket server not supported on this platform");
+#endif
+        }
+
+        if (options->shared_memory_name != nullptr)
+        {
+#if METHCLA_HAVE_SHARED_MEMORY
+            m_sharedMemoryServer = std::unique_ptr<Methcla::IO::SharedMemoryServer>(
+                new Methcla::IO::SharedMemoryServer(options->shared_memory_name));
+            packetHandler = forwardPackets(packetHandler, m_sharedMemoryServer.get());
+#else
+            throw Methcla::Error(kMethcla_UnimplementedError, "Shared memory transport not supported on this platform");
+#endif
+        }
+
         m_env = std::unique_ptr<Methcla::Audio::Environment>(
             new Methcla::Audio::Environment(
                     std::bind(options->log_handler.log_line, options->log_handler.handle, _1, _2),
-                    std::bind(options->packet_handler.handle_packet, options->packet_handler.handle, _1, _2, _3),
+                    packetHandler,
                     engineOptions
                 )
             );
@@ -125,8 +171,31 @@ public:
     const Methcla::Audio::IO::Driver* driver() const { return m_driver->driver(); }
     Methcla::Audio::IO::Driver* driver() { return m_driver->driver(); }
 
-    void start() { driver()->start(); }
-    void stop() { driver()->stop(); }
+    void start()
+    {
+        driver()->start();
+#if METHCLA_HAVE_SOCKET_SERVER
+        if (m_server)
+            m_server->start(m_env.get());
+#endif
+#if METHCLA_HAVE_SHARED_MEMORY
+        if (m_sharedMemoryServer)
+            m_sharedMemoryServer->start(m_env.get());
+#endif
+    }
+
+    void stop()
+    {
+#if METHCLA_HAVE_SOCKET_SERVER
+        if (m_server)
+            m_server->stop();
+#endif
+#if METHCLA_HAVE_SHARED_MEMORY
+        if (m_sharedMemoryServer)
+            m_sharedMemoryServer->stop();
+#endif
+        driver()->stop();
+    }
 
     ~Methcla_Engine()
     {
@@ -146,6 +215,13 @@ private:
     }
 
 private:
+#if METHCLA_HAVE_SOCKET_SERVER
+    // Destroyed after the environment, which returns the server's receive buffers
+    std::unique_ptr<Methcla::IO::SocketServer>   m_server;
+#endif
+#if METHCLA_HAVE_SHARED_MEMORY
+    std::unique_ptr<Methcla::IO::SharedMemoryServer> m_sharedMemoryServer;
+#endif
     std::unique_ptr<Methcla::Audio::Environment> m_env;
     std::unique_ptr<Methcla_AudioDriver>         m_driver;
 };
@@ -307,7 +383,7 @@ METHCLA_EXPORT Methcla_Time methcla_engine_current_time(Methcla_Engine* engine)
     return engine == nullptr ? 0. : engine->driver()->currentTime();
 }
 
-METHCLA_EXPORT Methcla_Error methcla_engine_send(Methcla_Engine* engine, const void* packet, size_t size)
+static Methcla_Error sendPacket(Methcla_Engine* engine, const void* packet, size_t size, double timeout)
 {
     if (engine == nullptr)
         return methcla_error_new(kMethcla_ArgumentError);
@@ -316,7 +392,70 @@ METHCLA_EXPORT Methcla_Error methcla_engine_send(Methcla_Engine* engine, const v
     if (size == 0)
         return methcla_error_new(kMethcla_ArgumentError);
     METHCLA_API_TRY {
-        engine->env()->send(packet, size);
+        engine->env()->send(packet, size, timeout);
+    } METHCLA_API_CATCH;
+    return methcla_no_error();
+}
+
+METHCLA_EXPORT Methcla_Error methcla_engine_send(Methcla_Engine* engine, const void* packet, size_t size)
+{
+    return sendPacket(engine, packet, size, 0.);
+}
+
+METHCLA_EXPORT Methcla_Error methcla_engine_try_send(Methcla_Engine* engine, const void* packet, size_t size)
+{
+    return sendPacket(engine, packet, size, 0.);
+}
+
+METHCLA_EXPORT Methcla_Error methcla_engine_send_with_timeout(Methcla_Engine* engine, const void* packet, size_t size, double timeout)
+{
+    if (timeout < 0.)
+        return methcla_error_new(kMethcla_ArgumentError);
+    return sendPacket(engine, packet, size, timeout);
+}
+
+METHCLA_EXPORT Methcla_Error methcla_engine_queue_stats(const Methcla_Engine* engine, Methcla_EngineQueueStats* stats)
+{
+    if (engine == nullptr)
+        return methcla_error_new(kMethcla_ArgumentError);
+    if (stats == nullptr)
+        return methcla_error_new(kMethcla_ArgumentError);
+    METHCLA_API_TRY {
+        *stats = engine->env()->queueStatistics();
+    } METHCLA_API_CATCH;
+    return methcla_no_error();
+}
+
+METHCLA_EXPORT Methcla_Error methcla_engine_send_batch(Methcla_Engine* engine, const Methcla_Packet* packets, size_t count)
+{
+    if (engine == nullptr)
+        return methcla_error_new(kMethcla_ArgumentError);
+    if (count == 0)
+        return methcla_no_error();
+    if (packets == nullptr)
+        return methcla_error_new(kMethcla_ArgumentError);
+    for (size_t i=0; i < count; i++)
+    {
+        if (packets[i].data == nullptr || packets[i].size == 0)
+            return methcla_error_new(kMethcla_ArgumentError);
+    }
+    METHCLA_API_TRY {
+        engine->env()->send(packets, count);
+    } METHCLA_API_CATCH;
+    return methcla_no_error();
+}
+
+METHCLA_EXPORT Methcla_Error methcla_engine_send_buffer(Methcla_Engine* engine, void* buffer, size_t size, Methcla_PacketReleaseFunction release, void* data)
+{
+    if (buffer == nullptr || release == nullptr)
+        return methcla_error_new(kMethcla_ArgumentError);
+    if (engine == nullptr || size == 0)
+    {
+        release(data, buffer);
+        return methcla_error_new(kMethcla_ArgumentError);
+    }
+    METHCLA_API_TRY {
+        engine->env()->send(buffer, size, release, data);
     } METHCLA_API_CATCH;
     return methcla_no_error();
 }
@@ -355,6 +494,7 @@ METHCLA_EXPORT const char* methcla_error_code_description(Methcla_ErrorCode code
         case kMethcla_SynthDefNotFoundError: return "SynthDef not found";
         case kMethcla_NodeIdError: return "Invalid node id";
         case kMethcla_NodeTypeError: return "Invalid node type";
+        case kMethcla_QueueFullError: return "Request queue full";
 
         /* File errors */
         case kMethcla_FileNotFoundError: return "File not found";
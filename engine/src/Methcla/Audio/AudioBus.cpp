@@ -18,8 +18,10 @@
 using namespace Methcla::Audio;
 using namespace Methcla::Memory;
 
-AudioBus::AudioBus(sample_t* data, Epoch epoch)
-    : m_epoch(epoch)
+AudioBus::AudioBus(size_t index, sample_t* data, Epoch epoch)
+    : m_index(index)
+    , m_epoch(epoch)
+    , m_silent(false)
     , m_data(data)
 {
 }
@@ -28,13 +30,14 @@ AudioBus::~AudioBus()
 {
 }
 
-ExternalAudioBus::ExternalAudioBus(Epoch epoch)
-    : AudioBus(nullptr, epoch)
+ExternalAudioBus::ExternalAudioBus(size_t index, Epoch epoch)
+    : AudioBus(index, nullptr, epoch)
 {
 }
 
-InternalAudioBus::InternalAudioBus(size_t numFrames, Epoch epoch)
-    : AudioBus( allocAlignedOf<sample_t>(kSIMDAlignment, numFrames)
+InternalAudioBus::InternalAudioBus(size_t index, size_t numFrames, Epoch epoch)
+    : AudioBus( index
+              , allocAlignedOf<sample_t>(kSIMDAlignment, numFrames)
               , epoch )
 {
 }
@@ -16,6 +16,7 @@
 #define METHCLA_AUDIO_AUDIOBUS_HPP_INCLUDED
 
 #include "Methcla/Audio.hpp"
+#include "Methcla/Utility/SpinLock.hpp"
 
 #include <boost/serialization/strong_typedef.hpp>
 
@@ -26,28 +27,25 @@ BOOST_STRONG_TYPEDEF(uint32_t, AudioBusId);
 class AudioBus
 {
 public:
-    // class Lock
-    // {
-    // public:
-    //     void lock() { }
-    //     void try_lock() { }
-    //     void unlock() { }
-    // 
-    //     void lock_shared() { }
-    //     bool try_lock_shared() { return true; }
-    //     void unlock_shared() { }
-    // };
+    //* Lock protecting bus data and epoch when synths are processed in parallel.
+    typedef Utility::SpinLock Lock;
 
     // typedef boost::intrusive_ptr<AudioBus> Handle;
 
 public:
-    AudioBus(sample_t* data, Epoch epoch);
+    AudioBus(size_t index, sample_t* data, Epoch epoch);
     virtual ~AudioBus();
 
     AudioBus(const AudioBus&) = delete;
     AudioBus& operator=(const AudioBus&) = delete;
 
-    // Lock& lock() { return m_lock; }
+    Lock& lock() { return m_lock; }
+
+    //* Return index of this bus among all buses (internal and external) of the engine.
+    size_t index() const
+    {
+        return m_index;
+    }
 
     const Epoch& epoch() const
     {
@@ -59,6 +57,17 @@ public:
         m_epoch = epoch;
     }
 
+    //* Return true if the bus data written in the current epoch is known to be silent.
+    bool isSilent() const
+    {
+        return m_silent;
+    }
+
+    void setSilent(bool silent)
+    {
+        m_silent = silent;
+    }
+
     sample_t* data()
     {
         return m_data;
@@ -71,15 +80,17 @@ protected:
     }
 
 private:
-    // Lock        m_lock;
+    Lock        m_lock;
+    size_t      m_index;
     Epoch       m_epoch;
+    bool        m_silent;
     sample_t*   m_data;
 };
 
 class ExternalAudioBus : public AudioBus
 {
 public:
-    ExternalAudioBus(Epoch epoch);
+    ExternalAudioBus(size_t index, Epoch epoch);
     void setData(sample_t* data)
     {
         AudioBus::setData(data);
@@ -89,7 +100,7 @@ public:
 class InternalAudioBus : public AudioBus
 {
 public:
-    InternalAudioBus(size_t numFrames, Epoch epoch);
+    InternalAudioBus(size_t index, size_t numFrames, Epoch epoch);
     virtual ~InternalAudioBus();
 };
 
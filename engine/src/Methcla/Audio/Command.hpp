@@ -0,0 +1,138 @@
+// Copyright 2012-2014 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_AUDIO_COMMAND_HPP_INCLUDED
+#define METHCLA_AUDIO_COMMAND_HPP_INCLUDED
+
+#include <methcla/common.h>
+#include <methcla/plugin.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <oscpp/server.hpp>
+
+namespace Methcla { namespace Audio {
+
+class SynthDef;
+
+//* Command opcodes, one for each OSC request address.
+enum Opcode
+{
+    kOpBundle,
+    kOpGroupNew,
+    kOpParallelGroupNew,
+    kOpGroupFreeAll,
+    kOpSynthNew,
+    kOpSynthActivate,
+    kOpSynthMapInput,
+    kOpSynthMapOutput,
+    kOpSynthMapControlInput,
+    kOpSynthMapControlOutput,
+    kOpSynthSetDoneFlags,
+    kOpSynthSetTailTime,
+    kOpNodeFree,
+    kOpNodeSet,
+    kOpNodeTreeStatistics,
+    kOpRealtimeMemoryStatistics,
+    kOpPluginCommand
+};
+
+//* Pre-parsed request command.
+//
+// OSC requests are translated to arrays of commands before they are sent to
+// the realtime thread, which then dispatches on the opcode and reads fixed
+// width arguments without touching strings. Bundles are stored in depth
+// first order, each bundle followed by the commands it contains.
+struct Command
+{
+    struct Bundle
+    {
+        Methcla_Time    time;
+        // Number of commands following the bundle that are part of it
+        uint32_t        size;
+    };
+
+    struct NodeNew
+    {
+        int32_t         node;
+        int32_t         target;
+        int32_t         placement;
+        // Resolved when translating the request
+        const SynthDef* synthDef;
+    };
+
+    struct Node
+    {
+        int32_t         node;
+    };
+
+    struct Map
+    {
+        int32_t         node;
+        int32_t         index;
+        int32_t         bus;
+        int32_t         flags;
+    };
+
+    struct SetFlags
+    {
+        int32_t         node;
+        int32_t         flags;
+    };
+
+    struct SetValue
+    {
+        int32_t         node;
+        int32_t         index;
+        float           value;
+    };
+
+    struct Query
+    {
+        int32_t         requestId;
+    };
+
+    struct PluginCommand
+    {
+        const Methcla_CommandDef* def;
+    };
+
+    Opcode opcode;
+
+    union
+    {
+        Bundle          bundle;
+        NodeNew         nodeNew;
+        Node            node;
+        Map             map;
+        SetFlags        setFlags;
+        SetValue        setValue;
+        Query           query;
+        PluginCommand   plugin;
+    };
+
+    // Synth control initializers and options for kOpSynthNew
+    OSCPP::Server::ArgStream controls;
+    OSCPP::Server::ArgStream options;
+
+    // Message arguments for kOpPluginCommand
+    OSCPP::Server::ArgStream args;
+
+    // OSC message the command was translated from, for logging and error reporting
+    OSCPP::Server::Packet message;
+};
+
+} }
+
+#endif // METHCLA_AUDIO_COMMAND_HPP_INCLUDED
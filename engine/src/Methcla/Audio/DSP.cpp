@@ -0,0 +1,956 @@
+// Copyright 2012-2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Methcla/Audio/DSP.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__i386__) || defined(__x86_64__)
+# define METHCLA_DSP_X86 1
+# include <cpuid.h>
+# include <immintrin.h>
+// Compile individual functions for instruction sets not enabled globally.
+# define METHCLA_DSP_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+using namespace Methcla::Audio;
+using namespace Methcla::Audio::DSP;
+
+static_assert(std::is_same<sample_t,float>::value, "DSP kernels require float samples");
+
+// ====================================================================
+// Generic kernels
+//
+// Also used for processing the remainder of the specialized kernels.
+
+static void zero_generic(sample_t* dst, size_t n)
+{
+    for (size_t i=0; i < n; i++)
+        dst[i] = 0.f;
+}
+
+static void copy_generic(sample_t* __restrict dst, const sample_t* __restrict src, size_t n)
+{
+    for (size_t i=0; i < n; i++)
+        dst[i] = src[i];
+}
+
+static void accumulate_generic(sample_t* __restrict dst, const sample_t* __restrict src, size_t n)
+{
+    for (size_t i=0; i < n; i++)
+        dst[i] += src[i];
+}
+
+static void mix_generic(sample_t* __restrict dst, const sample_t* __restrict src, sample_t gain, size_t n)
+{
+    for (size_t i=0; i < n; i++)
+        dst[i] += gain * src[i];
+}
+
+static void sum_generic(sample_t* dst, const sample_t* const* srcs, size_t numSrcs, size_t n)
+{
+    for (size_t i=0; i < n; i++)
+    {
+        sample_t x = 0.f;
+        for (size_t k=0; k < numSrcs; k++)
+            x += srcs[k][i];
+        dst[i] = x;
+    }
+}
+
+static void deinterleave_generic(sample_t* const* dst, size_t offset, const sample_t* src, size_t numChannels, size_t numFrames)
+{
+    for (size_t c=0; c < numChannels; c++)
+    {
+        sample_t* out = dst[c] + offset;
+        for (size_t i=0; i < numFrames; i++)
+            out[i] = src[i*numChannels+c];
+    }
+}
+
+static void interleave_generic(sample_t* dst, const sample_t* const* src, size_t offset, size_t numChannels, size_t numFrames)
+{
+    for (size_t c=0; c < numChannels; c++)
+    {
+        const sample_t* in = src[c] + offset;
+        for (size_t i=0; i < numFrames; i++)
+            dst[i*numChannels+c] = in[i];
+    }
+}
+
+// Scale factors for integer conversion
+static const sample_t kInt16Scale = 32768.f;
+static const sample_t kInt24Scale = 8388608.f;
+static const sample_t kInt32Scale = 2147483648.f;
+// Largest floating point values that can be converted to each integer format
+static const sample_t kInt16Max = 32767.f;
+static const sample_t kInt24Max = 8388607.f;
+static const sample_t kInt32Max = 2147483520.f;
+
+// Clip, scale and round to nearest, like the SIMD conversion instructions.
+static inline long fromSample(sample_t x, sample_t scale, sample_t max)
+{
+    return std::lrint(std::min(std::max(x, -1.f) * scale, max));
+}
+
+static void fromInt16_generic(sample_t* dst, const int16_t* src, size_t n)
+{
+    for (size_t i=0; i < n; i++)
+        dst[i] = (sample_t)src[i] * (1.f / kInt16Scale);
+}
+
+static void toInt16_generic(int16_t* dst, const sample_t* src, size_t n)
+{
+    for (size_t i=0; i < n; i++)
+        dst[i] = (int16_t)fromSample(src[i], kInt16Scale, kInt16Max);
+}
+
+static void fromInt24_generic(sample_t* dst, const Int24* src, size_t n)
+{
+    for (size_t i=0; i < n; i++)
+    {
+        const uint8_t* b = src[i].bytes;
+        // Sign extend by shifting into the upper 24 bits
+        const int32_t x = (int32_t)(((uint32_t)b[0] << 8) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 24)) >> 8;
+        dst[i] = (sample_t)x * (1.f / kInt24Scale);
+    }
+}
+
+static void toInt24_generic(Int24* dst, const sample_t* src, size_t n)
+{
+    for (size_t i=0; i < n; i++)
+    {
+        const uint32_t x = (uint32_t)fromSample(src[i], kInt24Scale, kInt24Max);
+        dst[i].bytes[0] = (uint8_t)x;
+        dst[i].bytes[1] = (uint8_t)(x >> 8);
+        dst[i].bytes[2] = (uint8_t)(x >> 16);
+    }
+}
+
+static void fromInt32_generic(sample_t* dst, const int32_t* src, size_t n)
+{
+    for (size_t i=0; i < n; i++)
+        dst[i] = (sample_t)src[i] * (1.f / kInt32Scale);
+}
+
+static void toInt32_generic(int32_t* dst, const sample_t* src, size_t n)
+{
+    for (size_t i=0; i < n; i++)
+        dst[i] = (int32_t)fromSample(src[i], kInt32Scale, kInt32Max);
+}
+
+static const Kernels kGenericKernels = {
+    kGeneric, zero_generic, copy_generic, accumulate_generic, mix_generic, sum_generic,
+    deinterleave_generic, interleave_generic,
+    fromInt16_generic, toInt16_generic,
+    fromInt24_generic, toInt24_generic,
+    fromInt32_generic, toInt32_generic
+};
+
+#if defined(METHCLA_DSP_X86)
+
+// ====================================================================
+// SSE2 kernels
+
+METHCLA_DSP_TARGET("sse2")
+static void zero_sse2(sample_t* dst, size_t n)
+{
+    const __m128 z = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dst + i, z);
+    zero_generic(dst + i, n - i);
+}
+
+METHCLA_DSP_TARGET("sse2")
+static void copy_sse2(sample_t* dst, const sample_t* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dst + i, _mm_loadu_ps(src + i));
+    copy_generic(dst + i, src + i, n - i);
+}
+
+METHCLA_DSP_TARGET("sse2")
+static void accumulate_sse2(sample_t* dst, const sample_t* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+    accumulate_generic(dst + i, src + i, n - i);
+}
+
+METHCLA_DSP_TARGET("sse2")
+static void mix_sse2(sample_t* dst, const sample_t* src, sample_t gain, size_t n)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(g, _mm_loadu_ps(src + i))));
+    mix_generic(dst + i, src + i, gain, n - i);
+}
+
+METHCLA_DSP_TARGET("sse2")
+static void sum_sse2(sample_t* dst, const sample_t* const* srcs, size_t numSrcs, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 x = _mm_setzero_ps();
+        for (size_t k=0; k < numSrcs; k++)
+            x = _mm_add_ps(x, _mm_loadu_ps(srcs[k] + i));
+        _mm_storeu_ps(dst + i, x);
+    }
+    for (; i < n; i++)
+    {
+        sample_t x = 0.f;
+        for (size_t k=0; k < numSrcs; k++)
+            x += srcs[k][i];
+        dst[i] = x;
+    }
+}
+
+METHCLA_DSP_TARGET("sse2")
+static void deinterleave_sse2(sample_t* const* dst, size_t offset, const sample_t* src, size_t numChannels, size_t numFrames)
+{
+    size_t i = 0;
+    switch (numChannels)
+    {
+        case 1:
+            copy_sse2(dst[0] + offset, src, numFrames);
+            return;
+        case 2:
+            for (; i + 4 <= numFrames; i += 4)
+            {
+                const __m128 a = _mm_loadu_ps(src + 2*i);
+                const __m128 b = _mm_loadu_ps(src + 2*i + 4);
+                _mm_storeu_ps(dst[0] + offset + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0)));
+                _mm_storeu_ps(dst[1] + offset + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1)));
+            }
+            break;
+        case 4:
+        case 8:
+            // Transpose 4x4 blocks of frames and channels
+            for (; i + 4 <= numFrames; i += 4)
+            {
+                for (size_t c=0; c < numChannels; c += 4)
+                {
+                    __m128 r0 = _mm_loadu_ps(src + (i+0)*numChannels + c);
+                    __m128 r1 = _mm_loadu_ps(src + (i+1)*numChannels + c);
+                    __m128 r2 = _mm_loadu_ps(src + (i+2)*numChannels + c);
+                    __m128 r3 = _mm_loadu_ps(src + (i+3)*numChannels + c);
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    _mm_storeu_ps(dst[c+0] + offset + i, r0);
+                    _mm_storeu_ps(dst[c+1] + offset + i, r1);
+                    _mm_storeu_ps(dst[c+2] + offset + i, r2);
+                    _mm_storeu_ps(dst[c+3] + offset + i, r3);
+                }
+            }
+            break;
+    }
+    deinterleave_generic(dst, offset + i, src + i*numChannels, numChannels, numFrames - i);
+}
+
+METHCLA_DSP_TARGET("sse2")
+static void interleave_sse2(sample_t* dst, const sample_t* const* src, size_t offset, size_t numChannels, size_t numFrames)
+{
+    size_t i = 0;
+    switch (numChannels)
+    {
+        case 1:
+            copy_sse2(dst, src[0] + offset, numFrames);
+            return;
+        case 2:
+            for (; i + 4 <= numFrames; i += 4)
+            {
+                const __m128 a = _mm_loadu_ps(src[0] + offset + i);
+                const __m128 b = _mm_loadu_ps(src[1] + offset + i);
+                _mm_storeu_ps(dst + 2*i,     _mm_unpacklo_ps(a, b));
+                _mm_storeu_ps(dst + 2*i + 4, _mm_unpackhi_ps(a, b));
+            }
+            break;
+        case 4:
+        case 8:
+            for (; i + 4 <= numFrames; i += 4)
+            {
+                for (size_t c=0; c < numChannels; c += 4)
+                {
+                    __m128 r0 = _mm_loadu_ps(src[c+0] + offset + i);
+                    __m128 r1 = _mm_loadu_ps(src[c+1] + offset + i);
+                    __m128 r2 = _mm_loadu_ps(src[c+2] + offset + i);
+                    __m128 r3 = _mm_loadu_ps(src[c+3] + offset + i);
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    _mm_storeu_ps(dst + (i+0)*numChannels + c, r0);
+                    _mm_storeu_ps(dst + (i+1)*numChannels + c, r1);
+                    _mm_storeu_ps(dst + (i+2)*numChannels + c, r2);
+                    _mm_storeu_ps(dst + (i+3)*numChannels + c, r3);
+                }
+            }
+            break;
+    }
+    interleave_generic(dst + i*numChannels, src, offset + i, numChannels, numFrames - i);
+}
+
+METHCLA_DSP_TARGET("sse2")
+static void fromInt16_sse2(sample_t* dst, const int16_t* src, size_t n)
+{
+    const __m128 scale = _mm_set1_ps(1.f / kInt16Scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        // Sign extend to 32 bits
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(dst + i,     _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    fromInt16_generic(dst + i, src + i, n - i);
+}
+
+METHCLA_DSP_TARGET("sse2")
+static void toInt16_sse2(int16_t* dst, const sample_t* src, size_t n)
+{
+    const __m128 lower = _mm_set1_ps(-1.f);
+    const __m128 scale = _mm_set1_ps(kInt16Scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        // The upper bound is enforced by saturation when packing
+        const __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_max_ps(_mm_loadu_ps(src + i), lower), scale));
+        const __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4), lower), scale));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(lo, hi));
+    }
+    toInt16_generic(dst + i, src + i, n - i);
+}
+
+METHCLA_DSP_TARGET("sse2")
+static void fromInt32_sse2(sample_t* dst, const int32_t* src, size_t n)
+{
+    const __m128 scale = _mm_set1_ps(1.f / kInt32Scale);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+    }
+    fromInt32_generic(dst + i, src + i, n - i);
+}
+
+METHCLA_DSP_TARGET("sse2")
+static void toInt32_sse2(int32_t* dst, const sample_t* src, size_t n)
+{
+    const __m128 lower = _mm_set1_ps(-1.f);
+    const __m128 scale = _mm_set1_ps(kInt32Scale);
+    const __m128 upper = _mm_set1_ps(kInt32Max);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m128 x = _mm_min_ps(_mm_mul_ps(_mm_max_ps(_mm_loadu_ps(src + i), lower), scale), upper);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_cvtps_epi32(x));
+    }
+    toInt32_generic(dst + i, src + i, n - i);
+}
+
+// Packed 24 bit samples need byte shuffles, which are not available in SSE2.
+static const Kernels kSSE2Kernels = {
+    kSSE2, zero_sse2, copy_sse2, accumulate_sse2, mix_sse2, sum_sse2,
+    deinterleave_sse2, interleave_sse2,
+    fromInt16_sse2, toInt16_sse2,
+    fromInt24_generic, toInt24_generic,
+    fromInt32_sse2, toInt32_sse2
+};
+
+// ====================================================================
+// AVX2 kernels
+
+METHCLA_DSP_TARGET("avx2")
+static void zero_avx2(sample_t* dst, size_t n)
+{
+    const __m256 z = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, z);
+    zero_generic(dst + i, n - i);
+}
+
+METHCLA_DSP_TARGET("avx2")
+static void copy_avx2(sample_t* dst, const sample_t* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_loadu_ps(src + i));
+    copy_generic(dst + i, src + i, n - i);
+}
+
+METHCLA_DSP_TARGET("avx2")
+static void accumulate_avx2(sample_t* dst, const sample_t* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+    accumulate_generic(dst + i, src + i, n - i);
+}
+
+METHCLA_DSP_TARGET("avx2")
+static void mix_avx2(sample_t* dst, const sample_t* src, sample_t gain, size_t n)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(g, _mm256_loadu_ps(src + i))));
+    mix_generic(dst + i, src + i, gain, n - i);
+}
+
+METHCLA_DSP_TARGET("avx2")
+static void sum_avx2(sample_t* dst, const sample_t* const* srcs, size_t numSrcs, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 x = _mm256_setzero_ps();
+        for (size_t k=0; k < numSrcs; k++)
+            x = _mm256_add_ps(x, _mm256_loadu_ps(srcs[k] + i));
+        _mm256_storeu_ps(dst + i, x);
+    }
+    for (; i < n; i++)
+    {
+        sample_t x = 0.f;
+        for (size_t k=0; k < numSrcs; k++)
+            x += srcs[k][i];
+        dst[i] = x;
+    }
+}
+
+// Transpose the 4x4 matrices in the lower and upper lanes of r0 to r3.
+METHCLA_DSP_TARGET("avx2")
+static inline void transpose4x4Lanes(__m256& r0, __m256& r1, __m256& r2, __m256& r3)
+{
+    const __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+    const __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+    const __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+    const __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+    r0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1,0,1,0));
+    r1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3,2,3,2));
+    r2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1,0,1,0));
+    r3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3,2,3,2));
+}
+
+METHCLA_DSP_TARGET("avx2")
+static inline void transpose8x8(__m256* r)
+{
+    transpose4x4Lanes(r[0], r[1], r[2], r[3]);
+    transpose4x4Lanes(r[4], r[5], r[6], r[7]);
+    for (size_t k=0; k < 4; k++)
+    {
+        const __m256 lo = _mm256_permute2f128_ps(r[k], r[k+4], 0x20);
+        const __m256 hi = _mm256_permute2f128_ps(r[k], r[k+4], 0x31);
+        r[k] = lo;
+        r[k+4] = hi;
+    }
+}
+
+METHCLA_DSP_TARGET("avx2")
+static void deinterleave_avx2(sample_t* const* dst, size_t offset, const sample_t* src, size_t numChannels, size_t numFrames)
+{
+    size_t i = 0;
+    switch (numChannels)
+    {
+        case 1:
+            copy_avx2(dst[0] + offset, src, numFrames);
+            return;
+        case 2:
+            for (; i + 8 <= numFrames; i += 8)
+            {
+                const __m256 a = _mm256_loadu_ps(src + 2*i);
+                const __m256 b = _mm256_loadu_ps(src + 2*i + 8);
+                const __m256 lo = _mm256_permute2f128_ps(a, b, 0x20);
+                const __m256 hi = _mm256_permute2f128_ps(a, b, 0x31);
+                _mm256_storeu_ps(dst[0] + offset + i, _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2,0,2,0)));
+                _mm256_storeu_ps(dst[1] + offset + i, _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3,1,3,1)));
+            }
+            break;
+        case 4:
+            for (; i + 8 <= numFrames; i += 8)
+            {
+                // Frames k and k+4 in the lower and upper lanes
+                __m256 r[4];
+                for (size_t k=0; k < 4; k++)
+                {
+                    r[k] = _mm256_insertf128_ps(
+                        _mm256_castps128_ps256(_mm_loadu_ps(src + 4*(i+k))),
+                        _mm_loadu_ps(src + 4*(i+k+4)), 1);
+                }
+                transpose4x4Lanes(r[0], r[1], r[2], r[3]);
+                for (size_t c=0; c < 4; c++)
+                    _mm256_storeu_ps(dst[c] + offset + i, r[c]);
+            }
+            break;
+        case 8:
+            for (; i + 8 <= numFrames; i += 8)
+            {
+                __m256 r[8];
+                for (size_t k=0; k < 8; k++)
+                    r[k] = _mm256_loadu_ps(src + 8*(i+k));
+                transpose8x8(r);
+                for (size_t c=0; c < 8; c++)
+                    _mm256_storeu_ps(dst[c] + offset + i, r[c]);
+            }
+            break;
+    }
+    deinterleave_generic(dst, offset + i, src + i*numChannels, numChannels, numFrames - i);
+}
+
+METHCLA_DSP_TARGET("avx2")
+static void interleave_avx2(sample_t* dst, const sample_t* const* src, size_t offset, size_t numChannels, size_t numFrames)
+{
+    size_t i = 0;
+    switch (numChannels)
+    {
+        case 1:
+            copy_avx2(dst, src[0] + offset, numFrames);
+            return;
+        case 2:
+            for (; i + 8 <= numFrames; i += 8)
+            {
+                const __m256 a = _mm256_loadu_ps(src[0] + offset + i);
+                const __m256 b = _mm256_loadu_ps(src[1] + offset + i);
+                const __m256 lo = _mm256_unpacklo_ps(a, b);
+                const __m256 hi = _mm256_unpackhi_ps(a, b);
+                _mm256_storeu_ps(dst + 2*i,     _mm256_permute2f128_ps(lo, hi, 0x20));
+                _mm256_storeu_ps(dst + 2*i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+            }
+            break;
+        case 4:
+            for (; i + 8 <= numFrames; i += 8)
+            {
+                __m256 r[4];
+                for (size_t c=0; c < 4; c++)
+                    r[c] = _mm256_loadu_ps(src[c] + offset + i);
+                transpose4x4Lanes(r[0], r[1], r[2], r[3]);
+                // Frames k and k+4 in the lower and upper lanes
+                for (size_t k=0; k < 4; k++)
+                {
+                    _mm_storeu_ps(dst + 4*(i+k),   _mm256_castps256_ps128(r[k]));
+                    _mm_storeu_ps(dst + 4*(i+k+4), _mm256_extractf128_ps(r[k], 1));
+                }
+            }
+            break;
+        case 8:
+            for (; i + 8 <= numFrames; i += 8)
+            {
+                __m256 r[8];
+                for (size_t c=0; c < 8; c++)
+                    r[c] = _mm256_loadu_ps(src[c] + offset + i);
+                transpose8x8(r);
+                for (size_t k=0; k < 8; k++)
+                    _mm256_storeu_ps(dst + 8*(i+k), r[k]);
+            }
+            break;
+    }
+    interleave_generic(dst + i*numChannels, src, offset + i, numChannels, numFrames - i);
+}
+
+METHCLA_DSP_TARGET("avx2")
+static void fromInt16_avx2(sample_t* dst, const int16_t* src, size_t n)
+{
+    const __m256 scale = _mm256_set1_ps(1.f / kInt16Scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+    }
+    fromInt16_generic(dst + i, src + i, n - i);
+}
+
+METHCLA_DSP_TARGET("avx2")
+static void toInt16_avx2(int16_t* dst, const sample_t* src, size_t n)
+{
+    const __m256 lower = _mm256_set1_ps(-1.f);
+    const __m256 scale = _mm256_set1_ps(kInt16Scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        // The upper bound is enforced by saturation when packing
+        const __m256i x = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_max_ps(_mm256_loadu_ps(src + i), lower), scale));
+        const __m128i y = _mm_packs_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), y);
+    }
+    toInt16_generic(dst + i, src + i, n - i);
+}
+
+METHCLA_DSP_TARGET("avx2")
+static void fromInt24_avx2(sample_t* dst, const Int24* src, size_t n)
+{
+    // Move each sample into the upper 24 bits of a 32 bit lane. The upper
+    // lane is loaded from an offset of eight bytes, so that all loads stay
+    // within the eight samples processed in each iteration.
+    const __m256i shuffle = _mm256_setr_epi8(
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1,  9, 10, 11,
+        -1, 4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15);
+    const __m256 scale = _mm256_set1_ps(1.f / kInt24Scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const uint8_t* p = src[i].bytes;
+        const __m256i x = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8)), 1);
+        const __m256i y = _mm256_srai_epi32(_mm256_shuffle_epi8(x, shuffle), 8);
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(y), scale));
+    }
+    fromInt24_generic(dst + i, src + i, n - i);
+}
+
+// Store the lower 12 bytes of x.
+METHCLA_DSP_TARGET("avx2")
+static inline void store12(uint8_t* dst, __m128i x)
+{
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), x);
+    const int32_t hi = _mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+    std::memcpy(dst + 8, &hi, sizeof(hi));
+}
+
+METHCLA_DSP_TARGET("avx2")
+static void toInt24_avx2(Int24* dst, const sample_t* src, size_t n)
+{
+    // Pack the lower 24 bits of each 32 bit lane
+    const __m256i shuffle = _mm256_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256 lower = _mm256_set1_ps(-1.f);
+    const __m256 scale = _mm256_set1_ps(kInt24Scale);
+    const __m256 upper = _mm256_set1_ps(kInt24Max);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 x = _mm256_min_ps(_mm256_mul_ps(_mm256_max_ps(_mm256_loadu_ps(src + i), lower), scale), upper);
+        const __m256i y = _mm256_shuffle_epi8(_mm256_cvtps_epi32(x), shuffle);
+        uint8_t* p = dst[i].bytes;
+        store12(p,      _mm256_castsi256_si128(y));
+        store12(p + 12, _mm256_extracti128_si256(y, 1));
+    }
+    toInt24_generic(dst + i, src + i, n - i);
+}
+
+METHCLA_DSP_TARGET("avx2")
+static void fromInt32_avx2(sample_t* dst, const int32_t* src, size_t n)
+{
+    const __m256 scale = _mm256_set1_ps(1.f / kInt32Scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+    }
+    fromInt32_generic(dst + i, src + i, n - i);
+}
+
+METHCLA_DSP_TARGET("avx2")
+static void toInt32_avx2(int32_t* dst, const sample_t* src, size_t n)
+{
+    const __m256 lower = _mm256_set1_ps(-1.f);
+    const __m256 scale = _mm256_set1_ps(kInt32Scale);
+    const __m256 upper = _mm256_set1_ps(kInt32Max);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 x = _mm256_min_ps(_mm256_mul_ps(_mm256_max_ps(_mm256_loadu_ps(src + i), lower), scale), upper);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_cvtps_epi32(x));
+    }
+    toInt32_generic(dst + i, src + i, n - i);
+}
+
+static const Kernels kAVX2Kernels = {
+    kAVX2, zero_avx2, copy_avx2, accumulate_avx2, mix_avx2, sum_avx2,
+    deinterleave_avx2, interleave_avx2,
+    fromInt16_avx2, toInt16_avx2,
+    fromInt24_avx2, toInt24_avx2,
+    fromInt32_avx2, toInt32_avx2
+};
+
+// ====================================================================
+// AVX-512 kernels
+//
+// The remainder is processed with masked loads and stores.
+
+METHCLA_DSP_TARGET("avx512f")
+static inline __mmask16 tailMask(size_t n)
+{
+    return (__mmask16)((1u << n) - 1u);
+}
+
+METHCLA_DSP_TARGET("avx512f")
+static void zero_avx512(sample_t* dst, size_t n)
+{
+    const __m512 z = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm512_storeu_ps(dst + i, z);
+    if (i < n)
+        _mm512_mask_storeu_ps(dst + i, tailMask(n - i), z);
+}
+
+METHCLA_DSP_TARGET("avx512f")
+static void copy_avx512(sample_t* dst, const sample_t* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm512_storeu_ps(dst + i, _mm512_loadu_ps(src + i));
+    if (i < n)
+    {
+        const __mmask16 m = tailMask(n - i);
+        _mm512_mask_storeu_ps(dst + i, m, _mm512_maskz_loadu_ps(m, src + i));
+    }
+}
+
+METHCLA_DSP_TARGET("avx512f")
+static void accumulate_avx512(sample_t* dst, const sample_t* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm512_storeu_ps(dst + i, _mm512_add_ps(_mm512_loadu_ps(dst + i), _mm512_loadu_ps(src + i)));
+    if (i < n)
+    {
+        const __mmask16 m = tailMask(n - i);
+        _mm512_mask_storeu_ps(dst + i, m, _mm512_add_ps(_mm512_maskz_loadu_ps(m, dst + i), _mm512_maskz_loadu_ps(m, src + i)));
+    }
+}
+
+METHCLA_DSP_TARGET("avx512f")
+static void mix_avx512(sample_t* dst, const sample_t* src, sample_t gain, size_t n)
+{
+    const __m512 g = _mm512_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm512_storeu_ps(dst + i, _mm512_fmadd_ps(g, _mm512_loadu_ps(src + i), _mm512_loadu_ps(dst + i)));
+    if (i < n)
+    {
+        const __mmask16 m = tailMask(n - i);
+        _mm512_mask_storeu_ps(dst + i, m, _mm512_fmadd_ps(g, _mm512_maskz_loadu_ps(m, src + i), _mm512_maskz_loadu_ps(m, dst + i)));
+    }
+}
+
+METHCLA_DSP_TARGET("avx512f")
+static void sum_avx512(sample_t* dst, const sample_t* const* srcs, size_t numSrcs, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512 x = _mm512_setzero_ps();
+        for (size_t k=0; k < numSrcs; k++)
+            x = _mm512_add_ps(x, _mm512_loadu_ps(srcs[k] + i));
+        _mm512_storeu_ps(dst + i, x);
+    }
+    if (i < n)
+    {
+        const __mmask16 m = tailMask(n - i);
+        __m512 x = _mm512_setzero_ps();
+        for (size_t k=0; k < numSrcs; k++)
+            x = _mm512_add_ps(x, _mm512_maskz_loadu_ps(m, srcs[k] + i));
+        _mm512_mask_storeu_ps(dst + i, m, x);
+    }
+}
+
+// Shuffles and conversions are bound by memory bandwidth at typical channel
+// counts and reuse the AVX2 kernels.
+static const Kernels kAVX512Kernels = {
+    kAVX512, zero_avx512, copy_avx512, accumulate_avx512, mix_avx512, sum_avx512,
+    deinterleave_avx2, interleave_avx2,
+    fromInt16_avx2, toInt16_avx2,
+    fromInt24_avx2, toInt24_avx2,
+    fromInt32_avx2, toInt32_avx2
+};
+
+// ====================================================================
+// CPU feature detection
+
+#ifndef bit_OSXSAVE
+# define bit_OSXSAVE (1 << 27)
+#endif
+#ifndef bit_AVX
+# define bit_AVX (1 << 28)
+#endif
+#ifndef bit_AVX2
+# define bit_AVX2 (1 << 5)
+#endif
+#ifndef bit_AVX512F
+# define bit_AVX512F (1 << 16)
+#endif
+
+// XCR0 state components that need to be enabled by the OS
+enum
+{
+    kXCR0_SSE       = 0x2,
+    kXCR0_AVX       = 0x4,
+    kXCR0_AVX512    = 0xe0
+};
+
+static uint64_t xgetbv()
+{
+    uint32_t eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+}
+
+static InstructionSet detectInstructionSet()
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || (edx & bit_SSE2) == 0)
+        return kGeneric;
+
+    InstructionSet result = kSSE2;
+
+    // AVX state must be enabled by the OS as well
+    if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX) && __get_cpuid_max(0, nullptr) >= 7)
+    {
+        const uint64_t xcr0 = xgetbv();
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        const uint64_t avxState = kXCR0_SSE | kXCR0_AVX;
+        if ((xcr0 & avxState) == avxState && (ebx & bit_AVX2))
+        {
+            result = kAVX2;
+            const uint64_t avx512State = avxState | kXCR0_AVX512;
+            if ((xcr0 & avx512State) == avx512State && (ebx & bit_AVX512F))
+                result = kAVX512;
+        }
+    }
+
+    return result;
+}
+
+#else
+
+static InstructionSet detectInstructionSet()
+{
+    return kGeneric;
+}
+
+#endif // METHCLA_DSP_X86
+
+// Function local statics are initialized on first use, so that kernels can
+// be used during the dynamic initialization of other translation units.
+static InstructionSet supportedInstructionSet()
+{
+    static const InstructionSet instructionSet = detectInstructionSet();
+    return instructionSet;
+}
+
+const Kernels* Methcla::Audio::DSP::kernels(InstructionSet instructionSet)
+{
+    if (instructionSet > supportedInstructionSet())
+        return nullptr;
+
+    switch (instructionSet)
+    {
+        case kGeneric:
+            return &kGenericKernels;
+#if defined(METHCLA_DSP_X86)
+        case kSSE2:
+            return &kSSE2Kernels;
+        case kAVX2:
+            return &kAVX2Kernels;
+        case kAVX512:
+            return &kAVX512Kernels;
+#else
+        default:
+            break;
+#endif
+    }
+
+    return nullptr;
+}
+
+const Kernels& Methcla::Audio::DSP::kernels()
+{
+    static const Kernels& defaultKernels = *kernels(supportedInstructionSet());
+    return defaultKernels;
+}
+
+// ====================================================================
+// Interleaving with sample format conversion
+//
+// Samples are converted in chunks that fit into the L1 cache and then
+// shuffled with the floating point kernels.
+
+static const size_t kChunkSize = 1024;
+
+template <typename T> static void deinterleaveConverted(sample_t* const* dst, const T* src, size_t numChannels, size_t numFrames)
+{
+    assert( numChannels <= kChunkSize );
+    if (numChannels == 0)
+        return;
+    const Kernels& k = kernels();
+    alignas(64) sample_t buffer[kChunkSize];
+    const size_t chunkFrames = kChunkSize / numChannels;
+    for (size_t i=0; i < numFrames; i += chunkFrames)
+    {
+        const size_t n = std::min(chunkFrames, numFrames - i);
+        convert(buffer, src + i*numChannels, n*numChannels);
+        k.deinterleave(dst, i, buffer, numChannels, n);
+    }
+}
+
+template <typename T> static void interleaveConverted(T* dst, const sample_t* const* src, size_t numChannels, size_t numFrames)
+{
+    assert( numChannels <= kChunkSize );
+    if (numChannels == 0)
+        return;
+    const Kernels& k = kernels();
+    alignas(64) sample_t buffer[kChunkSize];
+    const size_t chunkFrames = kChunkSize / numChannels;
+    for (size_t i=0; i < numFrames; i += chunkFrames)
+    {
+        const size_t n = std::min(chunkFrames, numFrames - i);
+        k.interleave(buffer, src, i, numChannels, n);
+        convert(dst + i*numChannels, buffer, n*numChannels);
+    }
+}
+
+void Methcla::Audio::DSP::deinterleave(sample_t* const* dst, const int16_t* src, size_t numChannels, size_t numFrames)
+{
+    deinterleaveConverted(dst, src, numChannels, numFrames);
+}
+
+void Methcla::Audio::DSP::deinterleave(sample_t* const* dst, const Int24* src, size_t numChannels, size_t numFrames)
+{
+    deinterleaveConverted(dst, src, numChannels, numFrames);
+}
+
+void Methcla::Audio::DSP::deinterleave(sample_t* const* dst, const int32_t* src, size_t numChannels, size_t numFrames)
+{
+    deinterleaveConverted(dst, src, numChannels, numFrames);
+}
+
+void Methcla::Audio::DSP::interleave(int16_t* dst, const sample_t* const* src, size_t numChannels, size_t numFrames)
+{
+    interleaveConverted(dst, src, numChannels, numFrames);
+}
+
+void Methcla::Audio::DSP::interleave(Int24* dst, const sample_t* const* src, size_t numChannels, size_t numFrames)
+{
+    interleaveConverted(dst, src, numChannels, numFrames);
+}
+
+void Methcla::Audio::DSP::interleave(int32_t* dst, const sample_t* const* src, size_t numChannels, size_t numFrames)
+{
+    interleaveConverted(dst, src, numChannels, numFrames);
+}
@@ -1,22 +0,0 @@
-// Copyright 2012-2013 Samplecount S.L.
-//
-// Licensed under the Apache License, Version 2.0 (the "License");
-// you may not use this file except in compliance with the License.
-// You may obtain a copy of the License at
-//
-//     http://www.apache.org/licenses/LICENSE-2.0
-//
-// Unless required by applicable law or agreed to in writing, software
-// distributed under the License is distributed on an "AS IS" BASIS,
-// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
-// See the License for the specific language governing permissions and
-// limitations under the License.
-
-#ifndef METHCLA_AUDIO_DSP_H_INCLUDED
-#define METHCLA_AUDIO_DSP_H_INCLUDED
-
-#include <methcla/common.h>
-
-METHCLA_C_LINKAGE void accumulate(float* a, const float* b, int n);
-
-#endif // METHCLA_AUDIO_DSP_H_INCLUDED
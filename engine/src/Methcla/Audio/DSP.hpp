@@ -0,0 +1,168 @@
+// Copyright 2012-2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_AUDIO_DSP_HPP_INCLUDED
+#define METHCLA_AUDIO_DSP_HPP_INCLUDED
+
+#include "Methcla/Audio.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Methcla { namespace Audio { namespace DSP {
+
+//* Instruction sets with specialized kernel implementations.
+enum InstructionSet
+{
+    kGeneric,
+    kSSE2,
+    kAVX2,
+    kAVX512
+};
+
+//* Packed little endian 24 bit integer sample.
+struct Int24
+{
+    uint8_t bytes[3];
+};
+
+static_assert(sizeof(Int24) == 3, "Int24 must be packed");
+
+//* Kernel functions for a particular instruction set.
+//
+// Buffers don't need to be aligned and may not overlap, except where noted.
+//
+// Integer samples are scaled by 2^-(bits-1) when converting to floating
+// point; when converting from floating point, samples are clipped to the
+// range of the integer format.
+struct Kernels
+{
+    InstructionSet instructionSet;
+    //* dst[i] = 0
+    void (*zero)(sample_t* dst, size_t n);
+    //* dst[i] = src[i]
+    void (*copy)(sample_t* dst, const sample_t* src, size_t n);
+    //* dst[i] += src[i]
+    void (*accumulate)(sample_t* dst, const sample_t* src, size_t n);
+    //* dst[i] += gain * src[i]
+    void (*mix)(sample_t* dst, const sample_t* src, sample_t gain, size_t n);
+    //* dst[i] = srcs[0][i] + ... + srcs[numSrcs-1][i]
+    //
+    // `dst` may be one of the sources.
+    void (*sum)(sample_t* dst, const sample_t* const* srcs, size_t numSrcs, size_t n);
+    //* dst[c][offset+i] = src[i*numChannels+c]
+    void (*deinterleave)(sample_t* const* dst, size_t offset, const sample_t* src, size_t numChannels, size_t numFrames);
+    //* dst[i*numChannels+c] = src[c][offset+i]
+    void (*interleave)(sample_t* dst, const sample_t* const* src, size_t offset, size_t numChannels, size_t numFrames);
+    void (*fromInt16)(sample_t* dst, const int16_t* src, size_t n);
+    void (*toInt16)(int16_t* dst, const sample_t* src, size_t n);
+    void (*fromInt24)(sample_t* dst, const Int24* src, size_t n);
+    void (*toInt24)(Int24* dst, const sample_t* src, size_t n);
+    void (*fromInt32)(sample_t* dst, const int32_t* src, size_t n);
+    void (*toInt32)(int32_t* dst, const sample_t* src, size_t n);
+};
+
+//* Return the kernels for `instructionSet` or nullptr if the instruction set isn't supported by the CPU.
+const Kernels* kernels(InstructionSet instructionSet);
+
+//* Return the kernels for the best instruction set supported by the CPU.
+//
+// The kernels are selected on the first call and cached in a function-local
+// static; subsequent calls only pay for the initialization guard.
+const Kernels& kernels();
+
+inline void zero(sample_t* dst, size_t n)
+{
+    kernels().zero(dst, n);
+}
+
+inline void copy(sample_t* dst, const sample_t* src, size_t n)
+{
+    kernels().copy(dst, src, n);
+}
+
+inline void accumulate(sample_t* dst, const sample_t* src, size_t n)
+{
+    kernels().accumulate(dst, src, n);
+}
+
+inline void mix(sample_t* dst, const sample_t* src, sample_t gain, size_t n)
+{
+    kernels().mix(dst, src, gain, n);
+}
+
+inline void sum(sample_t* dst, const sample_t* const* srcs, size_t numSrcs, size_t n)
+{
+    kernels().sum(dst, srcs, numSrcs, n);
+}
+
+inline void convert(sample_t* dst, const int16_t* src, size_t n)
+{
+    kernels().fromInt16(dst, src, n);
+}
+
+inline void convert(int16_t* dst, const sample_t* src, size_t n)
+{
+    kernels().toInt16(dst, src, n);
+}
+
+inline void convert(sample_t* dst, const Int24* src, size_t n)
+{
+    kernels().fromInt24(dst, src, n);
+}
+
+inline void convert(Int24* dst, const sample_t* src, size_t n)
+{
+    kernels().toInt24(dst, src, n);
+}
+
+inline void convert(sample_t* dst, const int32_t* src, size_t n)
+{
+    kernels().fromInt32(dst, src, n);
+}
+
+inline void convert(int32_t* dst, const sample_t* src, size_t n)
+{
+    kernels().toInt32(dst, src, n);
+}
+
+//* Split interleaved samples into separate channel buffers.
+//
+// There are specialized kernels for one, two, four and eight channels.
+inline void deinterleave(sample_t* const* dst, const sample_t* src, size_t numChannels, size_t numFrames)
+{
+    kernels().deinterleave(dst, 0, src, numChannels, numFrames);
+}
+
+//* Convert and split interleaved integer samples into separate channel buffers.
+void deinterleave(sample_t* const* dst, const int16_t* src, size_t numChannels, size_t numFrames);
+void deinterleave(sample_t* const* dst, const Int24* src, size_t numChannels, size_t numFrames);
+void deinterleave(sample_t* const* dst, const int32_t* src, size_t numChannels, size_t numFrames);
+
+//* Interleave samples from separate channel buffers.
+//
+// There are specialized kernels for one, two, four and eight channels.
+inline void interleave(sample_t* dst, const sample_t* const* src, size_t numChannels, size_t numFrames)
+{
+    kernels().interleave(dst, src, 0, numChannels, numFrames);
+}
+
+//* Interleave and convert samples from separate channel buffers to integers.
+void interleave(int16_t* dst, const sample_t* const* src, size_t numChannels, size_t numFrames);
+void interleave(Int24* dst, const sample_t* const* src, size_t numChannels, size_t numFrames);
+void interleave(int32_t* dst, const sample_t* const* src, size_t numChannels, size_t numFrames);
+
+} } }
+
+#endif // METHCLA_AUDIO_DSP_HPP_INCLUDED
@@ -20,6 +20,8 @@
 #include "Methcla/Platform.hpp"
 
 #include <cassert>
+#include <new>
+#include <string>
 
 using namespace Methcla;
 using namespace Methcla::Audio;
@@ -48,6 +50,13 @@ static void methcla_api_host_register_synthdef(const Methcla_Host* host, const M
     static_cast<Environment*>(host->handle)->registerSynthDef(synthDef);
 }
 
+static void methcla_api_host_register_command(const Methcla_Host* host, const Methcla_CommandDef* command)
+{
+    assert(host && host->handle);
+    assert(command);
+    static_cast<Environment*>(host->handle)->registerCommand(command);
+}
+
 static void methcla_api_host_register_soundfile_api(const Methcla_Host* host, const Methcla_SoundFileAPI* api)
 {
     assert(host && host->handle && api);
@@ -182,6 +191,12 @@ static void methcla_api_world_synth_done(const Methcla_World*, Methcla_Synth* sy
     Synth::fromSynth(synth)->setDone();
 }
 
+static void methcla_api_world_synth_output_silent(const Methcla_World*, Methcla_Synth* synth)
+{
+    assert(synth != nullptr);
+    Synth::fromSynth(synth)->setOutputSilent();
+}
+
 static void methcla_api_host_perform_command(const Methcla_Host*, Methcla_WorldPerformFunction, void*);
 static void methcla_api_world_perform_command(const Methcla_World*, Methcla_HostPerformFunction, void*);
 
@@ -208,7 +223,8 @@ Environment::Environment(
         methcla_api_host_soundfile_open,
         methcla_api_host_perform_command,
         methcla_api_host_notify,
-        methcla_api_host_log_line
+        methcla_api_host_log_line,
+        methcla_api_host_register_command
     };
 
     // Initialize Methcla_World interface
@@ -222,7 +238,8 @@ Environment::Environment(
         methcla_api_world_free,
         methcla_api_world_perform_command,
         methcla_api_world_log_line,
-        methcla_api_world_synth_done
+        methcla_api_world_synth_done,
+        methcla_api_world_synth_output_silent
     };
 
     m_impl = new EnvironmentImpl(this, logHandler, packetHandler, options, messageQueue, worker);
@@ -266,6 +283,17 @@ AudioBus* Environment::audioBus(AudioBusId id)
     return m_impl->m_internalAudioBuses.at(id).get();
 }
 
+size_t Environment::numControlBuses() const
+{
+    return m_impl->m_numControlBuses;
+}
+
+sample_t* Environment::controlBus(ControlBusId id)
+{
+    assert( id < m_impl->m_numControlBuses );
+    return m_impl->m_controlBuses + id;
+}
+
 size_t Environment::numExternalAudioOutputs() const
 {
     return m_impl->m_externalAudioOutputs.size();
@@ -291,6 +319,38 @@ Memory::RTMemoryManager& Environment::rtMem()
     return m_impl->rtMem();
 }
 
+Memory::CommandPool& Environment::rtCommands()
+{
+    return m_impl->m_rtCommands;
+}
+
+Memory::CommandPool& Environment::nrtCommands()
+{
+    return m_impl->m_nrtCommands;
+}
+
+Utility::ThreadPool& Environment::threadPool()
+{
+    return *m_impl->m_threadPool;
+}
+
+size_t Environment::numScratchBuffers() const
+{
+    return m_impl->m_numScratchBuffers;
+}
+
+sample_t* Environment::scratchBuffers()
+{
+    const size_t thread = Utility::ThreadPool::currentThread();
+    assert( thread < m_impl->m_threadPool->numThreads() );
+    return m_impl->m_scratchBuffers + thread * m_impl->m_numScratchBuffers * blockSize();
+}
+
+const sample_t* Environment::zeroBuffer() const
+{
+    return m_impl->m_zeroBuffer;
+}
+
 Epoch Environment::epoch() const
 {
     return m_impl->m_epoch;
@@ -301,19 +361,39 @@ Methcla_Time Environment::currentTime() const
     return m_impl->currentTime();
 }
 
-void Environment::send(const void* packet, size_t size)
+void Environment::send(const void* packet, size_t size, double timeout)
 {
-    m_impl->m_requests->send(new Request(this, packet, size));
+    m_impl->send(new Request(m_impl, packet, size), timeout);
+}
+
+void Environment::send(void* buffer, size_t size, Methcla_PacketReleaseFunction release, void* data)
+{
+    m_impl->send(Request::construct(m_impl, buffer, size, release, data), 0.);
+}
+
+void Environment::send(const Methcla_Packet* packets, size_t count)
+{
+    m_impl->send(packets, count);
+}
+
+void Environment::collectReleasedRequests()
+{
+    m_impl->destroyReleasedRequests();
+}
+
+Methcla_EngineQueueStats Environment::queueStatistics() const
+{
+    return m_impl->queueStatistics();
 }
 
 bool Environment::hasPendingCommands() const
 {
-    return !m_impl->m_scheduler.isEmpty();
+    return !m_impl->m_scheduler.isEmpty() || m_impl->m_numStaged > 0;
 }
 
-void Environment::sendToWorker(PerformFunc f, void* data)
+void Environment::sendToWorker(PerformFunc f, void* data, Utility::WorkerLane lane)
 {
-    m_impl->sendToWorker(f, data);
+    m_impl->sendToWorker(f, data, lane);
 }
 
 void Environment::sendFromWorker(PerformFunc f, void* data)
@@ -347,6 +427,11 @@ void Environment::nodeEnded(NodeId nodeId)
     m_impl->nodeEnded(nodeId);
 }
 
+void Environment::nodeDone()
+{
+    m_impl->nodeDone();
+}
+
 void Environment::reply(Methcla_RequestId requestId, const void* packet, size_t size)
 {
     m_impl->reply(requestId, packet, size);
@@ -382,6 +467,21 @@ const Memory::shared_ptr<SynthDef>& Environment::synthDef(const char* uri) const
     return m_impl->synthDef(uri);
 }
 
+void Environment::registerCommand(const Methcla_CommandDef* command)
+{
+    m_impl->registerCommand(command);
+}
+
+bool Environment::isQuery(const char* address) const
+{
+    return m_impl->isQuery(address);
+}
+
+Methcla_RequestId Environment::newServerRequestId()
+{
+    return m_impl->newServerRequestId();
+}
+
 void Environment::registerSoundFileAPI(const Methcla_SoundFileAPI* api)
 {
     m_impl->m_soundFileAPIs.push_front(api);
@@ -402,13 +502,13 @@ static void perform_worldCommand(Environment* env, void* data)
 {
     CallbackData<Methcla_WorldPerformFunction>* self = (CallbackData<Methcla_WorldPerformFunction>*)data;
     self->func(*env, self->arg);
-    env->sendToWorker(perform_nrt_free, self);
+    env->nrtCommands().free(self);
 }
 
 static void methcla_api_host_perform_command(const Methcla_Host* host, Methcla_WorldPerformFunction perform, void* data)
 {
     Environment* env = static_cast<Environment*>(host->handle);
-    CallbackData<Methcla_WorldPerformFunction>* callbackData = Methcla::Memory::allocOf<CallbackData<Methcla_WorldPerformFunction>>();
+    CallbackData<Methcla_WorldPerformFunction>* callbackData = env->nrtCommands().allocOf<CallbackData<Methcla_WorldPerformFunction>>();
     callbackData->func = perform;
     callbackData->arg = data;
     env->sendFromWorker(perform_worldCommand, callbackData);
@@ -418,16 +518,34 @@ static void perform_hostCommand(Environment* env, void* data)
 {
     CallbackData<Methcla_HostPerformFunction>* self = (CallbackData<Methcla_HostPerformFunction>*)data;
     self->func(*env, self->arg);
-    env->sendFromWorker(perform_rt_free, self);
+    env->rtCommands().free(self);
 }
 
 static void methcla_api_world_perform_command(const Methcla_World* world, Methcla_HostPerformFunction perform, void* data)
 {
     Environment* env = static_cast<Environment*>(world->handle);
-    CallbackData<Methcla_HostPerformFunction>* callbackData = env->rtMem().allocOf<CallbackData<Methcla_HostPerformFunction>>();
+    CallbackData<Methcla_HostPerformFunction>* callbackData;
+    try
+    {
+        callbackData = env->rtCommands().allocOf<CallbackData<Methcla_HostPerformFunction>>();
+    }
+    catch (std::bad_alloc&)
+    {
+        env->logLineRT(kMethcla_LogError, "ERROR: Realtime command pool exhausted");
+        return;
+    }
     callbackData->func = perform;
     callbackData->arg = data;
-    env->sendToWorker(perform_hostCommand, callbackData);
+    try
+    {
+        // Plugin commands typically do file I/O
+        env->sendToWorker(perform_hostCommand, callbackData, Utility::kWorkerBulkLane);
+    }
+    catch (std::exception& e)
+    {
+        env->rtCommands().free(callbackData);
+        env->logLineRT(kMethcla_LogError, (std::string("ERROR: ") + e.what()).c_str());
+    }
 }
 
 #include <iostream>
@@ -25,6 +25,7 @@
 #include "Methcla/Audio/SynthDef.hpp"
 #include "Methcla/Memory/Manager.hpp"
 #include "Methcla/Utility/MessageQueueInterface.hpp"
+#include "Methcla/Utility/ThreadPool.hpp"
 #include "Methcla/Utility/WorkerInterface.hpp"
 
 #include <cstddef>
@@ -39,6 +40,8 @@ namespace Methcla { namespace Audio
 {
     class Environment;
 
+    BOOST_STRONG_TYPEDEF(uint32_t, ControlBusId);
+
     typedef void (*PerformFunc)(Environment* env, void* data);
 
     class Group;
@@ -70,7 +73,13 @@ namespace Methcla { namespace Audio
             size_t blockSize = 64;
             size_t numHardwareInputChannels = 2;
             size_t numHardwareOutputChannels = 2;
+            size_t numRealtimeThreads = 1;
+            size_t numScratchBuffers = 32;
+            // Blocks ahead of the current time beyond which bundles are staged by the worker
+            size_t schedulerHorizon = 16;
             std::list<Methcla_LibraryFunction> pluginLibraries;
+            // Path of a file incoming requests are recorded to, empty if disabled
+            std::string captureFile;
         };
 
         struct Command
@@ -127,14 +136,70 @@ namespace Methcla { namespace Audio
         //* Return audio bus with id (needed by Synth).
         AudioBus* audioBus(AudioBusId id);
 
+        //* Return number of control buses.
+        size_t numControlBuses() const;
+
+        //* Return control bus with id.
+        //
+        // A control bus holds a single value per block; synths read and
+        // write it directly through their mapped control ports.
+        sample_t* controlBus(ControlBusId id);
+
         Memory::RTMemoryManager& rtMem();
 
+        //* Pool for commands sent from the realtime threads to the worker.
+        Memory::CommandPool& rtCommands();
+
+        //* Pool for commands sent from non-realtime threads to the realtime thread.
+        Memory::CommandPool& nrtCommands();
+
+        //* Return the thread pool used for processing parallel groups.
+        Utility::ThreadPool& threadPool();
+
+        //* Return the number of block sized scratch buffers available to each realtime thread.
+        size_t numScratchBuffers() const;
+
+        //* Return the scratch buffers of the calling realtime thread.
+        //
+        // Scratch buffers are shared by all nodes processed by a thread and
+        // their contents are only valid while processing a single node.
+        //
+        // Context: RT
+        sample_t* scratchBuffers();
+
+        //* Return a block sized buffer of silence.
+        const sample_t* zeroBuffer() const;
+
         Epoch epoch() const;
 
         Methcla_Time currentTime() const;
 
         //* Send an OSC request to the engine.
-        void send(const void* packet, size_t size);
+        //
+        // Waits up to timeout seconds for space in the request queue and
+        // throws kMethcla_QueueFullError if the queue is still full.
+        void send(const void* packet, size_t size, double timeout=0.);
+
+        //* Send an OSC request to the engine, taking ownership of the buffer.
+        //
+        // The packet follows a header of kMethcla_PacketHeaderSize bytes
+        // that is used for storing the request.
+        void send(void* buffer, size_t size, Methcla_PacketReleaseFunction release, void* data);
+
+        //* Send an array of OSC requests to the engine in a single request.
+        void send(const Methcla_Packet* packets, size_t count);
+
+        //* Destroy requests released by the realtime thread.
+        //
+        // Buffers passed to send are returned to their owner. Released
+        // requests are also collected by the worker once per block and before
+        // each send.
+        //
+        // Context: NRT
+        void collectReleasedRequests();
+
+        //* Return the fill levels of the engine's queues.
+        Methcla_EngineQueueStats queueStatistics() const;
 
         //* Return true if there are any pending scheduled commands.
         bool hasPendingCommands() const;
@@ -145,6 +210,24 @@ namespace Methcla { namespace Audio
         //* Lookup SynthDef
         const Memory::shared_ptr<SynthDef>& synthDef(const char* uri) const;
 
+        //* Register plugin command.
+        void registerCommand(const Methcla_CommandDef* command);
+
+        //* Return true if address is a query.
+        //
+        // Queries take a request id as their first argument and are answered
+        // with a reply to that id.
+        bool isQuery(const char* address) const;
+
+        //* Return a new negative request id for a query forwarded by a server.
+        //
+        // Servers replace the request ids chosen by their clients with ids
+        // from this sequence, so that replies to different clients, and to
+        // in-process clients counting up from one, can't be mixed up.
+        //
+        // Context: NRT
+        Methcla_RequestId newServerRequestId();
+
         //* Sound file API registration
         void registerSoundFileAPI(const Methcla_SoundFileAPI* api);
 
@@ -153,8 +236,11 @@ namespace Methcla { namespace Audio
 
         //* Send a command from the realtime thread to the worker thread.
         //
+        // Long running commands should be sent to the bulk lane so that they
+        // don't delay replies and notifications.
+        //
         // Context: RT
-        void sendToWorker(PerformFunc f, void* data);
+        void sendToWorker(PerformFunc f, void* data, Utility::WorkerLane lane=Utility::kWorkerLatencyLane);
 
         //* Send a command from the worker thread to the realtime thread.
         //
@@ -196,6 +282,11 @@ namespace Methcla { namespace Audio
         // Context: RT
         void nodeEnded(NodeId nodeId);
 
+        //* A node has requested its done action.
+        //
+        // Context: RT
+        void nodeDone();
+
     private:
         EnvironmentImpl*    m_impl;
         const double        m_sampleRate;
@@ -13,8 +13,10 @@
 // limitations under the License.
 
 #include "Methcla/Audio/EngineImpl.hpp"
+#include "Methcla/Audio/DSP.hpp"
 #include "Methcla/Audio/Engine.hpp"
 #include "Methcla/Audio/Group.hpp"
+#include "Methcla/Audio/ParallelGroup.hpp"
 #include "Methcla/Audio/Synth.hpp"
 #include "Methcla/Exception.hpp"
 #include "Methcla/Memory.hpp"
@@ -25,13 +27,14 @@
 
 #include <methcla/log.hpp>
 
-METHCLA_WITHOUT_WARNINGS_BEGIN
-# include <boost/heap/priority_queue.hpp>
-METHCLA_WITHOUT_WARNINGS_END
-
 #include <oscpp/print.hpp>
 #include <oscpp/util.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <thread>
+
 using namespace Methcla;
 using namespace Methcla::Audio;
 using namespace Methcla::Memory;
@@ -188,14 +191,75 @@ static inline void addNodeToTarget(Node* target, Node* node, Methcla_NodePlaceme
     assert(node->parent() != nullptr);
 }
 
-void Methcla::Audio::perform_nrt_free(Environment*, void* data)
+static void decodeNodeNew(const EnvironmentImpl*, OSCPP::Server::ArgStream& args, Command& cmd)
+{
+    cmd.nodeNew.node = args.int32();
+    cmd.nodeNew.target = args.int32();
+    cmd.nodeNew.placement = args.int32();
+    cmd.nodeNew.synthDef = nullptr;
+}
+
+static void decodeSynthNew(const EnvironmentImpl* env, OSCPP::Server::ArgStream& args, Command& cmd)
+{
+    const char* defName = args.string();
+
+    cmd.nodeNew.node = args.int32();
+    cmd.nodeNew.target = args.int32();
+    cmd.nodeNew.placement = args.int32();
+    cmd.nodeNew.synthDef = env->synthDef(defName).get();
+
+    cmd.controls = args.atEnd() ? OSCPP::Server::ArgStream() : args.array();
+    // FIXME: Cannot be checked before the synth is instantiated.
+    // if (def->numControlInputs() != synthControls.size()) {
+    //     throw std::runtime_error("Missing synth control initialisers");
+    // }
+    cmd.options = args.atEnd() ? OSCPP::Server::ArgStream() : args.array();
+}
+
+static void decodeNode(const EnvironmentImpl*, OSCPP::Server::ArgStream& args, Command& cmd)
+{
+    cmd.node.node = args.int32();
+}
+
+static void decodeMap(const EnvironmentImpl*, OSCPP::Server::ArgStream& args, Command& cmd)
+{
+    cmd.map.node = args.int32();
+    cmd.map.index = args.int32();
+    cmd.map.bus = args.int32();
+    cmd.map.flags = args.int32();
+}
+
+static void decodeMapControl(const EnvironmentImpl*, OSCPP::Server::ArgStream& args, Command& cmd)
+{
+    cmd.map.node = args.int32();
+    cmd.map.index = args.int32();
+    cmd.map.bus = args.int32();
+    cmd.map.flags = 0;
+}
+
+static void decodeSetFlags(const EnvironmentImpl*, OSCPP::Server::ArgStream& args, Command& cmd)
+{
+    cmd.setFlags.node = args.int32();
+    cmd.setFlags.flags = args.int32();
+}
+
+static void decodeSetTailTime(const EnvironmentImpl*, OSCPP::Server::ArgStream& args, Command& cmd)
+{
+    cmd.setValue.node = args.int32();
+    cmd.setValue.index = 0;
+    cmd.setValue.value = args.float32();
+}
+
+static void decodeSetValue(const EnvironmentImpl*, OSCPP::Server::ArgStream& args, Command& cmd)
 {
-    Methcla::Memory::free(data);
+    cmd.setValue.node = args.int32();
+    cmd.setValue.index = args.int32();
+    cmd.setValue.value = args.float32();
 }
 
-void Methcla::Audio::perform_rt_free(Environment* env, void* data)
+static void decodeQuery(const EnvironmentImpl*, OSCPP::Server::ArgStream& args, Command& cmd)
 {
-    env->rtMem().free(data);
+    cmd.query.requestId = args.int32();
 }
 
 EnvironmentImpl::EnvironmentImpl(
@@ -210,23 +274,70 @@ EnvironmentImpl::EnvironmentImpl(
     , m_logHandler(logHandler)
     , m_packetHandler(listener)
     , m_rtMem(options.realtimeMemorySize)
+    , m_rtCommands(kQueueSize)
+    , m_nrtCommands(kQueueSize)
+    , m_freeNodeEndedBatches(kNumNodeEndedBatches)
+    , m_nodeEnded(nullptr)
     , m_requests(messageQueue == nullptr ? new Utility::MessageQueue<Request*>(kQueueSize) : messageQueue)
+    , m_releasedRequests(kQueueSize)
+    , m_collectingReleasedRequests(false)
     , m_worker(worker ? worker : new Utility::WorkerThread<Environment::Command>(kQueueSize, 2))
-    , m_scheduler(options.mode == Environment::kRealtimeMode ? kQueueSize : 0)
+    , m_threadPool(new Utility::ThreadPool(options.numRealtimeThreads))
+    , m_numScratchBuffers(options.numScratchBuffers)
+    , m_scratchBuffers(Memory::allocAlignedOf<sample_t>(
+        Memory::kSIMDAlignment,
+        m_threadPool->numThreads() * options.numScratchBuffers * options.blockSize))
+    , m_zeroBuffer(Memory::allocAlignedOf<sample_t>(Memory::kSIMDAlignment, options.blockSize))
+    , m_numControlBuses(options.maxNumControlBuses)
+    , m_controlBuses(Memory::allocAlignedOf<sample_t>(Memory::kSIMDAlignment, std::max((size_t)1, options.maxNumControlBuses)))
+    , m_scheduler(options.mode == Environment::kRealtimeMode ? kSchedulerSize : 0,
+                  (double)options.sampleRate / options.blockSize)
+    , m_schedulerHorizon(options.mode == Environment::kRealtimeMode
+                            ? (double)(options.schedulerHorizon * options.blockSize) / options.sampleRate
+                            : 0.)
+    , m_numStagedTotal(0)
+    , m_numStaged(0)
+    , m_releasingStaged(false)
+    , m_nextStagingRelease(0)
+    , m_releasedBundles(nullptr)
+    , m_schedulerSize(0)
+    , m_schedulerMaxSize(0)
     , m_epoch(0)
     , m_currentTime(0)
+    , m_captureSequence(0)
+    , m_captureEpoch(0)
+    , m_captureTime(0)
     , m_nodes(options.maxNumNodes, nullptr)
     , m_logFlags(kMethcla_EngineLogDefault)
+    , m_nextServerRequestId(-1)
+    , m_capture(options.captureFile.empty()
+                    ? nullptr
+                    : new Methcla::IO::RequestCaptureWriter(options.captureFile, options.sampleRate, options.blockSize))
 {
     assert( m_logFlags.is_lock_free() );
 
+    memset(m_zeroBuffer, 0, options.blockSize * sizeof(sample_t));
+    memset(m_controlBuses, 0, m_numControlBuses * sizeof(sample_t));
+
+    for (size_t i=0; i < kNumNodeEndedBatches; i++)
+    {
+        m_nodeEndedBatches.emplace_back(new NodeEndedBatch(options.maxNumNodes, &m_freeNodeEndedBatches));
+        if (i == 0)
+            m_nodeEnded = m_nodeEndedBatches.back().get();
+        else
+            m_freeNodeEndedBatches.push(m_nodeEndedBatches.back().get());
+    }
+
     const Epoch prevEpoch = m_epoch - 1;
 
+    // Running index over all buses
+    size_t busIndex = 0;
+
     m_externalAudioInputs.reserve(options.numHardwareInputChannels);
     for (size_t i=0; i < options.numHardwareInputChannels; i++)
     {
         m_externalAudioInputs.push_back(
-            Memory::make_shared<ExternalAudioBus>(prevEpoch)
+            Memory::make_shared<ExternalAudioBus>(busIndex++, prevEpoch)
         );
     }
 
@@ -234,21 +345,54 @@ EnvironmentImpl::EnvironmentImpl(
     for (size_t i=0; i < options.numHardwareOutputChannels; i++)
     {
         m_externalAudioOutputs.push_back(
-            Memory::make_shared<ExternalAudioBus>(prevEpoch)
+            Memory::make_shared<ExternalAudioBus>(busIndex++, prevEpoch)
         );
     }
 
     for (size_t i=0; i < options.maxNumAudioBuses; i++)
     {
         m_internalAudioBuses.push_back(
-            Memory::make_shared<InternalAudioBus>(options.blockSize, prevEpoch)
+            Memory::make_shared<InternalAudioBus>(busIndex++, options.blockSize, prevEpoch)
         );
     }
+
+    m_plan = std::unique_ptr<ExecutionPlan>(new ExecutionPlan(options.maxNumNodes, busIndex, m_numControlBuses, options.numScratchBuffers));
+
+    registerCommand("/group/new", kOpGroupNew, decodeNodeNew);
+    registerCommand("/pargroup/new", kOpParallelGroupNew, decodeNodeNew);
+    registerCommand("/group/freeAll", kOpGroupFreeAll, decodeNode);
+    registerCommand("/synth/new", kOpSynthNew, decodeSynthNew);
+    registerCommand("/synth/activate", kOpSynthActivate, decodeNode);
+    registerCommand("/synth/map/input", kOpSynthMapInput, decodeMap);
+    registerCommand("/synth/map/output", kOpSynthMapOutput, decodeMap);
+    registerCommand("/synth/map/control/input", kOpSynthMapControlInput, decodeMapControl);
+    registerCommand("/synth/map/control/output", kOpSynthMapControlOutput, decodeMapControl);
+    registerCommand("/synth/property/doneFlags/set", kOpSynthSetDoneFlags, decodeSetFlags);
+    registerCommand("/synth/property/tailTime/set", kOpSynthSetTailTime, decodeSetTailTime);
+    registerCommand("/node/free", kOpNodeFree, decodeNode);
+    registerCommand("/node/set", kOpNodeSet, decodeSetValue);
+    registerCommand("/node/tree/statistics", kOpNodeTreeStatistics, decodeQuery);
+    registerCommand("/engine/realtime-memory/statistics", kOpRealtimeMemoryStatistics, decodeQuery);
 }
 
 EnvironmentImpl::~EnvironmentImpl()
 {
     m_rootNode->free();
+    // Perform pending commands, e.g. for staging and releasing bundles, so
+    // that the requests they refer to are released below.
+    m_worker->drain();
+    m_scheduler.removeAll([](const ScheduledBundle& bundle) {
+        bundle.m_request->release();
+    });
+    for (auto& staged : m_stagedBundles)
+        staged.second.m_request->release();
+    m_worker->drain();
+    destroyReleasedRequests();
+    m_worker.reset();
+    delete m_releasedBundles;
+    Memory::free(m_controlBuses);
+    Memory::free(m_zeroBuffer);
+    Memory::free(m_scratchBuffers);
 }
 
 void EnvironmentImpl::init(const Environment::Options& options)
@@ -269,7 +413,12 @@ void EnvironmentImpl::process(Methcla_Time currentTime, size_t numFrames, const
     const Methcla_EngineLogFlags logFlags = (Methcla_EngineLogFlags)m_logFlags.load();
 
     // Process external requests
+    m_scheduler.advance(currentTime);
     processRequests(logFlags, currentTime);
+    updateSchedulerStatistics();
+    // Requests enqueued from now on are processed in the next block
+    if (m_capture)
+        publishCaptureTime(m_epoch + 1, currentTime + numFrames / m_owner->sampleRate());
     // Process scheduled requests
     processScheduler(logFlags, currentTime, currentTime + numFrames / m_owner->sampleRate());
     // std::cout << "Environment::process " << currentTime << std::endl;
@@ -277,6 +426,10 @@ void EnvironmentImpl::process(Methcla_Time currentTime, size_t numFrames, const
     // Process non-realtime commands
     m_worker->perform();
 
+    // Fetch staged bundles that fall within the scheduler horizon
+    releaseStaged(currentTime);
+    updateSchedulerStatistics();
+
     const size_t numExternalInputs = m_externalAudioInputs.size();
     const size_t numExternalOutputs = m_externalAudioOutputs.size();
 
@@ -293,20 +446,240 @@ void EnvironmentImpl::process(Methcla_Time currentTime, size_t numFrames, const
     }
 
     // Run DSP graph
-    m_rootNode->process(numFrames);
+    m_plan->process(m_rootNode, *m_threadPool, numFrames);
+
+    // Notify clients about nodes freed during this block
+    sendNodeEnded();
+
+    // Return buffers of processed requests even when nobody is sending
+    collectReleasedRequests();
 
     // Zero outputs that haven't been written to
     for (size_t i=0; i < numExternalOutputs; i++)
     {
         if (m_externalAudioOutputs[i]->epoch() != m_epoch)
         {
-            memset(outputs[i], 0, numFrames * sizeof(sample_t));
+            DSP::zero(outputs[i], numFrames);
         }
     }
 
     m_epoch++;
 }
 
+void EnvironmentImpl::publishCaptureTime(Epoch epoch, Methcla_Time time)
+{
+    // Single writer sequence lock: readers retry while the sequence number
+    // is odd or has changed while reading.
+    const uint32_t sequence = m_captureSequence.load(std::memory_order_relaxed);
+    m_captureSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_captureEpoch.store(epoch, std::memory_order_relaxed);
+    m_captureTime.store(time, std::memory_order_relaxed);
+    m_captureSequence.store(sequence + 2, std::memory_order_release);
+}
+
+void EnvironmentImpl::loadCaptureTime(Epoch& epoch, Methcla_Time& time) const
+{
+    for (;;)
+    {
+        const uint32_t sequence = m_captureSequence.load(std::memory_order_acquire);
+        if (sequence % 2 == 0)
+        {
+            epoch = m_captureEpoch.load(std::memory_order_relaxed);
+            time = m_captureTime.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_captureSequence.load(std::memory_order_relaxed) == sequence)
+                return;
+        }
+        std::this_thread::yield();
+    }
+}
+
+EnvironmentImpl::NodeEndedBatch::NodeEndedBatch(size_t capacity, Utility::LockFreeQueue<NodeEndedBatch*>* freeList)
+    : m_capacity(capacity)
+    , m_size(0)
+    , m_nodeIds(Memory::allocOf<NodeId>(std::max((size_t)1, capacity)))
+    , m_packetSize(OSCPP::Size::message("/node/ended", kMaxNodesPerMessage) + OSCPP::Size::int32(kMaxNodesPerMessage))
+    , m_packet(Memory::allocOf<char>(m_packetSize))
+    , m_freeList(freeList)
+{ }
+
+EnvironmentImpl::NodeEndedBatch::~NodeEndedBatch()
+{
+    Memory::free(m_packet);
+    Memory::free(m_nodeIds);
+}
+
+void EnvironmentImpl::NodeEndedBatch::perform(Environment* env)
+{
+    static const char* address = "/node/ended";
+    const size_t size = std::min(m_size.load(std::memory_order_relaxed), m_capacity);
+    for (size_t i=0; i < size; i += kMaxNodesPerMessage)
+    {
+        const size_t numNodes = std::min(size - i, kMaxNodesPerMessage);
+        OSCPP::Client::Packet packet(m_packet, m_packetSize);
+        packet.openMessage(address, numNodes);
+        for (size_t k=i; k < i + numNodes; k++)
+            packet.int32(m_nodeIds[k]);
+        packet.closeMessage();
+        env->notify(packet);
+    }
+    m_size.store(0, std::memory_order_relaxed);
+    m_freeList->push(this);
+}
+
+void EnvironmentImpl::sendNodeEnded()
+{
+    // Keep collecting into the current batch until the worker has returned one
+    NodeEndedBatch* next;
+    if (!m_nodeEnded->isEmpty() && m_freeNodeEndedBatches.pop(next))
+    {
+        sendToWorker(m_nodeEnded);
+        m_nodeEnded = next;
+    }
+}
+
+bool EnvironmentImpl::schedule(Methcla_Time time, const ScheduledBundle& bundle)
+{
+    class StageBundle
+    {
+    public:
+        StageBundle(EnvironmentImpl* impl, Methcla_Time time, uint64_t index, const EnvironmentImpl::ScheduledBundle& bundle)
+            : m_impl(impl)
+            , m_time(time)
+            , m_index(index)
+            , m_bundle(bundle)
+        { }
+
+        void perform(Environment* env)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_impl->m_stagedBundlesMutex);
+                m_impl->m_stagedBundles.insert(std::make_pair(std::make_pair(m_time, m_index), m_bundle));
+            }
+            env->rtCommands().free(this);
+        }
+
+    private:
+        EnvironmentImpl*                    m_impl;
+        Methcla_Time                        m_time;
+        uint64_t                            m_index;
+        EnvironmentImpl::ScheduledBundle    m_bundle;
+    };
+
+    if (m_schedulerHorizon > 0. && time >= m_currentTime + m_schedulerHorizon)
+    {
+        if (!sendToWorker<StageBundle>(this, time, m_numStagedTotal, bundle))
+            return false;
+        m_numStagedTotal++;
+        m_numStaged++;
+    }
+    else
+    {
+        m_scheduler.push(time, bundle);
+    }
+    return true;
+}
+
+void EnvironmentImpl::scheduleBundle(Request* request, size_t bundle)
+{
+    request->retain();
+    bool scheduled = false;
+    try
+    {
+        scheduled = schedule(request->command(bundle).bundle.time, ScheduledBundle(request, bundle));
+    }
+    catch (std::exception& e)
+    {
+        replyError(kMethcla_Notification, e.what());
+    }
+    if (!scheduled)
+        request->release();
+}
+
+void EnvironmentImpl::releaseStaged(Methcla_Time currentTime)
+{
+    class ReleaseStagedBundles
+    {
+    public:
+        ReleaseStagedBundles(EnvironmentImpl* impl, Methcla_Time endTime, EnvironmentImpl::ReleasedBundles* bundles)
+            : m_impl(impl)
+            , m_endTime(endTime)
+            , m_bundles(bundles)
+        { }
+
+        //* Context: NRT
+        void perform(Environment* env)
+        {
+            if (m_bundles == nullptr)
+                m_bundles = new EnvironmentImpl::ReleasedBundles;
+            else
+                m_bundles->clear();
+            {
+                std::lock_guard<std::mutex> lock(m_impl->m_stagedBundlesMutex);
+                EnvironmentImpl::StagedBundles& staged = m_impl->m_stagedBundles;
+                auto end = staged.lower_bound(std::make_pair(m_endTime, (uint64_t)0));
+                for (auto it = staged.begin(); it != end; it++)
+                    m_bundles->push_back(std::make_pair(it->first.first, it->second));
+                staged.erase(staged.begin(), end);
+            }
+            env->sendFromWorker(scheduleReleased, this);
+        }
+
+    private:
+        //* Context: RT
+        static void scheduleReleased(Environment* env, void* data)
+        {
+            ReleaseStagedBundles* self = static_cast<ReleaseStagedBundles*>(data);
+            EnvironmentImpl* impl = self->m_impl;
+            for (const auto& x : *self->m_bundles)
+            {
+                try
+                {
+                    impl->m_scheduler.push(x.first, x.second);
+                }
+                catch (std::exception& e)
+                {
+                    impl->replyError(kMethcla_Notification, e.what());
+                    x.second.m_request->release();
+                }
+            }
+            impl->m_numStaged -= self->m_bundles->size();
+            impl->m_releasingStaged = false;
+            try
+            {
+                env->sendToWorker(perform_delete<EnvironmentImpl::ReleasedBundles*>, self->m_bundles);
+            }
+            catch (std::exception& e)
+            {
+                // Passed to the worker with the next release
+                impl->m_releasedBundles = self->m_bundles;
+                impl->rt_log(kMethcla_LogError) << "ERROR: " << e.what();
+            }
+            env->rtCommands().free(self);
+        }
+
+        EnvironmentImpl*                    m_impl;
+        Methcla_Time                        m_endTime;
+        EnvironmentImpl::ReleasedBundles*   m_bundles;
+    };
+
+    // Only one release is in flight at a time, so that released bundles
+    // reach the realtime scheduler in order. Bundles up to twice the horizon
+    // ahead are released every half horizon, before bundles with the same
+    // time can be scheduled directly.
+    if (m_numStaged > 0 && !m_releasingStaged && currentTime >= m_nextStagingRelease)
+    {
+        // Retried in the next block on failure
+        if (sendToWorker<ReleaseStagedBundles>(this, currentTime + 2. * m_schedulerHorizon, m_releasedBundles))
+        {
+            m_releasedBundles = nullptr;
+            m_releasingStaged = true;
+            m_nextStagingRelease = currentTime + m_schedulerHorizon / 2.;
+        }
+    }
+}
+
 void EnvironmentImpl::processRequests(Methcla_EngineLogFlags logFlags, const Methcla_Time currentTime)
 {
     Request* request;
@@ -314,377 +687,708 @@ void EnvironmentImpl::processRequests(Methcla_EngineLogFlags logFlags, const Met
     {
         try
         {
-            OSCPP::Server::Packet packet(request->packet(), request->size());
-            if (packet.isBundle())
+            // Batched requests hold several top-level packets
+            size_t i = 0;
+            while (i < request->numCommands())
             {
-                OSCPP::Server::Bundle bundle(packet);
-                Methcla_Time bundleTime = methcla_time_from_uint64(bundle.time());
-                if (bundleTime == 0.)
+                const Command& cmd = request->command(i);
+                if (cmd.opcode == kOpBundle)
                 {
-                    processBundle(logFlags, request, bundle, currentTime, currentTime);
+                    if (cmd.bundle.time == 0.)
+                    {
+                        processBundle(logFlags, request, i, currentTime, currentTime);
+                    }
+                    else
+                    {
+                        scheduleBundle(request, i);
+                    }
+                    i += 1 + cmd.bundle.size;
                 }
                 else
                 {
-                    request->retain();
-                    m_scheduler.push(bundleTime, ScheduledBundle(request, bundle));
+                    processCommand(logFlags, cmd, currentTime, currentTime);
+                    i++;
                 }
             }
-            else
-            {
-                processMessage(logFlags, packet, currentTime, currentTime);
-            }
-            request->release();
-        }
-        catch (OSCPP::Error&)
-        {
-            replyError(kMethcla_Notification, "Couldn't parse request packet");
         }
         catch (std::exception& e)
         {
             replyError(kMethcla_Notification, e.what());
         }
+        request->release();
     }
 }
 
 void EnvironmentImpl::processScheduler(Methcla_EngineLogFlags logFlags, const Methcla_Time currentTime, const Methcla_Time nextTime)
 {
-    while (!m_scheduler.isEmpty())
+    while (m_scheduler.isDue(nextTime))
     {
         Methcla_Time scheduleTime = m_scheduler.time();
-        if (scheduleTime < nextTime)
-        {
 #if DEBUG
-            if (scheduleTime < currentTime)
-                rt_log() << "Late " << scheduleTime << " " << currentTime << " " << nextTime;
+        if (scheduleTime < currentTime)
+            rt_log() << "Late " << scheduleTime << " " << currentTime << " " << nextTime;
 #endif // DEBUG
-            ScheduledBundle bundle = m_scheduler.top();
-            assert( methcla_time_from_uint64(bundle.m_bundle.time()) == scheduleTime );
-            processBundle(logFlags, bundle.m_request, bundle.m_bundle, scheduleTime, currentTime);
-            m_scheduler.pop();
-            bundle.m_request->release();
-        }
-        else
-        {
-            break;
-        }
+        ScheduledBundle bundle = m_scheduler.top();
+        assert( bundle.m_request->command(bundle.m_command).bundle.time == scheduleTime );
+        // Remove before processing, the bundle may schedule nested bundles
+        m_scheduler.pop();
+        processBundle(logFlags, bundle.m_request, bundle.m_command, scheduleTime, currentTime);
+        bundle.m_request->release();
     }
 }
 
-void EnvironmentImpl::processBundle(Methcla_EngineLogFlags logFlags, Request* request, const OSCPP::Server::Bundle& bundle, const Methcla_Time scheduleTime, const Methcla_Time currentTime)
+void EnvironmentImpl::processBundle(Methcla_EngineLogFlags logFlags, Request* request, size_t bundle, const Methcla_Time scheduleTime, const Methcla_Time currentTime)
 {
-    auto packets = bundle.packets();
-    while (!packets.atEnd())
+    const size_t end = bundle + 1 + request->command(bundle).bundle.size;
+    size_t i = bundle + 1;
+    while (i < end)
     {
-        auto packet = packets.next();
-        if (packet.isBundle())
+        const Command& cmd = request->command(i);
+        if (cmd.opcode == kOpBundle)
         {
-            OSCPP::Server::Bundle innerBundle(packet);
-            Methcla_Time innerBundleTime = methcla_time_from_uint64(innerBundle.time());
-            if (innerBundleTime <= scheduleTime)
+            if (cmd.bundle.time <= scheduleTime)
             {
-                processBundle(logFlags, request, innerBundle, scheduleTime, currentTime);
+                processBundle(logFlags, request, i, scheduleTime, currentTime);
             }
             else
             {
-                request->retain();
-                m_scheduler.push(innerBundleTime, ScheduledBundle(request, innerBundle));
+                scheduleBundle(request, i);
             }
+            i += 1 + cmd.bundle.size;
         }
         else
         {
-            processMessage(logFlags, packet, scheduleTime, currentTime);
+            processCommand(logFlags, cmd, scheduleTime, currentTime);
+            i++;
         }
     }
 }
 
-void EnvironmentImpl::processMessage(Methcla_EngineLogFlags logFlags, const OSCPP::Server::Message& msg, Methcla_Time scheduleTime, Methcla_Time currentTime)
+void EnvironmentImpl::send(Request* request, double timeout)
 {
-    using namespace std::placeholders;
-
-    if (logFlags & kMethcla_EngineLogRequests)
-        rt_log() << "Request: " << msg;
-
-    auto args = msg.args();
-    // Methcla_RequestId requestId = args.int32();
-
+    destroyReleasedRequests();
     try
     {
-        if (msg == "/group/new")
-        {
-            NodeId nodeId = NodeId(args.int32());
-            checkNodeIdIsFree(m_nodes, nodeId);
-
-            NodeId targetId = NodeId(args.int32());
-            Methcla_NodePlacement nodePlacement = Methcla_NodePlacement(args.int32());
-
-            Node* target = lookupNode(m_nodes, "Target node", targetId);
+        compile(request);
+    }
+    catch (OSCPP::Error&)
+    {
+        Request::destroy(request);
+        replyError(kMethcla_Notification, "Couldn't parse request packet");
+        return;
+    }
+    if (m_capture)
+    {
+        // The request belongs to the realtime thread once it has been
+        // enqueued, record a copy of the packet.
+        CapturedPackets captured;
+        const char* packet = static_cast<const char*>(request->packet());
+        captured.data.assign(packet, packet + request->size());
+        captured.sizes.push_back(request->size());
+        enqueue(request, timeout, &captured);
+    }
+    else
+    {
+        enqueue(request, timeout, nullptr);
+    }
+}
 
-            Group* group = Group::construct(*m_owner, nodeId);
-            addNode(m_nodes, group);
-            addNodeToTarget(target, group, nodePlacement);
+void EnvironmentImpl::send(const Methcla_Packet* packets, size_t count)
+{
+    destroyReleasedRequests();
+    Request* request = Request::batch(this, packets, count);
+    std::vector<Command>& commands = request->commands();
+    commands.reserve(count);
+    // Packets that were translated successfully, recorded when enqueuing
+    CapturedPackets captured;
+    const char* packet = static_cast<const char*>(request->packet());
+    for (size_t i=0; i < count; i++)
+    {
+        const size_t numCommands = commands.size();
+        try
+        {
+            compilePacket(OSCPP::Server::Packet(packet, packets[i].size), commands);
+            if (m_capture)
+            {
+                captured.data.insert(captured.data.end(), packet, packet + packets[i].size);
+                captured.sizes.push_back(packets[i].size);
+            }
         }
-        else if (msg == "/group/freeAll")
+        catch (OSCPP::Error&)
         {
-            NodeId nodeId = NodeId(args.int32());
-            Group* group = lookupNodeAs<Group>(m_nodes, "Group", nodeId);
-            group->freeAll();
+            // Drop commands from a partially translated bundle
+            commands.erase(commands.begin() + numCommands, commands.end());
+            replyError(kMethcla_Notification, "Couldn't parse request packet");
         }
-        else if (msg == "/synth/new")
+        packet += packets[i].size;
+    }
+    enqueue(request, 0., m_capture ? &captured : nullptr);
+}
+
+bool EnvironmentImpl::trySend(Request* request, const CapturedPackets* captured)
+{
+    if (captured == nullptr)
+        return m_requests->trySend(request);
+
+    // Record packets in the order of the request queue, with the block that
+    // was due to process them when they were enqueued.
+    std::lock_guard<std::mutex> lock(m_captureMutex);
+    Epoch epoch;
+    Methcla_Time time;
+    loadCaptureTime(epoch, time);
+    if (!m_requests->trySend(request))
+        return false;
+    const char* packet = captured->data.data();
+    for (size_t size : captured->sizes)
+    {
+        m_capture->write(time, epoch, packet, size);
+        packet += size;
+    }
+    return true;
+}
+
+void EnvironmentImpl::enqueue(Request* request, double timeout, const CapturedPackets* captured)
+{
+    bool sent = trySend(request, captured);
+    if (!sent && timeout > 0.)
+    {
+        // Poll a few times per audio block until the realtime thread has
+        // made room or the timeout expires.
+        const auto deadline = std::chrono::steady_clock::now()
+                            + std::chrono::duration<double>(timeout);
+        const auto interval = std::chrono::duration<double>(
+            std::min(timeout, (double)m_owner->blockSize() / m_owner->sampleRate() / 4.));
+        do
         {
-            const char* defName = args.string();
+            std::this_thread::sleep_for(interval);
+            sent = trySend(request, captured);
+        } while (!sent && std::chrono::steady_clock::now() < deadline);
+    }
+    if (!sent)
+    {
+        Request::destroy(request);
+        throw Error(kMethcla_QueueFullError, "Request queue full");
+    }
+}
 
-            NodeId nodeId = NodeId(args.int32());
-            checkNodeIdIsFree(m_nodes, nodeId);
+static Methcla_QueueStats queueStats(const Utility::QueueStatistics& stats)
+{
+    Methcla_QueueStats result;
+    result.size = stats.size;
+    result.max_size = stats.maxSize;
+    result.capacity = stats.capacity;
+    return result;
+}
 
-            NodeId targetId = NodeId(args.int32());
-            Methcla_NodePlacement nodePlacement = Methcla_NodePlacement(args.int32());
+Methcla_EngineQueueStats EnvironmentImpl::queueStatistics() const
+{
+    Methcla_EngineQueueStats result;
+    result.requests = queueStats(m_requests->statistics());
+    result.to_worker = queueStats(m_worker->toWorkerStatistics(Utility::kWorkerLatencyLane));
+    result.to_worker_bulk = queueStats(m_worker->toWorkerStatistics(Utility::kWorkerBulkLane));
+    result.from_worker = queueStats(m_worker->fromWorkerStatistics());
+    result.scheduler.size = m_schedulerSize.load(std::memory_order_relaxed);
+    result.scheduler.max_size = m_schedulerMaxSize.load(std::memory_order_relaxed);
+    result.scheduler.capacity = m_scheduler.maxSize();
+    return result;
+}
 
-            const shared_ptr<SynthDef> def = m_owner->synthDef(defName);
+void EnvironmentImpl::updateSchedulerStatistics()
+{
+    const size_t size = m_scheduler.size();
+    m_schedulerSize.store(size, std::memory_order_relaxed);
+    if (size > m_schedulerMaxSize.load(std::memory_order_relaxed))
+        m_schedulerMaxSize.store(size, std::memory_order_relaxed);
+}
 
-            auto synthControls = args.atEnd() ? OSCPP::Server::ArgStream() : args.array();
-            // FIXME: Cannot be checked before the synth is instantiated.
-            // if (def->numControlInputs() != synthControls.size()) {
-            //     throw std::runtime_error("Missing synth control initialisers");
-            // }
-            auto synthArgs = args.atEnd() ? OSCPP::Server::ArgStream() : args.array();
+void Request::release()
+{
+    m_refs--;
+    if (m_refs == 0)
+        m_env->releaseRequest(this);
+}
 
-            Node* target = lookupNode(m_nodes, "Target node", targetId);
+void EnvironmentImpl::releaseRequest(Request* request)
+{
+    // Fall back to the worker when senders haven't caught up
+    if (!m_releasedRequests.push(request))
+        sendToWorker(Request::perform_destroy, request);
+}
 
-            try
-            {
-                Synth* synth = Synth::construct(
-                    *m_owner,
-                    nodeId,
-                    *def,
-                    synthControls,
-                    synthArgs);
-
-                addNode(m_nodes, synth);
-                addNodeToTarget(target, synth, nodePlacement);
-            }
-            catch (OSCPP::UnderrunError&)
-            {
-                throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
-                    s << "Missing control initializer for synth " << nodeId;
-                });
-            }
-            catch (OSCPP::ParseError&)
-            {
-                throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
-                    s << "Invalid control initializer for synth " << nodeId;
-                });
-            }
+void EnvironmentImpl::destroyReleasedRequests()
+{
+    Request* request;
+    while (m_releasedRequests.pop(request))
+        Request::destroy(request);
+}
+
+void EnvironmentImpl::collectReleasedRequests()
+{
+    struct CollectReleasedRequests
+    {
+        static void perform(Environment*, void* data)
+        {
+            EnvironmentImpl* self = static_cast<EnvironmentImpl*>(data);
+            // Requests released from now on are collected by the next command
+            self->m_collectingReleasedRequests.store(false, std::memory_order_relaxed);
+            self->destroyReleasedRequests();
         }
-        else if (msg == "/synth/activate")
+    };
+
+    if (m_releasedRequests.size() > 0
+        && !m_collectingReleasedRequests.exchange(true, std::memory_order_relaxed))
+    {
+        try
         {
-            NodeId nodeId = NodeId(args.int32());
-            Synth* synth = lookupNodeAs<Synth>(m_nodes, "Synth", nodeId);
-            // TODO: Use sample rate estimate from driver
-            const double sampleOffset = std::max(0., (scheduleTime - currentTime) * m_owner->sampleRate());
-            synth->activate(sampleOffset);
+            sendToWorker(CollectReleasedRequests::perform, this);
         }
-        else if (msg == "/synth/map/input")
+        catch (std::exception& e)
         {
-            NodeId nodeId = NodeId(args.int32());
-            int32_t index = args.int32();
-            int32_t busId = AudioBusId(args.int32());
-            Methcla_BusMappingFlags flags = Methcla_BusMappingFlags(args.int32());
-
-            if (busId < 0 || ((flags & kMethcla_BusMappingExternal) && (size_t)busId > m_externalAudioInputs.size())
-                          || ((size_t)busId > m_internalAudioBuses.size()))
-            {
-                throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
-                    s << "Audio bus id " << busId << " out of range";
-                });
-            }
-
-            Synth* synth = lookupNodeAs<Synth>(m_nodes, "Synth", nodeId);
+            // Retried in the next block
+            m_collectingReleasedRequests.store(false, std::memory_order_relaxed);
+            rt_log(kMethcla_LogError) << "ERROR: " << e.what();
+        }
+    }
+}
 
-            if ((index < 0) || (index >= (int32_t)synth->numAudioInputs()))
-            {
-                throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
-                    s << "Audio input index " << index << " out of range for synth " << nodeId;
-                });
-            }
+void EnvironmentImpl::compile(Request* request)
+{
+    OSCPP::Server::Packet packet(request->packet(), request->size());
+    compilePacket(packet, request->commands());
+}
 
-            synth->mapInput(index, AudioBusId(busId), flags);
+void EnvironmentImpl::compilePacket(const OSCPP::Server::Packet& packet, std::vector<Command>& commands)
+{
+    if (packet.isBundle())
+    {
+        OSCPP::Server::Bundle bundle(packet);
+        const size_t index = commands.size();
+        Command cmd;
+        cmd.opcode = kOpBundle;
+        cmd.bundle.time = methcla_time_from_uint64(bundle.time());
+        cmd.bundle.size = 0;
+        cmd.message = packet;
+        commands.push_back(cmd);
+        auto packets = bundle.packets();
+        while (!packets.atEnd())
+        {
+            compilePacket(packets.next(), commands);
         }
-        else if (msg == "/synth/map/output")
+        commands[index].bundle.size = commands.size() - index - 1;
+    }
+    else
+    {
+        OSCPP::Server::Message msg(packet);
+        try
         {
-            NodeId nodeId = NodeId(args.int32());
-            int32_t index = args.int32();
-            int32_t busId = args.int32();
-            Methcla_BusMappingFlags flags = Methcla_BusMappingFlags(args.int32());
+            Command cmd;
+            cmd.message = packet;
+            if (decodeMessage(msg, cmd))
+                commands.push_back(cmd);
+        }
+        catch (std::exception& e)
+        {
+            std::stringstream s;
+            s << msg.address() << ": " << e.what();
+            replyError(kMethcla_Notification, s.str().c_str());
+        }
+    }
+}
 
-            if (busId < 0 || ((flags & kMethcla_BusMappingExternal) && (size_t)busId > m_externalAudioOutputs.size())
-                          || ((size_t)busId > m_internalAudioBuses.size()))
-            {
-                throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
-                    s << "Audio bus id " << busId << " out of range";
-                });
-            }
+bool EnvironmentImpl::decodeMessage(const OSCPP::Server::Message& msg, Command& cmd) const
+{
+    auto it = m_commands.find(msg.address());
+    if (it == m_commands.end())
+        return false;
 
-            Synth* synth = lookupNodeAs<Synth>(m_nodes, "Synth", nodeId);
+    const CommandHandler& handler = it->second;
+    auto args = msg.args();
 
-            if ((index < 0) || (index >= (int32_t)synth->numAudioOutputs()))
-            {
-                throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
-                    s << "Audio output index " << index << " out of range for synth " << nodeId;
-                });
-            }
+    cmd.opcode = handler.opcode;
+    if (handler.def != nullptr)
+    {
+        cmd.plugin.def = handler.def;
+        cmd.args = args;
+    }
+    else
+    {
+        handler.decode(this, args, cmd);
+    }
 
-            synth->mapOutput(index, AudioBusId(busId), flags);
-        }
-        else if (msg == "/synth/property/doneFlags/set")
-        {
-            NodeId nodeId = NodeId(args.int32());
-            Methcla_NodeDoneFlags flags = Methcla_NodeDoneFlags(args.int32());
-            Synth* synth = lookupNodeAs<Synth>(m_nodes, "Synth", nodeId);
-            synth->setDoneFlags(flags);
-        }
-        else if (msg == "/node/free")
-        {
-            NodeId nodeId = NodeId(args.int32());
-            Node* node = lookupNode(m_nodes, "Node", nodeId);
+    return true;
+}
 
-            if (node == m_rootNode)
-            {
-                throwErrorWith(kMethcla_NodeIdError, [&](std::stringstream& s) {
-                    s << "Cannot free root node " << nodeId;
-                });
-            }
+void EnvironmentImpl::processCommand(Methcla_EngineLogFlags logFlags, const Command& cmd, Methcla_Time scheduleTime, Methcla_Time currentTime)
+{
+    if (logFlags & kMethcla_EngineLogRequests)
+        rt_log() << "Request: " << OSCPP::Server::Message(cmd.message);
 
-            node->free();
-        }
-        else if (msg == "/node/set")
+    try
+    {
+        switch (cmd.opcode)
         {
-            NodeId nodeId = NodeId(args.int32());
-            int32_t index = args.int32();
-            float value = args.float32();
+            case kOpBundle:
+                // Bundles are unpacked by processBundle
+                assert(false);
+                break;
+            case kOpGroupNew:
+            case kOpParallelGroupNew:
+                {
+                    NodeId nodeId = NodeId(cmd.nodeNew.node);
+                    checkNodeIdIsFree(m_nodes, nodeId);
 
-            Synth* synth = lookupNodeAs<Synth>(m_nodes, "Synth", nodeId);
+                    NodeId targetId = NodeId(cmd.nodeNew.target);
+                    Methcla_NodePlacement nodePlacement = Methcla_NodePlacement(cmd.nodeNew.placement);
 
-            if ((index < 0) || (index >= (int32_t)synth->numControlInputs()))
-            {
-                throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
-                    s << "Control input index " << index << " out of range for synth " << nodeId;
-                });
-            }
+                    Node* target = lookupNode(m_nodes, "Target node", targetId);
 
-            synth->controlInput(index) = value;
-        }
-        else if (msg == "/node/tree/statistics")
-        {
-            class CommandNodeTreeStatistics
-            {
-            public:
-                struct Statistics
+                    Group* group = cmd.opcode == kOpGroupNew
+                                    ? Group::construct(*m_owner, nodeId)
+                                    : ParallelGroup::construct(*m_owner, nodeId);
+                    addNode(m_nodes, group);
+                    addNodeToTarget(target, group, nodePlacement);
+                }
+                break;
+            case kOpGroupFreeAll:
                 {
-                    Statistics()
-                        : numGroups(0)
-                        , numSynths(0)
-                    { }
+                    NodeId nodeId = NodeId(cmd.node.node);
+                    Group* group = lookupNodeAs<Group>(m_nodes, "Group", nodeId);
+                    group->freeAll();
+                }
+                break;
+            case kOpSynthNew:
+                {
+                    NodeId nodeId = NodeId(cmd.nodeNew.node);
+                    checkNodeIdIsFree(m_nodes, nodeId);
+
+                    NodeId targetId = NodeId(cmd.nodeNew.target);
+                    Methcla_NodePlacement nodePlacement = Methcla_NodePlacement(cmd.nodeNew.placement);
 
-                    size_t numGroups = 0;
-                    size_t numSynths = 0;
-                };
+                    Node* target = lookupNode(m_nodes, "Target node", targetId);
 
-                static Statistics collectStatistics(const Group* group, Statistics stats=Statistics())
+                    try
+                    {
+                        Synth* synth = Synth::construct(
+                            *m_owner,
+                            nodeId,
+                            *cmd.nodeNew.synthDef,
+                            cmd.controls,
+                            cmd.options);
+
+                        addNode(m_nodes, synth);
+                        addNodeToTarget(target, synth, nodePlacement);
+                    }
+                    catch (OSCPP::UnderrunError&)
+                    {
+                        throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
+                            s << "Missing control initializer for synth " << nodeId;
+                        });
+                    }
+                    catch (OSCPP::ParseError&)
+                    {
+                        throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
+                            s << "Invalid control initializer for synth " << nodeId;
+                        });
+                    }
+                }
+                break;
+            case kOpSynthActivate:
                 {
-                    stats.numGroups++;
+                    NodeId nodeId = NodeId(cmd.node.node);
+                    Synth* synth = lookupNodeAs<Synth>(m_nodes, "Synth", nodeId);
+                    // TODO: Use sample rate estimate from driver
+                    const double sampleOffset = std::max(0., (scheduleTime - currentTime) * m_owner->sampleRate());
+                    synth->activate(sampleOffset);
+                }
+                break;
+            case kOpSynthMapInput:
+                {
+                    NodeId nodeId = NodeId(cmd.map.node);
+                    int32_t index = cmd.map.index;
+                    int32_t busId = cmd.map.bus;
+                    Methcla_BusMappingFlags flags = Methcla_BusMappingFlags(cmd.map.flags);
+
+                    if (busId < 0 || ((flags & kMethcla_BusMappingExternal) && (size_t)busId > m_externalAudioInputs.size())
+                                  || ((size_t)busId > m_internalAudioBuses.size()))
+                    {
+                        throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
+                            s << "Audio bus id " << busId << " out of range";
+                        });
+                    }
 
-                    const Node* cur = group->first();
+                    Synth* synth = lookupNodeAs<Synth>(m_nodes, "Synth", nodeId);
 
-                    while (cur != nullptr)
+                    if ((index < 0) || (index >= (int32_t)synth->numAudioInputs()))
                     {
-                        const Group* subGroup = dynamic_cast<const Group*>(cur);
-                        if (subGroup == nullptr)
-                        {
-                            stats.numSynths++;
-                        }
-                        else
-                        {
-                            stats = collectStatistics(subGroup, stats);
-                        }
-                        cur = cur->next();
+                        throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
+                            s << "Audio input index " << index << " out of range for synth " << nodeId;
+                        });
                     }
 
-                    return stats;
+                    synth->mapInput(index, AudioBusId(busId), flags);
                 }
+                break;
+            case kOpSynthMapOutput:
+                {
+                    NodeId nodeId = NodeId(cmd.map.node);
+                    int32_t index = cmd.map.index;
+                    int32_t busId = cmd.map.bus;
+                    Methcla_BusMappingFlags flags = Methcla_BusMappingFlags(cmd.map.flags);
+
+                    if (busId < 0 || ((flags & kMethcla_BusMappingExternal) && (size_t)busId > m_externalAudioOutputs.size())
+                                  || ((size_t)busId > m_internalAudioBuses.size()))
+                    {
+                        throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
+                            s << "Audio bus id " << busId << " out of range";
+                        });
+                    }
+
+                    Synth* synth = lookupNodeAs<Synth>(m_nodes, "Synth", nodeId);
+
+                    if ((index < 0) || (index >= (int32_t)synth->numAudioOutputs()))
+                    {
+                        throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
+                            s << "Audio output index " << index << " out of range for synth " << nodeId;
+                        });
+                    }
 
-                CommandNodeTreeStatistics(Methcla_RequestId requestId, Statistics stats)
-                    : m_requestId(requestId)
-                    , m_stats(stats)
+                    synth->mapOutput(index, AudioBusId(busId), flags);
+                }
+                break;
+            case kOpSynthMapControlInput:
                 {
+                    NodeId nodeId = NodeId(cmd.map.node);
+                    int32_t index = cmd.map.index;
+                    int32_t busId = cmd.map.bus;
+
+                    if (busId < -1 || busId >= (int32_t)m_numControlBuses)
+                    {
+                        throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
+                            s << "Control bus id " << busId << " out of range";
+                        });
+                    }
+
+                    Synth* synth = lookupNodeAs<Synth>(m_nodes, "Synth", nodeId);
+
+                    if ((index < 0) || (index >= (int32_t)synth->numControlInputs()))
+                    {
+                        throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
+                            s << "Control input index " << index << " out of range for synth " << nodeId;
+                        });
+                    }
+
+                    if (busId < 0)
+                        synth->unmapControlInput(index);
+                    else
+                        synth->mapControlInput(index, ControlBusId(busId));
                 }
+                break;
+            case kOpSynthMapControlOutput:
+                {
+                    NodeId nodeId = NodeId(cmd.map.node);
+                    int32_t index = cmd.map.index;
+                    int32_t busId = cmd.map.bus;
 
-                void perform(Environment* env)
+                    if (busId < -1 || busId >= (int32_t)m_numControlBuses)
+                    {
+                        throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
+                            s << "Control bus id " << busId << " out of range";
+                        });
+                    }
+
+                    Synth* synth = lookupNodeAs<Synth>(m_nodes, "Synth", nodeId);
+
+                    if ((index < 0) || (index >= (int32_t)synth->numControlOutputs()))
+                    {
+                        throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
+                            s << "Control output index " << index << " out of range for synth " << nodeId;
+                        });
+                    }
+
+                    if (busId < 0)
+                        synth->unmapControlOutput(index);
+                    else
+                        synth->mapControlOutput(index, ControlBusId(busId));
+                }
+                break;
+            case kOpSynthSetDoneFlags:
                 {
-                    static const char* address = "/node/tree/statistics";
-                    OSCPP::Client::DynamicPacket packet(
-                        OSCPP::Size::message(address, 2)
-                      + OSCPP::Size::int32(2)
-                    );
-                    packet.openMessage(address, 2);
-                    packet.int32(m_stats.numGroups);
-                    packet.int32(m_stats.numSynths);
-                    packet.closeMessage();
-                    env->reply(m_requestId, packet);
-                    env->sendFromWorker(perform_rt_free, this);
+                    NodeId nodeId = NodeId(cmd.setFlags.node);
+                    Methcla_NodeDoneFlags flags = Methcla_NodeDoneFlags(cmd.setFlags.flags);
+                    Synth* synth = lookupNodeAs<Synth>(m_nodes, "Synth", nodeId);
+                    synth->setDoneFlags(flags);
+                    // Done flags affect the liveness of the synth in the execution plan
+                    if (synth->parent() != nullptr)
+                        synth->parent()->topologyChanged();
+                }
+                break;
+            case kOpSynthSetTailTime:
+                {
+                    NodeId nodeId = NodeId(cmd.setValue.node);
+                    float tailTime = cmd.setValue.value;
+                    Synth* synth = lookupNodeAs<Synth>(m_nodes, "Synth", nodeId);
+                    synth->setTailTime(tailTime);
                 }
+                break;
+            case kOpNodeFree:
+                {
+                    NodeId nodeId = NodeId(cmd.node.node);
+                    Node* node = lookupNode(m_nodes, "Node", nodeId);
 
-            private:
-                Methcla_RequestId m_requestId;
-                Statistics        m_stats;
-            };
+                    if (node == m_rootNode)
+                    {
+                        throwErrorWith(kMethcla_NodeIdError, [&](std::stringstream& s) {
+                            s << "Cannot free root node " << nodeId;
+                        });
+                    }
 
-            Methcla_RequestId requestId = args.int32();
+                    node->free();
+                }
+                break;
+            case kOpNodeSet:
+                {
+                    NodeId nodeId = NodeId(cmd.setValue.node);
+                    int32_t index = cmd.setValue.index;
+                    float value = cmd.setValue.value;
 
-            CommandNodeTreeStatistics::Statistics stats =
-                CommandNodeTreeStatistics::collectStatistics(rootNode());
+                    Synth* synth = lookupNodeAs<Synth>(m_nodes, "Synth", nodeId);
 
-            sendToWorker<CommandNodeTreeStatistics>(requestId, stats);
-        }
-        else if (msg == "/engine/realtime-memory/statistics")
-        {
-            class CommandRealtimeMemoryStatistics
-            {
-            public:
-                CommandRealtimeMemoryStatistics(Methcla_RequestId requestId, const RTMemoryManager::Statistics& stats)
-                    : m_requestId(requestId)
-                    , m_stats(stats)
+                    if ((index < 0) || (index >= (int32_t)synth->numControlInputs()))
+                    {
+                        throwErrorWith(kMethcla_ArgumentError, [&](std::stringstream& s) {
+                            s << "Control input index " << index << " out of range for synth " << nodeId;
+                        });
+                    }
+
+                    synth->controlInput(index) = value;
+                }
+                break;
+            case kOpNodeTreeStatistics:
                 {
+                    class CommandNodeTreeStatistics
+                    {
+                    public:
+                        struct Statistics
+                        {
+                            Statistics()
+                                : numGroups(0)
+                                , numSynths(0)
+                            { }
+
+                            size_t numGroups = 0;
+                            size_t numSynths = 0;
+                        };
+
+                        static Statistics collectStatistics(const Group* group, Statistics stats=Statistics())
+                        {
+                            stats.numGroups++;
+
+                            const Node* cur = group->first();
+
+                            while (cur != nullptr)
+                            {
+                                const Group* subGroup = dynamic_cast<const Group*>(cur);
+                                if (subGroup == nullptr)
+                                {
+                                    stats.numSynths++;
+                                }
+                                else
+                                {
+                                    stats = collectStatistics(subGroup, stats);
+                                }
+                                cur = cur->next();
+                            }
+
+                            return stats;
+                        }
+
+                        CommandNodeTreeStatistics(Methcla_RequestId requestId, Statistics stats)
+                            : m_requestId(requestId)
+                            , m_stats(stats)
+                        {
+                        }
+
+                        void perform(Environment* env)
+                        {
+                            static const char* address = "/node/tree/statistics";
+                            OSCPP::Client::DynamicPacket packet(
+                                OSCPP::Size::message(address, 2)
+                              + OSCPP::Size::int32(2)
+                            );
+                            packet.openMessage(address, 2);
+                            packet.int32(m_stats.numGroups);
+                            packet.int32(m_stats.numSynths);
+                            packet.closeMessage();
+                            env->reply(m_requestId, packet);
+                            env->rtCommands().free(this);
+                        }
+
+                    private:
+                        Methcla_RequestId m_requestId;
+                        Statistics        m_stats;
+                    };
+
+                    Methcla_RequestId requestId = cmd.query.requestId;
+
+                    CommandNodeTreeStatistics::Statistics stats =
+                        CommandNodeTreeStatistics::collectStatistics(rootNode());
+
+                    sendToWorker<CommandNodeTreeStatistics>(requestId, stats);
                 }
+                break;
+            case kOpRealtimeMemoryStatistics:
+                {
+                    class CommandRealtimeMemoryStatistics
+                    {
+                    public:
+                        CommandRealtimeMemoryStatistics(Methcla_RequestId requestId, const RTMemoryManager::Statistics& stats)
+                            : m_requestId(requestId)
+                            , m_stats(stats)
+                        {
+                        }
 
-                void perform(Environment* env)
+                        void perform(Environment* env)
+                        {
+                            static const char* address = "/engine/realtime-memory/statistics";
+                            OSCPP::Client::DynamicPacket packet(
+                                OSCPP::Size::message(address, 2)
+                              + OSCPP::Size::int32(2)
+                            );
+                            packet.openMessage(address, 2);
+                            packet.int32(m_stats.freeNumBytes);
+                            packet.int32(m_stats.usedNumBytes);
+                            packet.closeMessage();
+                            env->reply(m_requestId, packet);
+                            env->rtCommands().free(this);
+                        }
+
+                    private:
+                        Methcla_RequestId           m_requestId;
+                        RTMemoryManager::Statistics m_stats;
+                    };
+
+                    const Methcla_RequestId requestId = cmd.query.requestId;
+                    RTMemoryManager::Statistics stats(rtMem().statistics());
+                    sendToWorker<CommandRealtimeMemoryStatistics>(requestId, stats);
+                }
+                break;
+            case kOpPluginCommand:
                 {
-                    static const char* address = "/engine/realtime-memory/statistics";
-                    OSCPP::Client::DynamicPacket packet(
-                        OSCPP::Size::message(address, 2)
-                      + OSCPP::Size::int32(2)
+                    const Methcla_CommandDef* def = cmd.plugin.def;
+                    auto state = cmd.args.state();
+                    def->perform(
+                        *m_owner, def,
+                        std::get<0>(state).pos(), std::get<0>(state).consumable(),
+                        std::get<1>(state).pos(), std::get<1>(state).consumable()
                     );
-                    packet.openMessage(address, 2);
-                    packet.int32(m_stats.freeNumBytes);
-                    packet.int32(m_stats.usedNumBytes);
-                    packet.closeMessage();
-                    env->reply(m_requestId, packet);
-                    env->sendFromWorker(perform_rt_free, this);
                 }
-
-            private:
-                Methcla_RequestId           m_requestId;
-                RTMemoryManager::Statistics m_stats;
-            };
-
-            const Methcla_RequestId requestId = args.int32();
-            RTMemoryManager::Statistics stats(rtMem().statistics());
-            sendToWorker<CommandRealtimeMemoryStatistics>(requestId, stats);
+                break;
         }
     }
     catch (std::exception& e)
     {
         std::stringstream s;
-        s << msg.address() << ": " << e.what();
+        s << OSCPP::Server::Message(cmd.message).address() << ": " << e.what();
         replyError(kMethcla_Notification, s.str().c_str());
     }
 }
@@ -695,6 +1399,47 @@ void EnvironmentImpl::registerSynthDef(const Methcla_SynthDef* def)
     m_synthDefs[synthDef->uri()] = synthDef;
 }
 
+void EnvironmentImpl::registerCommand(const char* address, Opcode opcode, CommandDecoder decode)
+{
+    CommandHandler handler;
+    handler.opcode = opcode;
+    handler.decode = decode;
+    handler.def = nullptr;
+    m_commands[address] = handler;
+}
+
+void EnvironmentImpl::registerCommand(const Methcla_CommandDef* def)
+{
+    if (m_commands.find(def->address) != m_commands.end())
+    {
+        nrt_log(kMethcla_LogError) << "Command " << def->address << " already registered";
+        return;
+    }
+    CommandHandler handler;
+    handler.opcode = kOpPluginCommand;
+    handler.decode = nullptr;
+    handler.def = def;
+    m_commands[def->address] = handler;
+}
+
+bool EnvironmentImpl::isQuery(const char* address) const
+{
+    auto it = m_commands.find(address);
+    return it != m_commands.end() && it->second.decode == decodeQuery;
+}
+
+Methcla_RequestId EnvironmentImpl::newServerRequestId()
+{
+    Methcla_RequestId requestId = m_nextServerRequestId.load(std::memory_order_relaxed);
+    // Wrap around before reaching the ids of in-process clients
+    while (!m_nextServerRequestId.compare_exchange_weak(
+                requestId,
+                requestId == std::numeric_limits<Methcla_RequestId>::min() ? -1 : requestId - 1,
+                std::memory_order_relaxed))
+        ;
+    return requestId;
+}
+
 const shared_ptr<SynthDef>& EnvironmentImpl::synthDef(const char* uri) const
 {
     auto it = m_synthDefs.find(uri);
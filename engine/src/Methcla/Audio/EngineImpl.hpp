@@ -16,32 +16,36 @@
 #define METHCLA_AUDIO_ENGINE_IMPL_HPP_INCLUDED
 
 #include "Methcla/Audio/AudioBus.hpp"
+#include "Methcla/Audio/Command.hpp"
+#include "Methcla/Audio/ExecutionPlan.hpp"
 #include "Methcla/Audio/Group.hpp"
+#include "Methcla/Audio/Scheduler.hpp"
 #include "Methcla/Audio/Synth.hpp"
+#include "Methcla/IO/RequestCapture.hpp"
 #include "Methcla/Memory.hpp"
 #include "Methcla/Memory/Manager.hpp"
 #include "Methcla/Platform.hpp"
+#include "Methcla/Utility/Hash.hpp"
 #include "Methcla/Utility/Macros.h"
 #include "Methcla/Utility/MessageQueue.hpp"
+#include "Methcla/Utility/ThreadPool.hpp"
 
 #include <methcla/log.hpp>
 
-METHCLA_WITHOUT_WARNINGS_BEGIN
-# include <boost/heap/priority_queue.hpp>
-METHCLA_WITHOUT_WARNINGS_END
-
 #include <atomic>
 #include <cassert>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 // OSC request with reference counting.
 namespace Methcla { namespace Audio {
 
-void perform_nrt_free(Environment*, void* data);
-void perform_rt_free(Environment* env, void* data);
-
 template <class T> static void perform_delete(Environment*, void* data)
 {
     delete static_cast<T>(data);
@@ -52,37 +56,32 @@ template <class T> static void perform_perform(Environment* env, void* data)
     static_cast<T*>(data)->perform(env);
 }
 
+class EnvironmentImpl;
+
 class Request
 {
     typedef size_t RefCount;
 
-    Environment* m_env;
-    RefCount*    m_refs;
-    void*        m_packet;
-    size_t       m_size;
+    EnvironmentImpl*                m_env;
+    RefCount                        m_refs;
+    void*                           m_packet;
+    size_t                          m_size;
+    // Called instead of freeing the packet when the request was constructed
+    // in a buffer handed over by the client.
+    Methcla_PacketReleaseFunction   m_releasePacket;
+    void*                           m_releaseData;
+    std::vector<Command>            m_commands;
 
 public:
-    Request()
-        : m_env(nullptr)
-        , m_refs(nullptr)
-        , m_packet(nullptr)
-        , m_size(0)
-    {
-    }
-
-    Request(Environment* env, const void* packet, size_t size)
+    //* Copy packet.
+    Request(EnvironmentImpl* env, const void* packet, size_t size)
         : m_env(env)
+        , m_refs(1)
         , m_size(size)
+        , m_releasePacket(nullptr)
+        , m_releaseData(nullptr)
     {
-        // Allocate memory for packet and data block
-        char* mem = Memory::allocOf<char>(sizeof(RefCount) + size);
-        if (mem == nullptr)
-            throw std::bad_alloc();
-
-        m_refs = reinterpret_cast<RefCount*>(mem);
-        *m_refs = 1;
-
-        m_packet = mem + sizeof(RefCount);
+        m_packet = Memory::allocOf<char>(size);
         memcpy(m_packet, packet, size);
     }
 
@@ -92,123 +91,102 @@ public:
     ~Request()
     {
         // std::cout << "~Request()\n";
-        Methcla::Memory::free(m_refs);
+        if (m_releasePacket == nullptr)
+            Methcla::Memory::free(m_packet);
     }
 
-    void* packet()
+    //* Copy packets into a single buffer holding the request and the packet data.
+    static Request* batch(EnvironmentImpl* env, const Methcla_Packet* packets, size_t count)
     {
-        return m_packet;
-    }
-
-    size_t size() const
-    {
-        return m_size;
-    }
-
-    void retain()
-    {
-        if (m_refs != nullptr)
-            (*m_refs)++;
-    }
-
-    void release()
-    {
-        if (m_refs != nullptr)
+        size_t size = 0;
+        for (size_t i=0; i < count; i++)
+            size += packets[i].size;
+        char* buffer = Memory::allocOf<char>(kMethcla_PacketHeaderSize + size);
+        char* packet = buffer + kMethcla_PacketHeaderSize;
+        for (size_t i=0; i < count; i++)
         {
-            (*m_refs)--;
-            if (*m_refs == 0)
-                m_env->sendToWorker(perform_delete<Request*>, this);
+            memcpy(packet, packets[i].data, packets[i].size);
+            packet += packets[i].size;
         }
+        return construct(env, buffer, size, freeBuffer, nullptr);
     }
-};
 
-template <typename T> class Scheduler
-{
-    class Item
+    //* Construct request in the header of a client buffer, taking ownership of the buffer.
+    static Request* construct(EnvironmentImpl* env, void* buffer, size_t size, Methcla_PacketReleaseFunction release, void* data)
     {
-    public:
-        Item(Methcla_Time time, const T& data)
-            : m_time(time)
-            , m_data(data)
-        { }
-
-        Methcla_Time time() const
-        {
-            return m_time;
-        }
-
-        const T& data() const
-        {
-            return m_data;
-        }
+        static_assert(sizeof(Request) <= kMethcla_PacketHeaderSize, "Request doesn't fit into packet header");
+        return new (buffer) Request(env, static_cast<char*>(buffer) + kMethcla_PacketHeaderSize, size, release, data);
+    }
 
-        bool operator==(const Item& other) const
+    //* Destroy request and free or release its packet.
+    static void destroy(Request* request)
+    {
+        if (request->m_releasePacket == nullptr)
         {
-            return time() == other.time();
+            delete request;
         }
-
-        bool operator<(const Item& other) const
+        else
         {
-            return time() > other.time();
+            Methcla_PacketReleaseFunction release = request->m_releasePacket;
+            void* data = request->m_releaseData;
+            request->~Request();
+            release(data, request);
         }
+    }
 
-    private:
-        Methcla_Time    m_time;
-        T               m_data;
-    };
-
-    typedef boost::heap::priority_queue<
-        Item,
-        boost::heap::stable<true>,
-        boost::heap::stability_counter_type<uint64_t>
-        > PriorityQueue;
+    void* packet()
+    {
+        return m_packet;
+    }
 
-    // We need constant time size and reserve in order to avoid memory allocations from the audio thread.
-    static_assert(PriorityQueue::has_reserve, "priority queue does not implement reserve()");
-    static_assert(PriorityQueue::constant_time_size, "priority queue implementation has non-constant time size()");
-    // We want a stable priority queue
-    static_assert(PriorityQueue::is_stable, "priority queue implementation is not stable");
+    size_t size() const
+    {
+        return m_size;
+    }
 
-    size_t        m_maxSize;
-    PriorityQueue m_queue;
+    //* Commands translated from the packet.
+    std::vector<Command>& commands()
+    {
+        return m_commands;
+    }
 
-public:
-    Scheduler(size_t maxSize)
-        : m_maxSize(maxSize)
+    size_t numCommands() const
     {
-        m_queue.reserve(m_maxSize);
+        return m_commands.size();
     }
 
-    void push(Methcla_Time time, const T& data)
+    const Command& command(size_t index) const
     {
-        if (m_maxSize == 0 || m_queue.size() < m_maxSize) {
-            m_queue.push(Item(time, data));
-        } else {
-            throw std::runtime_error("Scheduler queue overflow");
-        }
+        return m_commands[index];
     }
 
-    bool isEmpty() const
+    void retain()
     {
-        return m_queue.empty();
+        m_refs++;
     }
 
-    Methcla_Time time() const
+    //* Context: RT
+    void release();
+
+    static void perform_destroy(Environment*, void* data)
     {
-        assert(!isEmpty());
-        return m_queue.top().time();
+        destroy(static_cast<Request*>(data));
     }
 
-    const T& top() const
+private:
+    static void freeBuffer(void*, void* buffer)
     {
-        assert(!isEmpty());
-        return m_queue.top().data();
+        Memory::free(buffer);
     }
 
-    void pop()
+    Request(EnvironmentImpl* env, void* packet, size_t size, Methcla_PacketReleaseFunction release, void* data)
+        : m_env(env)
+        , m_refs(1)
+        , m_packet(packet)
+        , m_size(size)
+        , m_releasePacket(release)
+        , m_releaseData(data)
     {
-        assert(!isEmpty());
-        m_queue.pop();
     }
 };
 
@@ -222,6 +200,9 @@ public:
     };
 
     static const size_t kQueueSize = 8192;
+    static const size_t kSchedulerSize = 65536;
+
+    class NodeEndedBatch;
 
     Environment*                m_owner;
 
@@ -231,27 +212,80 @@ public:
     PluginManager               m_plugins;
     Memory::RTMemoryManager     m_rtMem;
 
+    // Commands sent by the realtime threads and by non-realtime threads,
+    // freed directly by the receiving side.
+    Memory::CommandPool         m_rtCommands;
+    Memory::CommandPool         m_nrtCommands;
+
+    // Nodes ended during the current block and batches available for the
+    // next blocks; outlive the worker, which performs the batches.
+    static const size_t kNumNodeEndedBatches = 8;
+    std::vector<std::unique_ptr<NodeEndedBatch>> m_nodeEndedBatches;
+    Utility::LockFreeQueue<NodeEndedBatch*>      m_freeNodeEndedBatches;
+    NodeEndedBatch*                              m_nodeEnded;
+
     typedef Utility::MessageQueue<Request*> MessageQueue;
     typedef Utility::WorkerThread<Environment::Command> Worker;
 
     std::unique_ptr<Environment::MessageQueue> m_requests;
+    // Requests released by the realtime thread, destroyed by the next sender
+    // or by the worker, which is asked to collect them once per block
+    Utility::LockFreeQueue<Request*>           m_releasedRequests;
+    // Set while a worker command collecting released requests is pending
+    std::atomic<bool>                          m_collectingReleasedRequests;
 
     // NOTE: Worker needs to be constructed before and destroyed after node map (m_nodes).
     std::unique_ptr<Environment::Worker> m_worker;
 
+    std::unique_ptr<Utility::ThreadPool> m_threadPool;
+
+    // Scratch buffers for each realtime thread
+    const size_t                         m_numScratchBuffers;
+    sample_t*                            m_scratchBuffers;
+    sample_t*                            m_zeroBuffer;
+
+    // Control bus values
+    const size_t                         m_numControlBuses;
+    sample_t*                            m_controlBuses;
+
     struct ScheduledBundle
     {
-        ScheduledBundle(Request* request, const OSCPP::Server::Bundle& bundle)
+        ScheduledBundle(Request* request, size_t command)
             : m_request(request)
-            , m_bundle(bundle)
+            , m_command(command)
         { }
 
-        Request*              m_request;
-        OSCPP::Server::Bundle m_bundle;
+        Request*    m_request;
+        // Index of the bundle command in the request
+        size_t      m_command;
     };
 
     Scheduler<ScheduledBundle>  m_scheduler;
 
+    // Bundles scheduled beyond the horizon of the realtime scheduler are
+    // staged by the worker, ordered by time and arrival, and moved to the
+    // realtime scheduler shortly before they are due.
+    typedef std::map<std::pair<Methcla_Time,uint64_t>,ScheduledBundle> StagedBundles;
+    typedef std::vector<std::pair<Methcla_Time,ScheduledBundle>> ReleasedBundles;
+
+    // Horizon in seconds; zero disables staging
+    Methcla_Time                m_schedulerHorizon;
+    // Context: NRT
+    StagedBundles               m_stagedBundles;
+    std::mutex                  m_stagedBundlesMutex;
+    // Context: RT
+    uint64_t                    m_numStagedTotal;
+    size_t                      m_numStaged;
+    bool                        m_releasingStaged;
+    Methcla_Time                m_nextStagingRelease;
+    // Buffer of a previous release that couldn't be returned to the worker,
+    // reused by the next release
+    ReleasedBundles*            m_releasedBundles;
+
+    // Scheduler fill level, published by the realtime thread once per block
+    std::atomic<size_t>         m_schedulerSize;
+    std::atomic<size_t>         m_schedulerMaxSize;
+
     std::vector<Memory::shared_ptr<ExternalAudioBus>>   m_externalAudioInputs;
     std::vector<Memory::shared_ptr<ExternalAudioBus>>   m_externalAudioOutputs;
     std::vector<Memory::shared_ptr<AudioBus>>           m_internalAudioBuses;
@@ -259,14 +293,51 @@ public:
     Epoch                                               m_epoch;
     Methcla_Time                                        m_currentTime;
 
+    // Index and start time of the block that processes newly enqueued
+    // requests, published by the realtime thread once per block under a
+    // sequence lock for recording request arrival in the capture file
+    std::atomic<uint32_t>                               m_captureSequence;
+    std::atomic<Epoch>                                  m_captureEpoch;
+    std::atomic<Methcla_Time>                           m_captureTime;
+
     std::vector<Node*>                                  m_nodes;
     Group*                                              m_rootNode;
+    std::unique_ptr<ExecutionPlan>                      m_plan;
 
     SynthDefMap                                         m_synthDefs;
+
+    //* Decode the arguments of a request message into a command.
+    typedef void (*CommandDecoder)(const EnvironmentImpl* env, OSCPP::Server::ArgStream& args, Command& cmd);
+
+    struct CommandHandler
+    {
+        Opcode                      opcode;
+        CommandDecoder              decode;
+        // Command definition for kOpPluginCommand
+        const Methcla_CommandDef*   def;
+    };
+
+    typedef std::unordered_map<const char*,
+                               CommandHandler,
+                               Utility::Hash::cstr_hash,
+                               Utility::Hash::cstr_equal>
+            CommandMap;
+
+    // Request address dispatch table, read concurrently by sending threads
+    // and only modified while loading plugins.
+    CommandMap                                          m_commands;
     std::list<const Methcla_SoundFileAPI*>              m_soundFileAPIs;
 
     std::atomic<int>                                    m_logFlags;
 
+    // Next request id returned by newServerRequestId
+    std::atomic<Methcla_RequestId>                      m_nextServerRequestId;
+
+    // Records incoming requests, null if capturing is disabled
+    std::unique_ptr<Methcla::IO::RequestCaptureWriter>           m_capture;
+    // Orders capture records like the requests in the request queue
+    std::mutex                                          m_captureMutex;
+
     EnvironmentImpl(Environment* owner, LogHandler logHandler, PacketHandler listener, const Environment::Options& options, Environment::MessageQueue* messageQueue, Environment::Worker* worker);
     ~EnvironmentImpl();
 
@@ -289,22 +360,120 @@ public:
     }
 
     void registerSynthDef(const Methcla_SynthDef* def);
+    void registerCommand(const char* address, Opcode opcode, CommandDecoder decode);
+    void registerCommand(const Methcla_CommandDef* def);
+    bool isQuery(const char* address) const;
+    Methcla_RequestId newServerRequestId();
     const Memory::shared_ptr<SynthDef>& synthDef(const char* uri) const;
 
     void process(Methcla_Time currentTime, size_t numFrames, const sample_t* const* inputs, sample_t* const* outputs);
 
+    //* Schedule bundle for processing at `time`.
+    //
+    // Returns false if the bundle couldn't be staged; the error has been
+    // reported.
+    //
+    // Context: RT
+    bool schedule(Methcla_Time time, const ScheduledBundle& bundle);
+    //* Retain request and schedule its bundle at command index `bundle`.
+    //
+    // Failures are reported as errors and leave the request's reference
+    // count unchanged.
+    //
+    // Context: RT
+    void scheduleBundle(Request* request, size_t bundle);
+    //* Request staged bundles that are due soon from the worker.
+    //
+    // Context: RT
+    void releaseStaged(Methcla_Time currentTime);
+
+    //* Translate request and send it to the realtime thread.
+    //
+    // Waits up to timeout seconds for space in the request queue and throws
+    // kMethcla_QueueFullError if the queue is still full.
+    //
+    // Context: NRT
+    void send(Request* request, double timeout);
+
+    //* Translate packets to a single request and send it to the realtime thread.
+    //
+    // Context: NRT
+    void send(const Methcla_Packet* packets, size_t count);
+
+    //* Packets of a request that are recorded in the capture file.
+    struct CapturedPackets
+    {
+        std::vector<char>   data;
+        std::vector<size_t> sizes;
+    };
+
+    //* Enqueue a translated request, destroying it if the queue stays full.
+    //
+    // When captured is non-null, its packets are recorded once the request
+    // has been enqueued.
+    //
+    // Context: NRT
+    void enqueue(Request* request, double timeout, const CapturedPackets* captured);
+
+    //* Try to enqueue request once, see enqueue.
+    //
+    // Context: NRT
+    bool trySend(Request* request, const CapturedPackets* captured);
+
+    //* Publish the index and start time of the block that processes newly enqueued requests.
+    //
+    // Context: RT
+    void publishCaptureTime(Epoch epoch, Methcla_Time time);
+
+    //* Read the values stored by publishCaptureTime.
+    //
+    // Context: NRT
+    void loadCaptureTime(Epoch& epoch, Methcla_Time& time) const;
+
+    //* Return the fill levels of the request, worker and scheduler queues.
+    Methcla_EngineQueueStats queueStatistics() const;
+
+    //* Publish the scheduler fill level.
+    //
+    // Context: RT
+    void updateSchedulerStatistics();
+
+    //* Hand a request that is no longer referenced back to the senders.
+    //
+    // Context: RT
+    void releaseRequest(Request* request);
+
+    //* Destroy requests released by the realtime thread.
+    //
+    // Context: NRT
+    void destroyReleasedRequests();
+
+    //* Ask the worker to destroy released requests if there are any.
+    //
+    // Context: RT
+    void collectReleasedRequests();
+
+    //* Translate the request packet to commands.
+    //
+    // Messages that fail to decode are reported and skipped.
+    //
+    // Context: NRT
+    void compile(Request* request);
+    void compilePacket(const OSCPP::Server::Packet& packet, std::vector<Command>& commands);
+    bool decodeMessage(const OSCPP::Server::Message& msg, Command& cmd) const;
+
     void processRequests(Methcla_EngineLogFlags logFlags, const Methcla_Time currentTime);
     void processScheduler(Methcla_EngineLogFlags logFlags, const Methcla_Time currentTime, const Methcla_Time nextTime);
-    void processBundle(Methcla_EngineLogFlags logFlags, Request* request, const OSCPP::Server::Bundle& bundle, const Methcla_Time scheduleTime, const Methcla_Time currentTime);
-    void processMessage(Methcla_EngineLogFlags logFlags, const OSCPP::Server::Message& msg, const Methcla_Time scheduleTime, const Methcla_Time currentTime);
+    void processBundle(Methcla_EngineLogFlags logFlags, Request* request, size_t bundle, const Methcla_Time scheduleTime, const Methcla_Time currentTime);
+    void processCommand(Methcla_EngineLogFlags logFlags, const Command& cmd, const Methcla_Time scheduleTime, const Methcla_Time currentTime);
 
-    void sendToWorker(PerformFunc f, void* data)
+    void sendToWorker(PerformFunc f, void* data, Utility::WorkerLane lane=Utility::kWorkerLatencyLane)
     {
         Environment::Command cmd;
         cmd.m_env = m_owner;
         cmd.m_perform = f;
         cmd.m_data = data;
-        m_worker->sendToWorker(cmd);
+        m_worker->sendToWorker(cmd, lane);
     }
 
     void sendFromWorker(PerformFunc f, void* data)
@@ -321,9 +490,38 @@ public:
         sendToWorker(perform_perform<T>, command);
     }
 
-    template <class T, class ... Args> void sendToWorker(Args&&...args)
+    //* Construct command from the realtime command pool and send it to the worker.
+    //
+    // The command returns its memory with `env->rtCommands().free(this)`.
+    // Returns false and logs an error if the pool is exhausted or the worker
+    // queue is full.
+    //
+    // Context: RT
+    template <class T, class ... Args> bool sendToWorker(Args&&...args)
     {
-        sendToWorker(perform_perform<T>, rtMem().construct<T,Args...>(std::forward<Args>(args)...));
+        static_assert(sizeof(T) <= Memory::CommandPool::kBlockSize, "Command too large for command pool");
+        T* command;
+        try
+        {
+            command = m_rtCommands.construct<T,Args...>(std::forward<Args>(args)...);
+        }
+        catch (std::bad_alloc&)
+        {
+            rt_log(kMethcla_LogError) << "ERROR: Realtime command pool exhausted";
+            return false;
+        }
+        try
+        {
+            sendToWorker(perform_perform<T>, command);
+        }
+        catch (std::exception& e)
+        {
+            command->~T();
+            m_rtCommands.free(command);
+            rt_log(kMethcla_LogError) << "ERROR: " << e.what();
+            return false;
+        }
+        return true;
     }
 
     template <class T> void sendFromWorker(T* command)
@@ -331,41 +529,56 @@ public:
         sendFromWorker(perform_perform<T>, command);
     }
 
-    class Notification
+    //* Ids of nodes that ended during an audio block.
+    //
+    // Ids are collected by the realtime threads and sent to the worker once
+    // per block, which notifies clients with `/node/ended` messages carrying
+    // all ids as int32 arguments. Batches and their packet buffers are
+    // preallocated and recycled through a free list.
+    class NodeEndedBatch
     {
     public:
-        void perform(Environment* env)
-        {
-            notify(env);
-            env->sendFromWorker(perform_rt_free, this);
-        }
+        // Maximum number of ids per message; keeps packets below the size limit of the socket and shared memory transports.
+        static const size_t kMaxNodesPerMessage = 1024;
 
-    private:
-        virtual void notify(Environment* env) = 0;
-    };
+        NodeEndedBatch(size_t capacity, Utility::LockFreeQueue<NodeEndedBatch*>* freeList);
+        ~NodeEndedBatch();
 
-    class NodeEndedNotification : public Notification
-    {
-        NodeId m_nodeId;
+        NodeEndedBatch(const NodeEndedBatch&) = delete;
+        NodeEndedBatch& operator=(const NodeEndedBatch&) = delete;
 
-    public:
-        NodeEndedNotification(NodeId nodeId)
-            : m_nodeId(nodeId)
-        {}
+        //* Add a node id, return false if the batch is full.
+        //
+        // Context: RT
+        bool add(NodeId nodeId)
+        {
+            const size_t index = m_size.fetch_add(1, std::memory_order_relaxed);
+            if (index < m_capacity)
+            {
+                m_nodeIds[index] = nodeId;
+                return true;
+            }
+            return false;
+        }
 
-    private:
-        void notify(Environment* env) override
+        //* Context: RT
+        bool isEmpty() const
         {
-            static const char* address = "/node/ended";
-            OSCPP::Client::DynamicPacket packet(
-                OSCPP::Size::message(address, 1)
-              + OSCPP::Size::int32(1)
-            );
-            packet.openMessage(address, 1);
-            packet.int32(m_nodeId);
-            packet.closeMessage();
-            env->notify(packet);
+            return m_size.load(std::memory_order_relaxed) == 0;
         }
+
+        //* Send notifications and return the batch to the free list.
+        //
+        // Context: NRT
+        void perform(Environment* env);
+
+    private:
+        const size_t                                m_capacity;
+        std::atomic<size_t>                         m_size;
+        NodeId*                                     m_nodeIds;
+        const size_t                                m_packetSize;
+        char*                                       m_packet;
+        Utility::LockFreeQueue<NodeEndedBatch*>*    m_freeList;
     };
 
     //* Context: RT
@@ -374,10 +587,22 @@ public:
         if (nodeId >= 0 && (size_t)nodeId < m_nodes.size())
         {
             m_nodes[nodeId] = nullptr;
-            sendToWorker<NodeEndedNotification>(nodeId);
+            if (!m_nodeEnded->add(nodeId))
+                logLineRT(kMethcla_LogError, "Too many ended nodes, dropping /node/ended notification");
         }
     }
 
+    //* Send the ids of nodes that ended during the current block to the worker.
+    //
+    // Context: RT
+    void sendNodeEnded();
+
+    //* Context: RT
+    void nodeDone()
+    {
+        m_plan->nodeDone();
+    }
+
     //* Context: NRT
     void reply(Methcla_RequestId requestId, const void* packet, size_t size)
     {
@@ -0,0 +1,596 @@
+// Copyright 2012-2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Methcla/Audio/ExecutionPlan.hpp"
+#include "Methcla/Audio/Group.hpp"
+#include "Methcla/Audio/ParallelGroup.hpp"
+#include "Methcla/Audio/Synth.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace Methcla::Audio;
+
+ExecutionPlan::ExecutionPlan(size_t maxNumNodes, size_t numAudioBuses, size_t numControlBuses, size_t numScratchBuffers)
+    : m_numAudioBuses(numAudioBuses)
+    , m_buses(numAudioBuses + numControlBuses)
+    , m_liveBuses(numAudioBuses)
+    , m_batchBuses(numAudioBuses + numControlBuses, 0)
+    , m_numScratchBuffers(numScratchBuffers)
+    , m_valid(false)
+    , m_version(0)
+    , m_hasDoneRequests(false)
+    , m_hasDoneNodes(false)
+    , m_currentLevel(0)
+    , m_numFrames(0)
+{
+    // Reserve memory in order to avoid allocations in the audio thread
+    m_nodes.reserve(maxNumNodes);
+    m_subtreeEnd.reserve(maxNumNodes);
+    m_tasks.reserve(maxNumNodes);
+    m_taskLevels.reserve(maxNumNodes);
+    m_liveTasks.reserve(maxNumNodes);
+    m_schedule.reserve(maxNumNodes);
+    m_instances.resize(maxNumNodes);
+    m_levels.reserve(maxNumNodes + 1);
+}
+
+size_t ExecutionPlan::controlBusIndex(const ControlConnection& conn) const
+{
+    assert( conn.isMapped() );
+    return m_numAudioBuses + conn.bus();
+}
+
+void ExecutionPlan::collect(Node* node, bool isInsideTask)
+{
+    const size_t index = m_nodes.size();
+    m_nodes.push_back(node);
+    m_subtreeEnd.push_back(index);
+
+    // Parallel groups are processed as a whole
+    const bool isParallelGroup = dynamic_cast<ParallelGroup*>(node) != nullptr;
+
+    if (!isInsideTask)
+    {
+        if (node->isSynth())
+        {
+            const Task task = { node, static_cast<Synth*>(node), 1 };
+            m_tasks.push_back(task);
+        }
+        else if (isParallelGroup)
+        {
+            const Task task = { node, nullptr, 1 };
+            m_tasks.push_back(task);
+        }
+    }
+
+    if (node->isGroup())
+    {
+        for (Node* child = static_cast<Group*>(node)->first(); child != nullptr; child = child->next())
+        {
+            collect(child, isInsideTask || isParallelGroup);
+        }
+    }
+
+    m_subtreeEnd[index] = m_nodes.size();
+}
+
+template <class F> static void forEachSynth(Node* node, F func)
+{
+    if (node->isSynth())
+    {
+        func(static_cast<const Synth*>(node));
+    }
+    else if (node->isGroup())
+    {
+        for (Node* child = static_cast<Group*>(node)->first(); child != nullptr; child = child->next())
+        {
+            forEachSynth(child, func);
+        }
+    }
+}
+
+bool ExecutionPlan::isSink(Node* task)
+{
+    bool result = false;
+
+    forEachSynth(task, [&](const Synth* synth) {
+        if (   synth->numAudioOutputs() == 0
+            || synth->numControlOutputs() > 0
+            || synth->doneFlags() != kMethcla_NodeDoneDoNothing)
+        {
+            result = true;
+        }
+        for (Methcla_PortCount i=0; i < synth->numAudioOutputs(); i++)
+        {
+            const AudioOutputConnection& conn = synth->audioOutputConnection(i);
+            if (conn.bus() != nullptr && (conn.flags() & kMethcla_BusMappingExternal))
+                result = true;
+        }
+    });
+
+    return result;
+}
+
+bool ExecutionPlan::writesLiveBus(Node* task)
+{
+    bool result = false;
+
+    forEachSynth(task, [&](const Synth* synth) {
+        for (Methcla_PortCount i=0; i < synth->numAudioOutputs(); i++)
+        {
+            const AudioOutputConnection& conn = synth->audioOutputConnection(i);
+            if (conn.bus() != nullptr && m_liveBuses[conn.bus()->index()])
+                result = true;
+        }
+    });
+
+    return result;
+}
+
+void ExecutionPlan::markInputsLive(Node* task)
+{
+    forEachSynth(task, [&](const Synth* synth) {
+        for (Methcla_PortCount i=0; i < synth->numAudioInputs(); i++)
+        {
+            const AudioInputConnection& conn = synth->audioInputConnection(i);
+            if (conn.bus() != nullptr)
+                m_liveBuses[conn.bus()->index()] = true;
+        }
+    });
+}
+
+void ExecutionPlan::eliminateDeadTasks()
+{
+    m_liveTasks.assign(m_tasks.size(), false);
+    std::fill(m_liveBuses.begin(), m_liveBuses.end(), false);
+
+    // Propagate liveness backwards through the bus mappings until a fixed
+    // point is reached. Liveness doesn't depend on the processing order,
+    // which keeps feedback connections live, too. Visiting the tasks in
+    // reverse order usually reaches the fixed point in a single pass.
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i=m_tasks.size(); i > 0; i--)
+        {
+            Node* task = m_tasks[i-1].node;
+            if (!m_liveTasks[i-1] && (isSink(task) || writesLiveBus(task)))
+            {
+                m_liveTasks[i-1] = true;
+                markInputsLive(task);
+                changed = true;
+            }
+        }
+    }
+
+    // Remove dead tasks, preserving the order of the others
+    size_t numLiveTasks = 0;
+    for (size_t i=0; i < m_tasks.size(); i++)
+    {
+        if (m_liveTasks[i])
+            m_tasks[numLiveTasks++] = m_tasks[i];
+    }
+    m_tasks.resize(numLiveTasks);
+}
+
+uint32_t ExecutionPlan::level(Node* task)
+{
+    uint32_t result = 0;
+
+    forEachSynth(task, [&](const Synth* synth) {
+        for (Methcla_PortCount i=0; i < synth->numAudioInputs(); i++)
+        {
+            const AudioInputConnection& conn = synth->audioInputConnection(i);
+            if (conn.bus() != nullptr)
+            {
+                const BusState& bus = m_buses[conn.bus()->index()];
+                result = std::max(result, bus.afterWrite);
+            }
+        }
+        for (Methcla_PortCount i=0; i < synth->numAudioOutputs(); i++)
+        {
+            const AudioOutputConnection& conn = synth->audioOutputConnection(i);
+            if (conn.bus() != nullptr)
+            {
+                const BusState& bus = m_buses[conn.bus()->index()];
+                result = std::max(result, bus.afterRead);
+                result = std::max(result, conn.flags() & kMethcla_BusMappingReplace
+                                            ? bus.afterWrite
+                                            : bus.afterReplace);
+            }
+        }
+        for (Methcla_PortCount i=0; i < synth->numControlInputs(); i++)
+        {
+            const ControlConnection& conn = synth->controlInputConnection(i);
+            if (conn.isMapped())
+                result = std::max(result, m_buses[controlBusIndex(conn)].afterWrite);
+        }
+        // Control outputs replace the bus value
+        for (Methcla_PortCount i=0; i < synth->numControlOutputs(); i++)
+        {
+            const ControlConnection& conn = synth->controlOutputConnection(i);
+            if (conn.isMapped())
+            {
+                const BusState& bus = m_buses[controlBusIndex(conn)];
+                result = std::max(result, std::max(bus.afterRead, bus.afterWrite));
+            }
+        }
+    });
+
+    return result;
+}
+
+void ExecutionPlan::update(Node* task, uint32_t level)
+{
+    const uint32_t next = level + 1;
+
+    forEachSynth(task, [&](const Synth* synth) {
+        for (Methcla_PortCount i=0; i < synth->numAudioInputs(); i++)
+        {
+            const AudioInputConnection& conn = synth->audioInputConnection(i);
+            if (conn.bus() != nullptr)
+            {
+                BusState& bus = m_buses[conn.bus()->index()];
+                bus.afterRead = std::max(bus.afterRead, next);
+            }
+        }
+        for (Methcla_PortCount i=0; i < synth->numAudioOutputs(); i++)
+        {
+            const AudioOutputConnection& conn = synth->audioOutputConnection(i);
+            if (conn.bus() != nullptr)
+            {
+                BusState& bus = m_buses[conn.bus()->index()];
+                bus.afterWrite = std::max(bus.afterWrite, next);
+                if (conn.flags() & kMethcla_BusMappingReplace)
+                    bus.afterReplace = std::max(bus.afterReplace, next);
+            }
+        }
+        for (Methcla_PortCount i=0; i < synth->numControlInputs(); i++)
+        {
+            const ControlConnection& conn = synth->controlInputConnection(i);
+            if (conn.isMapped())
+            {
+                BusState& bus = m_buses[controlBusIndex(conn)];
+                bus.afterRead = std::max(bus.afterRead, next);
+            }
+        }
+        for (Methcla_PortCount i=0; i < synth->numControlOutputs(); i++)
+        {
+            const ControlConnection& conn = synth->controlOutputConnection(i);
+            if (conn.isMapped())
+            {
+                BusState& bus = m_buses[controlBusIndex(conn)];
+                bus.afterWrite = std::max(bus.afterWrite, next);
+                bus.afterReplace = std::max(bus.afterReplace, next);
+            }
+        }
+    });
+}
+
+bool ExecutionPlan::dependsOnBatch(const Synth* synth) const
+{
+    for (Methcla_PortCount i=0; i < synth->numAudioInputs(); i++)
+    {
+        const AudioBus* bus = synth->audioInputConnection(i).bus();
+        if (bus != nullptr && (m_batchBuses[bus->index()] & kBatchBusWrite))
+            return true;
+    }
+    for (Methcla_PortCount i=0; i < synth->numAudioOutputs(); i++)
+    {
+        const AudioOutputConnection& conn = synth->audioOutputConnection(i);
+        if (conn.bus() != nullptr)
+        {
+            const uint8_t state = m_batchBuses[conn.bus()->index()];
+            if (   (state & (kBatchBusRead | kBatchBusReplace))
+                || ((state & kBatchBusWrite) && (conn.flags() & kMethcla_BusMappingReplace)))
+                return true;
+        }
+    }
+    // Control ports access the bus value directly while the batch is processed
+    for (Methcla_PortCount i=0; i < synth->numControlInputs(); i++)
+    {
+        const ControlConnection& conn = synth->controlInputConnection(i);
+        if (conn.isMapped() && (m_batchBuses[controlBusIndex(conn)] & kBatchBusWrite))
+            return true;
+    }
+    for (Methcla_PortCount i=0; i < synth->numControlOutputs(); i++)
+    {
+        const ControlConnection& conn = synth->controlOutputConnection(i);
+        if (conn.isMapped() && m_batchBuses[controlBusIndex(conn)] != 0)
+            return true;
+    }
+    return false;
+}
+
+void ExecutionPlan::updateBatchBuses(const Synth* synth, bool clear)
+{
+    for (Methcla_PortCount i=0; i < synth->numAudioInputs(); i++)
+    {
+        const AudioBus* bus = synth->audioInputConnection(i).bus();
+        if (bus != nullptr)
+            m_batchBuses[bus->index()] = clear ? 0 : m_batchBuses[bus->index()] | kBatchBusRead;
+    }
+    for (Methcla_PortCount i=0; i < synth->numAudioOutputs(); i++)
+    {
+        const AudioOutputConnection& conn = synth->audioOutputConnection(i);
+        if (conn.bus() != nullptr)
+        {
+            uint8_t& state = m_batchBuses[conn.bus()->index()];
+            if (clear)
+                state = 0;
+            else
+                state |= kBatchBusWrite | (conn.flags() & kMethcla_BusMappingReplace ? kBatchBusReplace : 0);
+        }
+    }
+    for (Methcla_PortCount i=0; i < synth->numControlInputs(); i++)
+    {
+        const ControlConnection& conn = synth->controlInputConnection(i);
+        if (conn.isMapped())
+        {
+            uint8_t& state = m_batchBuses[controlBusIndex(conn)];
+            state = clear ? 0 : state | kBatchBusRead;
+        }
+    }
+    for (Methcla_PortCount i=0; i < synth->numControlOutputs(); i++)
+    {
+        const ControlConnection& conn = synth->controlOutputConnection(i);
+        if (conn.isMapped())
+        {
+            uint8_t& state = m_batchBuses[controlBusIndex(conn)];
+            state = clear ? 0 : state | kBatchBusWrite | kBatchBusReplace;
+        }
+    }
+}
+
+void ExecutionPlan::formBatches(Task* tasks, size_t numTasks, size_t maxBatchSize, bool checkDependencies)
+{
+    size_t i = 0;
+    while (i < numTasks)
+    {
+        const Synth* synth = tasks[i].synth;
+        size_t end = i + 1;
+        if (synth != nullptr && synth->synthDef().hasProcessBatch())
+        {
+            // All synths of a batch read their inputs before any of them is
+            // processed and write their outputs afterwards. When processing
+            // in depth first order, a synth can only join the batch if it
+            // doesn't depend on the bus accesses of the preceding synths.
+            // The ports of all synths in a batch need to fit into the
+            // scratch buffers of the processing thread.
+            if (checkDependencies)
+                updateBatchBuses(synth, false);
+            size_t numScratchBuffers = synth->numScratchBuffers();
+            while (   end < numTasks
+                   && end - i < maxBatchSize
+                   && tasks[end].synth != nullptr
+                   && &tasks[end].synth->synthDef() == &synth->synthDef()
+                   && numScratchBuffers + tasks[end].synth->numScratchBuffers() <= m_numScratchBuffers
+                   && !(checkDependencies && dependsOnBatch(tasks[end].synth)))
+            {
+                if (checkDependencies)
+                    updateBatchBuses(tasks[end].synth, false);
+                numScratchBuffers += tasks[end].synth->numScratchBuffers();
+                end++;
+            }
+            if (checkDependencies)
+            {
+                for (size_t k=i; k < end; k++)
+                    updateBatchBuses(tasks[k].synth, true);
+            }
+        }
+        tasks[i].batchSize = end - i;
+        for (size_t k=i+1; k < end; k++)
+            tasks[k].batchSize = 0;
+        i = end;
+    }
+}
+
+void ExecutionPlan::compile(Group* root, size_t numThreads)
+{
+    m_nodes.clear();
+    m_subtreeEnd.clear();
+    m_tasks.clear();
+    collect(root, false);
+    eliminateDeadTasks();
+
+    m_valid = true;
+    m_version = root->topologyVersion();
+
+    // Tasks are processed in depth first order when running single threaded
+    if (numThreads < 2)
+    {
+        formBatches(m_tasks.data(), m_tasks.size(), m_tasks.size(), true);
+        return;
+    }
+
+    // Assign levels
+    const BusState initialState = { 0, 0, 0 };
+    std::fill(m_buses.begin(), m_buses.end(), initialState);
+
+    m_taskLevels.clear();
+    size_t numLevels = 0;
+    for (const Task& task : m_tasks)
+    {
+        const uint32_t taskLevel = level(task.node);
+        update(task.node, taskLevel);
+        m_taskLevels.push_back(taskLevel);
+        numLevels = std::max(numLevels, (size_t)taskLevel + 1);
+    }
+
+    // Stable counting sort by level
+    m_levels.assign(numLevels + 1, 0);
+    for (uint32_t taskLevel : m_taskLevels)
+        m_levels[taskLevel + 1]++;
+    for (size_t i=1; i <= numLevels; i++)
+        m_levels[i] += m_levels[i - 1];
+
+    m_schedule.resize(m_tasks.size());
+    for (size_t i=0; i < m_tasks.size(); i++)
+        m_schedule[m_levels[m_taskLevels[i]]++] = m_tasks[i];
+
+    // Restore level offsets
+    for (size_t i=numLevels; i > 0; i--)
+        m_levels[i] = m_levels[i - 1];
+    m_levels[0] = 0;
+
+    // Batch tasks within each level, leaving enough batches to keep all
+    // threads busy. Tasks on the same level don't depend on each other.
+    for (size_t i=0; i < numLevels; i++)
+    {
+        const size_t numTasks = m_levels[i + 1] - m_levels[i];
+        const size_t maxBatchSize = (numTasks + numThreads - 1) / numThreads;
+        formBatches(&m_schedule[m_levels[i]], numTasks, maxBatchSize, false);
+    }
+}
+
+bool ExecutionPlan::performDoneActions()
+{
+    // Done actions only mark nodes as done, they don't change the node tree
+    bool performed = false;
+    for (Node* node : m_nodes)
+    {
+        if (node->isDonePending())
+        {
+            node->performDoneAction();
+            performed = true;
+        }
+    }
+    return performed;
+}
+
+bool ExecutionPlan::freeDoneNodes()
+{
+    bool freed = false;
+    size_t i = 0;
+    while (i < m_nodes.size())
+    {
+        Node* node = m_nodes[i];
+        if (node->isDone())
+        {
+            // Skip the subtree, it's freed together with the node
+            const size_t end = m_subtreeEnd[i];
+            node->free();
+            freed = true;
+            i = end;
+        }
+        else
+        {
+            i++;
+        }
+    }
+    return freed;
+}
+
+inline void ExecutionPlan::processTask(const Task* task, Methcla_Synth** instances, size_t numFrames)
+{
+    if (task->batchSize == 1)
+    {
+        if (task->synth != nullptr)
+            task->synth->processSynth(numFrames, task->synth->env().scratchBuffers());
+        else
+            task->node->doProcess(numFrames);
+    }
+    else if (task->batchSize > 1)
+    {
+        Environment& env = task->synth->env();
+        sample_t* const scratch = env.scratchBuffers();
+        const size_t blockSize = env.blockSize();
+
+        // Collect the instances that need to be processed in this block.
+        // Each of them gets its own slice of the scratch buffers; synths
+        // that are processed right away use the next free slice without
+        // claiming it.
+        size_t numInstances = 0;
+        size_t scratchOffset = 0;
+        for (size_t i=0; i < task->batchSize; i++)
+        {
+            Synth* synth = task[i].synth;
+            if (synth->beginProcessBatch(numFrames, scratch + scratchOffset))
+            {
+                instances[numInstances++] = synth->instance();
+                scratchOffset += synth->numScratchBuffers() * blockSize;
+            }
+        }
+        if (numInstances > 0)
+        {
+            task->synth->synthDef().processBatch(env, instances, numInstances, numFrames);
+            scratchOffset = 0;
+            for (size_t i=0; i < numInstances; i++)
+            {
+                Synth* synth = Synth::fromSynth(instances[i]);
+                synth->endProcessBatch(numFrames, scratch + scratchOffset);
+                scratchOffset += synth->numScratchBuffers() * blockSize;
+            }
+        }
+    }
+}
+
+void ExecutionPlan::processTask(void* data, size_t task)
+{
+    ExecutionPlan* self = static_cast<ExecutionPlan*>(data);
+    const size_t index = self->m_currentLevel + task;
+    processTask(&self->m_schedule[index], &self->m_instances[index], self->m_numFrames);
+}
+
+void ExecutionPlan::process(Group* root, Utility::ThreadPool& pool, size_t numFrames)
+{
+    const size_t numThreads = pool.numThreads();
+
+    if (!m_valid || m_version != root->topologyVersion())
+        compile(root, numThreads);
+
+    // Only scan for done nodes when a node has been marked as done
+    if (m_hasDoneNodes)
+    {
+        m_hasDoneNodes = false;
+        if (freeDoneNodes())
+            compile(root, numThreads);
+    }
+
+    if (numThreads < 2)
+    {
+        const Task* tasks = m_tasks.data();
+        const size_t numTasks = m_tasks.size();
+        for (size_t i=0; i < numTasks; i += tasks[i].batchSize)
+        {
+            processTask(&tasks[i], &m_instances[i], numFrames);
+        }
+    }
+    else
+    {
+        m_numFrames = numFrames;
+
+        for (size_t i=0; i + 1 < m_levels.size(); i++)
+        {
+            const size_t begin = m_levels[i];
+            const size_t numTasks = m_levels[i + 1] - begin;
+            if (numTasks == 1)
+            {
+                // Process single tasks directly, so that a parallel group can make use of the thread pool.
+                processTask(&m_schedule[begin], &m_instances[begin], numFrames);
+            }
+            else
+            {
+                m_currentLevel = begin;
+                pool.run(processTask, this, numTasks);
+            }
+        }
+    }
+
+    // All threads have joined, done actions can safely modify other nodes
+    if (m_hasDoneRequests.exchange(false, std::memory_order_relaxed))
+        m_hasDoneNodes = performDoneActions();
+}
@@ -0,0 +1,186 @@
+// Copyright 2012-2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_AUDIO_EXECUTIONPLAN_HPP_INCLUDED
+#define METHCLA_AUDIO_EXECUTIONPLAN_HPP_INCLUDED
+
+#include "Methcla/Utility/ThreadPool.hpp"
+
+#include <methcla/plugin.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Methcla { namespace Audio {
+
+class ControlConnection;
+class Group;
+class Node;
+class Synth;
+
+//* Flat execution plan for processing the node tree.
+//
+// The plan flattens the node tree into a contiguous array of tasks (synths
+// and parallel groups) in depth first order, so that processing a block
+// doesn't need to follow the links between nodes or dispatch through the
+// virtual Node::doProcess for each synth.
+//
+// When processing with more than one thread, each task is additionally
+// assigned a level derived from the bus mappings of the synths it contains:
+//
+// * a task reading a bus comes after all preceding tasks writing to it,
+// * a task accumulating into a bus comes after all preceding tasks reading it
+//   or replacing its contents,
+// * a task replacing the contents of a bus comes after all preceding tasks
+//   reading or writing it.
+//
+// Control buses are tracked like audio buses, with mapped control inputs
+// reading and mapped control outputs replacing the bus value.
+//
+// Tasks accumulating into the same bus don't depend on each other. Tasks on
+// the same level are independent and are processed concurrently, levels are
+// processed in order. Plain groups don't impose any ordering beyond the data
+// dependencies of their children.
+//
+// Tasks that cannot affect any external output are left out of the plan.
+// A task is live when it writes to an external output, when it has side
+// effects that can't be tracked through bus mappings (no audio outputs,
+// control outputs or done flags) or when it writes to a bus read by a live
+// task.
+//
+// The plan is recompiled lazily when the topology version of the root group
+// changes, i.e. when nodes are added or removed or when bus mappings change.
+class ExecutionPlan
+{
+public:
+    //* Construct an execution plan.
+    //
+    // Memory for at most `maxNumNodes` nodes, `numAudioBuses` audio buses
+    // (internal and external) and `numControlBuses` control buses is
+    // allocated up front. The synths of a batch share the `numScratchBuffers`
+    // scratch buffers of the processing thread.
+    ExecutionPlan(size_t maxNumNodes, size_t numAudioBuses, size_t numControlBuses, size_t numScratchBuffers);
+
+    ExecutionPlan(const ExecutionPlan&) = delete;
+    ExecutionPlan& operator=(const ExecutionPlan&) = delete;
+
+    //* Free nodes that are done and process the node tree rooted at `root`.
+    //
+    // Context: RT
+    void process(Group* root, Utility::ThreadPool& pool, size_t numFrames);
+
+    //* Signal that a node has requested its done action.
+    //
+    // The action is performed after the current block has been processed
+    // and the nodes it marks as done are freed before the next block.
+    //
+    // Context: RT
+    void nodeDone()
+    {
+        m_hasDoneRequests.store(true, std::memory_order_relaxed);
+    }
+
+private:
+    //* Process thunk.
+    struct Task
+    {
+        Node*   node;
+        // Synths are processed directly, without virtual dispatch.
+        // nullptr for parallel groups.
+        Synth*  synth;
+        // Number of adjacent synths with the same definition processed
+        // together with this task by the definition's batch process
+        // function; 0 for synths that are part of a preceding batch.
+        size_t  batchSize;
+    };
+
+    enum BatchBusFlags
+    {
+        kBatchBusRead    = 0x1,
+        kBatchBusWrite   = 0x2,
+        kBatchBusReplace = 0x4
+    };
+
+    struct BusState
+    {
+        // Lowest level at which a subsequent task may access the bus.
+        uint32_t afterRead;
+        uint32_t afterWrite;
+        uint32_t afterReplace;
+    };
+
+    //* Return the index of a mapped control bus in m_buses and m_batchBuses.
+    size_t controlBusIndex(const ControlConnection& conn) const;
+
+    void compile(Group* root, size_t numThreads);
+    bool dependsOnBatch(const Synth* synth) const;
+    void updateBatchBuses(const Synth* synth, bool clear);
+    void formBatches(Task* tasks, size_t numTasks, size_t maxBatchSize, bool checkDependencies);
+    void collect(Node* node, bool isInsideTask);
+    bool isSink(Node* task);
+    bool writesLiveBus(Node* task);
+    void markInputsLive(Node* task);
+    //* Remove tasks from the plan that can't affect any external output.
+    void eliminateDeadTasks();
+    uint32_t level(Node* task);
+    void update(Node* task, uint32_t level);
+
+    //* Perform pending done actions and return true if there were any.
+    bool performDoneActions();
+
+    //* Free nodes that are done and return true if any node was freed.
+    bool freeDoneNodes();
+
+    static void processTask(const Task* task, Methcla_Synth** instances, size_t numFrames);
+    static void processTask(void* data, size_t task);
+
+private:
+    // All nodes in depth first order
+    std::vector<Node*>      m_nodes;
+    // Index of the first node after the subtree rooted at the node with the same index
+    std::vector<size_t>     m_subtreeEnd;
+    // Tasks in depth first order and their levels
+    std::vector<Task>       m_tasks;
+    std::vector<uint32_t>   m_taskLevels;
+    // Tasks ordered by level
+    std::vector<Task>       m_schedule;
+    // Offsets of levels in m_schedule
+    std::vector<size_t>     m_levels;
+    // Audio buses followed by control buses
+    size_t                  m_numAudioBuses;
+    std::vector<BusState>   m_buses;
+    // Scratch space for collecting the instances of a batch, indexed like the tasks
+    std::vector<Methcla_Synth*> m_instances;
+    // Liveness of tasks and buses
+    std::vector<bool>       m_liveTasks;
+    std::vector<bool>       m_liveBuses;
+    // Bus accesses of the batch being formed, indexed like m_buses
+    std::vector<uint8_t>    m_batchBuses;
+    size_t                  m_numScratchBuffers;
+    bool                    m_valid;
+    uint32_t                m_version;
+    // Set by nodes requesting their done action from any realtime thread
+    std::atomic<bool>       m_hasDoneRequests;
+    // Nodes have been marked as done and are freed before the next block
+    bool                    m_hasDoneNodes;
+    // Offset of the level currently being processed in m_schedule
+    size_t                  m_currentLevel;
+    size_t                  m_numFrames;
+};
+
+} }
+
+#endif // METHCLA_AUDIO_EXECUTIONPLAN_HPP_INCLUDED
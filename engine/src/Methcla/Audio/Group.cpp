@@ -21,6 +21,7 @@ Group::Group(Environment& env, NodeId nodeId)
     : Node(env, nodeId)
     , m_first(nullptr)
     , m_last(nullptr)
+    , m_topologyVersion(0)
 {
 }
 
@@ -63,6 +64,8 @@ void Group::addToHead(Node* node)
 
     if (m_last == nullptr)
         m_last = node;
+
+    topologyChanged();
 }
 
 void Group::addToTail(Node* node)
@@ -82,6 +85,8 @@ void Group::addToTail(Node* node)
 
     if (m_first == nullptr)
         m_first = node;
+
+    topologyChanged();
 }
 
 void Group::addBefore(Node* target, Node* node)
@@ -95,11 +100,15 @@ void Group::addBefore(Node* target, Node* node)
 
     node->m_parent = this;
     node->m_prev = target->m_prev;
+    if (target->m_prev != nullptr)
+        target->m_prev->m_next = node;
     target->m_prev = node;
     node->m_next = target;
 
     if (target == m_first)
         m_first = node;
+
+    topologyChanged();
 }
 
 void Group::addAfter(Node* target, Node* node)
@@ -113,11 +122,15 @@ void Group::addAfter(Node* target, Node* node)
 
     node->m_parent = this;
     node->m_next = target->m_next;
+    if (target->m_next != nullptr)
+        target->m_next->m_prev = node;
     target->m_next = node;
     node->m_prev = target;
 
     if (target == m_last)
         m_last = node;
+
+    topologyChanged();
 }
 
 void Group::remove(Node* node)
@@ -157,6 +170,16 @@ void Group::remove(Node* node)
     node->m_parent = nullptr;
     node->m_prev = nullptr;
     node->m_next = nullptr;
+
+    topologyChanged();
+}
+
+void Group::topologyChanged()
+{
+    for (Group* group = this; group != nullptr; group = group->parent())
+    {
+        group->m_topologyVersion.fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
 bool Group::isEmpty() const
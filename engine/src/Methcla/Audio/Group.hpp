@@ -17,6 +17,8 @@
 
 #include "Methcla/Audio/Node.hpp"
 
+#include <atomic>
+
 namespace Methcla { namespace Audio {
 
 class Group : public Node
@@ -40,19 +42,38 @@ public:
 
     void freeAll();
 
-private:
+    //* Signal that the children of this group or their bus mappings have changed.
+    //
+    // Increments the topology version of this group and all of its ancestors.
+    void topologyChanged();
+
+    //* Return a counter that changes whenever the topology of the subtree rooted at this group changes.
+    uint32_t topologyVersion() const
+    {
+        return m_topologyVersion.load(std::memory_order_relaxed);
+    }
+
+protected:
     Group(Environment& env, NodeId nodeId);
     ~Group();
 
     virtual void doProcess(size_t numFrames) override;
 
+    //* Process a child node without checking whether it is done.
+    static void processChild(Node* node, size_t numFrames)
+    {
+        node->doProcess(numFrames);
+    }
+
 private:
     friend class Node;
     void remove(Node* node);
 
 private:
-    Node* m_first;
-    Node* m_last;
+    Node*                   m_first;
+    Node*                   m_last;
+    // Atomic because nodes may be freed concurrently by parallel groups.
+    std::atomic<uint32_t>   m_topologyVersion;
 };
 
 } }
@@ -16,9 +16,10 @@
 #define METHCLA_AUDIO_MULTICHANNELBUFFER_HPP_INCLUDED
 
 #include "Methcla/Audio.hpp"
+#include "Methcla/Audio/DSP.hpp"
 #include "Methcla/Memory.hpp"
 
-#include <cstring>
+#include <algorithm>
 
 namespace Methcla { namespace Audio {
 
@@ -63,7 +64,7 @@ public:
 
     void deinterleave(const Methcla_AudioSample* src, size_t srcFrames)
     {
-        Methcla::Audio::deinterleave(data(), src, numChannels(), std::min(numFrames(), srcFrames));
+        DSP::deinterleave(data(), src, numChannels(), std::min(numFrames(), srcFrames));
     }
 
     void deinterleave(const Methcla_AudioSample* src)
@@ -73,19 +74,19 @@ public:
 
     void interleave(Methcla_AudioSample* dst, size_t dstFrames) const
     {
-        Methcla::Audio::interleave(dst, data(), numChannels(), std::min(numFrames(), dstFrames));
+        DSP::interleave(dst, data(), numChannels(), std::min(numFrames(), dstFrames));
     }
 
     void interleave(Methcla_AudioSample* dst) const
     {
-        Methcla::Audio::interleave(dst, data(), numChannels(), numFrames());
+        DSP::interleave(dst, data(), numChannels(), numFrames());
     }
 
     void zero()
     {
         for (size_t i=0; i < numChannels(); i++)
         {
-            std::memset(data()[i], 0, numFrames() * sizeof(Methcla_AudioSample));
+            DSP::zero(data()[i], numFrames());
         }
     }
 
@@ -26,6 +26,7 @@ Node::Node(Environment& env, NodeId nodeId)
     , m_next(nullptr)
     , m_doneFlags(kMethcla_NodeDoneDoNothing)
     , m_done(false)
+    , m_donePending(false)
 {
 }
 
@@ -68,14 +69,29 @@ void Node::doProcess(size_t)
 
 inline static void setDoneFreeSelf(Node* node)
 {
+    if (node->isDone())
+        return;
     node->setDoneFlags((Methcla_NodeDoneFlags)(node->doneFlags() | kMethcla_NodeDoneFreeSelf));
-    node->setDone();
+    node->performDoneAction();
 }
 
 void Node::setDone()
 {
+    // Only touch this node, siblings may be processed by other threads
+    if (!m_donePending.exchange(true, std::memory_order_relaxed))
+        env().nodeDone();
+}
+
+void Node::performDoneAction()
+{
+    m_donePending.store(false, std::memory_order_relaxed);
+
     Methcla_NodeDoneFlags flags(m_doneFlags);
 
+    // Mark this node first, so that nodes freeing each other terminate
+    if (flags & kMethcla_NodeDoneFreeSelf)
+        m_done = true;
+
     if (flags & kMethcla_NodeDoneFreeParent)
     {
         if (m_parent != nullptr && m_parent != env().rootNode())
@@ -114,9 +130,5 @@ void Node::setDone()
              if (m_next != nullptr)
                  setDoneFreeSelf(m_next);
         }
-        if (flags & kMethcla_NodeDoneFreeSelf)
-        {
-            m_done = true;
-        }
     }
 }
\ No newline at end of file
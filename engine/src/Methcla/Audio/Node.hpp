@@ -18,6 +18,7 @@
 #include <methcla/types.h>
 
 #include <boost/serialization/strong_typedef.hpp>
+#include <atomic>
 #include <cstdint>
 
 namespace Methcla { namespace Audio {
@@ -26,6 +27,7 @@ namespace Methcla { namespace Audio {
     // const NodeId InvalidNodeId = -1;
 
     class Environment;
+    class ExecutionPlan;
     class Group;
 
     class Node
@@ -70,8 +72,34 @@ namespace Methcla { namespace Audio {
             m_doneFlags = flags;
         }
 
+        //* Request the done action specified by the done flags.
+        //
+        // Done actions may mark siblings or the parent as done, which can be
+        // processed concurrently by other realtime threads. The request is
+        // only recorded here and the action is performed by
+        // performDoneAction() after processing of the current block has
+        // joined.
+        //
+        // Context: RT
         void setDone();
 
+        //* Perform the done action requested by setDone().
+        //
+        // Context: RT (audio thread)
+        void performDoneAction();
+
+        //* Return true if setDone() has been called and the done action hasn't been performed yet.
+        bool isDonePending() const
+        {
+            return m_donePending.load(std::memory_order_relaxed);
+        }
+
+        //* Return true if the node is going to be freed before it is processed next.
+        bool isDone() const
+        {
+            return m_done;
+        }
+
         //* Free a node.
         void free();
 
@@ -82,6 +110,7 @@ namespace Methcla { namespace Audio {
         virtual void doProcess(size_t numFrames);
 
     protected:
+        friend class ExecutionPlan;
         friend class Group;
 
         Environment&            m_env;
@@ -93,6 +122,8 @@ namespace Methcla { namespace Audio {
 
         Methcla_NodeDoneFlags   m_doneFlags;
         bool                    m_done;
+        // Set by setDone() from any realtime thread
+        std::atomic<bool>       m_donePending;
     };
 } }
 
@@ -0,0 +1,97 @@
+// Copyright 2012-2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Methcla/Audio/Engine.hpp"
+#include "Methcla/Audio/ParallelGroup.hpp"
+
+#include <algorithm>
+
+using namespace Methcla::Audio;
+
+ParallelGroup::ParallelGroup(Environment& env, NodeId nodeId)
+    : Group(env, nodeId)
+    , m_tasks(nullptr)
+    , m_capacity(0)
+    , m_numFrames(0)
+{
+}
+
+ParallelGroup::~ParallelGroup()
+{
+    env().rtMem().free(m_tasks);
+}
+
+ParallelGroup* ParallelGroup::construct(Environment& env, NodeId nodeId)
+{
+    return new (env.rtMem().alloc(sizeof(ParallelGroup))) ParallelGroup(env, nodeId);
+}
+
+bool ParallelGroup::reserve(size_t numTasks)
+{
+    if (numTasks > m_capacity)
+    {
+        const size_t capacity = std::max(numTasks, 2 * m_capacity);
+        try
+        {
+            Node** tasks = env().rtMem().allocOf<Node*>(capacity);
+            env().rtMem().free(m_tasks);
+            m_tasks = tasks;
+            m_capacity = capacity;
+        }
+        catch (std::bad_alloc&)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ParallelGroup::processTask(void* data, size_t task)
+{
+    ParallelGroup* self = static_cast<ParallelGroup*>(data);
+    processChild(self->m_tasks[task], self->m_numFrames);
+}
+
+void ParallelGroup::doProcess(size_t numFrames)
+{
+    // Free children that are done before going parallel; freeing modifies the group.
+    size_t numTasks = 0;
+    Node* node = first();
+    while (node != nullptr)
+    {
+        Node* nextNode = node->next();
+        if (node->isDone())
+            node->free();
+        else
+            numTasks++;
+        node = nextNode;
+    }
+
+    if (!reserve(numTasks))
+    {
+        // Out of realtime memory; fall back to serial processing.
+        Group::doProcess(numFrames);
+        return;
+    }
+
+    size_t i = 0;
+    for (node = first(); node != nullptr; node = node->next())
+    {
+        m_tasks[i++] = node;
+    }
+    assert( i == numTasks );
+
+    m_numFrames = numFrames;
+    env().threadPool().run(processTask, this, numTasks);
+}
@@ -0,0 +1,55 @@
+// Copyright 2012-2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_AUDIO_PARALLELGROUP_HPP_INCLUDED
+#define METHCLA_AUDIO_PARALLELGROUP_HPP_INCLUDED
+
+#include "Methcla/Audio/Group.hpp"
+
+namespace Methcla { namespace Audio {
+
+//* Group whose children are processed concurrently by the realtime thread pool.
+//
+// The children of a parallel group must not depend on each other, i.e. no
+// child may read a bus that is written by one of its siblings. Children
+// writing to the same bus are fine, accumulation is serialized by the bus
+// lock. Processing joins before the parent group continues with the next
+// node.
+class ParallelGroup : public Group
+{
+public:
+    static ParallelGroup* construct(Environment& env, NodeId nodeId);
+
+private:
+    ParallelGroup(Environment& env, NodeId nodeId);
+    ~ParallelGroup();
+
+    virtual void doProcess(size_t numFrames) override;
+
+    //* Make room for at least `numTasks` children in the task array.
+    //
+    // Return false if the realtime memory is exhausted.
+    bool reserve(size_t numTasks);
+
+    static void processTask(void* data, size_t task);
+
+private:
+    Node**  m_tasks;
+    size_t  m_capacity;
+    size_t  m_numFrames;
+};
+
+} }
+
+#endif // METHCLA_AUDIO_PARALLELGROUP_HPP_INCLUDED
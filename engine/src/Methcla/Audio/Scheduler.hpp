@@ -0,0 +1,374 @@
+// Copyright 2012-2014 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_AUDIO_SCHEDULER_HPP_INCLUDED
+#define METHCLA_AUDIO_SCHEDULER_HPP_INCLUDED
+
+#include <methcla/common.h>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace Methcla { namespace Audio {
+
+//* Queue of time stamped items, ordered by time.
+//
+// Items are kept in a hierarchical timing wheel keyed on slot index, where a
+// slot usually covers one audio block. Each of the three levels has 256
+// slots, covering 2^8, 2^16 and 2^24 slots respectively; items further in
+// the future are kept in an overflow list that is redistributed every 2^24
+// slots. When the wheel advances to the next range of a level, the items of
+// the corresponding slot are cascaded to the level below.
+//
+// Inserting an item and draining the items of a block are constant time
+// operations. Only the items within a slot of the lowest level are kept
+// sorted by time; inserting items in time order appends them to the slot in
+// constant time. Items with equal times are returned in insertion order.
+//
+// Memory for items is allocated up front when a maximum size is given,
+// otherwise the queue grows on demand.
+template <typename T> class Scheduler
+{
+    typedef uint32_t Index;
+
+    static const Index kNil = std::numeric_limits<Index>::max();
+
+    enum
+    {
+        kLevelBits = 8,
+        kNumSlots  = 1 << kLevelBits,
+        kSlotMask  = kNumSlots - 1,
+        kNumLevels = 3
+    };
+
+    struct Item
+    {
+        Item(Methcla_Time time, uint64_t slot, const T& data)
+            : m_time(time)
+            , m_slot(slot)
+            , m_next(kNil)
+            , m_data(data)
+        { }
+
+        Methcla_Time    m_time;
+        uint64_t        m_slot;
+        Index           m_next;
+        T               m_data;
+    };
+
+    struct List
+    {
+        Index head;
+        Index tail;
+
+        bool isEmpty() const
+        {
+            return head == kNil;
+        }
+    };
+
+    size_t              m_maxSize;
+    double              m_slotsPerSecond;
+    // Items and free list; slots of removed items are reused
+    std::vector<Item>   m_items;
+    Index               m_free;
+    size_t              m_size;
+    // Slot index of the current block
+    uint64_t            m_current;
+    List                m_wheel[kNumLevels][kNumSlots];
+    List                m_overflow;
+
+public:
+    //* Construct a scheduler with slots of `1/slotsPerSecond` seconds.
+    //
+    // If `maxSize` is zero, the number of items is unbounded.
+    Scheduler(size_t maxSize, double slotsPerSecond)
+        : m_maxSize(maxSize)
+        , m_slotsPerSecond(slotsPerSecond)
+        , m_free(kNil)
+        , m_size(0)
+        , m_current(0)
+    {
+        assert( m_maxSize < kNil );
+        m_items.reserve(m_maxSize);
+        for (size_t level=0; level < kNumLevels; level++) {
+            for (size_t i=0; i < kNumSlots; i++) {
+                clear(m_wheel[level][i]);
+            }
+        }
+        clear(m_overflow);
+    }
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    //* Insert an item scheduled at `time`.
+    //
+    // Items scheduled before the current block are due in the current block.
+    //
+    // Context: RT
+    void push(Methcla_Time time, const T& data)
+    {
+        Index index;
+        if (m_free != kNil) {
+            index = m_free;
+            m_free = m_items[index].m_next;
+            Item& item = m_items[index];
+            item.m_time = time;
+            item.m_slot = slot(time);
+            item.m_next = kNil;
+            item.m_data = data;
+        } else if (m_maxSize == 0 || m_items.size() < m_maxSize) {
+            index = m_items.size();
+            m_items.push_back(Item(time, slot(time), data));
+        } else {
+            throw std::runtime_error("Scheduler queue overflow");
+        }
+        insert(index);
+        m_size++;
+    }
+
+    bool isEmpty() const
+    {
+        return m_size == 0;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    //* Maximum number of items, zero if unbounded.
+    size_t maxSize() const
+    {
+        return m_maxSize;
+    }
+
+    //* Advance to the block starting at `time`.
+    //
+    // Context: RT
+    void advance(Methcla_Time time)
+    {
+        advanceTo(slot(time));
+    }
+
+    //* Return true if an item is scheduled before `endTime`.
+    //
+    // Advances to the block ending at `endTime`; the earliest item is then
+    // accessible with time() and top() and removed with pop().
+    //
+    // Context: RT
+    bool isDue(Methcla_Time endTime)
+    {
+        advanceTo(slot(endTime));
+
+        const List& list = m_wheel[0][m_current & kSlotMask];
+        if (list.isEmpty())
+            return false;
+
+        // Items of the last slot may be scheduled after the end of the block
+        const Item& item = m_items[list.head];
+        return item.m_slot < m_current || item.m_time < endTime;
+    }
+
+    Methcla_Time time() const
+    {
+        assert(!isEmpty());
+        return m_items[m_wheel[0][m_current & kSlotMask].head].m_time;
+    }
+
+    const T& top() const
+    {
+        assert(!isEmpty());
+        return m_items[m_wheel[0][m_current & kSlotMask].head].m_data;
+    }
+
+    void pop()
+    {
+        assert(!isEmpty());
+        List& list = m_wheel[0][m_current & kSlotMask];
+        const Index index = list.head;
+        list.head = m_items[index].m_next;
+        if (list.head == kNil)
+            list.tail = kNil;
+        m_items[index].m_next = m_free;
+        m_free = index;
+        m_size--;
+    }
+
+    //* Remove all items, passing the data of each to `func`.
+    //
+    // Context: NRT, after the realtime thread has stopped
+    template <class F> void removeAll(F func)
+    {
+        for (size_t level=0; level < kNumLevels; level++) {
+            for (size_t i=0; i < kNumSlots; i++) {
+                removeAll(m_wheel[level][i], func);
+            }
+        }
+        removeAll(m_overflow, func);
+        m_items.clear();
+        m_free = kNil;
+        m_size = 0;
+    }
+
+private:
+    template <class F> void removeAll(List& list, F func)
+    {
+        for (Index index = list.head; index != kNil; index = m_items[index].m_next) {
+            func(m_items[index].m_data);
+        }
+        clear(list);
+    }
+
+    static void clear(List& list)
+    {
+        list.head = list.tail = kNil;
+    }
+
+    uint64_t slot(Methcla_Time time) const
+    {
+        return time > 0. ? (uint64_t)(time * m_slotsPerSecond) : 0;
+    }
+
+    void append(List& list, Index index)
+    {
+        m_items[index].m_next = kNil;
+        if (list.isEmpty()) {
+            list.head = index;
+        } else {
+            m_items[list.tail].m_next = index;
+        }
+        list.tail = index;
+    }
+
+    // Insert into a slot of the lowest level, after all items with a smaller or equal time.
+    void insertSorted(List& list, Index index)
+    {
+        Item& item = m_items[index];
+        if (list.isEmpty() || m_items[list.tail].m_time <= item.m_time) {
+            append(list, index);
+        } else if (item.m_time < m_items[list.head].m_time) {
+            item.m_next = list.head;
+            list.head = index;
+        } else {
+            Index prev = list.head;
+            while (m_items[m_items[prev].m_next].m_time <= item.m_time)
+                prev = m_items[prev].m_next;
+            item.m_next = m_items[prev].m_next;
+            m_items[prev].m_next = index;
+        }
+    }
+
+    void insert(Index index)
+    {
+        const uint64_t slot = m_items[index].m_slot;
+        if (slot <= m_current) {
+            // Late items are due in the current block
+            insertSorted(m_wheel[0][m_current & kSlotMask], index);
+        } else if ((slot >> kLevelBits) == (m_current >> kLevelBits)) {
+            insertSorted(m_wheel[0][slot & kSlotMask], index);
+        } else if ((slot >> (2*kLevelBits)) == (m_current >> (2*kLevelBits))) {
+            append(m_wheel[1][(slot >> kLevelBits) & kSlotMask], index);
+        } else if ((slot >> (3*kLevelBits)) == (m_current >> (3*kLevelBits))) {
+            append(m_wheel[2][(slot >> (2*kLevelBits)) & kSlotMask], index);
+        } else {
+            append(m_overflow, index);
+        }
+    }
+
+    // Reinsert the items of a list relative to the current slot.
+    void cascade(List& list)
+    {
+        Index index = list.head;
+        clear(list);
+        while (index != kNil) {
+            const Index next = m_items[index].m_next;
+            insert(index);
+            index = next;
+        }
+    }
+
+    // Move all items from `src` to the end of `dst`.
+    void concat(List& dst, List& src)
+    {
+        if (!src.isEmpty()) {
+            if (dst.isEmpty())
+                dst.head = src.head;
+            else
+                m_items[dst.tail].m_next = src.head;
+            dst.tail = src.tail;
+            clear(src);
+        }
+    }
+
+    void advanceTo(uint64_t slot)
+    {
+        if (slot <= m_current)
+            return;
+
+        if (m_size == 0) {
+            m_current = slot;
+            return;
+        }
+
+        if (slot - m_current > kNumSlots) {
+            // Large jumps only happen when the time base changes; reinsert
+            // all items instead of stepping through the intermediate slots.
+            List items;
+            clear(items);
+            for (size_t level=0; level < kNumLevels; level++) {
+                for (size_t i=0; i < kNumSlots; i++) {
+                    concat(items, m_wheel[level][i]);
+                }
+            }
+            concat(items, m_overflow);
+            m_current = slot;
+            cascade(items);
+            return;
+        }
+
+        // Items of the passed slots are due in the new current slot
+        List due;
+        clear(due);
+        concat(due, m_wheel[0][m_current & kSlotMask]);
+
+        while (m_current < slot) {
+            m_current++;
+            if ((m_current & kSlotMask) == 0) {
+                // Cascade from the highest level that wrapped around
+                if ((m_current & ((1 << (2*kLevelBits)) - 1)) == 0) {
+                    if ((m_current & ((1 << (3*kLevelBits)) - 1)) == 0)
+                        cascade(m_overflow);
+                    cascade(m_wheel[2][(m_current >> (2*kLevelBits)) & kSlotMask]);
+                }
+                cascade(m_wheel[1][(m_current >> kLevelBits) & kSlotMask]);
+            }
+            if (m_current < slot)
+                concat(due, m_wheel[0][m_current & kSlotMask]);
+        }
+
+        List& current = m_wheel[0][m_current & kSlotMask];
+        concat(due, current);
+        current = due;
+    }
+};
+
+} }
+
+#endif // METHCLA_AUDIO_SCHEDULER_HPP_INCLUDED
@@ -12,7 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "Methcla/Audio/Group.hpp"
 #include "Methcla/Audio/Synth.hpp"
+#include "Methcla/Utility/ThreadPool.hpp"
 
 #include <algorithm>
 #include <boost/type_traits/alignment_of.hpp>
@@ -32,6 +34,7 @@ Synth::Synth( Environment& env
             , Methcla_Synth* synth
             , AudioInputConnection* audioInputConnections
             , AudioOutputConnection* audioOutputConnections
+            , ControlConnection* controlConnections
             , sample_t* controlBuffers
             , sample_t* audioBuffers
             )
@@ -41,16 +44,24 @@ Synth::Synth( Environment& env
     , m_numControlOutputs(numControlOutputs)
     , m_numAudioInputs(numAudioInputs)
     , m_numAudioOutputs(numAudioOutputs)
+    , m_numScratchBuffers(0)
+    , m_numConnectedAudioInputs(0)
+    , m_numConnectedAudioOutputs(0)
     , m_sampleOffset(0.)
+    , m_tailFrames(0)
+    , m_silentFrames(0)
     , m_synth(synth)
     , m_audioInputConnections(audioInputConnections)
     , m_audioOutputConnections(audioOutputConnections)
+    , m_controlConnections(controlConnections)
     , m_controlBuffers(controlBuffers)
     , m_audioBuffers(audioBuffers)
 {
     // Initialize flags
     memset(&m_flags, 0, sizeof(m_flags));
     m_flags.state = kStateInactive;
+    // Buses may be written concurrently when processing with more than one thread
+    m_flags.accumulateInPlace = env.threadPool().numThreads() < 2;
 
     // Align audio buffers
     m_audioBuffers = kBufferAlignment.align(audioBuffers);
@@ -60,6 +71,8 @@ Synth::Synth( Environment& env
                                  (uintptr_t)m_audioInputConnections) );
     assert( Alignment::isAligned(boost::alignment_of<AudioOutputConnection>::value,
                                  (uintptr_t)m_audioOutputConnections) );
+    assert( Alignment::isAligned(boost::alignment_of<ControlConnection>::value,
+                                 (uintptr_t)m_controlConnections) );
     assert( Alignment::isAligned(boost::alignment_of<sample_t>::value,
                                  (uintptr_t)m_controlBuffers) );
     assert( kBufferAlignment.isAligned(m_audioBuffers) );
@@ -82,12 +95,15 @@ Synth* Synth::construct(Environment& env, NodeId nodeId, const SynthDef& synthDe
     Methcla_PortCount numControlOutputs = 0;
     Methcla_PortCount numAudioInputs    = 0;
     Methcla_PortCount numAudioOutputs   = 0;
+    Methcla_PortCount numPersistentAudioBuffers = 0;
 
     // Get port counts.
     Methcla_PortDescriptor port;
     for (size_t i=0; synthDef.portDescriptor(synthOptions, i, &port); i++) {
         switch (port.type) {
             case kMethcla_AudioPort:
+                if (port.flags & kMethcla_PersistentBuffer)
+                    numPersistentAudioBuffers++;
                 switch (port.direction) {
                     case kMethcla_Input:
                         numAudioInputs++;
@@ -115,15 +131,23 @@ Synth* Synth::construct(Environment& env, NodeId nodeId, const SynthDef& synthDe
     // const size_t numAudioOutputs            = synthDef.numAudioOutputs();
     const size_t blockSize                  = env.blockSize();
 
+    // Ports use the per-thread scratch buffers, unless they need persistent
+    // buffers or the synth has more ports than there are scratch buffers.
+    const size_t numAudioPorts              = numAudioInputs + numAudioOutputs;
+    const bool useScratchBuffers            = numAudioPorts - numPersistentAudioBuffers <= env.numScratchBuffers();
+    const size_t numAudioBuffers            = useScratchBuffers ? numPersistentAudioBuffers : numAudioPorts;
+
     const size_t synthAllocSize             = sizeof(Synth) + synthDef.instanceSize();
     const size_t audioInputOffset           = synthAllocSize;
     const size_t audioInputAllocSize        = numAudioInputs * sizeof(AudioInputConnection);
     const size_t audioOutputOffset          = audioInputOffset + audioInputAllocSize;
     const size_t audioOutputAllocSize       = numAudioOutputs * sizeof(AudioOutputConnection);
-    const size_t controlBufferOffset        = audioOutputOffset + audioOutputAllocSize;
+    const size_t controlConnectionOffset    = audioOutputOffset + audioOutputAllocSize;
+    const size_t controlConnectionAllocSize = (numControlInputs + numControlOutputs) * sizeof(ControlConnection);
+    const size_t controlBufferOffset        = controlConnectionOffset + controlConnectionAllocSize;
     const size_t controlBufferAllocSize     = (numControlInputs + numControlOutputs) * sizeof(sample_t);
     const size_t audioBufferOffset          = controlBufferOffset + controlBufferAllocSize;
-    const size_t audioBufferAllocSize       = (numAudioInputs + numAudioOutputs) * blockSize * sizeof(sample_t);
+    const size_t audioBufferAllocSize       = numAudioBuffers * blockSize * sizeof(sample_t);
     const size_t allocSize                  = audioBufferOffset + audioBufferAllocSize + kBufferAlignment /* alignment margin */;
 
     char* mem = env.rtMem().allocOf<char>(allocSize);
@@ -141,6 +165,7 @@ Synth* Synth::construct(Environment& env, NodeId nodeId, const SynthDef& synthDe
             reinterpret_cast<Methcla_Synth*>(mem + sizeof(Synth)),
             reinterpret_cast<AudioInputConnection*>(mem + audioInputOffset),
             reinterpret_cast<AudioOutputConnection*>(mem + audioOutputOffset),
+            reinterpret_cast<ControlConnection*>(mem + controlConnectionOffset),
             reinterpret_cast<sample_t*>(mem + controlBufferOffset),
             reinterpret_cast<sample_t*>(mem + audioBufferOffset)
         );
@@ -149,7 +174,7 @@ Synth* Synth::construct(Environment& env, NodeId nodeId, const SynthDef& synthDe
     synth->construct(synthOptions);
 
     // Connect ports
-    synth->connectPorts(synthOptions, controls);
+    synth->connectPorts(synthOptions, controls, useScratchBuffers);
 
     return synth;
 }
@@ -165,13 +190,31 @@ void Synth::construct(const Methcla_SynthOptions* synthOptions)
     m_synthDef.construct(env(), synthOptions, m_synth);
 }
 
-void Synth::connectPorts(const Methcla_SynthOptions* synthOptions, OSCPP::Server::ArgStream controls)
+void Synth::connectPorts(const Methcla_SynthOptions* synthOptions, OSCPP::Server::ArgStream controls, bool useScratchBuffers)
 {
+    Environment& env = this->env();
+    const size_t blockSize = env.blockSize();
+    sample_t* const scratch = env.scratchBuffers();
+    size_t audioBufferIndex = 0;
+
+    // Return persistent buffer for port or nullptr and offset into scratch buffers.
+    auto allocBuffer = [&](const Methcla_PortDescriptor& port, size_t& scratchOffset) -> sample_t* {
+        if (useScratchBuffers && (port.flags & kMethcla_PersistentBuffer) == 0) {
+            scratchOffset = m_numScratchBuffers++ * blockSize;
+            return nullptr;
+        }
+        sample_t* buffer = m_audioBuffers + audioBufferIndex++ * blockSize;
+        assert( kBufferAlignment.isAligned(buffer) );
+        scratchOffset = 0;
+        return buffer;
+    };
+
     Methcla_PortDescriptor port;
     Methcla_PortCount controlInputIndex  = 0;
     Methcla_PortCount controlOutputIndex = 0;
     Methcla_PortCount audioInputIndex    = 0;
     Methcla_PortCount audioOutputIndex   = 0;
+    bool silenceInSilenceOut = true;
     for (size_t i=0; m_synthDef.portDescriptor(synthOptions, i, &port); i++) {
         switch (port.type) {
         case kMethcla_ControlPort:
@@ -180,12 +223,14 @@ void Synth::connectPorts(const Methcla_SynthOptions* synthOptions, OSCPP::Server
                 // Initialize with control value
                 m_controlBuffers[controlInputIndex] = controls.next<float>();
                 sample_t* buffer = &m_controlBuffers[controlInputIndex];
+                new (&m_controlConnections[controlInputIndex]) ControlConnection(i, buffer);
                 m_synthDef.connect(m_synth, i, buffer);
                 controlInputIndex++;
                 };
                 break;
             case kMethcla_Output: {
                 sample_t* buffer = &m_controlBuffers[numControlInputs() + controlOutputIndex];
+                new (&m_controlConnections[numControlInputs() + controlOutputIndex]) ControlConnection(i, buffer);
                 m_synthDef.connect(m_synth, i, buffer);
                 controlOutputIndex++;
                 };
@@ -195,18 +240,31 @@ void Synth::connectPorts(const Methcla_SynthOptions* synthOptions, OSCPP::Server
         case kMethcla_AudioPort:
             switch (port.direction) {
             case kMethcla_Input: {
-                new (&m_audioInputConnections[audioInputIndex]) AudioInputConnection(audioInputIndex);
-                sample_t* buffer = m_audioBuffers + audioInputIndex * env().blockSize();
-                assert( kBufferAlignment.isAligned(buffer) );
-                m_synthDef.connect(m_synth, i, buffer);
+                size_t scratchOffset;
+                sample_t* buffer = allocBuffer(port, scratchOffset);
+                // Unconnected inputs are not read, initialize with silence.
+                // Scratch inputs are connected to the processing thread's
+                // scratch memory before each block.
+                sample_t* data = buffer;
+                if (buffer != nullptr)
+                    DSP::zero(buffer, blockSize);
+                else
+                    data = const_cast<sample_t*>(env.zeroBuffer());
+                new (&m_audioInputConnections[audioInputIndex])
+                    AudioInputConnection(audioInputIndex, i, buffer, scratchOffset, data);
+                m_synthDef.connect(m_synth, i, data);
                 audioInputIndex++;
                 };
                 break;
             case kMethcla_Output: {
-                new (&m_audioOutputConnections[audioOutputIndex]) AudioOutputConnection(audioOutputIndex);
-                sample_t* buffer = m_audioBuffers + (numAudioInputs() + audioOutputIndex) * env().blockSize();
-                assert( kBufferAlignment.isAligned(buffer) );
-                m_synthDef.connect(m_synth, i, buffer);
+                size_t scratchOffset;
+                sample_t* buffer = allocBuffer(port, scratchOffset);
+                sample_t* data = buffer != nullptr ? buffer : scratch + scratchOffset;
+                new (&m_audioOutputConnections[audioOutputIndex])
+                    AudioOutputConnection(audioOutputIndex, i, buffer, scratchOffset, data);
+                m_synthDef.connect(m_synth, i, data);
+                if ((port.flags & kMethcla_SilenceInSilenceOut) == 0)
+                    silenceInSilenceOut = false;
                 audioOutputIndex++;
                 };
                 break;
@@ -214,6 +272,7 @@ void Synth::connectPorts(const Methcla_SynthOptions* synthOptions, OSCPP::Server
             break;
         }
     }
+    m_flags.silenceInSilenceOut = silenceInSilenceOut && numAudioOutputs() > 0;
 }
 
 template <class T>
@@ -232,15 +291,6 @@ private:
     Methcla_PortCount m_index;
 };
 
-template <class T>
-struct ByBusId
-{
-    inline bool operator () (const T& a, const T& b) const
-    {
-        return a.busId() < b.busId();
-    }
-};
-
 void Synth::mapInput(Methcla_PortCount index, const AudioBusId& busId, Methcla_BusMappingFlags flags)
 {
     AudioInputConnection* const begin = m_audioInputConnections;
@@ -253,7 +303,22 @@ void Synth::mapInput(Methcla_PortCount index, const AudioBusId& busId, Methcla_B
         AudioBus* bus = flags & kMethcla_BusMappingExternal
                             ? env().externalAudioInput(busId)
                             : env().audioBus(busId);
-        conn->connect(bus, flags);
+        if (conn->connect(bus, flags)) {
+            if (bus == nullptr) {
+                // Unconnected inputs are not read, reset to silence
+                if (conn->isPersistent()) {
+                    sample_t* buffer = conn->buffer(nullptr);
+                    DSP::zero(buffer, env().blockSize());
+                    connectPort(*conn, buffer);
+                } else {
+                    // Replaced by scratch memory before the next block
+                    connectPort(*conn, const_cast<sample_t*>(env().zeroBuffer()));
+                }
+            }
+            updateConnections();
+            if (parent() != nullptr)
+                parent()->topologyChanged();
+        }
     }
 }
 
@@ -269,7 +334,99 @@ void Synth::mapOutput(Methcla_PortCount index, const AudioBusId& busId, Methcla_
         AudioBus* bus = flags & kMethcla_BusMappingExternal
                             ? env().externalAudioOutput(busId)
                             : env().audioBus(busId);
-        conn->connect(bus, flags);
+        if (conn->connect(bus, flags)) {
+            if (bus == nullptr)
+                connectPort(*conn, conn->buffer(env().scratchBuffers()));
+            updateConnections();
+            if (parent() != nullptr)
+                parent()->topologyChanged();
+        }
+    }
+}
+
+void Synth::mapControl(ControlConnection& conn, Methcla_PortCount bufferIndex, const ControlBusId* bus)
+{
+    if (bus != nullptr ? conn.connect(*bus) : conn.disconnect()) {
+        sample_t* data = bus != nullptr ? env().controlBus(*bus) : &m_controlBuffers[bufferIndex];
+        m_synthDef.connect(m_synth, conn.port(), data);
+        conn.setPortData(data);
+        if (parent() != nullptr)
+            parent()->topologyChanged();
+    }
+}
+
+void Synth::mapControlInput(Methcla_PortCount index, const ControlBusId& busId)
+{
+    assert( index < numControlInputs() );
+    mapControl(m_controlConnections[index], index, &busId);
+}
+
+void Synth::unmapControlInput(Methcla_PortCount index)
+{
+    assert( index < numControlInputs() );
+    mapControl(m_controlConnections[index], index, nullptr);
+}
+
+void Synth::mapControlOutput(Methcla_PortCount index, const ControlBusId& busId)
+{
+    assert( index < numControlOutputs() );
+    const Methcla_PortCount i = numControlInputs() + index;
+    mapControl(m_controlConnections[i], i, &busId);
+}
+
+void Synth::unmapControlOutput(Methcla_PortCount index)
+{
+    assert( index < numControlOutputs() );
+    const Methcla_PortCount i = numControlInputs() + index;
+    mapControl(m_controlConnections[i], i, nullptr);
+}
+
+// Stable partition without allocating memory; returns the number of connected connections.
+template <class Conn>
+static Methcla_PortCount partitionConnected(Conn* begin, Conn* end)
+{
+    Conn* next = begin;
+    for (Conn* it = begin; it != end; it++) {
+        if (it->isConnected()) {
+            std::rotate(next, it, it + 1);
+            next++;
+        }
+    }
+    return next - begin;
+}
+
+void Synth::updateConnections()
+{
+    m_numConnectedAudioInputs =
+        partitionConnected(m_audioInputConnections, m_audioInputConnections + numAudioInputs());
+    m_numConnectedAudioOutputs =
+        partitionConnected(m_audioOutputConnections, m_audioOutputConnections + numAudioOutputs());
+
+    auto numPortsMappedTo = [this](const AudioBus* bus) -> size_t {
+        size_t result = 0;
+        for (size_t i=0; i < m_numConnectedAudioInputs; i++) {
+            if (audioInputConnection(i).bus() == bus)
+                result++;
+        }
+        for (size_t i=0; i < m_numConnectedAudioOutputs; i++) {
+            if (audioOutputConnection(i).bus() == bus)
+                result++;
+        }
+        return result;
+    };
+
+    // Ports sharing a bus with other ports of this synth are not allowed to
+    // access the bus directly, because the plugin might not support aliased
+    // buffers. Ports with persistent buffers always use their own buffer.
+    for (size_t i=0; i < m_numConnectedAudioInputs; i++) {
+        m_audioInputConnections[i].setDirect(
+               !audioInputConnection(i).isPersistent()
+            && numPortsMappedTo(audioInputConnection(i).bus()) == 1);
+    }
+    for (size_t i=0; i < m_numConnectedAudioOutputs; i++) {
+        m_audioOutputConnections[i].setDirect(
+               !audioOutputConnection(i).isPersistent()
+            && numPortsMappedTo(audioOutputConnection(i).bus()) == 1);
     }
 }
 
@@ -283,67 +440,45 @@ void Synth::activate(double sampleOffset)
     }
 }
 
+void Synth::setTailTime(double tailTime)
+{
+    m_tailFrames = (size_t)std::max(0., tailTime * env().sampleRate());
+}
+
 void Synth::doProcess(size_t numFrames)
 {
-    // Sort connections by bus id (if necessary)
-    // Only needed for bus locking protocol in a parallel implementation
-    // if (m_flags.audioInputConnectionsChanged) {
-    //     m_flags.audioInputConnectionsChanged = false;
-    //     std::sort( m_audioInputConnections
-    //              , m_audioInputConnections + numAudioInputs()
-    //              , ByBusId<AudioInputConnection>() );
-    // }
-    // if (m_flags.audioOutputConnectionsChanged) {
-    //     m_flags.audioOutputConnectionsChanged = false;
-    //     std::sort( m_audioOutputConnections
-    //              , m_audioOutputConnections + numAudioOutputs()
-    //              , ByBusId<AudioOutputConnection>() );
-    // }
+    processSynth(numFrames, env().scratchBuffers());
+}
 
+void Synth::processActivating(size_t numFrames, sample_t* scratch)
+{
     Environment& env = this->env();
-    const size_t blockSize = env.blockSize();
-
-    sample_t* const inputBuffers = m_audioBuffers;
-    sample_t* const outputBuffers = m_audioBuffers + numAudioInputs() * blockSize;
 
-    if (m_flags.state == kStateActive) {
-        // TODO: Iterate only over connected connections (by tracking number of connections).
-        for (size_t i=0; i < numAudioInputs(); i++) {
-            AudioInputConnection& x = m_audioInputConnections[i];
-            x.read(env, numFrames, inputBuffers + x.index() * blockSize);
-        }
+    const size_t sampleOffset = std::floor(m_sampleOffset);
+    assert( m_sampleOffset < (double)numFrames && sampleOffset < numFrames );
 
-        m_synthDef.process(env, m_synth, numFrames);
+    for (size_t i=0; i < m_numConnectedAudioInputs; i++) {
+        AudioInputConnection& x = m_audioInputConnections[i];
+        sample_t* buffer = x.buffer(scratch);
+        connectPort(x, buffer);
+        x.read(env, numFrames - sampleOffset, buffer, sampleOffset);
+    }
 
-        for (size_t i=0; i < numAudioOutputs(); i++) {
-            AudioOutputConnection& x = m_audioOutputConnections[i];
-            x.write(env, numFrames, outputBuffers + x.index() * blockSize);
-        }
-    // Reset triggers
-//    if (m_flags.test(kHasTriggerInput)) {
-//        for (size_t i=0; i < numControlInputs(); i++) {
-//            if (synthDef().controlInputSpec(i).flags & kMethclaControlTrigger) {
-//                *controlInput(i) = 0.f;
-//            }
-//        }
-//    }
-    } else if (m_flags.state == kStateActivating) {
-        const size_t sampleOffset = std::floor(m_sampleOffset);
-        assert( m_sampleOffset < (double)numFrames && sampleOffset < numFrames );
-
-        for (size_t i=0; i < numAudioInputs(); i++) {
-            AudioInputConnection& x = m_audioInputConnections[i];
-            x.read(env, numFrames - sampleOffset, inputBuffers + x.index() * blockSize, sampleOffset);
-        }
+    connectUnconnectedInputs(numFrames - sampleOffset, scratch);
 
-        m_synthDef.process(env, m_synth, numFrames - sampleOffset);
+    for (size_t i=0; i < numAudioOutputs(); i++) {
+        AudioOutputConnection& x = m_audioOutputConnections[i];
+        connectPort(x, x.buffer(scratch));
+    }
 
-        for (size_t i=0; i < numAudioOutputs(); i++) {
-            AudioOutputConnection& x = m_audioOutputConnections[i];
-            x.zero(env, sampleOffset);
-            x.write(env, numFrames - sampleOffset, outputBuffers + x.index() * blockSize, sampleOffset);
-        }
+    m_synthDef.process(env, m_synth, numFrames - sampleOffset);
 
-        m_flags.state = kStateActive;
+    for (size_t i=0; i < m_numConnectedAudioOutputs; i++) {
+        AudioOutputConnection& x = m_audioOutputConnections[i];
+        x.zero(env, sampleOffset);
+        x.write(env, numFrames - sampleOffset, x.buffer(scratch), sampleOffset);
     }
+
+    m_flags.outputSilent = false;
+    m_flags.state = kStateActive;
 }
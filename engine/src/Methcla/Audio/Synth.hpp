@@ -16,11 +16,12 @@
 #define METHCLA_AUDIO_SYNTH_HPP_INCLUDED
 
 #include "Methcla/Audio/AudioBus.hpp"
-// #include "Methcla/Audio/DSP.h"
+#include "Methcla/Audio/DSP.hpp"
 #include "Methcla/Audio/Engine.hpp"
 
 #include <cstdint>
 #include <methcla/plugin.h>
+#include <mutex>
 #include <oscpp/server.hpp>
 #include <thread>
 
@@ -44,14 +45,28 @@ template <typename Bus>
 class Connection
 {
     Methcla_PortCount       m_index;
+    Methcla_PortCount       m_port;
     Methcla_BusMappingFlags m_flags;
+    bool                    m_direct;
     Bus*                    m_bus;
+    sample_t*               m_buffer;
+    size_t                  m_scratchOffset;
+    sample_t*               m_portData;
 
 public:
-    Connection(Methcla_PortCount index)
+    //* Construct a connection for a plugin port.
+    //
+    // The port either uses the persistent `buffer` or, if `buffer` is
+    // nullptr, the scratch buffer at `scratchOffset` of the current thread.
+    Connection(Methcla_PortCount index, Methcla_PortCount port, sample_t* buffer, size_t scratchOffset, sample_t* portData)
         : m_index(index)
+        , m_port(port)
         , m_flags(kMethcla_BusMappingInternal)
+        , m_direct(false)
         , m_bus(nullptr)
+        , m_buffer(buffer)
+        , m_scratchOffset(scratchOffset)
+        , m_portData(portData)
     {}
 
     Methcla_PortCount index() const
@@ -59,85 +74,288 @@ public:
         return m_index;
     }
 
+    //* Return the plugin port index.
+    Methcla_PortCount port() const
+    {
+        return m_port;
+    }
+
+    //* Return true if the port uses a buffer owned by the synth.
+    bool isPersistent() const
+    {
+        return m_buffer != nullptr;
+    }
+
+    //* Return the buffer for this port, given the scratch buffers of the current thread.
+    sample_t* buffer(sample_t* scratch)
+    {
+        return m_buffer != nullptr ? m_buffer : scratch + m_scratchOffset;
+    }
+
+    //* Return the memory the plugin port is currently connected to.
+    sample_t* portData()
+    {
+        return m_portData;
+    }
+
+    void setPortData(sample_t* data)
+    {
+        m_portData = data;
+    }
+
+    //* Return true if the port may access the bus memory directly.
+    //
+    // This is the case when no other port of the same synth is mapped to the bus.
+    bool isDirect() const
+    {
+        return m_direct;
+    }
+
+    void setDirect(bool direct)
+    {
+        m_direct = direct;
+    }
+
+    //* Connect to bus with flags and return true if the connection changed.
     bool connect(Bus* bus, Methcla_BusMappingFlags flags)
     {
         bool changed = false;
-        if (bus != m_bus) {
+        if (bus != m_bus || flags != m_flags) {
             m_bus = bus;
+            m_flags = flags;
             changed = true;
         }
-        m_flags = flags;
         return changed;
     }
 
-protected:
     Methcla_BusMappingFlags flags() const { return m_flags; }
+    const Bus* bus() const { return m_bus; }
+    bool isConnected() const { return m_bus != nullptr; }
+
+protected:
     Bus* bus() { return m_bus; }
 };
 
 class AudioInputConnection : public Connection<AudioBus>
 {
 public:
-    AudioInputConnection(Methcla_PortCount index)
-        : Connection<AudioBus>(index)
+    AudioInputConnection(Methcla_PortCount index, Methcla_PortCount port, sample_t* buffer, size_t scratchOffset, sample_t* portData)
+        : Connection<AudioBus>(index, port, buffer, scratchOffset, portData)
     { }
 
+    //* Return true if the input is known to be silent in the current block.
+    //
+    // External and feedback inputs are never considered silent.
+    bool isSilent(const Environment& env)
+    {
+        if (bus() != nullptr) {
+            if (flags() & (kMethcla_BusMappingExternal | kMethcla_BusMappingFeedback))
+                return false;
+            std::lock_guard<AudioBus::Lock> lock(bus()->lock());
+            return bus()->epoch() != env.epoch() || bus()->isSilent();
+        }
+        return true;
+    }
+
     void read(const Environment& env, size_t numFrames, sample_t* dst, size_t offset=0)
     {
         if (bus() != nullptr) {
-            // std::lock_guard<AudioBus::Lock> lock(bus->lock());
+            std::lock_guard<AudioBus::Lock> lock(bus()->lock());
             if (   (flags() & kMethcla_BusMappingExternal)
                 || (flags() & kMethcla_BusMappingFeedback)
                 || (bus()->epoch() == env.epoch())) {
-                memcpy(dst, bus()->data() + offset, numFrames * sizeof(sample_t));
+                DSP::copy(dst, bus()->data() + offset, numFrames);
             } else {
-                memset(dst, 0, numFrames * sizeof(sample_t));
+                DSP::zero(dst, numFrames);
             }
         } else {
-            memset(dst, 0, numFrames * sizeof(sample_t));
+            DSP::zero(dst, numFrames);
+        }
+    }
+
+    //* Return the input data for the current block.
+    //
+    // Points directly at the bus memory if possible, otherwise the bus data
+    // is copied to the connection's buffer.
+    sample_t* readBlock(const Environment& env, size_t numFrames, sample_t* scratch)
+    {
+        assert( bus() != nullptr );
+        std::lock_guard<AudioBus::Lock> lock(bus()->lock());
+        if (   (flags() & kMethcla_BusMappingExternal)
+            || (flags() & kMethcla_BusMappingFeedback)
+            || (bus()->epoch() == env.epoch())) {
+            if (isDirect())
+                return bus()->data();
+            sample_t* dst = buffer(scratch);
+            DSP::copy(dst, bus()->data(), numFrames);
+            return dst;
+        } else {
+            sample_t* dst = buffer(scratch);
+            DSP::zero(dst, numFrames);
+            return dst;
         }
     }
 };
 
 class AudioOutputConnection : public Connection<AudioBus>
 {
+    bool m_inPlace;
+
 public:
-    AudioOutputConnection(Methcla_PortCount index)
-        : Connection<AudioBus>(index)
+    AudioOutputConnection(Methcla_PortCount index, Methcla_PortCount port, sample_t* buffer, size_t scratchOffset, sample_t* portData)
+        : Connection<AudioBus>(index, port, buffer, scratchOffset, portData)
+        , m_inPlace(false)
     { }
 
+    //* Return the memory the synth writes its output to in the current block.
+    //
+    // Output is written directly to the bus when replacing its contents or,
+    // if `accumulateInPlace` is true, when this is the first write to the bus
+    // in the current block. Otherwise output goes to the connection's buffer
+    // and is copied to the bus by endWrite().
+    sample_t* beginWrite(const Environment& env, bool accumulateInPlace, sample_t* scratch)
+    {
+        assert( bus() != nullptr );
+        if (isDirect()) {
+            if (flags() & kMethcla_BusMappingReplace) {
+                m_inPlace = true;
+            } else if (accumulateInPlace) {
+                std::lock_guard<AudioBus::Lock> lock(bus()->lock());
+                if (bus()->epoch() != env.epoch()) {
+                    // Claim the bus, subsequent writers accumulate
+                    bus()->setEpoch(env.epoch());
+                    m_inPlace = true;
+                }
+            }
+        }
+        return m_inPlace ? bus()->data() : buffer(scratch);
+    }
+
+    //* Finish writing output started with beginWrite().
+    void endWrite(const Environment& env, size_t numFrames, sample_t* scratch)
+    {
+        if (m_inPlace) {
+            std::lock_guard<AudioBus::Lock> lock(bus()->lock());
+            bus()->setEpoch(env.epoch());
+            bus()->setSilent(false);
+            m_inPlace = false;
+        } else {
+            write(env, numFrames, buffer(scratch));
+        }
+    }
+
     void write(const Environment& env, size_t numFrames, const sample_t* src, size_t offset=0)
     {
         if (bus() != nullptr) {
+            std::lock_guard<AudioBus::Lock> lock(bus()->lock());
             if (   ((flags() & kMethcla_BusMappingReplace) == 0)
                 && (bus()->epoch() == env.epoch()))
             {
                 // Accumulate
-                sample_t* dst = bus()->data() + offset;
-                // accumulate(dst, src, numFrames);
-                for (size_t i=0; i < numFrames; i++) {
-                    dst[i] += src[i];
-                }
+                DSP::accumulate(bus()->data() + offset, src, numFrames);
             } else {
                 // Copy
-                std::copy(src, src + numFrames, bus()->data() + offset);
+                DSP::copy(bus()->data() + offset, src, numFrames);
                 bus()->setEpoch(env.epoch());
             }
+            bus()->setSilent(false);
+        }
+    }
+
+    //* Write a block of silence.
+    //
+    // Accumulating silence into a bus that has already been written to in
+    // the current block is a no-op.
+    void writeSilence(const Environment& env, size_t numFrames)
+    {
+        if (bus() != nullptr) {
+            std::lock_guard<AudioBus::Lock> lock(bus()->lock());
+            if (   m_inPlace
+                || ((flags() & kMethcla_BusMappingReplace) != 0)
+                || (bus()->epoch() != env.epoch()))
+            {
+                // Zero the data for feedback readers, which ignore the epoch
+                DSP::zero(bus()->data(), numFrames);
+                bus()->setEpoch(env.epoch());
+                bus()->setSilent(true);
+            }
+            m_inPlace = false;
         }
     }
 
     void zero(const Environment& env, size_t numFrames, size_t offset=0)
     {
         if (bus() != nullptr) {
+            std::lock_guard<AudioBus::Lock> lock(bus()->lock());
             if (   ((flags() & kMethcla_BusMappingReplace) != 0)
                 && (bus()->epoch() == env.epoch() /* Otherwise bus will be zero'd anyway */))
             {
-                memset(bus()->data() + offset, 0, numFrames * sizeof(sample_t));
+                DSP::zero(bus()->data() + offset, numFrames);
             }
         }
     }
 };
 
+//* Connection of a control port to a control bus.
+//
+// Unmapped ports use the synth's own control buffer; mapped ports are
+// connected directly to the bus value.
+class ControlConnection
+{
+    Methcla_PortCount   m_port;
+    bool                m_mapped;
+    ControlBusId        m_bus;
+    sample_t*           m_portData;
+
+public:
+    ControlConnection(Methcla_PortCount port, sample_t* portData)
+        : m_port(port)
+        , m_mapped(false)
+        , m_bus(0)
+        , m_portData(portData)
+    { }
+
+    //* Return the plugin port index.
+    Methcla_PortCount port() const
+    {
+        return m_port;
+    }
+
+    //* Return the memory the plugin port is currently connected to.
+    const sample_t* portData() const
+    {
+        return m_portData;
+    }
+
+    void setPortData(sample_t* data)
+    {
+        m_portData = data;
+    }
+
+    //* Map to bus and return true if the connection changed.
+    bool connect(ControlBusId bus)
+    {
+        bool changed = false;
+        if (!m_mapped || bus != m_bus) {
+            m_mapped = true;
+            m_bus = bus;
+            changed = true;
+        }
+        return changed;
+    }
+
+    //* Unmap from bus and return true if the connection changed.
+    bool disconnect()
+    {
+        const bool changed = m_mapped;
+        m_mapped = false;
+        return changed;
+    }
+
+    bool isMapped() const { return m_mapped; }
+    ControlBusId bus() const { return m_bus; }
+};
+
 class Synth : public Node
 {
 protected:
@@ -151,13 +369,14 @@ protected:
          , Methcla_Synth* synth
          , AudioInputConnection* audioInputConnections
          , AudioOutputConnection* audioOutputConnections
+         , ControlConnection* controlConnections
          , sample_t* controlBuffers
          , sample_t* audioBuffers
          );
     ~Synth();
 
     void construct(const Methcla_SynthOptions* synthOptions);
-    void connectPorts(const Methcla_SynthOptions* synthOptions, OSCPP::Server::ArgStream controls);
+    void connectPorts(const Methcla_SynthOptions* synthOptions, OSCPP::Server::ArgStream controls, bool useScratchBuffers);
     virtual void doProcess(size_t numFrames) override;
 
 public:
@@ -183,9 +402,58 @@ public:
     //* Map output to bus.
     void mapOutput(Methcla_PortCount output, const AudioBusId& busId, Methcla_BusMappingFlags flags);
 
+    //* Return the audio input connection at position `i`.
+    //
+    // NOTE: The position is not necessarily equal to the input port index.
+    const AudioInputConnection& audioInputConnection(Methcla_PortCount i) const
+    {
+        assert( i < numAudioInputs() );
+        return m_audioInputConnections[i];
+    }
+
+    //* Return the audio output connection at position `i`.
+    //
+    // NOTE: The position is not necessarily equal to the output port index.
+    const AudioOutputConnection& audioOutputConnection(Methcla_PortCount i) const
+    {
+        assert( i < numAudioOutputs() );
+        return m_audioOutputConnections[i];
+    }
+
     Methcla_PortCount numControlInputs() const { return m_numControlInputs; }
     Methcla_PortCount numControlOutputs() const { return m_numControlOutputs; }
 
+    //* Map control input to control bus.
+    //
+    // While mapped, the input reads the bus value and values set with
+    // controlInput() take effect only after unmapping.
+    void mapControlInput(Methcla_PortCount input, const ControlBusId& busId);
+
+    //* Restore control input to the synth's own control value.
+    void unmapControlInput(Methcla_PortCount input);
+
+    //* Map control output to control bus.
+    //
+    // The output replaces the bus value in each block the synth is processed.
+    void mapControlOutput(Methcla_PortCount output, const ControlBusId& busId);
+
+    //* Restore control output to the synth's own control buffer.
+    void unmapControlOutput(Methcla_PortCount output);
+
+    //* Return the control input connection with index `i`.
+    const ControlConnection& controlInputConnection(Methcla_PortCount i) const
+    {
+        assert( i < numControlInputs() );
+        return m_controlConnections[i];
+    }
+
+    //* Return the control output connection with index `i`.
+    const ControlConnection& controlOutputConnection(Methcla_PortCount i) const
+    {
+        assert( i < numControlOutputs() );
+        return m_controlConnections[numControlInputs() + i];
+    }
+
     float controlInput(Methcla_PortCount index) const
     {
         assert( index < numControlInputs() );
@@ -200,8 +468,7 @@ public:
 
     float controlOutput(Methcla_PortCount index) const
     {
-        assert( index < numControlOutputs() );
-        return m_controlBuffers[numControlInputs() + index];
+        return *controlOutputConnection(index).portData();
     }
 
     //* Activate synth.
@@ -213,6 +480,196 @@ public:
         return m_sampleOffset;
     }
 
+    //* Set the time in seconds the synth keeps being processed after its inputs have become silent.
+    //
+    // Only effective for synths declaring kMethcla_SilenceInSilenceOut on all audio outputs.
+    void setTailTime(double tailTime);
+
+    //* Signal that the synth's outputs are silent in the current block.
+    //
+    // Context: RT
+    void setOutputSilent()
+    {
+        m_flags.outputSilent = true;
+    }
+
+    //* Return the number of scratch buffers used by the synth's audio ports.
+    Methcla_PortCount numScratchBuffers() const
+    {
+        return m_numScratchBuffers;
+    }
+
+    //* Process a block of audio.
+    //
+    // Equivalent to doProcess(), but can be inlined by callers that know
+    // they are dealing with a synth, such as the execution plan. `scratch`
+    // points to at least numScratchBuffers() scratch buffers.
+    //
+    // Context: RT
+    void processSynth(size_t numFrames, sample_t* scratch)
+    {
+        if (m_flags.state == kStateActive)
+            processActive(numFrames, scratch);
+        else if (m_flags.state == kStateActivating)
+            processActivating(numFrames, scratch);
+    }
+
+    //* Prepare processing the synth as part of a batch.
+    //
+    // Return true if the synth's instance needs to be passed to the batch
+    // process function of its definition, followed by a call to
+    // endProcessBatch(). Otherwise the synth has already been processed
+    // completely for the current block.
+    //
+    // Context: RT
+    bool beginProcessBatch(size_t numFrames, sample_t* scratch)
+    {
+        if (m_flags.state == kStateActive)
+            return beginProcessActive(numFrames, scratch);
+        processSynth(numFrames, scratch);
+        return false;
+    }
+
+    //* Finish processing the synth as part of a batch.
+    //
+    // Context: RT
+    void endProcessBatch(size_t numFrames, sample_t* scratch)
+    {
+        endProcessActive(numFrames, scratch);
+    }
+
+    //* Return the plugin's synth instance.
+    Methcla_Synth* instance()
+    {
+        return m_synth;
+    }
+
+private:
+    void processActive(size_t numFrames, sample_t* scratch)
+    {
+        if (beginProcessActive(numFrames, scratch)) {
+            m_synthDef.process(env(), m_synth, numFrames);
+            endProcessActive(numFrames, scratch);
+        }
+    }
+
+    // Read inputs and return true if the synth needs to be processed.
+    bool beginProcessActive(size_t numFrames, sample_t* scratch)
+    {
+        // Bus access is serialized by the bus lock in each connection's
+        // read/write. Only one lock is held at a time, so there is no need to
+        // acquire bus locks in a particular order.
+
+        if (m_flags.silenceInSilenceOut) {
+            if (audioInputsSilent()) {
+                if (m_silentFrames >= m_tailFrames) {
+                    // Sleep until one of the inputs becomes non-silent
+                    writeSilence(numFrames);
+                    return false;
+                }
+                m_silentFrames += numFrames;
+            } else {
+                m_silentFrames = 0;
+            }
+        }
+
+        Environment& env = this->env();
+
+        for (size_t i=0; i < m_numConnectedAudioInputs; i++) {
+            AudioInputConnection& x = m_audioInputConnections[i];
+            connectPort(x, x.readBlock(env, numFrames, scratch));
+        }
+
+        connectUnconnectedInputs(numFrames, scratch);
+
+        for (size_t i=0; i < m_numConnectedAudioOutputs; i++) {
+            AudioOutputConnection& x = m_audioOutputConnections[i];
+            connectPort(x, x.beginWrite(env, m_flags.accumulateInPlace, scratch));
+        }
+
+        // Unconnected outputs are discarded, but still need a buffer
+        for (size_t i=m_numConnectedAudioOutputs; i < numAudioOutputs(); i++) {
+            AudioOutputConnection& x = m_audioOutputConnections[i];
+            connectPort(x, x.buffer(scratch));
+        }
+
+        return true;
+    }
+
+    // Write outputs after processing.
+    void endProcessActive(size_t numFrames, sample_t* scratch)
+    {
+        if (m_flags.outputSilent) {
+            m_flags.outputSilent = false;
+            writeSilence(numFrames);
+        } else {
+            Environment& env = this->env();
+            for (size_t i=0; i < m_numConnectedAudioOutputs; i++) {
+                m_audioOutputConnections[i].endWrite(env, numFrames, scratch);
+            }
+        }
+
+        // Reset triggers
+        //    if (m_flags.test(kHasTriggerInput)) {
+        //        for (size_t i=0; i < numControlInputs(); i++) {
+        //            if (synthDef().controlInputSpec(i).flags & kMethclaControlTrigger) {
+        //                *controlInput(i) = 0.f;
+        //            }
+        //        }
+        //    }
+    }
+
+    // Connect plugin port to data, unless it's already connected to it.
+    template <class Conn> void connectPort(Conn& conn, sample_t* data)
+    {
+        if (conn.portData() != data) {
+            m_synthDef.connect(m_synth, conn.port(), data);
+            conn.setPortData(data);
+        }
+    }
+
+    // Move connected connections to the front and decide which ports may access bus memory directly.
+    void updateConnections();
+
+    // Connect control port to bus or to its control buffer if `bus` is nullptr.
+    void mapControl(ControlConnection& conn, Methcla_PortCount bufferIndex, const ControlBusId* bus);
+
+    // Process first block after activation, taking the sample offset into account.
+    void processActivating(size_t numFrames, sample_t* scratch);
+
+    bool audioInputsSilent()
+    {
+        const Environment& env = this->env();
+        for (size_t i=0; i < m_numConnectedAudioInputs; i++) {
+            if (!m_audioInputConnections[i].isSilent(env))
+                return false;
+        }
+        return true;
+    }
+
+    // Connect unconnected inputs without a buffer of their own to silence in
+    // the scratch memory of the processing thread, so that a plugin writing
+    // to its inputs can't affect other synths.
+    void connectUnconnectedInputs(size_t numFrames, sample_t* scratch)
+    {
+        for (size_t i=m_numConnectedAudioInputs; i < numAudioInputs(); i++) {
+            AudioInputConnection& x = m_audioInputConnections[i];
+            if (!x.isPersistent()) {
+                sample_t* buffer = x.buffer(scratch);
+                DSP::zero(buffer, numFrames);
+                connectPort(x, buffer);
+            }
+        }
+    }
+
+    void writeSilence(size_t numFrames)
+    {
+        const Environment& env = this->env();
+        for (size_t i=0; i < m_numConnectedAudioOutputs; i++) {
+            m_audioOutputConnections[i].writeSilence(env, numFrames);
+        }
+    }
+
 private:
     enum State
     {
@@ -224,6 +681,12 @@ private:
     struct Flags
     {
         unsigned int state : 2;
+        // All audio outputs have kMethcla_SilenceInSilenceOut set
+        unsigned int silenceInSilenceOut : 1;
+        // The synth signalled silent output in the current block
+        unsigned int outputSilent : 1;
+        // Outputs may accumulate directly into buses not written yet in the current block
+        unsigned int accumulateInPlace : 1;
     };
 
     const SynthDef&         m_synthDef;
@@ -231,11 +694,19 @@ private:
     const Methcla_PortCount m_numControlOutputs;
     const Methcla_PortCount m_numAudioInputs;
     const Methcla_PortCount m_numAudioOutputs;
+    Methcla_PortCount       m_numScratchBuffers;
+    // Connected connections are kept at the front of the connection arrays
+    Methcla_PortCount       m_numConnectedAudioInputs;
+    Methcla_PortCount       m_numConnectedAudioOutputs;
     Flags                   m_flags;
     double                  m_sampleOffset;
+    size_t                  m_tailFrames;
+    size_t                  m_silentFrames;
     Methcla_Synth*          m_synth;
     AudioInputConnection*   m_audioInputConnections;
     AudioOutputConnection*  m_audioOutputConnections;
+    // Control inputs followed by control outputs
+    ControlConnection*      m_controlConnections;
     sample_t*               m_controlBuffers;
     sample_t*               m_audioBuffers;
 };
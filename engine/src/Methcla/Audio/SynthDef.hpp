@@ -70,6 +70,17 @@ public:
         m_descriptor->process(world, synth, numFrames);
     }
 
+    //* Return true if the definition provides a batch process function.
+    inline bool hasProcessBatch() const
+    {
+        return m_descriptor->process_batch != nullptr;
+    }
+
+    inline void processBatch(const Methcla_World* world, Methcla_Synth* const* synths, size_t numSynths, size_t numFrames) const
+    {
+        m_descriptor->process_batch(world, synths, numSynths, numFrames);
+    }
+
 private:
     const Methcla_SynthDef* m_descriptor;
     Methcla_SynthOptions*   m_options; // Only access from one thread
@@ -0,0 +1,69 @@
+// Copyright 2012-2014 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Methcla/IO/QueryIds.hpp"
+
+#include <oscpp/server.hpp>
+
+#include <cstdint>
+#include <exception>
+#include <tuple>
+
+using namespace Methcla;
+using namespace Methcla::IO;
+
+static void collectPacketQueries(const Audio::Environment* env, const OSCPP::Server::Packet& packet, std::vector<QueryId>& queries)
+{
+    if (packet.isBundle())
+    {
+        auto packets = OSCPP::Server::Bundle(packet).packets();
+        while (!packets.atEnd())
+            collectPacketQueries(env, packets.next(), queries);
+    }
+    else
+    {
+        OSCPP::Server::Message msg(packet);
+        if (env->isQuery(msg.address()))
+        {
+            OSCPP::Server::ArgStream args(msg.args());
+            QueryId query;
+            // The packet is writable, see collectQueries
+            query.position = const_cast<char*>(std::get<1>(args.state()).pos());
+            query.requestId = args.int32();
+            queries.push_back(query);
+        }
+    }
+}
+
+void Methcla::IO::collectQueries(const Audio::Environment* env, char* packet, size_t size, std::vector<QueryId>& queries)
+{
+    const size_t numQueries = queries.size();
+    try
+    {
+        collectPacketQueries(env, OSCPP::Server::Packet(packet, size), queries);
+    }
+    catch (std::exception&)
+    {
+        queries.erase(queries.begin() + numQueries, queries.end());
+    }
+}
+
+void Methcla::IO::replaceRequestId(const QueryId& query, Methcla_RequestId requestId)
+{
+    const uint32_t x = static_cast<uint32_t>(requestId);
+    query.position[0] = static_cast<char>(x >> 24);
+    query.position[1] = static_cast<char>(x >> 16);
+    query.position[2] = static_cast<char>(x >> 8);
+    query.position[3] = static_cast<char>(x);
+}
@@ -0,0 +1,46 @@
+// Copyright 2012-2014 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_IO_QUERYIDS_HPP_INCLUDED
+#define METHCLA_IO_QUERYIDS_HPP_INCLUDED
+
+#include <methcla/engine.h>
+
+#include "Methcla/Audio/Engine.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace Methcla { namespace IO {
+
+//* Request id of a query inside a packet received by a server.
+struct QueryId
+{
+    // Position of the request id argument in the packet
+    char*               position;
+    Methcla_RequestId   requestId;
+};
+
+//* Append the queries contained in packet to queries.
+//
+// Malformed packets are ignored; they are reported when the engine parses
+// them.
+void collectQueries(const Audio::Environment* env, char* packet, size_t size, std::vector<QueryId>& queries);
+
+//* Overwrite the request id of query in its packet.
+void replaceRequestId(const QueryId& query, Methcla_RequestId requestId);
+
+} }
+
+#endif // METHCLA_IO_QUERYIDS_HPP_INCLUDED
@@ -0,0 +1,174 @@
+// Copyright 2012-2014 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Methcla/IO/RequestCapture.hpp"
+#include "Methcla/Exception.hpp"
+
+#include <methcla/engine.h>
+
+#include <cerrno>
+#include <cstring>
+
+using namespace Methcla;
+using namespace Methcla::IO;
+
+static const char* const kInfoAddress = "/capture/info";
+static const char* const kRequestAddress = "/capture";
+
+// Size of the info message
+static const size_t kInfoSize = 16 + 4 + 2 * 4;
+// Size of the /capture message inside a request bundle
+static const size_t kRequestMessageSize = 12 + 4 + 4;
+// Offset of the request packet size inside a request bundle
+static const size_t kRequestPacketOffset = 16 + 4 + kRequestMessageSize;
+
+static void put32(std::vector<char>& buffer, uint32_t x)
+{
+    buffer.push_back((char)(x >> 24));
+    buffer.push_back((char)(x >> 16));
+    buffer.push_back((char)(x >> 8));
+    buffer.push_back((char)x);
+}
+
+static void put64(std::vector<char>& buffer, uint64_t x)
+{
+    put32(buffer, (uint32_t)(x >> 32));
+    put32(buffer, (uint32_t)x);
+}
+
+// Append a zero terminated string padded to a multiple of four bytes
+static void putString(std::vector<char>& buffer, const char* str)
+{
+    const size_t n = std::strlen(str);
+    buffer.insert(buffer.end(), str, str + n);
+    buffer.insert(buffer.end(), 4 - n % 4, 0);
+}
+
+static uint32_t get32(const char* data)
+{
+    const unsigned char* x = reinterpret_cast<const unsigned char*>(data);
+    return ((uint32_t)x[0] << 24) | ((uint32_t)x[1] << 16) | ((uint32_t)x[2] << 8) | (uint32_t)x[3];
+}
+
+static uint64_t get64(const char* data)
+{
+    return ((uint64_t)get32(data) << 32) | get32(data + 4);
+}
+
+RequestCaptureWriter::RequestCaptureWriter(const std::string& path, size_t sampleRate, size_t blockSize)
+    : m_file(std::fopen(path.c_str(), "wb"))
+{
+    if (m_file == nullptr)
+        throw Error(kMethcla_SystemError, "Couldn't open capture file " + path + ": " + std::strerror(errno));
+
+    std::setvbuf(m_file, nullptr, _IOFBF, 1 << 16);
+
+    put32(m_record, 0);
+    putString(m_record, kInfoAddress);
+    putString(m_record, ",ii");
+    put32(m_record, (uint32_t)sampleRate);
+    put32(m_record, (uint32_t)blockSize);
+    flushRecord();
+}
+
+RequestCaptureWriter::~RequestCaptureWriter()
+{
+    std::fclose(m_file);
+}
+
+void RequestCaptureWriter::write(Methcla_Time time, uint32_t block, const void* packet, size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_record.clear();
+    put32(m_record, 0);
+    putString(m_record, "#bundle");
+    put64(m_record, methcla_time_to_uint64(time));
+    put32(m_record, kRequestMessageSize);
+    putString(m_record, kRequestAddress);
+    putString(m_record, ",i");
+    put32(m_record, block);
+    put32(m_record, (uint32_t)size);
+    m_record.insert(m_record.end(), static_cast<const char*>(packet), static_cast<const char*>(packet) + size);
+    flushRecord();
+}
+
+void RequestCaptureWriter::flushRecord()
+{
+    const uint32_t size = m_record.size() - 4;
+    for (size_t i=0; i < 4; i++)
+        m_record[i] = (char)(size >> (24 - 8 * i));
+    std::fwrite(m_record.data(), 1, m_record.size(), m_file);
+}
+
+RequestCaptureReader::RequestCaptureReader(const std::string& path)
+    : m_path(path)
+    , m_file(std::fopen(path.c_str(), "rb"))
+    , m_sampleRate(0)
+    , m_blockSize(0)
+{
+    if (m_file == nullptr)
+        throw Error(kMethcla_FileNotFoundError, "Couldn't open capture file " + path);
+
+    if (!readPacket()
+        || m_packet.size() != kInfoSize
+        || std::strcmp(m_packet.data(), kInfoAddress) != 0)
+    {
+        std::fclose(m_file);
+        throw Error(kMethcla_InvalidFileError, "Not a capture file: " + path);
+    }
+
+    m_sampleRate = get32(m_packet.data() + 20);
+    m_blockSize = get32(m_packet.data() + 24);
+}
+
+RequestCaptureReader::~RequestCaptureReader()
+{
+    std::fclose(m_file);
+}
+
+bool RequestCaptureReader::readPacket()
+{
+    char header[4];
+    if (std::fread(header, 1, sizeof(header), m_file) != sizeof(header))
+        return false;
+    m_packet.resize(get32(header));
+    if (std::fread(m_packet.data(), 1, m_packet.size(), m_file) != m_packet.size())
+        throw Error(kMethcla_InvalidFileError, "Truncated capture file: " + m_path);
+    return true;
+}
+
+bool RequestCaptureReader::read(CapturedRequest& request)
+{
+    if (!readPacket())
+        return false;
+
+    const char* data = m_packet.data();
+    const size_t size = m_packet.size();
+
+    if (size < kRequestPacketOffset + 4
+        || std::memcmp(data, "#bundle", 8) != 0
+        || get32(data + 16) != kRequestMessageSize
+        || std::strcmp(data + 20, kRequestAddress) != 0
+        || kRequestPacketOffset + 4 + get32(data + kRequestPacketOffset) > size)
+    {
+        throw Error(kMethcla_InvalidFileError, "Malformed request in capture file: " + m_path);
+    }
+
+    request.time = methcla_time_from_uint64(get64(data + 8));
+    request.block = get32(data + kRequestPacketOffset - 4);
+    const char* packet = data + kRequestPacketOffset + 4;
+    request.packet.assign(packet, packet + get32(data + kRequestPacketOffset));
+
+    return true;
+}
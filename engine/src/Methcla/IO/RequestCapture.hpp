@@ -0,0 +1,108 @@
+// Copyright 2012-2014 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_IO_REQUESTCAPTURE_HPP_INCLUDED
+#define METHCLA_IO_REQUESTCAPTURE_HPP_INCLUDED
+
+#include <methcla/common.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Methcla { namespace IO {
+
+// Capture files are sequences of OSC packets, each prefixed by its size as
+// a big-endian int32, and can be printed with tools/dumposcfile.
+//
+// The first packet is the message
+//
+//     /capture/info ,ii <sample rate> <block size>
+//
+// followed by one bundle per captured request in the order the requests
+// were enqueued. The bundle's first element is the message
+//
+//     /capture ,i <block index>
+//
+// with the index (modulo 2^32) of the audio block that was due to process
+// the request when it was enqueued, the bundle's time tag is that block's
+// start time and its second element is the request packet as received.
+
+//* Request read from a capture file.
+struct CapturedRequest
+{
+    Methcla_Time        time;
+    uint32_t            block;
+    std::vector<char>   packet;
+};
+
+//* Appends incoming request packets to a capture file.
+//
+// Records are buffered and written when the buffer is full or the writer is
+// destroyed.
+class RequestCaptureWriter
+{
+public:
+    //* Create or truncate the file at path.
+    RequestCaptureWriter(const std::string& path, size_t sampleRate, size_t blockSize);
+    ~RequestCaptureWriter();
+
+    RequestCaptureWriter(const RequestCaptureWriter&) = delete;
+    RequestCaptureWriter& operator=(const RequestCaptureWriter&) = delete;
+
+    //* Append a request packet due to be processed in block, which starts at time.
+    //
+    // Context: NRT
+    void write(Methcla_Time time, uint32_t block, const void* packet, size_t size);
+
+private:
+    void flushRecord();
+
+    std::mutex          m_mutex;
+    FILE*               m_file;
+    std::vector<char>   m_record;
+};
+
+//* Reads request packets from a capture file.
+class RequestCaptureReader
+{
+public:
+    RequestCaptureReader(const std::string& path);
+    ~RequestCaptureReader();
+
+    RequestCaptureReader(const RequestCaptureReader&) = delete;
+    RequestCaptureReader& operator=(const RequestCaptureReader&) = delete;
+
+    size_t sampleRate() const { return m_sampleRate; }
+    size_t blockSize() const { return m_blockSize; }
+
+    //* Read the next request, return false at the end of the file.
+    bool read(CapturedRequest& request);
+
+private:
+    bool readPacket();
+
+    std::string         m_path;
+    FILE*               m_file;
+    size_t              m_sampleRate;
+    size_t              m_blockSize;
+    std::vector<char>   m_packet;
+};
+
+} }
+
+#endif // METHCLA_IO_REQUESTCAPTURE_HPP_INCLUDED
@@ -0,0 +1,189 @@
+// Copyright 2012-2014 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Methcla/IO/SharedMemoryServer.hpp"
+
+#if METHCLA_HAVE_SHARED_MEMORY
+
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <string>
+
+using namespace Methcla;
+using namespace Methcla::IO;
+
+// Number of empty polls before the pump thread starts sleeping; spinning
+// avoids a system call when packets arrive in quick succession.
+static const size_t kSpinCount = 256;
+// Polling interval of an idle pump thread
+static const std::chrono::microseconds kPollInterval(100);
+// Time to wait for room in the engine's request queue before dropping a request
+static const double kSendTimeout = 1.;
+// Seconds after which unanswered queries are forgotten
+static const int kRouteTimeout = 10;
+
+static void* initTransport(detail::SharedMemory& memory)
+{
+    detail::SharedMemoryTransport::init(memory.data());
+    return memory.data();
+}
+
+SharedMemoryServer::SharedMemoryServer(const std::string& name)
+    : m_memory(name, detail::SharedMemoryTransport::memorySize())
+    , m_transport(initTransport(m_memory), m_memory.size())
+    , m_env(nullptr)
+    , m_running(false)
+    , m_request(m_transport.requests().maxPacketSize())
+    , m_nextRouteExpiry(Clock::now())
+{
+}
+
+SharedMemoryServer::~SharedMemoryServer()
+{
+    stop();
+}
+
+void SharedMemoryServer::start(Audio::Environment* env)
+{
+    if (!m_running.load())
+    {
+        m_env = env;
+        m_running.store(true);
+        m_thread = std::thread(&SharedMemoryServer::run, this);
+    }
+}
+
+void SharedMemoryServer::stop()
+{
+    if (m_running.load())
+    {
+        m_running.store(false);
+        m_thread.join();
+    }
+}
+
+void SharedMemoryServer::run()
+{
+    auto send = [this](int32_t, const void* packet, size_t size) {
+        handleRequest(packet, size);
+    };
+
+    size_t numEmptyPolls = 0;
+    while (m_running.load(std::memory_order_relaxed))
+    {
+        expireRoutes();
+        if (m_transport.requests().pop(send))
+        {
+            numEmptyPolls = 0;
+        }
+        else if (numEmptyPolls < kSpinCount)
+        {
+            numEmptyPolls++;
+        }
+        else
+        {
+            std::this_thread::sleep_for(kPollInterval);
+        }
+    }
+}
+
+void SharedMemoryServer::handleRequest(const void* packet, size_t size)
+{
+    // Replace query ids in a copy, the client may reuse the cell as soon as
+    // the packet has been popped.
+    std::memcpy(m_request.data(), packet, size);
+
+    m_queries.clear();
+    collectQueries(m_env, m_request.data(), size, m_queries);
+    if (!m_queries.empty())
+    {
+        const Clock::time_point expires = Clock::now() + std::chrono::seconds(kRouteTimeout);
+        std::lock_guard<std::mutex> lock(m_routesMutex);
+        for (QueryId& query : m_queries)
+        {
+            const Methcla_RequestId requestId = m_env->newServerRequestId();
+            replaceRequestId(query, requestId);
+            Route route;
+            route.requestId = query.requestId;
+            route.expires = expires;
+            m_routes[requestId] = route;
+            // Remember the server id for removing the route on failure
+            query.requestId = requestId;
+        }
+    }
+
+    try
+    {
+        m_env->send(m_request.data(), size, kSendTimeout);
+    }
+    catch (std::exception& e)
+    {
+        m_env->logLineNRT(kMethcla_LogError, e.what());
+        std::lock_guard<std::mutex> lock(m_routesMutex);
+        for (const QueryId& query : m_queries)
+            m_routes.erase(query.requestId);
+    }
+}
+
+void SharedMemoryServer::expireRoutes()
+{
+    const Clock::time_point now = Clock::now();
+    if (now < m_nextRouteExpiry)
+        return;
+    m_nextRouteExpiry = now + std::chrono::seconds(1);
+
+    std::lock_guard<std::mutex> lock(m_routesMutex);
+    auto it = m_routes.begin();
+    while (it != m_routes.end())
+    {
+        if (it->second.expires <= now)
+        {
+            const std::string message =
+                "SharedMemoryServer: No reply to request " + std::to_string(it->second.requestId);
+            m_env->logLineNRT(kMethcla_LogWarn, message.c_str());
+            it = m_routes.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+}
+
+void SharedMemoryServer::handlePacket(Methcla_RequestId requestId, const void* packet, size_t size)
+{
+    if (size > m_transport.replies().maxPacketSize())
+        return;
+
+    if (requestId == kMethcla_Notification)
+    {
+        m_transport.replies().push(requestId, packet, size);
+    }
+    else
+    {
+        Methcla_RequestId clientRequestId;
+        {
+            std::lock_guard<std::mutex> lock(m_routesMutex);
+            auto it = m_routes.find(requestId);
+            if (it == m_routes.end())
+                return;
+            clientRequestId = it->second.requestId;
+            m_routes.erase(it);
+        }
+        m_transport.replies().push(clientRequestId, packet, size);
+    }
+}
+
+#endif // METHCLA_HAVE_SHARED_MEMORY
@@ -0,0 +1,105 @@
+// Copyright 2012-2014 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_IO_SHAREDMEMORYSERVER_HPP_INCLUDED
+#define METHCLA_IO_SHAREDMEMORYSERVER_HPP_INCLUDED
+
+#include <methcla/engine.h>
+#include <methcla/detail/shared_memory.hpp>
+
+#include "Methcla/Audio/Engine.hpp"
+#include "Methcla/IO/QueryIds.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Methcla { namespace IO {
+
+#if METHCLA_HAVE_SHARED_MEMORY
+
+//* Request transport for clients in other processes through shared memory.
+//
+// Clients push packets to a request queue in a shared memory segment, which
+// a pump thread moves to the engine's request queue; replies and
+// notifications are pushed to a reply queue read by the client (see
+// Methcla::SharedMemoryEngine). Neither side enters the kernel while there
+// are packets to process; an idle pump thread polls at short intervals.
+//
+// Like SocketServer, the pump replaces the request ids of queries by ids
+// unique to the engine and only forwards replies to those ids, under the id
+// chosen by the client. Routes for queries that aren't answered within ten
+// seconds are dropped.
+class SharedMemoryServer
+{
+public:
+    //* Create the shared memory segment, replacing an existing one with the same name.
+    SharedMemoryServer(const std::string& name);
+    ~SharedMemoryServer();
+
+    SharedMemoryServer(const SharedMemoryServer&) = delete;
+    SharedMemoryServer& operator=(const SharedMemoryServer&) = delete;
+
+    //* Start moving requests to env.
+    void start(Audio::Environment* env);
+
+    //* Stop moving requests.
+    void stop();
+
+    //* Push a notification or a reply to a query of the client to the reply queue.
+    //
+    // Packets are dropped when the client doesn't keep up.
+    //
+    // Context: NRT
+    void handlePacket(Methcla_RequestId requestId, const void* packet, size_t size);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Route
+    {
+        // Request id chosen by the client
+        Methcla_RequestId   requestId;
+        Clock::time_point   expires;
+    };
+
+    void run();
+    void handleRequest(const void* packet, size_t size);
+    void expireRoutes();
+
+    detail::SharedMemory            m_memory;
+    detail::SharedMemoryTransport   m_transport;
+    Audio::Environment*             m_env;
+    std::thread                     m_thread;
+    std::atomic<bool>               m_running;
+
+    // Copy of the request being forwarded, whose query ids are replaced
+    std::vector<char>               m_request;
+    std::vector<QueryId>            m_queries;
+    Clock::time_point               m_nextRouteExpiry;
+
+    std::mutex                      m_routesMutex;
+    // Client request ids keyed by server request id
+    std::unordered_map<Methcla_RequestId,Route> m_routes;
+};
+
+#endif // METHCLA_HAVE_SHARED_MEMORY
+
+} }
+
+#endif // METHCLA_IO_SHAREDMEMORYSERVER_HPP_INCLUDED
@@ -0,0 +1,337 @@
+// Copyright 2012-2014 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Methcla/IO/SocketServer.hpp"
+
+#if METHCLA_HAVE_SOCKET_SERVER
+
+#include "Methcla/Exception.hpp"
+#include "Methcla/IO/QueryIds.hpp"
+#include "Methcla/Memory.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace Methcla;
+using namespace Methcla::IO;
+
+// Timeout for checking whether the server has been stopped
+static const int kPollTimeout = 100;
+
+// Seconds after which unanswered queries are forgotten
+static const int kRouteTimeout = 10;
+
+static void throwSystemError(const std::string& what, int error)
+{
+    throw Error(kMethcla_SystemError, what + ": " + std::strerror(error));
+}
+
+bool SocketServer::Peer::operator==(const Peer& other) const
+{
+    return length == other.length
+        && std::memcmp(address.sun_path, other.address.sun_path,
+                       length - offsetof(sockaddr_un, sun_path)) == 0;
+}
+
+SocketServer::SocketServer(const std::string& path)
+    : m_path(path)
+    , m_socket(-1)
+    , m_env(nullptr)
+    , m_running(false)
+    , m_buffers(nullptr)
+    , m_freeBuffers(kNumBuffers)
+    , m_batchSize(0)
+    , m_nextRouteExpiry(Clock::now())
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+        throw Error(kMethcla_ArgumentError, "Invalid socket path");
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+
+    m_socket = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (m_socket < 0)
+        throwSystemError("socket", errno);
+
+    // Remove stale socket file left behind by a previous server, but don't
+    // touch anything else
+    struct stat info;
+    if (lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+        unlink(path.c_str());
+
+    if (bind(m_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0)
+    {
+        const int error = errno;
+        close(m_socket);
+        throwSystemError("bind " + path, error);
+    }
+
+    // Leave room for bursts while the engine holds on to all buffers
+    const int receiveBufferSize = 1 << 20;
+    setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+
+    m_buffers = Memory::allocAlignedOf<char>(Memory::kSIMDAlignment, kNumBuffers * kBufferSize);
+    for (size_t i=0; i < kNumBuffers; i++)
+        m_freeBuffers.push(m_buffers + i * kBufferSize);
+}
+
+SocketServer::~SocketServer()
+{
+    stop();
+    close(m_socket);
+    unlink(m_path.c_str());
+    Memory::free(m_buffers);
+}
+
+void SocketServer::start(Audio::Environment* env)
+{
+    if (!m_running.load())
+    {
+        m_env = env;
+        m_running.store(true);
+        m_thread = std::thread(&SocketServer::run, this);
+    }
+}
+
+void SocketServer::stop()
+{
+    if (m_running.load())
+    {
+        m_running.store(false);
+        m_thread.join();
+    }
+}
+
+void SocketServer::release(void* data, void* buffer)
+{
+    static_cast<SocketServer*>(data)->m_freeBuffers.push(static_cast<char*>(buffer));
+}
+
+void SocketServer::run()
+{
+    while (m_running.load(std::memory_order_relaxed))
+    {
+        expireRoutes();
+
+        // Refill the batch with buffers returned by the engine
+        while (m_batchSize < kBatchSize && m_freeBuffers.pop(m_batch[m_batchSize]))
+            m_batchSize++;
+
+        if (m_batchSize == 0)
+        {
+            // Return buffers of processed requests that haven't been
+            // collected yet, otherwise all buffers are queued in the engine
+            // and the socket buffer absorbs the load.
+            m_env->collectReleasedRequests();
+            if (m_freeBuffers.size() == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        pollfd fds;
+        fds.fd = m_socket;
+        fds.events = POLLIN;
+        fds.revents = 0;
+        if (poll(&fds, 1, kPollTimeout) <= 0)
+            continue;
+
+        const size_t count = receive(m_batchSize);
+
+        for (size_t i=0; i < count; i++)
+        {
+            char* buffer = m_batch[i];
+            const size_t size = m_batchSizes[i];
+            if (size == 0)
+            {
+                m_freeBuffers.push(buffer);
+                m_env->logLineNRT(kMethcla_LogWarn, "SocketServer: Dropping empty or truncated packet");
+                continue;
+            }
+            const Peer& peer = m_batchPeers[i];
+            // Unbound peers can't receive packets
+            if (peer.length > offsetof(sockaddr_un, sun_path))
+                addPeer(peer);
+            learnRoutes(peer, buffer + kMethcla_PacketHeaderSize, size);
+            try
+            {
+                // Takes ownership of the buffer, also in case of an error
+                m_env->send(buffer, size, release, this);
+            }
+            catch (std::exception& e)
+            {
+                m_env->logLineNRT(kMethcla_LogError, e.what());
+            }
+        }
+
+        // Keep unused buffers for the next receive
+        std::copy(m_batch + count, m_batch + m_batchSize, m_batch);
+        m_batchSize -= count;
+    }
+}
+
+size_t SocketServer::receive(size_t count)
+{
+#if defined(__linux__)
+    mmsghdr msgs[kBatchSize];
+    iovec iovs[kBatchSize];
+    for (size_t i=0; i < count; i++)
+    {
+        iovs[i].iov_base = m_batch[i] + kMethcla_PacketHeaderSize;
+        iovs[i].iov_len = kMaxPacketSize;
+        std::memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &m_batchPeers[i].address;
+        msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_un);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    const int result = recvmmsg(m_socket, msgs, count, MSG_DONTWAIT, nullptr);
+    if (result < 0)
+        return 0;
+    for (int i=0; i < result; i++)
+    {
+        m_batchPeers[i].length = msgs[i].msg_hdr.msg_namelen;
+        m_batchSizes[i] = msgs[i].msg_hdr.msg_flags & MSG_TRUNC ? 0 : msgs[i].msg_len;
+    }
+    return result;
+#else
+    // One system call per packet where recvmmsg is not available
+    size_t received = 0;
+    while (received < count)
+    {
+        iovec iov;
+        iov.iov_base = m_batch[received] + kMethcla_PacketHeaderSize;
+        iov.iov_len = kMaxPacketSize;
+        msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &m_batchPeers[received].address;
+        msg.msg_namelen = sizeof(sockaddr_un);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        const ssize_t size = recvmsg(m_socket, &msg, MSG_DONTWAIT);
+        if (size < 0)
+            break;
+        m_batchPeers[received].length = msg.msg_namelen;
+        m_batchSizes[received] = msg.msg_flags & MSG_TRUNC ? 0 : size;
+        received++;
+    }
+    return received;
+#endif
+}
+
+void SocketServer::learnRoutes(const Peer& peer, char* packet, size_t size)
+{
+    std::vector<QueryId> queries;
+    collectQueries(m_env, packet, size, queries);
+    if (!queries.empty())
+    {
+        const bool isBound = peer.length > offsetof(sockaddr_un, sun_path);
+        const Clock::time_point expires = Clock::now() + std::chrono::seconds(kRouteTimeout);
+        std::lock_guard<std::mutex> lock(m_peersMutex);
+        for (const QueryId& query : queries)
+        {
+            const Methcla_RequestId requestId = m_env->newServerRequestId();
+            replaceRequestId(query, requestId);
+            if (isBound)
+            {
+                Route route;
+                route.peer = peer;
+                route.requestId = query.requestId;
+                route.expires = expires;
+                m_routes[requestId] = route;
+            }
+        }
+    }
+}
+
+void SocketServer::expireRoutes()
+{
+    const Clock::time_point now = Clock::now();
+    if (now < m_nextRouteExpiry)
+        return;
+    m_nextRouteExpiry = now + std::chrono::seconds(1);
+
+    std::lock_guard<std::mutex> lock(m_peersMutex);
+    auto it = m_routes.begin();
+    while (it != m_routes.end())
+    {
+        if (it->second.expires <= now)
+        {
+            const Route& route = it->second;
+            std::string message("SocketServer: No reply to request ");
+            message += std::to_string(route.requestId);
+            message += " from ";
+            message.append(route.peer.address.sun_path,
+                           strnlen(route.peer.address.sun_path, route.peer.length - offsetof(sockaddr_un, sun_path)));
+            m_env->logLineNRT(kMethcla_LogWarn, message.c_str());
+            it = m_routes.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+}
+
+void SocketServer::addPeer(const Peer& peer)
+{
+    std::lock_guard<std::mutex> lock(m_peersMutex);
+    if (std::find(m_peers.begin(), m_peers.end(), peer) == m_peers.end())
+        m_peers.push_back(peer);
+}
+
+bool SocketServer::sendTo(const Peer& peer, const void* packet, size_t size)
+{
+    const ssize_t result = sendto(
+        m_socket, packet, size, MSG_DONTWAIT,
+        reinterpret_cast<const sockaddr*>(&peer.address), peer.length
+    );
+    // Packets to peers that don't keep up are dropped; peers whose socket
+    // has gone away are forgotten.
+    return result >= 0 || (errno != ECONNREFUSED && errno != ENOENT);
+}
+
+void SocketServer::handlePacket(Methcla_RequestId requestId, const void* packet, size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_peersMutex);
+    if (requestId == kMethcla_Notification)
+    {
+        auto it = m_peers.begin();
+        while (it != m_peers.end())
+        {
+            if (sendTo(*it, packet, size))
+                it++;
+            else
+                it = m_peers.erase(it);
+        }
+    }
+    else
+    {
+        auto it = m_routes.find(requestId);
+        if (it != m_routes.end())
+        {
+            sendTo(it->second.peer, packet, size);
+            m_routes.erase(it);
+        }
+    }
+}
+
+#endif // METHCLA_HAVE_SOCKET_SERVER
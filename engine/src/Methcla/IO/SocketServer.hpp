@@ -0,0 +1,140 @@
+// Copyright 2012-2014 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_IO_SOCKETSERVER_HPP_INCLUDED
+#define METHCLA_IO_SOCKETSERVER_HPP_INCLUDED
+
+#include <methcla/engine.h>
+
+#include "Methcla/Audio/Engine.hpp"
+#include "Methcla/Utility/LockFreeQueue.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__native_client__)
+#   define METHCLA_HAVE_SOCKET_SERVER 1
+#   include <sys/socket.h>
+#   include <sys/un.h>
+#else
+#   define METHCLA_HAVE_SOCKET_SERVER 0
+#endif
+
+namespace Methcla { namespace IO {
+
+#if METHCLA_HAVE_SOCKET_SERVER
+
+//* OSC server on a Unix domain datagram socket.
+//
+// A dedicated I/O thread receives batches of packets directly into pooled
+// buffers that are handed to the engine without copying. Replies to queries
+// are sent to the peer the query came from and notifications to every peer
+// that has sent a request. Peers need to bind their socket to an address in
+// order to receive packets.
+//
+// The request ids of queries are replaced by negative ids unique to the
+// engine (Audio::Environment::newServerRequestId), so that peers using the
+// same ids, other servers and in-process clients counting up from one don't
+// receive each other's replies. Routes for queries that
+// aren't answered within ten seconds are dropped.
+class SocketServer
+{
+public:
+    //* Bind a socket to path, replacing an existing socket file.
+    SocketServer(const std::string& path);
+    ~SocketServer();
+
+    SocketServer(const SocketServer&) = delete;
+    SocketServer& operator=(const SocketServer&) = delete;
+
+    //* Start receiving requests and sending them to env.
+    void start(Audio::Environment* env);
+
+    //* Stop receiving requests.
+    void stop();
+
+    //* Send a reply or notification to the peers.
+    //
+    // Context: NRT
+    void handlePacket(Methcla_RequestId requestId, const void* packet, size_t size);
+
+private:
+    // Maximum size of a received packet
+    static const size_t kMaxPacketSize = 8192;
+    static const size_t kBufferSize = kMethcla_PacketHeaderSize + kMaxPacketSize;
+    // Maximum number of packets received with a single system call
+    static const size_t kBatchSize = 32;
+    static const size_t kNumBuffers = 1024;
+    typedef std::chrono::steady_clock Clock;
+
+    struct Peer
+    {
+        sockaddr_un address;
+        socklen_t   length;
+
+        bool operator==(const Peer& other) const;
+    };
+
+    struct Route
+    {
+        Peer                peer;
+        // Request id chosen by the peer
+        Methcla_RequestId   requestId;
+        Clock::time_point   expires;
+    };
+
+    void run();
+    size_t receive(size_t count);
+    void learnRoutes(const Peer& peer, char* packet, size_t size);
+    void expireRoutes();
+    void addPeer(const Peer& peer);
+    bool sendTo(const Peer& peer, const void* packet, size_t size);
+
+    static void release(void* data, void* buffer);
+
+    std::string                         m_path;
+    int                                 m_socket;
+    Audio::Environment*                 m_env;
+    std::thread                         m_thread;
+    std::atomic<bool>                   m_running;
+
+    // Receive buffers, returned to the free list by the engine
+    char*                               m_buffers;
+    Utility::LockFreeQueue<char*>       m_freeBuffers;
+
+    // Buffers and peer addresses of the next receive
+    char*                               m_batch[kBatchSize];
+    size_t                              m_batchSize;
+    Peer                                m_batchPeers[kBatchSize];
+    size_t                              m_batchSizes[kBatchSize];
+
+    Clock::time_point                   m_nextRouteExpiry;
+
+    std::mutex                          m_peersMutex;
+    std::vector<Peer>                   m_peers;
+    // Peers waiting for a reply, keyed by server request id
+    std::unordered_map<Methcla_RequestId,Route> m_routes;
+};
+
+#endif // METHCLA_HAVE_SOCKET_SERVER
+
+} }
+
+#endif // METHCLA_IO_SOCKETSERVER_HPP_INCLUDED
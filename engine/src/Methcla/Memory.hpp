@@ -111,7 +111,10 @@ private:
 };
 
 //* Alignment needed for data accessed by SIMD instructions.
-static const Alignment kSIMDAlignment(16);
+//
+// Matches the AVX-512 vector size and the cache line size of common CPUs,
+// so that audio buffers never straddle cache lines.
+static const Alignment kSIMDAlignment(64);
 
 //* Allocate memory of `size` bytes.
 //
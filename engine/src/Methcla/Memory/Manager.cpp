@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include "Methcla/Memory/Manager.hpp"
+#include <mutex>        // std::lock_guard
 #include <stdexcept>    // std::invalid_argument
 #include <new>          // std::bad_alloc
 
@@ -57,6 +58,7 @@ void* RTMemoryManager::alloc(size_t size)
 #else
     if (size == 0)
         throw std::invalid_argument("allocation size must be greater than zero");
+    std::lock_guard<Utility::SpinLock> lock(m_lock);
     void* ptr = tlsf_malloc(m_pool, size);
     if (ptr == nullptr)
         throw std::bad_alloc();
@@ -71,6 +73,7 @@ void* RTMemoryManager::allocAligned(Alignment align, size_t size)
 #else
     if (size == 0)
         throw std::invalid_argument("allocation size must be greater than zero");
+    std::lock_guard<Utility::SpinLock> lock(m_lock);
     void* ptr = tlsf_memalign(m_pool, align, size);
     if (ptr == nullptr)
         throw std::bad_alloc();
@@ -84,7 +87,10 @@ void RTMemoryManager::free(void* ptr) noexcept
     Methcla::Memory::free(ptr);
 #else
     if (ptr != nullptr)
+    {
+        std::lock_guard<Utility::SpinLock> lock(m_lock);
         tlsf_free(m_pool, ptr);
+    }
 #endif
 }
 
@@ -103,7 +109,50 @@ RTMemoryManager::Statistics RTMemoryManager::statistics() const
     stats.freeNumBytes = 0;
     stats.usedNumBytes = 0;
 #if !METHCLA_NO_RT_MEMORY
+    std::lock_guard<Utility::SpinLock> lock(m_lock);
     tlsf_walk_heap(m_pool, collectStatistics, &stats);
 #endif
     return stats;
 }
+
+CommandPool::CommandPool(size_t numBlocks)
+    : m_memory(Memory::allocAlignedOf<char>(Alignment(kBlockSize), numBlocks * kBlockSize))
+    , m_freeList(numBlocks)
+{
+    for (size_t i=0; i < numBlocks; i++)
+        m_freeList.push(m_memory + i * kBlockSize);
+}
+
+CommandPool::~CommandPool()
+{
+    Memory::free(m_memory);
+}
+
+void* CommandPool::alloc(size_t size)
+{
+    if (size == 0)
+        throw std::invalid_argument("allocation size must be greater than zero");
+    if (size > kBlockSize)
+        throw std::invalid_argument("allocation size exceeds command pool block size");
+    void* ptr;
+    if (!m_freeList.pop(ptr))
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* CommandPool::allocAligned(Alignment align, size_t size)
+{
+    if (align > kBlockSize)
+        throw std::invalid_argument("alignment exceeds command pool block size");
+    return alloc(size);
+}
+
+void CommandPool::free(void* ptr) noexcept
+{
+    if (ptr != nullptr)
+    {
+        const bool success = m_freeList.push(ptr);
+        assert( success );
+        (void)success;
+    }
+}
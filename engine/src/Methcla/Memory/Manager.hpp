@@ -16,6 +16,8 @@
 #define METHCLA_MEMORY_MANAGER_HPP_INCLUDED
 
 #include "Methcla/Memory.hpp"
+#include "Methcla/Utility/LockFreeQueue.hpp"
+#include "Methcla/Utility/SpinLock.hpp"
 
 #include <boost/type_traits/alignment_of.hpp>
 #include <boost/type_traits/aligned_storage.hpp>
@@ -78,6 +80,11 @@ public:
     }
 };
 
+//* Realtime memory allocator.
+//
+// Allocation and deallocation are serialized by a spin lock, so that the
+// allocator can be used from the realtime helper threads processing parallel
+// groups.
 class RTMemoryManager : public Allocator
 {
 public:
@@ -109,8 +116,46 @@ public:
     Statistics statistics() const;
 
 private:
-    void*       m_memory;
-    tlsf_pool   m_pool;
+    void*                       m_memory;
+    tlsf_pool                   m_pool;
+    mutable Utility::SpinLock   m_lock;
+};
+
+//* Pool of preallocated fixed size blocks for commands sent between threads.
+//
+// Blocks are returned to a lock-free free list, so that a command allocated
+// by one thread can be freed directly by the thread that performs it instead
+// of being sent back to its origin.
+class CommandPool : public Allocator
+{
+public:
+    static const size_t kBlockSize = 64;
+
+    //* Construct a pool with `numBlocks` blocks of kBlockSize bytes.
+    CommandPool(size_t numBlocks);
+    ~CommandPool();
+
+    CommandPool(const CommandPool&) = delete;
+    CommandPool& operator=(const CommandPool&) = delete;
+
+    //* Allocate a block for an object of `size` bytes.
+    //
+    // @throw std::invalid_argument
+    // @throw std::bad_alloc
+    void* alloc(size_t size) override;
+
+    //* Allocate a block for an object of `size` bytes with alignment `align`.
+    //
+    // @throw std::invalid_argument
+    // @throw std::bad_alloc
+    void* allocAligned(Alignment align, size_t size) override;
+
+    //* Return a block to the pool.
+    void free(void* ptr) noexcept override;
+
+private:
+    char*                           m_memory;
+    Utility::LockFreeQueue<void*>   m_freeList;
 };
 
 template <class T, class Allocator> class AllocatedBase
@@ -0,0 +1,156 @@
+// Copyright 2012-2014 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_UTILITY_LOCKFREEQUEUE_HPP_INCLUDED
+#define METHCLA_UTILITY_LOCKFREEQUEUE_HPP_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace Methcla { namespace Utility {
+
+//* Bounded lock-free queue for multiple producers and consumers.
+//
+// Each cell carries a sequence number that tells producers and consumers
+// whether the cell is free for the lap of the ring they are in; positions
+// are claimed with a single compare-and-swap and threads never wait for
+// each other. A producer preempted between claiming and filling a cell makes
+// the queue appear empty to consumers until it resumes. Capacity is rounded
+// up to the next power of two.
+//
+// See Dmitry Vyukov, "Bounded MPMC queue".
+template <typename T> class LockFreeQueue
+{
+public:
+    LockFreeQueue(size_t capacity)
+        : m_mask(roundUpToPowerOfTwo(std::max(capacity, (size_t)2)) - 1)
+        , m_cells(new Cell[m_mask + 1])
+    {
+        for (size_t i=0; i <= m_mask; i++)
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        m_pushPos.store(0, std::memory_order_relaxed);
+        m_popPos.store(0, std::memory_order_relaxed);
+    }
+
+    LockFreeQueue(const LockFreeQueue&) = delete;
+    LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+    //* Return the number of values in the queue.
+    //
+    // The result is approximate while other threads push or pop values.
+    size_t size() const
+    {
+        const size_t popPos = m_popPos.load(std::memory_order_relaxed);
+        const size_t pushPos = m_pushPos.load(std::memory_order_relaxed);
+        return pushPos > popPos ? std::min(pushPos - popPos, capacity()) : 0;
+    }
+
+    //* Append value, return false if the queue is full.
+    bool push(const T& value)
+    {
+        size_t pos = m_pushPos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = m_cells[pos & m_mask];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (m_pushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                // Cell still holds a value from the previous lap
+                return false;
+            }
+            else
+            {
+                pos = m_pushPos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //* Remove the oldest value, return false if the queue is empty.
+    bool pop(T& value)
+    {
+        size_t pos = m_popPos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = m_cells[pos & m_mask];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (m_popPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    value = cell.value;
+                    cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_popPos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    static const size_t kCacheLineSize = 64;
+
+    static size_t roundUpToPowerOfTwo(size_t n)
+    {
+        size_t result = 1;
+        while (result < n) result <<= 1;
+        return result;
+    }
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T                   value;
+    };
+
+    // Keep the positions on separate cache lines so that producers and
+    // consumers don't invalidate each other's cache.
+    char                    m_pad0[kCacheLineSize];
+    const size_t            m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+    char                    m_pad1[kCacheLineSize];
+    std::atomic<size_t>     m_pushPos;
+    char                    m_pad2[kCacheLineSize];
+    std::atomic<size_t>     m_popPos;
+    char                    m_pad3[kCacheLineSize];
+};
+
+} }
+
+#endif // METHCLA_UTILITY_LOCKFREEQUEUE_HPP_INCLUDED
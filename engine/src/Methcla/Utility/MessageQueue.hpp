@@ -15,24 +15,29 @@
 #ifndef METHCLA_UTILITY_MESSAGEQUEUE_HPP_INCLUDED
 #define METHCLA_UTILITY_MESSAGEQUEUE_HPP_INCLUDED
 
-#include <array>
+#include <algorithm>
 #include <atomic>
-#include <mutex>
+#include <stdexcept>
 #include <thread>
 #include <vector>
 
-#include "Methcla/Utility/Macros.h"
+#include "Methcla/Utility/LockFreeQueue.hpp"
 #include "Methcla/Utility/MessageQueueInterface.hpp"
 #include "Methcla/Utility/Semaphore.hpp"
 #include "Methcla/Utility/WorkerInterface.hpp"
 
-METHCLA_WITHOUT_WARNINGS_BEGIN
-# include <boost/lockfree/spsc_queue.hpp>
-METHCLA_WITHOUT_WARNINGS_END
-
 namespace Methcla { namespace Utility {
 
+//* Raise `maxSize` to `size` if it is smaller.
+inline void updateMaxQueueSize(std::atomic<size_t>& maxSize, size_t size)
+{
+    size_t current = maxSize.load(std::memory_order_relaxed);
+    while (size > current && !maxSize.compare_exchange_weak(current, size, std::memory_order_relaxed))
+        ;
+}
+
 //* MWSR queue for sending commands to the engine.
+// Senders don't take a lock and don't wait for each other.
 // Request payload lifetime: from request until response callback.
 // Caller is responsible for freeing request payload after the response callback has been called.
 template <typename T> class MessageQueue : public MessageQueueInterface<T>
@@ -40,6 +45,7 @@ template <typename T> class MessageQueue : public MessageQueueInterface<T>
 public:
     MessageQueue(size_t queueSize)
         : m_queue(queueSize)
+        , m_maxSize(0)
     { }
 
     MessageQueue(const MessageQueue<T>& other) = delete;
@@ -47,45 +53,65 @@ public:
 
     void send(const T& msg) override
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        bool success = m_queue.push(msg);
+        bool success = trySend(msg);
         if (!success) throw std::runtime_error("Message queue overflow");
     }
 
+    bool trySend(const T& msg) override
+    {
+        if (m_queue.push(msg))
+        {
+            updateMaxQueueSize(m_maxSize, m_queue.size());
+            return true;
+        }
+        return false;
+    }
+
     bool next(T& msg) override
     {
         return m_queue.pop(msg);
     }
 
+    QueueStatistics statistics() const override
+    {
+        QueueStatistics result;
+        result.size = m_queue.size();
+        result.maxSize = m_maxSize.load(std::memory_order_relaxed);
+        result.capacity = m_queue.capacity();
+        return result;
+    }
+
 private:
-    typedef boost::lockfree::spsc_queue<T> Queue;
-    Queue      m_queue;
-    std::mutex m_mutex;
+    LockFreeQueue<T>    m_queue;
+    std::atomic<size_t> m_maxSize;
 };
 
 template <class Command> class Transport
 {
 public:
-    Transport(size_t queueSize, bool needsLock)
+    Transport(size_t queueSize)
         : m_queue(queueSize)
-        , m_needsLock(needsLock)
-    { }
-    virtual ~Transport()
+        , m_maxSize(0)
     { }
 
     Transport(const Transport&) = delete;
     Transport& operator=(const Transport&) = delete;
 
-    virtual void send(const Command& cmd) = 0;
+    size_t capacity() const
+    {
+        return m_queue.capacity();
+    }
 
-    virtual bool dequeue(Command& cmd) = 0;
+    void send(const Command& cmd)
+    {
+        bool success = m_queue.push(cmd);
+        if (!success) throw std::runtime_error("Channel overflow");
+        updateMaxQueueSize(m_maxSize, m_queue.size());
+    }
 
-    void performOne()
+    bool dequeue(Command& cmd)
     {
-        Command cmd;
-        if (dequeue(cmd)) {
-            cmd.perform();
-        }
+        return m_queue.pop(cmd);
     }
 
     void performAll()
@@ -96,139 +122,148 @@ public:
         }
     }
 
-protected:
-    typedef boost::lockfree::spsc_queue<Command> Queue;
-
-    Queue& queue()
-    {
-        return m_queue;
-    }
-
-    bool needsLock() const
+    QueueStatistics statistics() const
     {
-        return m_needsLock;
-    }
-
-    std::mutex& mutex()
-    {
-        return m_mutex;
-    }
-
-    void sendCommand(const Command& cmd)
-    {
-        bool success = m_queue.push(cmd);
-        if (!success) throw std::runtime_error("Channel overflow");
+        QueueStatistics result;
+        result.size = m_queue.size();
+        result.maxSize = m_maxSize.load(std::memory_order_relaxed);
+        result.capacity = capacity();
+        return result;
     }
 
 private:
-    // typedef boost::lockfree::queue<Command,boost::lockfree::capacity<queueSize>> Queue;
-    Queue       m_queue;
-    bool        m_needsLock;
-    std::mutex  m_mutex;
+    LockFreeQueue<Command>  m_queue;
+    std::atomic<size_t>     m_maxSize;
 };
 
-template <class Command> class ToWorker : public Transport<Command>
+//* Commands sent to and from worker threads.
+//
+// Commands to the worker are queued in two lock-free lanes. Commands in the
+// latency lane are always taken first; commands in the bulk lane are only
+// taken while fewer than `maxNumBulkCommands` of them are being performed,
+// so that long running bulk commands can't hold up latency sensitive ones.
+template <typename Command> class Worker : public WorkerInterface<Command>
 {
 public:
-    ToWorker(size_t queueSize, bool needsLock, std::function<void()> signal)
-        : Transport<Command>(queueSize, needsLock)
-        , m_signal(signal)
+    Worker(size_t queueSize, size_t maxNumBulkCommands=1)
+        : m_latencyLane(queueSize)
+        , m_bulkLane(queueSize)
+        , m_fromWorker(queueSize)
+        , m_maxNumBulkCommands(std::max((size_t)1, maxNumBulkCommands))
+        , m_numBulkCommands(0)
     { }
 
-    virtual void send(const Command& cmd) override
+    Worker(const Worker&) = delete;
+    Worker& operator=(const Worker&) = delete;
+
+    //* Return the number of commands that can be queued in each lane.
+    size_t maxCapacity() const
     {
-        this->sendCommand(cmd);
-        if (m_signal) m_signal();
+        return m_fromWorker.capacity();
     }
 
-    bool dequeue(Command& cmd)
+    void sendToWorker(const Command& cmd, WorkerLane lane=kWorkerLatencyLane) override
     {
-        if (this->needsLock()) {
-            std::lock_guard<std::mutex> lock(this->mutex());
-            return this->queue().pop(cmd);
-        } else {
-            return this->queue().pop(cmd);
-        }
+        toWorker(lane).send(cmd);
+        signalWorker();
     }
 
-private:
-    std::function<void()> m_signal;
-};
+    void sendFromWorker(const Command& cmd) override
+    {
+        m_fromWorker.send(cmd);
+    }
 
-template <class Command> class FromWorker : public Transport<Command>
-{
-public:
-    FromWorker(size_t queueSize, bool needsLock)
-        : Transport<Command>(queueSize, needsLock)
-    { }
+    void perform() override
+    {
+        m_fromWorker.performAll();
+    }
 
-    virtual void send(const Command& cmd) override
+    void drain() override
     {
-        if (this->needsLock()) {
-            std::lock_guard<std::mutex> lock(this->mutex());
-            this->sendCommand(cmd);
-        } else {
-            this->sendCommand(cmd);
+        // Commands may send further commands in either direction
+        Command cmd;
+        for (;;) {
+            if (work())
+                continue;
+            if (m_fromWorker.dequeue(cmd)) {
+                cmd.perform();
+                continue;
+            }
+            break;
         }
     }
 
-    bool dequeue(Command& cmd) override
+    QueueStatistics toWorkerStatistics(WorkerLane lane) const override
     {
-        return this->queue().pop(cmd);
+        return toWorker(lane).statistics();
     }
-};
-
-template <typename Command> class Worker : public WorkerInterface<Command>
-{
-public:
-    Worker(size_t queueSize, bool needsLock)
-        : m_queueSize(queueSize)
-        , m_toWorker(queueSize, needsLock, [this](){ this->signalWorker(); })
-        , m_fromWorker(queueSize, needsLock)
-    { }
 
-    Worker(const Worker&) = delete;
-    Worker& operator=(const Worker&) = delete;
-
-    size_t maxCapacity() const
+    QueueStatistics fromWorkerStatistics() const override
     {
-        return m_queueSize - 1;
+        return m_fromWorker.statistics();
     }
 
-    void sendToWorker(const Command& cmd) override
+protected:
+    //* Perform a single command, return false if there was none that could be taken.
+    bool work()
     {
-        m_toWorker.send(cmd);
+        Command cmd;
+        if (m_latencyLane.dequeue(cmd)) {
+            cmd.perform();
+            return true;
+        }
+        if (acquireBulkSlot()) {
+            const bool found = m_bulkLane.dequeue(cmd);
+            if (found) cmd.perform();
+            m_numBulkCommands.fetch_sub(1, std::memory_order_release);
+            return found;
+        }
+        return false;
     }
 
-    void sendFromWorker(const Command& cmd) override
+    virtual void signalWorker() { }
+
+private:
+    Transport<Command>& toWorker(WorkerLane lane)
     {
-        m_fromWorker.send(cmd);
+        return lane == kWorkerBulkLane ? m_bulkLane : m_latencyLane;
     }
 
-    void perform() override
+    const Transport<Command>& toWorker(WorkerLane lane) const
     {
-        m_fromWorker.performAll();
+        return lane == kWorkerBulkLane ? m_bulkLane : m_latencyLane;
     }
 
-protected:
-    void work()
+    bool acquireBulkSlot()
     {
-        m_toWorker.performOne();
+        size_t n = m_numBulkCommands.load(std::memory_order_relaxed);
+        while (n < m_maxNumBulkCommands) {
+            if (m_numBulkCommands.compare_exchange_weak(n, n + 1, std::memory_order_acquire))
+                return true;
+        }
+        return false;
     }
 
-    virtual void signalWorker() { }
-
-private:
-    size_t              m_queueSize;
-    ToWorker<Command>   m_toWorker;
-    FromWorker<Command> m_fromWorker;
+    Transport<Command>                  m_latencyLane;
+    Transport<Command>                  m_bulkLane;
+    Transport<Command>                  m_fromWorker;
+    const size_t                        m_maxNumBulkCommands;
+    std::atomic<size_t>                 m_numBulkCommands;
 };
 
+//* Worker performing commands on a pool of threads.
+//
+// Threads only sleep when both lanes are empty (or the bulk lane is busy)
+// and senders only post the semaphore when a thread is sleeping, so a burst
+// of commands wakes at most one thread per sleeping thread instead of
+// signalling once per command. With more than one thread, one of them is
+// always left for the latency lane.
 template <typename Command> class WorkerThread : public Worker<Command>
 {
 public:
     WorkerThread(size_t queueSize, size_t numThreads=1)
-        : Worker<Command>(queueSize, numThreads > 1)
+        : Worker<Command>(queueSize, numThreads > 1 ? numThreads - 1 : 1)
+        , m_numSleeping(0)
         , m_continue(true)
     {
         for (size_t i=0; i < std::max((size_t)1, numThreads); i++) {
@@ -237,6 +272,18 @@ public:
     }
 
     ~WorkerThread()
+    {
+        stopThreads();
+    }
+
+    void drain() override
+    {
+        stopThreads();
+        Worker<Command>::drain();
+    }
+
+private:
+    void stopThreads()
     {
         m_continue.store(false, std::memory_order_relaxed);
         // Signal *all* threads
@@ -245,29 +292,48 @@ public:
         }
         // Wait for threads to exit
         for (auto& t : m_threads) { t.join(); }
+        m_threads.clear();
     }
 
-private:
     void process()
     {
-        for (;;) {
-            m_sem.wait();
-            bool cont = m_continue.load(std::memory_order_relaxed);
-            if (cont) {
-                this->work();
-            } else {
-                break;
+        while (m_continue.load(std::memory_order_relaxed)) {
+            if (this->work())
+                continue;
+            // Announce that this thread is going to sleep and check again for
+            // commands that were sent before the announcement was visible.
+            m_numSleeping.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (this->work()) {
+                // A sender may already have taken over the announcement and
+                // posted the semaphore; the next wait then returns immediately.
+                releaseSleeper();
+                continue;
             }
+            m_sem.wait();
         }
     }
 
     virtual void signalWorker() override
     {
-        m_sem.post();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (releaseSleeper())
+            m_sem.post();
+    }
+
+    bool releaseSleeper()
+    {
+        size_t n = m_numSleeping.load(std::memory_order_relaxed);
+        while (n > 0) {
+            if (m_numSleeping.compare_exchange_weak(n, n - 1, std::memory_order_relaxed))
+                return true;
+        }
+        return false;
     }
 
 private:
     Semaphore                   m_sem;
+    std::atomic<size_t>         m_numSleeping;
     std::atomic<bool>           m_continue;
     std::vector<std::thread>    m_threads;
 };
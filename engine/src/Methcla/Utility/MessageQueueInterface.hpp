@@ -15,13 +15,35 @@
 #ifndef METHCLA_MESSAGE_QUEUE_INTERFACE_HPP_INCLUDED
 #define METHCLA_MESSAGE_QUEUE_INTERFACE_HPP_INCLUDED
 
+#include <cstddef>
+
 namespace Methcla { namespace Utility {
+    //* Fill level of a queue.
+    struct QueueStatistics
+    {
+        QueueStatistics()
+            : size(0)
+            , maxSize(0)
+            , capacity(0)
+        { }
+
+        // Number of queued messages
+        size_t size;
+        // Largest number of queued messages seen so far
+        size_t maxSize;
+        size_t capacity;
+    };
+
     template <typename Message> class MessageQueueInterface
     {
     public:
         virtual ~MessageQueueInterface() { }
+        //* Send message, throw an exception if the queue is full.
         virtual void send(const Message& msg) = 0;
+        //* Send message, return false if the queue is full.
+        virtual bool trySend(const Message& msg) = 0;
         virtual bool next(Message& msg) = 0;
+        virtual QueueStatistics statistics() const = 0;
     };
 } }
 
@@ -0,0 +1,231 @@
+// Copyright 2012-2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Methcla/Utility/ThreadPool.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__native_client__)
+# define METHCLA_HAVE_PTHREAD_SCHEDULING 1
+# include <pthread.h>
+#else
+# define METHCLA_HAVE_PTHREAD_SCHEDULING 0
+#endif
+
+#if defined(__APPLE__)
+# include <mach/mach.h>
+#endif
+
+using namespace Methcla::Utility;
+
+static thread_local size_t gCurrentThread = 0;
+
+size_t ThreadPool::currentThread()
+{
+    return gCurrentThread;
+}
+
+ThreadPool::ThreadPool(size_t numThreads)
+    : m_ranges(std::max((size_t)1, numThreads))
+    , m_continue(true)
+    , m_busy(false)
+    , m_state(0)
+    , m_numCompleted(0)
+    , m_func(nullptr)
+    , m_data(nullptr)
+    , m_hasCapturedScheduling(false)
+    , m_hasScheduling(false)
+    , m_schedPolicy(0)
+    , m_schedPriority(0)
+#if defined(__APPLE__)
+    , m_hasTimeConstraint(false)
+#endif
+{
+    for (auto& range : m_ranges)
+    {
+        range.next.store(0, std::memory_order_relaxed);
+        range.end = 0;
+    }
+    for (size_t i=1; i < m_ranges.size(); i++)
+    {
+        m_helpers.emplace_back([this,i](){ this->helper(i); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    m_continue.store(false, std::memory_order_relaxed);
+    // Signal *all* threads
+    for (size_t i=0; i < m_helpers.size(); i++)
+    {
+        m_sem.post();
+    }
+    // Wait for threads to exit
+    for (auto& t : m_helpers) { t.join(); }
+}
+
+void ThreadPool::run(TaskFunc func, void* data, size_t numTasks)
+{
+    if (m_helpers.empty() || numTasks < 2 || m_busy.exchange(true, std::memory_order_acquire))
+    {
+        for (size_t i=0; i < numTasks; i++)
+            func(data, i);
+        return;
+    }
+
+    // The first invocation determines the helpers' scheduling parameters
+    if (!m_hasCapturedScheduling)
+        captureSchedulingParameters();
+
+    // Distribute tasks evenly across ranges
+    const size_t numRanges = m_ranges.size();
+    const size_t chunkSize = numTasks / numRanges;
+    const size_t remainder = numTasks % numRanges;
+    size_t begin = 0;
+    for (size_t i=0; i < numRanges; i++)
+    {
+        const size_t end = begin + chunkSize + (i < remainder ? 1 : 0);
+        m_ranges[i].next.store(begin, std::memory_order_relaxed);
+        m_ranges[i].end = end;
+        begin = end;
+    }
+    assert( begin == numTasks );
+
+    m_func = func;
+    m_data = data;
+    m_numCompleted.store(0, std::memory_order_relaxed);
+
+    // Publish job and wake up helpers
+    m_state.store(kOpen, std::memory_order_release);
+    const size_t numWakeups = std::min(m_helpers.size(), numTasks - 1);
+    for (size_t i=0; i < numWakeups; i++)
+    {
+        m_sem.post();
+    }
+
+    work(0);
+
+    // Wait for tasks that are still executing on helper threads
+    while (m_numCompleted.load(std::memory_order_acquire) < numTasks) { }
+
+    // Stop accepting participants once all helpers have left the job.
+    // Helpers that wake up later find the job closed and go back to sleep.
+    size_t expected = kOpen;
+    while (!m_state.compare_exchange_weak(expected, 0, std::memory_order_acq_rel))
+    {
+        expected = kOpen;
+    }
+
+    m_busy.store(false, std::memory_order_release);
+}
+
+void ThreadPool::helper(size_t index)
+{
+    gCurrentThread = index;
+
+    bool hasScheduling = false;
+
+    for (;;)
+    {
+        m_sem.wait();
+
+        if (!m_continue.load(std::memory_order_relaxed))
+            break;
+
+        if (!hasScheduling && m_hasScheduling.load(std::memory_order_acquire))
+        {
+            applySchedulingParameters();
+            hasScheduling = true;
+        }
+
+        size_t state = m_state.load(std::memory_order_acquire);
+        while (state & kOpen)
+        {
+            if (m_state.compare_exchange_weak(state, state + kParticipant, std::memory_order_acq_rel))
+            {
+                work(index);
+                m_state.fetch_sub(kParticipant, std::memory_order_release);
+                break;
+            }
+        }
+    }
+}
+
+void ThreadPool::work(size_t index)
+{
+    const size_t numRanges = m_ranges.size();
+
+    // Process own range first, then steal from the others
+    for (size_t k=0; k < numRanges; k++)
+    {
+        Range& range = m_ranges[(index + k) % numRanges];
+        while (range.next.load(std::memory_order_relaxed) < range.end)
+        {
+            const size_t task = range.next.fetch_add(1, std::memory_order_relaxed);
+            if (task >= range.end)
+                break;
+            m_func(m_data, task);
+            m_numCompleted.fetch_add(1, std::memory_order_release);
+        }
+    }
+}
+
+void ThreadPool::captureSchedulingParameters()
+{
+    m_hasCapturedScheduling = true;
+#if METHCLA_HAVE_PTHREAD_SCHEDULING
+    sched_param param;
+    if (pthread_getschedparam(pthread_self(), &m_schedPolicy, &param) == 0)
+        m_schedPriority = param.sched_priority;
+    else
+        m_schedPolicy = SCHED_OTHER;
+#endif
+#if defined(__APPLE__)
+    mach_msg_type_number_t count = THREAD_TIME_CONSTRAINT_POLICY_COUNT;
+    boolean_t getDefault = false;
+    m_hasTimeConstraint =
+        thread_policy_get(
+            pthread_mach_thread_np(pthread_self()),
+            THREAD_TIME_CONSTRAINT_POLICY,
+            reinterpret_cast<thread_policy_t>(&m_timeConstraint),
+            &count,
+            &getDefault) == KERN_SUCCESS
+        && !getDefault;
+#endif
+    m_hasScheduling.store(true, std::memory_order_release);
+}
+
+void ThreadPool::applySchedulingParameters()
+{
+    // Failures are ignored, the helpers then keep running with normal priority.
+#if METHCLA_HAVE_PTHREAD_SCHEDULING
+    if (m_schedPolicy != SCHED_OTHER)
+    {
+        sched_param param;
+        param.sched_priority = m_schedPriority;
+        pthread_setschedparam(pthread_self(), m_schedPolicy, &param);
+    }
+#endif
+#if defined(__APPLE__)
+    if (m_hasTimeConstraint)
+    {
+        thread_policy_set(
+            pthread_mach_thread_np(pthread_self()),
+            THREAD_TIME_CONSTRAINT_POLICY,
+            reinterpret_cast<thread_policy_t>(&m_timeConstraint),
+            THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+    }
+#endif
+}
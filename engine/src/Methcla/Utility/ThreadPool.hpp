@@ -0,0 +1,120 @@
+// Copyright 2012-2013 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METHCLA_UTILITY_THREADPOOL_HPP_INCLUDED
+#define METHCLA_UTILITY_THREADPOOL_HPP_INCLUDED
+
+#include "Methcla/Utility/Semaphore.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#if defined(__APPLE__)
+# include <mach/thread_policy.h>
+#endif
+
+namespace Methcla { namespace Utility {
+
+//* Pool of helper threads for executing independent tasks from a realtime thread.
+//
+// The calling thread takes part in the computation and tasks are
+// distributed across per-thread ranges; threads that finish their own range
+// steal remaining tasks from the others. Running tasks never allocates memory
+// or takes locks apart from waking up helper threads. Helper threads adopt
+// the scheduling policy and priority of the thread calling run() the first
+// time, so that they aren't preempted by lower priority work while the
+// realtime thread waits for them.
+class ThreadPool
+{
+public:
+    typedef void (*TaskFunc)(void* data, size_t task);
+
+    //* Create a thread pool with `numThreads` threads, including the calling thread.
+    ThreadPool(size_t numThreads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    //* Return number of threads, including the calling thread.
+    size_t numThreads() const
+    {
+        return m_helpers.size() + 1;
+    }
+
+    //* Return the index of the calling thread in its pool.
+    //
+    // Helper threads have indices `[1, numThreads())`; any other thread,
+    // including the thread calling run(), has index 0.
+    static size_t currentThread();
+
+    //* Run `func(data, i)` for each `i` in `[0, numTasks)` and return when all tasks have completed.
+    //
+    // Nested invocations from within a task and invocations while another
+    // thread is running tasks are executed serially by the calling thread.
+    //
+    // Context: RT
+    void run(TaskFunc func, void* data, size_t numTasks);
+
+private:
+    struct Range
+    {
+        std::atomic<size_t> next;
+        size_t              end;
+        // Keep ranges on separate cache lines.
+        char                padding[64 - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    };
+
+    enum
+    {
+        kOpen = 1,
+        kParticipant = 2
+    };
+
+    void helper(size_t index);
+    void work(size_t index);
+
+    //* Record the scheduling parameters of the calling thread for the helpers.
+    void captureSchedulingParameters();
+    //* Apply the recorded scheduling parameters to the calling helper thread.
+    void applySchedulingParameters();
+
+private:
+    std::vector<std::thread>    m_helpers;
+    std::vector<Range>          m_ranges;
+    Semaphore                   m_sem;
+    std::atomic<bool>           m_continue;
+    std::atomic<bool>           m_busy;
+    // Bit 0: accepting participants; remaining bits: number of participating helpers.
+    std::atomic<size_t>         m_state;
+    std::atomic<size_t>         m_numCompleted;
+    TaskFunc                    m_func;
+    void*                       m_data;
+    // Scheduling parameters of the thread calling run(), published once
+    bool                        m_hasCapturedScheduling;
+    std::atomic<bool>           m_hasScheduling;
+    int                         m_schedPolicy;
+    int                         m_schedPriority;
+#if defined(__APPLE__)
+    // Audio threads use the Mach time constraint policy instead of a POSIX priority
+    bool                                    m_hasTimeConstraint;
+    thread_time_constraint_policy_data_t    m_timeConstraint;
+#endif
+};
+
+} }
+
+#endif // METHCLA_UTILITY_THREADPOOL_HPP_INCLUDED
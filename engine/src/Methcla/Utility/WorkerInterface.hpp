@@ -15,14 +15,31 @@
 #ifndef METHCLA_WORKER_INTERFACE_HPP_INCLUDED
 #define METHCLA_WORKER_INTERFACE_HPP_INCLUDED
 
+#include "Methcla/Utility/MessageQueueInterface.hpp"
+
 namespace Methcla { namespace Utility {
+    //* Worker queue a command is sent to.
+    enum WorkerLane
+    {
+        //* Short commands that should be performed promptly, e.g. replies, notifications and frees.
+        kWorkerLatencyLane,
+        //* Long running commands, e.g. file I/O and decoding.
+        kWorkerBulkLane
+    };
+
     template <typename Command> class WorkerInterface
     {
     public:
         virtual ~WorkerInterface() { }
-        virtual void sendToWorker(const Command& cmd) = 0;
+        virtual void sendToWorker(const Command& cmd, WorkerLane lane=kWorkerLatencyLane) = 0;
         virtual void sendFromWorker(const Command& cmd) = 0;
         virtual void perform() = 0;
+        //* Stop background processing and perform the remaining commands in both directions on the calling thread.
+        //
+        // Context: NRT, after the realtime thread has stopped
+        virtual void drain() = 0;
+        virtual QueueStatistics toWorkerStatistics(WorkerLane lane) const = 0;
+        virtual QueueStatistics fromWorkerStatistics() const = 0;
     };
 } }
 
@@ -21,6 +21,13 @@
 
 #include "gtest/gtest.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
 using namespace Methcla::Tests;
 
 TEST(Methcla_Engine, Creation_and_destruction)
@@ -184,3 +191,1630 @@ TEST(Methcla_Engine, Node_ended_notification)
     ASSERT_EQ( engine->getNodeTreeStatistics().numSynths, 0ul );
     ASSERT_EQ( engine->nodeIdAllocator().getStatistics().allocated(), 0ul );
 }
+
+TEST(Methcla_Engine, Node_ended_notifications_should_be_coalesced_per_block)
+{
+    std::atomic<size_t> numMessages(0);
+    std::atomic<size_t> numNodes(0);
+
+    auto engine = std::unique_ptr<Methcla::Engine>(
+        new Methcla::Engine(Methcla::EngineOptions().addLibrary(methcla_plugins_sine))
+    );
+
+    engine->start();
+
+    engine->addNotificationHandler([&](const OSCPP::Server::Message& msg) {
+        if (msg == "/node/ended")
+        {
+            numMessages++;
+            OSCPP::Server::ArgStream args(msg.args());
+            while (!args.atEnd())
+            {
+                args.int32();
+                numNodes++;
+            }
+        }
+        return false;
+    });
+
+    const size_t numSynths = 64;
+    Methcla::GroupId group;
+
+    {
+        Methcla::Request request(*engine);
+        request.openBundle();
+        group = request.group(engine->root());
+        for (size_t i=0; i < numSynths; i++)
+        {
+            Methcla::SynthId synth = request.synth(METHCLA_PLUGINS_SINE_URI, group, { 440.f, 1.f });
+            engine->addNotificationHandler(engine->freeNodeIdHandler(synth));
+        }
+        request.closeBundle();
+        request.send();
+    }
+
+    EXPECT_EQ( engine->getNodeTreeStatistics().numSynths, numSynths );
+
+    // Free the group and all of its children in the same block; the
+    // client releases the group id itself.
+    engine->free(group);
+    sleepFor(0.1);
+
+    EXPECT_EQ( numMessages.load(), 1ul );
+    EXPECT_EQ( numNodes.load(), numSynths + 1 );
+    ASSERT_EQ( engine->nodeIdAllocator().getStatistics().allocated(), 0ul );
+}
+
+// Counts /node/ended notifications and waits for an expected number of them.
+class NodeEndedCounter
+{
+public:
+    NodeEndedCounter()
+        : m_count(0)
+    { }
+
+    std::function<void(Methcla::NodeId)> handler()
+    {
+        return [this](Methcla::NodeId) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_count++;
+            m_cond.notify_all();
+        };
+    }
+
+    bool wait(size_t count, double timeout)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_cond.wait_for(
+            lock,
+            std::chrono::duration<double>(timeout),
+            [this,count]{ return m_count >= count; });
+    }
+
+private:
+    std::mutex              m_mutex;
+    std::condition_variable m_cond;
+    size_t                  m_count;
+};
+
+TEST(Methcla_Engine, Parallel_group_children_should_be_processed_and_freed)
+{
+    Methcla::EngineOptions options;
+    options.numRealtimeThreads = 4;
+    auto engine = std::unique_ptr<Methcla::Engine>(
+        new Methcla::Engine(
+            options
+                .addLibrary(methcla_plugins_sine)
+                .addLibrary(methcla_plugins_node_control)
+        )
+    );
+
+    engine->start();
+
+    const size_t numSynths = 16;
+    NodeEndedCounter ended;
+
+    {
+        Methcla::Request request(*engine);
+        request.openBundle();
+        Methcla::GroupId group = request.parallelGroup(engine->root());
+        for (size_t i=0; i < numSynths; i++)
+        {
+            Methcla::SynthId synth = request.synth(METHCLA_PLUGINS_DONE_AFTER_URI, group, {}, { Methcla::Value(0.05f) });
+            request.whenDone(synth, Methcla::kNodeDoneFreeSelf);
+            request.activate(synth);
+            engine->addNotificationHandler(engine->freeNodeIdHandler(synth, ended.handler()));
+        }
+        request.closeBundle();
+        request.send();
+    }
+
+    EXPECT_EQ( engine->getNodeTreeStatistics().numGroups, 2ul );
+    EXPECT_EQ( engine->getNodeTreeStatistics().numSynths, numSynths );
+    ASSERT_TRUE( ended.wait(numSynths, 5.) );
+    ASSERT_EQ( engine->getNodeTreeStatistics().numSynths, 0ul );
+    ASSERT_EQ( engine->getNodeTreeStatistics().numGroups, 2ul );
+}
+
+TEST(Methcla_Engine, Parallel_group_children_should_free_their_siblings_and_parent)
+{
+    Methcla::EngineOptions options;
+    options.numRealtimeThreads = 4;
+    auto engine = std::unique_ptr<Methcla::Engine>(
+        new Methcla::Engine(
+            options
+                .addLibrary(methcla_plugins_sine)
+                .addLibrary(methcla_plugins_node_control)
+        )
+    );
+
+    engine->start();
+
+    const size_t numSynths = 16;
+    NodeEndedCounter ended;
+
+    {
+        Methcla::Request request(*engine);
+        request.openBundle();
+        Methcla::GroupId group = request.parallelGroup(engine->root());
+        engine->addNotificationHandler(engine->freeNodeIdHandler(group, ended.handler()));
+        for (size_t i=0; i < numSynths; i++)
+        {
+            // All children end in the same block and free each other concurrently
+            Methcla::SynthId synth = request.synth(METHCLA_PLUGINS_DONE_AFTER_URI, group, {}, { Methcla::Value(0.05f) });
+            request.whenDone(synth, i % 2 == 0 ? Methcla::kNodeDoneFreeAllSiblings : Methcla::kNodeDoneFreeParent);
+            request.activate(synth);
+            engine->addNotificationHandler(engine->freeNodeIdHandler(synth, ended.handler()));
+        }
+        request.closeBundle();
+        request.send();
+    }
+
+    ASSERT_TRUE( ended.wait(numSynths + 1, 5.) );
+    ASSERT_EQ( engine->getNodeTreeStatistics().numSynths, 0ul );
+    ASSERT_EQ( engine->getNodeTreeStatistics().numGroups, 1ul );
+    ASSERT_EQ( engine->nodeIdAllocator().getStatistics().allocated(), 0ul );
+}
+
+TEST(Methcla_Engine, Bundles_beyond_the_scheduler_horizon_should_be_processed)
+{
+    Methcla::EngineOptions options;
+    options.schedulerHorizon = 2;
+    auto engine = std::unique_ptr<Methcla::Engine>(
+        new Methcla::Engine(options)
+    );
+
+    engine->start();
+
+    const Methcla_Time time = engine->currentTime();
+
+    for (size_t i=3; i > 0; i--)
+    {
+        Methcla::Request request(*engine);
+        request.openBundle(time + 0.05 * i);
+        request.group(engine->root());
+        request.closeBundle();
+        request.send();
+    }
+
+    sleepFor(0.025);
+    EXPECT_EQ( engine->getNodeTreeStatistics().numGroups, 1ul );
+    sleepFor(0.2);
+    ASSERT_EQ( engine->getNodeTreeStatistics().numGroups, 4ul );
+}
+
+TEST(Methcla_Engine, Batched_requests_should_be_processed_in_order)
+{
+    auto engine = std::unique_ptr<Methcla::Engine>(
+        new Methcla::Engine()
+    );
+
+    engine->start();
+
+    const Methcla_Time time = engine->currentTime();
+    const size_t numGroups = 8;
+
+    std::vector<std::unique_ptr<Methcla::Request>> requests;
+    std::vector<const Methcla::Request*> batch;
+    Methcla::GroupId parent = engine->root();
+    for (size_t i=0; i < numGroups; i++)
+    {
+        std::unique_ptr<Methcla::Request> request(new Methcla::Request(*engine));
+        // Each group is added to the group created by the previous request
+        parent = request->group(parent);
+        batch.push_back(request.get());
+        requests.push_back(std::move(request));
+    }
+    {
+        std::unique_ptr<Methcla::Request> request(new Methcla::Request(*engine));
+        request->openBundle(time + 0.05);
+        request->group(engine->root());
+        request->closeBundle();
+        batch.push_back(request.get());
+        requests.push_back(std::move(request));
+    }
+    engine->sendBatch(batch);
+
+    EXPECT_EQ( engine->getNodeTreeStatistics().numGroups, 1ul + numGroups );
+    sleepFor(0.1);
+    ASSERT_EQ( engine->getNodeTreeStatistics().numGroups, 2ul + numGroups );
+}
+
+// Execution plan
+
+#include "Methcla/API.hpp"
+#include "Methcla/Audio/IO/Driver.hpp"
+#include "Methcla/IO/RequestCapture.hpp"
+
+#include <methcla/plugin.h>
+#include <oscpp/server.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+//* Driver processing blocks on demand in the calling thread.
+class ManualDriver : public Methcla::Audio::IO::Driver
+{
+public:
+    static const size_t kNumChannels = 2;
+    static const size_t kBufferSize = 64;
+
+    ManualDriver()
+        : Driver(Options())
+        , m_time(0.)
+        , m_inputBuffers(makeBuffers(kNumChannels, kBufferSize))
+        , m_outputBuffers(makeBuffers(kNumChannels, kBufferSize))
+    {
+        for (size_t i=0; i < kNumChannels; i++)
+            std::fill(m_inputBuffers[i], m_inputBuffers[i] + kBufferSize, 0.f);
+    }
+
+    ~ManualDriver()
+    {
+        freeBuffers(kNumChannels, m_inputBuffers);
+        freeBuffers(kNumChannels, m_outputBuffers);
+    }
+
+    virtual double sampleRate() const override { return 44100.; }
+    virtual size_t numInputs() const override { return kNumChannels; }
+    virtual size_t numOutputs() const override { return kNumChannels; }
+    virtual size_t bufferSize() const override { return kBufferSize; }
+
+    virtual void start() override { }
+    virtual void stop() override { }
+
+    virtual Methcla_Time currentTime() override { return m_time; }
+
+    //* Process numBlocks blocks.
+    void tick(size_t numBlocks=1)
+    {
+        for (size_t i=0; i < numBlocks; i++)
+        {
+            process(m_time, kBufferSize, m_inputBuffers, m_outputBuffers);
+            m_time += kBufferSize / sampleRate();
+        }
+    }
+
+    //* Return the last sample of an output channel written in the last block.
+    float output(size_t channel) const
+    {
+        return m_outputBuffers[channel][kBufferSize - 1];
+    }
+
+private:
+    Methcla_Time    m_time;
+    float**         m_inputBuffers;
+    float**         m_outputBuffers;
+};
+
+// Probe synth writing its input plus one to its output and recording the
+// order in which synths are processed.
+//
+// Options: int32 tag, int32 silenceInSilenceOut, int32 writesInput
+//
+// A probe with writesInput set overwrites its input after processing,
+// which plugins must not do.
+
+#define METHCLA_TESTS_PROBE_URI METHCLA_PLUGINS_URI "/tests/probe"
+
+struct ProbeOptions
+{
+    int32_t tag;
+    bool    silenceInSilenceOut;
+    bool    writesInput;
+};
+
+struct Probe
+{
+    int32_t         tag;
+    bool            writesInput;
+    const float*    input;
+    float*          output;
+};
+
+std::mutex gProbeMutex;
+// Tags of processed probes in processing order
+std::vector<int32_t> gProbeLog;
+// Sizes of the batches passed to process_batch
+std::vector<size_t> gProbeBatches;
+
+void resetProbeLog()
+{
+    std::lock_guard<std::mutex> lock(gProbeMutex);
+    gProbeLog.clear();
+    gProbeBatches.clear();
+}
+
+std::vector<int32_t> probeLog()
+{
+    std::lock_guard<std::mutex> lock(gProbeMutex);
+    return gProbeLog;
+}
+
+std::vector<size_t> probeBatches()
+{
+    std::lock_guard<std::mutex> lock(gProbeMutex);
+    return gProbeBatches;
+}
+
+size_t probeCount(int32_t tag)
+{
+    const std::vector<int32_t> log(probeLog());
+    return std::count(log.begin(), log.end(), tag);
+}
+
+void probeConfigure(const void* tags, size_t tagsSize, const void* args, size_t argsSize, Methcla_SynthOptions* outOptions)
+{
+    OSCPP::Server::ArgStream argStream(
+        OSCPP::ReadStream(tags, tagsSize),
+        OSCPP::ReadStream(args, argsSize)
+    );
+    ProbeOptions* options = static_cast<ProbeOptions*>(outOptions);
+    options->tag = argStream.int32();
+    options->silenceInSilenceOut = argStream.int32() != 0;
+    options->writesInput = argStream.int32() != 0;
+}
+
+bool probePortDescriptor(const Methcla_SynthOptions* inOptions, Methcla_PortCount index, Methcla_PortDescriptor* port)
+{
+    const ProbeOptions* options = static_cast<const ProbeOptions*>(inOptions);
+    switch (index)
+    {
+        case 0:
+            port->direction = kMethcla_Input;
+            port->type = kMethcla_AudioPort;
+            port->flags = kMethcla_PortFlags;
+            return true;
+        case 1:
+            port->direction = kMethcla_Output;
+            port->type = kMethcla_AudioPort;
+            port->flags = options->silenceInSilenceOut ? kMethcla_SilenceInSilenceOut : kMethcla_PortFlags;
+            return true;
+        default:
+            return false;
+    }
+}
+
+void probeConstruct(const Methcla_World*, const Methcla_SynthDef*, const Methcla_SynthOptions* inOptions, Methcla_Synth* synth)
+{
+    Probe* self = static_cast<Probe*>(synth);
+    const ProbeOptions* options = static_cast<const ProbeOptions*>(inOptions);
+    self->tag = options->tag;
+    self->writesInput = options->writesInput;
+    self->input = nullptr;
+    self->output = nullptr;
+}
+
+void probeConnect(Methcla_Synth* synth, Methcla_PortCount index, void* data)
+{
+    Probe* self = static_cast<Probe*>(synth);
+    if (index == 0)
+        self->input = static_cast<const float*>(data);
+    else
+        self->output = static_cast<float*>(data);
+}
+
+void probeProcess(const Methcla_World*, Methcla_Synth* synth, size_t numFrames)
+{
+    Probe* self = static_cast<Probe*>(synth);
+    for (size_t i=0; i < numFrames; i++)
+        self->output[i] = self->input[i] + 1.f;
+    if (self->writesInput)
+        std::fill(const_cast<float*>(self->input), const_cast<float*>(self->input) + numFrames, 100.f);
+    std::lock_guard<std::mutex> lock(gProbeMutex);
+    gProbeLog.push_back(self->tag);
+}
+
+void probeProcessBatch(const Methcla_World* world, Methcla_Synth* const* synths, size_t numSynths, size_t numFrames)
+{
+    {
+        std::lock_guard<std::mutex> lock(gProbeMutex);
+        gProbeBatches.push_back(numSynths);
+    }
+    for (size_t i=0; i < numSynths; i++)
+        probeProcess(world, synths[i], numFrames);
+}
+
+const Methcla_SynthDef kProbeDef =
+{
+    METHCLA_TESTS_PROBE_URI,
+    sizeof(Probe),
+    sizeof(ProbeOptions),
+    probeConfigure,
+    probePortDescriptor,
+    probeConstruct,
+    probeConnect,
+    nullptr,
+    probeProcess,
+    nullptr,
+    probeProcessBatch
+};
+
+// Control probe copying its control input to its control output and
+// writing it to its audio output.
+
+#define METHCLA_TESTS_CONTROL_PROBE_URI METHCLA_PLUGINS_URI "/tests/control-probe"
+
+struct ControlProbe
+{
+    const float*    input;
+    float*          output;
+    float*          audioOutput;
+};
+
+bool controlProbePortDescriptor(const Methcla_SynthOptions*, Methcla_PortCount index, Methcla_PortDescriptor* port)
+{
+    static const Methcla_PortDescriptor kPorts[] = {
+        { kMethcla_Input, kMethcla_ControlPort, kMethcla_PortFlags },
+        { kMethcla_Output, kMethcla_ControlPort, kMethcla_PortFlags },
+        { kMethcla_Output, kMethcla_AudioPort, kMethcla_PortFlags }
+    };
+    if (index < 3)
+    {
+        *port = kPorts[index];
+        return true;
+    }
+    return false;
+}
+
+void controlProbeConstruct(const Methcla_World*, const Methcla_SynthDef*, const Methcla_SynthOptions*, Methcla_Synth* synth)
+{
+    ControlProbe* self = static_cast<ControlProbe*>(synth);
+    self->input = nullptr;
+    self->output = nullptr;
+    self->audioOutput = nullptr;
+}
+
+void controlProbeConnect(Methcla_Synth* synth, Methcla_PortCount index, void* data)
+{
+    ControlProbe* self = static_cast<ControlProbe*>(synth);
+    switch (index)
+    {
+        case 0: self->input = static_cast<const float*>(data); break;
+        case 1: self->output = static_cast<float*>(data); break;
+        case 2: self->audioOutput = static_cast<float*>(data); break;
+    }
+}
+
+void controlProbeProcess(const Methcla_World*, Methcla_Synth* synth, size_t numFrames)
+{
+    ControlProbe* self = static_cast<ControlProbe*>(synth);
+    const float value = *self->input;
+    *self->output = value;
+    std::fill(self->audioOutput, self->audioOutput + numFrames, value);
+}
+
+const Methcla_SynthDef kControlProbeDef =
+{
+    METHCLA_TESTS_CONTROL_PROBE_URI,
+    sizeof(ControlProbe),
+    0,
+    nullptr,
+    controlProbePortDescriptor,
+    controlProbeConstruct,
+    controlProbeConnect,
+    nullptr,
+    controlProbeProcess,
+    nullptr,
+    nullptr
+};
+
+const Methcla_Library kProbeLibrary = { nullptr, nullptr };
+
+const Methcla_Library* probeLibrary(const Methcla_Host* host, const char*)
+{
+    methcla_host_register_synthdef(host, &kProbeDef);
+    methcla_host_register_synthdef(host, &kControlProbeDef);
+    return &kProbeLibrary;
+}
+
+// Plugin commands adding their int32 argument to the counter in their data
+// field. The second and third definition clash with an existing address and
+// must be rejected.
+
+std::atomic<int32_t> gCommandSum(0);
+std::atomic<int32_t> gRejectedCommandSum(0);
+
+void commandAdd(const Methcla_World*, const Methcla_CommandDef* def, const void* tag_buffer, size_t tag_size, const void* arg_buffer, size_t arg_size)
+{
+    OSCPP::Server::ArgStream args(
+        OSCPP::ReadStream(tag_buffer, tag_size),
+        OSCPP::ReadStream(arg_buffer, arg_size)
+    );
+    static_cast<std::atomic<int32_t>*>(def->data)->fetch_add(args.int32());
+}
+
+const Methcla_CommandDef kCommandDefs[] =
+{
+    { "/tests/add", &gCommandSum, commandAdd },
+    { "/tests/add", &gRejectedCommandSum, commandAdd },
+    { "/node/free", &gRejectedCommandSum, commandAdd }
+};
+
+const Methcla_Library* commandLibrary(const Methcla_Host* host, const char*)
+{
+    for (const auto& def : kCommandDefs)
+        methcla_host_register_command(host, &def);
+    return &kProbeLibrary;
+}
+
+//* Engine driven by a ManualDriver, with the probe plugin.
+struct ManualEngine
+{
+    ManualEngine(size_t numRealtimeThreads, Methcla::EngineOptions options=Methcla::EngineOptions())
+        : driver(new ManualDriver())
+    {
+        options.numRealtimeThreads = numRealtimeThreads;
+        options.addLibrary(probeLibrary)
+               .addLibrary(methcla_plugins_node_control);
+        engine = std::unique_ptr<Methcla::Engine>(
+            new Methcla::Engine(options, Methcla::API::wrapAudioDriver(driver)));
+        engine->start();
+        resetProbeLog();
+    }
+
+    Methcla::SynthId probe(Methcla::Request& request, const Methcla::NodePlacement& placement, int32_t tag, bool silenceInSilenceOut=false, bool writesInput=false)
+    {
+        Methcla::SynthId synth = request.synth(
+            METHCLA_TESTS_PROBE_URI, placement, {},
+            { Methcla::Value(tag), Methcla::Value(silenceInSilenceOut), Methcla::Value(writesInput) });
+        request.activate(synth);
+        return synth;
+    }
+
+    // Owned by the engine
+    ManualDriver* driver;
+    std::unique_ptr<Methcla::Engine> engine;
+};
+
+//* Return the code of an API error and free the error.
+Methcla_ErrorCode errorCode(Methcla_Error error)
+{
+    const Methcla_ErrorCode code = methcla_error_code(error);
+    methcla_error_free(error);
+    return code;
+}
+
+//* Fill the request queue of an engine that isn't processing requests.
+void fillRequestQueue(Methcla::Engine& engine)
+{
+    OSCPP::Client::DynamicPacket packet(32);
+    packet.openBundle(1).closeBundle();
+    for (;;)
+    {
+        const Methcla_ErrorCode code = errorCode(methcla_engine_try_send(engine, packet.data(), packet.size()));
+        if (code == kMethcla_QueueFullError)
+            break;
+        ASSERT_EQ( code, kMethcla_NoError );
+    }
+}
+
+//* Packet buffers for methcla_engine_send_buffer counting their releases.
+class ReleaseCounter
+{
+public:
+    ReleaseCounter()
+        : m_count(0)
+    { }
+
+    size_t count() const
+    {
+        return m_count.load();
+    }
+
+    void* buffer(const void* packet, size_t size)
+    {
+        char* buffer = new char[kMethcla_PacketHeaderSize + size];
+        std::memcpy(buffer + kMethcla_PacketHeaderSize, packet, size);
+        return buffer;
+    }
+
+    static void release(void* data, void* buffer)
+    {
+        static_cast<ReleaseCounter*>(data)->m_count++;
+        delete [] static_cast<char*>(buffer);
+    }
+
+private:
+    std::atomic<size_t> m_count;
+};
+
+}
+
+TEST(Methcla_Audio_ExecutionPlan, Dependent_synths_should_be_processed_in_bus_order)
+{
+    ManualEngine e(4);
+    Methcla::Engine& engine = *e.engine;
+
+    const Methcla::AudioBusId a = engine.audioBusId().alloc();
+    const Methcla::AudioBusId b = engine.audioBusId().alloc();
+    const Methcla::AudioBusId sum = engine.audioBusId().alloc();
+    const size_t numAccumulators = 6;
+
+    {
+        Methcla::Request request(engine);
+        request.openBundle();
+        // Chain 1 -> a -> 2 -> b -> 3 -> output 0, spread across groups
+        Methcla::GroupId g1 = request.group(engine.root());
+        Methcla::GroupId g2 = request.group(engine.root());
+        Methcla::SynthId s1 = e.probe(request, g1, 1);
+        request.mapOutput(s1, 0, a, Methcla::kBusMappingReplace);
+        Methcla::SynthId s2 = e.probe(request, g2, 2);
+        request.mapInput(s2, 0, a);
+        request.mapOutput(s2, 0, b, Methcla::kBusMappingReplace);
+        Methcla::SynthId s3 = e.probe(request, g2, 3);
+        request.mapInput(s3, 0, b);
+        request.mapOutput(s3, 0, Methcla::AudioBusId(0), Methcla::kBusMappingExternal);
+        // Independent synths accumulating into a bus read by 20 -> output 1
+        for (size_t i=0; i < numAccumulators; i++)
+        {
+            Methcla::SynthId s = e.probe(request, g2, 10 + i);
+            request.mapOutput(s, 0, sum);
+        }
+        Methcla::SynthId s20 = e.probe(request, engine.root(), 20);
+        request.mapInput(s20, 0, sum);
+        request.mapOutput(s20, 0, Methcla::AudioBusId(1), Methcla::kBusMappingExternal);
+        request.closeBundle();
+        request.send();
+    }
+
+    e.driver->tick(2);
+    resetProbeLog();
+
+    const size_t numBlocks = 16;
+    e.driver->tick(numBlocks);
+
+    EXPECT_EQ( e.driver->output(0), 3.f );
+    EXPECT_EQ( e.driver->output(1), numAccumulators + 1.f );
+
+    const std::vector<int32_t> log(probeLog());
+    ASSERT_EQ( log.size(), numBlocks * (4 + numAccumulators) );
+    for (size_t block=0; block < numBlocks; block++)
+    {
+        const auto begin = log.begin() + block * (4 + numAccumulators);
+        const auto end = begin + 4 + numAccumulators;
+        auto position = [&](int32_t tag) { return std::find(begin, end, tag) - begin; };
+        EXPECT_LT( position(1), position(2) );
+        EXPECT_LT( position(2), position(3) );
+        for (size_t i=0; i < numAccumulators; i++)
+            EXPECT_LT( position(10 + i), position(20) );
+    }
+}
+
+TEST(Methcla_Audio_ExecutionPlan, Synths_should_be_processed_in_tree_order)
+{
+    ManualEngine e(1);
+    Methcla::Engine& engine = *e.engine;
+
+    Methcla::SynthId s4;
+
+    {
+        Methcla::Request request(engine);
+        request.openBundle();
+        Methcla::GroupId g1 = request.group(engine.root());
+        Methcla::GroupId g2 = request.group(Methcla::NodePlacement::head(engine.root()));
+        Methcla::SynthId s1 = e.probe(request, g1, 1);
+        Methcla::SynthId s2 = e.probe(request, Methcla::NodePlacement::head(g1), 2);
+        Methcla::SynthId s3 = e.probe(request, Methcla::NodePlacement::after(s1), 3);
+        s4 = e.probe(request, g2, 4);
+        Methcla::SynthId s5 = e.probe(request, Methcla::NodePlacement::before(s2), 5);
+        Methcla::SynthId s6 = e.probe(request, engine.root(), 6);
+        // Write to an external output in order to stay in the plan
+        for (Methcla::SynthId s : { s1, s2, s3, s4, s5, s6 })
+            request.mapOutput(s, 0, Methcla::AudioBusId(0), Methcla::kBusMappingExternal);
+        request.closeBundle();
+        request.send();
+    }
+
+    e.driver->tick(2);
+    resetProbeLog();
+    e.driver->tick();
+
+    EXPECT_EQ( probeLog(), std::vector<int32_t>({ 4, 5, 2, 1, 3, 6 }) );
+    EXPECT_EQ( e.driver->output(0), 6.f );
+
+    // The plan is recompiled when the tree changes
+    engine.free(s4);
+    e.driver->tick();
+    resetProbeLog();
+    e.driver->tick();
+
+    EXPECT_EQ( probeLog(), std::vector<int32_t>({ 5, 2, 1, 3, 6 }) );
+    EXPECT_EQ( e.driver->output(0), 5.f );
+}
+
+TEST(Methcla_Audio_Group, Nodes_placed_between_siblings_should_be_linked_to_both_neighbours)
+{
+    ManualEngine e(1);
+    Methcla::Engine& engine = *e.engine;
+
+    Methcla::SynthId s3;
+
+    {
+        Methcla::Request request(engine);
+        request.openBundle();
+        Methcla::GroupId g = request.group(engine.root());
+        Methcla::SynthId s1 = e.probe(request, g, 1);
+        Methcla::SynthId s2 = e.probe(request, g, 2);
+        // Insert between s1 and s2, once after the predecessor and once
+        // before the successor
+        s3 = e.probe(request, Methcla::NodePlacement::after(s1), 3);
+        Methcla::SynthId s4 = e.probe(request, Methcla::NodePlacement::before(s2), 4);
+        for (Methcla::SynthId s : { s1, s2, s3, s4 })
+            request.mapOutput(s, 0, Methcla::AudioBusId(0), Methcla::kBusMappingExternal);
+        request.closeBundle();
+        request.send();
+    }
+
+    e.driver->tick(2);
+    resetProbeLog();
+    e.driver->tick();
+
+    EXPECT_EQ( probeLog(), std::vector<int32_t>({ 1, 3, 4, 2 }) );
+
+    // Removing a node in the middle relies on the links of both neighbours
+    engine.free(s3);
+    e.driver->tick();
+    resetProbeLog();
+    e.driver->tick();
+
+    EXPECT_EQ( probeLog(), std::vector<int32_t>({ 1, 4, 2 }) );
+}
+
+TEST(Methcla_Audio_ExecutionPlan, Silent_synths_should_sleep_until_their_inputs_are_written)
+{
+    ManualEngine e(1);
+    Methcla::Engine& engine = *e.engine;
+
+    const Methcla::AudioBusId in = engine.audioBusId().alloc();
+    const Methcla::AudioBusId mid = engine.audioBusId().alloc();
+    const size_t numTailBlocks = 10;
+
+    {
+        Methcla::Request request(engine);
+        request.openBundle();
+        // Nothing writes to `in`; 1 sleeps and its silence puts 2 to sleep
+        Methcla::SynthId s1 = e.probe(request, engine.root(), 1, true);
+        request.mapInput(s1, 0, in);
+        request.mapOutput(s1, 0, mid, Methcla::kBusMappingReplace);
+        Methcla::SynthId s2 = e.probe(request, engine.root(), 2, true);
+        request.mapInput(s2, 0, mid);
+        request.mapOutput(s2, 0, Methcla::AudioBusId(0), Methcla::kBusMappingExternal);
+        // 3 keeps being processed for its tail time
+        Methcla::SynthId s3 = e.probe(request, engine.root(), 3, true);
+        request.mapInput(s3, 0, in);
+        request.mapOutput(s3, 0, Methcla::AudioBusId(1), Methcla::kBusMappingExternal);
+        request.setTailTime(s3, numTailBlocks * ManualDriver::kBufferSize / e.driver->sampleRate());
+        request.closeBundle();
+        request.send();
+    }
+
+    e.driver->tick(4 * numTailBlocks);
+
+    // Synths are always processed in the block they are activated in
+    EXPECT_EQ( probeCount(1), 1ul );
+    EXPECT_EQ( probeCount(2), 1ul );
+    EXPECT_EQ( probeCount(3), 1 + numTailBlocks );
+    EXPECT_EQ( e.driver->output(0), 0.f );
+    EXPECT_EQ( e.driver->output(1), 0.f );
+
+    // Writing to `in` wakes up all synths
+    {
+        Methcla::Request request(engine);
+        request.openBundle();
+        Methcla::SynthId s4 = e.probe(request, Methcla::NodePlacement::head(engine.root()), 4);
+        request.mapOutput(s4, 0, in, Methcla::kBusMappingReplace);
+        request.closeBundle();
+        request.send();
+    }
+
+    e.driver->tick(2);
+    resetProbeLog();
+    e.driver->tick();
+
+    EXPECT_EQ( probeLog(), std::vector<int32_t>({ 4, 1, 2, 3 }) );
+    EXPECT_EQ( e.driver->output(0), 3.f );
+    EXPECT_EQ( e.driver->output(1), 2.f );
+}
+
+TEST(Methcla_Audio_ExecutionPlan, Dead_synths_should_be_left_out_of_the_plan)
+{
+    ManualEngine e(1);
+    Methcla::Engine& engine = *e.engine;
+
+    const Methcla::AudioBusId a = engine.audioBusId().alloc();
+    const Methcla::AudioBusId b = engine.audioBusId().alloc();
+    const Methcla::AudioBusId c = engine.audioBusId().alloc();
+    const Methcla::AudioBusId unread = engine.audioBusId().alloc();
+
+    {
+        Methcla::Request request(engine);
+        request.openBundle();
+        // Live chain 1 -> a -> 2 -> output 0
+        Methcla::SynthId s1 = e.probe(request, engine.root(), 1);
+        request.mapOutput(s1, 0, a);
+        Methcla::SynthId s2 = e.probe(request, engine.root(), 2);
+        request.mapInput(s2, 0, a);
+        request.mapOutput(s2, 0, Methcla::AudioBusId(0), Methcla::kBusMappingExternal);
+        // Dead chain 3 -> b -> 4 -> c
+        Methcla::SynthId s3 = e.probe(request, engine.root(), 3);
+        request.mapOutput(s3, 0, b);
+        Methcla::SynthId s4 = e.probe(request, engine.root(), 4);
+        request.mapInput(s4, 0, b);
+        request.mapOutput(s4, 0, c);
+        // Unmapped output
+        e.probe(request, engine.root(), 5);
+        // Done flags are side effects that keep a synth alive
+        Methcla::SynthId s6 = e.probe(request, engine.root(), 6);
+        request.mapOutput(s6, 0, unread);
+        request.whenDone(s6, Methcla::kNodeDoneFreeSelf);
+        request.closeBundle();
+        request.send();
+    }
+
+    e.driver->tick(4);
+
+    EXPECT_EQ( probeCount(1), 4ul );
+    EXPECT_EQ( probeCount(2), 4ul );
+    EXPECT_EQ( probeCount(3), 0ul );
+    EXPECT_EQ( probeCount(4), 0ul );
+    EXPECT_EQ( probeCount(5), 0ul );
+    EXPECT_EQ( probeCount(6), 4ul );
+    EXPECT_EQ( e.driver->output(0), 2.f );
+
+    // Reading c from a live synth brings the dead chain back into the plan
+    {
+        Methcla::Request request(engine);
+        request.openBundle();
+        Methcla::SynthId s7 = e.probe(request, engine.root(), 7);
+        request.mapInput(s7, 0, c);
+        request.mapOutput(s7, 0, Methcla::AudioBusId(1), Methcla::kBusMappingExternal);
+        request.closeBundle();
+        request.send();
+    }
+
+    e.driver->tick();
+    resetProbeLog();
+    e.driver->tick();
+
+    EXPECT_EQ( probeLog(), std::vector<int32_t>({ 1, 2, 3, 4, 6, 7 }) );
+    EXPECT_EQ( e.driver->output(1), 3.f );
+}
+
+TEST(Methcla_Audio_ExecutionPlan, Batches_should_not_contain_dependent_synths)
+{
+    ManualEngine e(1);
+    Methcla::Engine& engine = *e.engine;
+
+    const Methcla::AudioBusId a = engine.audioBusId().alloc();
+    const Methcla::AudioBusId b = engine.audioBusId().alloc();
+    const size_t numIndependent = 4;
+
+    {
+        Methcla::Request request(engine);
+        request.openBundle();
+        // Chain of same-def synths 1 -> a -> 2 -> b -> 3 -> output 0
+        Methcla::SynthId s1 = e.probe(request, engine.root(), 1);
+        request.mapOutput(s1, 0, a, Methcla::kBusMappingReplace);
+        Methcla::SynthId s2 = e.probe(request, engine.root(), 2);
+        request.mapInput(s2, 0, a);
+        request.mapOutput(s2, 0, b, Methcla::kBusMappingReplace);
+        Methcla::SynthId s3 = e.probe(request, engine.root(), 3);
+        request.mapInput(s3, 0, b);
+        request.mapOutput(s3, 0, Methcla::AudioBusId(0), Methcla::kBusMappingExternal);
+        // Independent synths join the batch of 3
+        for (size_t i=0; i < numIndependent; i++)
+        {
+            Methcla::SynthId s = e.probe(request, engine.root(), 10 + i);
+            request.mapOutput(s, 0, Methcla::AudioBusId(1), Methcla::kBusMappingExternal);
+        }
+        request.closeBundle();
+        request.send();
+    }
+
+    e.driver->tick(2);
+    resetProbeLog();
+    e.driver->tick();
+
+    EXPECT_EQ( e.driver->output(0), 3.f );
+    EXPECT_EQ( e.driver->output(1), (float)numIndependent );
+    // Single synths are processed without process_batch
+    EXPECT_EQ( probeBatches(), std::vector<size_t>({ 1 + numIndependent }) );
+    EXPECT_EQ( probeLog(), std::vector<int32_t>({ 1, 2, 3, 10, 11, 12, 13 }) );
+}
+
+TEST(Methcla_Engine, Control_bus_values_should_propagate_between_synths)
+{
+    ManualEngine e(1);
+    Methcla::Engine& engine = *e.engine;
+
+    const Methcla::ControlBusId a = engine.controlBusId().alloc();
+    const Methcla::ControlBusId b = engine.controlBusId().alloc();
+    Methcla::SynthId writer, reader;
+
+    {
+        Methcla::Request request(engine);
+        request.openBundle();
+        // writer -> a -> reader -> b -> delayed, which is processed before reader
+        Methcla::SynthId delayed = request.synth(METHCLA_TESTS_CONTROL_PROBE_URI, engine.root(), { 0.f });
+        request.mapControlInput(delayed, 0, b);
+        request.mapOutput(delayed, 0, Methcla::AudioBusId(1), Methcla::kBusMappingExternal);
+        request.activate(delayed);
+        writer = request.synth(METHCLA_TESTS_CONTROL_PROBE_URI, engine.root(), { 21.f });
+        request.mapControlOutput(writer, 0, a);
+        request.activate(writer);
+        reader = request.synth(METHCLA_TESTS_CONTROL_PROBE_URI, engine.root(), { 0.f });
+        request.mapControlInput(reader, 0, a);
+        request.mapControlOutput(reader, 0, b);
+        request.mapOutput(reader, 0, Methcla::AudioBusId(0), Methcla::kBusMappingExternal);
+        request.activate(reader);
+        request.closeBundle();
+        request.send();
+    }
+
+    // The reader sees the value written in the same block, the synth
+    // processed before the writer of its bus in the next block
+    e.driver->tick();
+    EXPECT_EQ( e.driver->output(0), 21.f );
+    EXPECT_EQ( e.driver->output(1), 0.f );
+    e.driver->tick();
+    EXPECT_EQ( e.driver->output(1), 21.f );
+
+    engine.set(writer, 0, 42.);
+    e.driver->tick();
+    EXPECT_EQ( e.driver->output(0), 42.f );
+    e.driver->tick();
+    EXPECT_EQ( e.driver->output(1), 42.f );
+
+    // Out of range bus ids and indices are reported as errors and leave the
+    // mappings unchanged
+    {
+        Methcla::Request request(engine);
+        request.openBundle();
+        request.mapControlInput(reader, 2, b);
+        request.mapControlOutput(reader, 0, Methcla::ControlBusId(1 << 30));
+        request.closeBundle();
+        request.send();
+    }
+
+    engine.set(writer, 0, 84.);
+    e.driver->tick(2);
+    EXPECT_EQ( e.driver->output(0), 84.f );
+    EXPECT_EQ( e.driver->output(1), 84.f );
+
+    // Unmapping an input reconnects it to its control value
+    {
+        Methcla::Request request(engine);
+        request.openBundle();
+        request.mapControlInput(reader, 0, Methcla::ControlBusId(-1));
+        request.set(reader, 0, 7.);
+        request.closeBundle();
+        request.send();
+    }
+
+    e.driver->tick(2);
+    EXPECT_EQ( e.driver->output(0), 7.f );
+    EXPECT_EQ( e.driver->output(1), 7.f );
+}
+
+TEST(Methcla_Engine, Scheduling_failures_should_be_reported)
+{
+    // Overflow the realtime scheduler and the commands staging bundles
+    // beyond the scheduler horizon (about 23 ms)
+    const std::pair<double,size_t> cases[] = {
+        std::make_pair(0.01, 65537),
+        std::make_pair(10., 100000)
+    };
+
+    for (const auto& c : cases)
+    {
+        std::mutex mutex;
+        std::condition_variable cond;
+        size_t numErrors = 0;
+
+        Methcla::EngineOptions options;
+        options.logHandler = [&](Methcla_LogLevel level, const char*) {
+            if (level == kMethcla_LogError)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                numErrors++;
+                cond.notify_all();
+            }
+        };
+        ManualEngine e(1, options);
+        Methcla::Engine& engine = *e.engine;
+
+        const uint64_t time = methcla_time_to_uint64(engine.currentTime() + c.first);
+        OSCPP::Client::DynamicPacket packet(c.second * 32);
+        packet.openBundle(1);
+        for (size_t i=0; i < c.second; i++)
+            packet.openBundle(time).closeBundle();
+        packet.closeBundle();
+        Methcla::detail::checkReturnCode(methcla_engine_send(engine, packet.data(), packet.size()));
+
+        e.driver->tick();
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ASSERT_TRUE( cond.wait_for(lock, std::chrono::seconds(5), [&]{ return numErrors > 0; }) );
+        }
+
+        // Subsequent requests are processed
+        {
+            Methcla::Request request(engine);
+            request.openBundle();
+            Methcla::SynthId s = e.probe(request, engine.root(), 1);
+            request.mapOutput(s, 0, Methcla::AudioBusId(0), Methcla::kBusMappingExternal);
+            request.closeBundle();
+            request.send();
+        }
+
+        e.driver->tick(2);
+        EXPECT_EQ( e.driver->output(0), 1.f );
+    }
+}
+
+TEST(Methcla_Engine, Plugin_commands_should_be_dispatched)
+{
+    std::mutex mutex;
+    std::vector<std::string> errors;
+
+    Methcla::EngineOptions options;
+    options.logHandler = [&](Methcla_LogLevel level, const char* message) {
+        if (level == kMethcla_LogError)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            errors.push_back(message);
+        }
+    };
+    options.addLibrary(commandLibrary);
+    gCommandSum = 0;
+    gRejectedCommandSum = 0;
+    ManualEngine e(1, options);
+    Methcla::Engine& engine = *e.engine;
+
+    // Registering an address twice or clashing with an engine command fails
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ASSERT_EQ( errors.size(), 2u );
+        EXPECT_EQ( errors[0], "Command /tests/add already registered" );
+        EXPECT_EQ( errors[1], "Command /node/free already registered" );
+    }
+
+    Methcla::SynthId synth;
+    {
+        Methcla::Request request(engine);
+        request.openBundle();
+        synth = e.probe(request, engine.root(), 1);
+        request.mapOutput(synth, 0, Methcla::AudioBusId(0), Methcla::kBusMappingExternal);
+        request.closeBundle();
+        request.send();
+    }
+
+    for (int32_t x : { 3, 4 })
+    {
+        OSCPP::Client::DynamicPacket packet(64);
+        packet.openMessage("/tests/add", 1).int32(x).closeMessage();
+        Methcla::detail::checkReturnCode(methcla_engine_send(engine, packet.data(), packet.size()));
+    }
+
+    e.driver->tick(2);
+    EXPECT_EQ( gCommandSum.load(), 7 );
+    EXPECT_EQ( e.driver->output(0), 1.f );
+
+    // Engine commands are not replaced by plugin commands
+    {
+        Methcla::Request request(engine);
+        request.free(synth);
+        request.send();
+    }
+
+    e.driver->tick(2);
+    EXPECT_EQ( e.driver->output(0), 0.f );
+    EXPECT_EQ( gRejectedCommandSum.load(), 0 );
+}
+
+TEST(Methcla_Engine, Requests_should_only_be_sent_once)
+{
+    ManualEngine e(1);
+    Methcla::Engine& engine = *e.engine;
+
+    Methcla::Request request(engine);
+    request.openBundle();
+    e.probe(request, engine.root(), 1);
+    request.closeBundle();
+    request.send();
+
+    EXPECT_THROW( request.send(), std::runtime_error );
+    EXPECT_THROW( request.openBundle(), std::runtime_error );
+    EXPECT_EQ( request.size(), 0u );
+}
+
+TEST(Methcla_Engine, Send_buffer_should_release_the_buffer_once)
+{
+    ReleaseCounter sent;
+    ReleaseCounter malformed;
+    ReleaseCounter rejected;
+
+    {
+        ManualEngine e(1);
+        Methcla::Engine& engine = *e.engine;
+
+        OSCPP::Client::DynamicPacket packet(32);
+        packet.openBundle(1).closeBundle();
+
+        // Released by the worker after the request has been processed
+        EXPECT_EQ( errorCode(methcla_engine_send_buffer(
+            engine, sent.buffer(packet.data(), packet.size()), packet.size(),
+            ReleaseCounter::release, &sent)), kMethcla_NoError );
+        EXPECT_EQ( sent.count(), 0u );
+        e.driver->tick();
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (sent.count() == 0 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        EXPECT_EQ( sent.count(), 1u );
+
+        // Released immediately when the packet can't be parsed
+        const char bundleHeader[12] = "#bundle";
+        EXPECT_EQ( errorCode(methcla_engine_send_buffer(
+            engine, malformed.buffer(bundleHeader, sizeof(bundleHeader)), sizeof(bundleHeader),
+            ReleaseCounter::release, &malformed)), kMethcla_NoError );
+        EXPECT_EQ( malformed.count(), 1u );
+
+        // Released immediately when the request queue is full
+        fillRequestQueue(engine);
+        EXPECT_EQ( errorCode(methcla_engine_send_buffer(
+            engine, rejected.buffer(packet.data(), packet.size()), packet.size(),
+            ReleaseCounter::release, &rejected)), kMethcla_QueueFullError );
+        EXPECT_EQ( rejected.count(), 1u );
+    }
+
+    EXPECT_EQ( sent.count(), 1u );
+    EXPECT_EQ( malformed.count(), 1u );
+    EXPECT_EQ( rejected.count(), 1u );
+}
+
+TEST(Methcla_Engine, Pending_buffers_should_be_released_when_the_engine_is_destroyed)
+{
+    ReleaseCounter staged;
+    ReleaseCounter scheduled;
+
+    {
+        ManualEngine e(1);
+        Methcla::Engine& engine = *e.engine;
+
+        // Beyond the scheduler horizon, staged by the worker
+        OSCPP::Client::DynamicPacket stagedPacket(32);
+        stagedPacket.openBundle(methcla_time_to_uint64(10.)).closeBundle();
+        EXPECT_EQ( errorCode(methcla_engine_send_buffer(
+            engine, staged.buffer(stagedPacket.data(), stagedPacket.size()), stagedPacket.size(),
+            ReleaseCounter::release, &staged)), kMethcla_NoError );
+
+        // Within the horizon, held by the realtime scheduler
+        OSCPP::Client::DynamicPacket scheduledPacket(32);
+        scheduledPacket.openBundle(methcla_time_to_uint64(0.01)).closeBundle();
+        EXPECT_EQ( errorCode(methcla_engine_send_buffer(
+            engine, scheduled.buffer(scheduledPacket.data(), scheduledPacket.size()), scheduledPacket.size(),
+            ReleaseCounter::release, &scheduled)), kMethcla_NoError );
+
+        e.driver->tick();
+        EXPECT_EQ( staged.count(), 0u );
+        EXPECT_EQ( scheduled.count(), 0u );
+    }
+
+    EXPECT_EQ( staged.count(), 1u );
+    EXPECT_EQ( scheduled.count(), 1u );
+}
+
+TEST(Methcla_Engine, Try_send_should_fail_when_the_request_queue_is_full)
+{
+    ManualEngine e(1);
+    Methcla::Engine& engine = *e.engine;
+
+    fillRequestQueue(engine);
+
+    const Methcla_EngineQueueStats stats = engine.queueStats();
+    EXPECT_EQ( stats.requests.size, stats.requests.capacity );
+    EXPECT_EQ( stats.requests.max_size, stats.requests.capacity );
+
+    OSCPP::Client::DynamicPacket packet(32);
+    packet.openBundle(1).closeBundle();
+    EXPECT_EQ( errorCode(methcla_engine_try_send(engine, packet.data(), packet.size())), kMethcla_QueueFullError );
+
+    // Processing a block makes room again
+    e.driver->tick();
+    EXPECT_EQ( errorCode(methcla_engine_try_send(engine, packet.data(), packet.size())), kMethcla_NoError );
+}
+
+TEST(Methcla_Engine, Send_with_timeout_should_wait_for_room_in_the_request_queue)
+{
+    ManualEngine e(1);
+    Methcla::Engine& engine = *e.engine;
+
+    OSCPP::Client::DynamicPacket packet(32);
+    packet.openBundle(1).closeBundle();
+
+    // Fails after the timeout while nothing is processed
+    fillRequestQueue(engine);
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ( errorCode(methcla_engine_send_with_timeout(engine, packet.data(), packet.size(), 0.05)), kMethcla_QueueFullError );
+    EXPECT_GE( std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50) );
+
+    // Succeeds when a block is processed before the timeout
+    std::thread audio([&e]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        e.driver->tick();
+    });
+    EXPECT_EQ( errorCode(methcla_engine_send_with_timeout(engine, packet.data(), packet.size(), 5.)), kMethcla_NoError );
+    audio.join();
+}
+
+TEST(Methcla_Engine, Capture_should_only_record_enqueued_requests)
+{
+    const std::string path = Methcla::Tests::outputFile("engine-capture.osc");
+    size_t numSent = 0;
+    Methcla_Time secondBlockTime = 0.;
+
+    {
+        Methcla::EngineOptions options;
+        options.captureFile = path;
+        ManualEngine e(1, options);
+        Methcla::Engine& engine = *e.engine;
+
+        OSCPP::Client::DynamicPacket packet(32);
+        packet.openBundle(1).closeBundle();
+
+        // Malformed packets are not recorded
+        const char bundleHeader[12] = "#bundle";
+        EXPECT_EQ( errorCode(methcla_engine_send(engine, bundleHeader, sizeof(bundleHeader))), kMethcla_NoError );
+
+        // Neither are packets rejected because the request queue is full
+        for (;;)
+        {
+            const Methcla_ErrorCode code = errorCode(methcla_engine_try_send(engine, packet.data(), packet.size()));
+            if (code == kMethcla_QueueFullError)
+                break;
+            ASSERT_EQ( code, kMethcla_NoError );
+            numSent++;
+        }
+
+        const Methcla_Packet batch[] = { { packet.data(), packet.size() } };
+        EXPECT_EQ( errorCode(methcla_engine_send_batch(engine, batch, 1)), kMethcla_QueueFullError );
+
+        e.driver->tick();
+        secondBlockTime = e.driver->currentTime();
+        EXPECT_EQ( errorCode(methcla_engine_try_send(engine, packet.data(), packet.size())), kMethcla_NoError );
+        numSent++;
+    }
+
+    Methcla::IO::RequestCaptureReader reader(path);
+    Methcla::IO::CapturedRequest request;
+    size_t numCaptured = 0;
+    while (reader.read(request))
+    {
+        EXPECT_NE( request.packet.size(), 12u );
+        numCaptured++;
+        // Recorded with the block due to process the request and its start time
+        if (numCaptured < numSent)
+        {
+            EXPECT_EQ( request.block, 0u );
+            EXPECT_EQ( request.time, 0. );
+        }
+        else
+        {
+            EXPECT_EQ( request.block, 1u );
+            EXPECT_NEAR( request.time, secondBlockTime, 1e-9 );
+        }
+    }
+    EXPECT_EQ( numCaptured, numSent );
+}
+
+TEST(Methcla_Audio_Synth, Unconnected_inputs_should_not_be_shared_between_synths)
+{
+    for (size_t numThreads : { 1, 4 })
+    {
+        ManualEngine e(numThreads);
+        Methcla::Engine& engine = *e.engine;
+        const size_t numSynths = 8;
+
+        {
+            Methcla::Request request(engine);
+            request.openBundle();
+            // All inputs are unconnected; every other synth overwrites its input
+            for (size_t i=0; i < numSynths; i++)
+            {
+                Methcla::SynthId s = e.probe(request, engine.root(), i, false, i % 2 == 0);
+                request.mapOutput(s, 0, Methcla::AudioBusId(0), Methcla::kBusMappingExternal);
+            }
+            request.closeBundle();
+            request.send();
+        }
+
+        e.driver->tick(4);
+
+        EXPECT_EQ( e.driver->output(0), (float)numSynths );
+    }
+}
+
+TEST(Methcla_Audio_Synth, Direct_bus_access_should_preserve_bus_contents)
+{
+    for (size_t numThreads : { 1, 4 })
+    {
+        ManualEngine e(numThreads);
+        Methcla::Engine& engine = *e.engine;
+
+        const Methcla::AudioBusId x = engine.audioBusId().alloc();
+
+        {
+            Methcla::Request request(engine);
+            request.openBundle();
+            // 1 writes x in place, 2 accumulates: x = 2
+            Methcla::SynthId s1 = e.probe(request, engine.root(), 1);
+            request.mapOutput(s1, 0, x);
+            Methcla::SynthId s2 = e.probe(request, engine.root(), 2);
+            request.mapOutput(s2, 0, x);
+            // 3 reads and accumulates into the same bus: x = 2 + 3
+            Methcla::SynthId s3 = e.probe(request, engine.root(), 3);
+            request.mapInput(s3, 0, x);
+            request.mapOutput(s3, 0, x);
+            // 4 and 5 read x in place
+            Methcla::SynthId s4 = e.probe(request, engine.root(), 4);
+            request.mapInput(s4, 0, x);
+            request.mapOutput(s4, 0, Methcla::AudioBusId(0), Methcla::kBusMappingExternal | Methcla::kBusMappingReplace);
+            Methcla::SynthId s5 = e.probe(request, engine.root(), 5);
+            request.mapInput(s5, 0, x);
+            request.mapOutput(s5, 0, Methcla::AudioBusId(1), Methcla::kBusMappingExternal);
+            request.closeBundle();
+            request.send();
+        }
+
+        e.driver->tick(4);
+
+        EXPECT_EQ( e.driver->output(0), 6.f );
+        EXPECT_EQ( e.driver->output(1), 6.f );
+
+    }
+}
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__native_client__)
+
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static sockaddr_un unixSocketAddress(const char* path)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    return address;
+}
+
+static const char* const kServerSocketPath = "/tmp/methcla-tests-server.sock";
+
+//* Datagram socket bound to a path, talking to the engine's socket server.
+class SocketClient
+{
+public:
+    SocketClient(const char* path)
+        : m_path(path)
+        , m_socket(socket(AF_UNIX, SOCK_DGRAM, 0))
+    {
+        const sockaddr_un address = unixSocketAddress(path);
+        unlink(path);
+        bind(m_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+        timeval timeout;
+        timeout.tv_sec = 2;
+        timeout.tv_usec = 0;
+        setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+
+    ~SocketClient()
+    {
+        close(m_socket);
+        unlink(m_path);
+    }
+
+    bool send(const OSCPP::Client::Packet& packet)
+    {
+        const sockaddr_un address = unixSocketAddress(kServerSocketPath);
+        return sendto(m_socket, packet.data(), packet.size(), 0,
+                      reinterpret_cast<const sockaddr*>(&address), sizeof(address))
+               == (ssize_t)packet.size();
+    }
+
+    //* Send a query with request id.
+    bool query(const char* address, Methcla_RequestId requestId)
+    {
+        OSCPP::Client::DynamicPacket packet(128);
+        packet.openMessage(address, 1).int32(requestId).closeMessage();
+        return send(packet);
+    }
+
+    //* Receive a packet, return its size or -1 after a timeout.
+    ssize_t receive(char* buffer, size_t size)
+    {
+        return recv(m_socket, buffer, size, 0);
+    }
+
+private:
+    const char* m_path;
+    int         m_socket;
+};
+
+static std::unique_ptr<Methcla::Engine> socketServerEngine()
+{
+    Methcla::EngineOptions options;
+    options.serverSocketPath = kServerSocketPath;
+    std::unique_ptr<Methcla::Engine> engine(new Methcla::Engine(options));
+    engine->start();
+    return engine;
+}
+
+TEST(Methcla_Engine, Socket_server_should_reply_to_the_requesting_client)
+{
+    auto engine = socketServerEngine();
+    SocketClient client("/tmp/methcla-tests-client.sock");
+
+    ASSERT_TRUE( client.query("/node/tree/statistics", 1) );
+
+    char reply[256];
+    const ssize_t size = client.receive(reply, sizeof(reply));
+    ASSERT_GT( size, 0 );
+    OSCPP::Server::Message message(OSCPP::Server::Packet(reply, size));
+    ASSERT_TRUE( message == "/node/tree/statistics" );
+    OSCPP::Server::ArgStream args(message.args());
+    EXPECT_EQ( args.int32(), 1 );
+    EXPECT_EQ( args.int32(), 0 );
+}
+
+TEST(Methcla_Engine, Socket_server_should_not_mix_up_clients_using_the_same_request_id)
+{
+    auto engine = socketServerEngine();
+    SocketClient client1("/tmp/methcla-tests-client-1.sock");
+    SocketClient client2("/tmp/methcla-tests-client-2.sock");
+
+    ASSERT_TRUE( client1.query("/node/tree/statistics", 1) );
+    ASSERT_TRUE( client2.query("/engine/realtime-memory/statistics", 1) );
+
+    char reply[256];
+    ssize_t size = client1.receive(reply, sizeof(reply));
+    ASSERT_GT( size, 0 );
+    EXPECT_TRUE( OSCPP::Server::Message(OSCPP::Server::Packet(reply, size)) == "/node/tree/statistics" );
+
+    size = client2.receive(reply, sizeof(reply));
+    ASSERT_GT( size, 0 );
+    EXPECT_TRUE( OSCPP::Server::Message(OSCPP::Server::Packet(reply, size)) == "/engine/realtime-memory/statistics" );
+}
+
+#endif
+
+#include <methcla/shared_memory.hpp>
+
+#if METHCLA_HAVE_SHARED_MEMORY
+
+TEST(Methcla_Engine, Shared_memory_client_should_receive_replies)
+{
+    const char* name = "/methcla-tests";
+
+    Methcla::EngineOptions options;
+    options.sharedMemoryName = name;
+    auto engine = std::unique_ptr<Methcla::Engine>(
+        new Methcla::Engine(options)
+    );
+
+    engine->start();
+
+    const Methcla_RequestId requestId = 1;
+    std::atomic<int32_t> numGroups(-1);
+
+    {
+        Methcla::SharedMemoryEngine client(name,
+            [&](Methcla_RequestId id, const void* packet, size_t size) {
+                OSCPP::Server::Message message(OSCPP::Server::Packet(packet, size));
+                if (id == requestId && message == "/node/tree/statistics")
+                    numGroups = message.args().int32();
+            });
+
+        client.group(client.root());
+
+        OSCPP::Client::DynamicPacket request(128);
+        request
+            .openMessage("/node/tree/statistics", 1)
+            .int32(requestId)
+            .closeMessage();
+        client.send(request.data(), request.size());
+
+        for (size_t i=0; i < 100 && numGroups.load() < 0; i++)
+            sleepFor(0.01);
+    }
+
+    ASSERT_EQ( numGroups.load(), 2 );
+}
+
+TEST(Methcla_Engine, Shared_memory_and_in_process_clients_should_not_mix_up_replies)
+{
+    const char* name = "/methcla-tests";
+
+    Methcla::EngineOptions options;
+    options.sharedMemoryName = name;
+    auto engine = std::unique_ptr<Methcla::Engine>(
+        new Methcla::Engine(options)
+    );
+
+    engine->start();
+
+    // Both clients use request id 1
+    const Methcla_RequestId requestId = 1;
+    std::atomic<int32_t> numGroups(-1);
+    std::atomic<size_t> numReplies(0);
+    std::atomic<bool> unexpectedReply(false);
+
+    {
+        Methcla::SharedMemoryEngine client(name,
+            [&](Methcla_RequestId id, const void* packet, size_t size) {
+                if (id == kMethcla_Notification)
+                    return;
+                OSCPP::Server::Message message(OSCPP::Server::Packet(packet, size));
+                numReplies++;
+                if (id == requestId && message == "/node/tree/statistics")
+                    numGroups = message.args().int32();
+                else
+                    unexpectedReply = true;
+            },
+            options.maxNumNodes);
+
+        // Node ids come from separate ranges
+        EXPECT_GE( client.nodeIdAllocator().alloc().id(), (int32_t)(options.maxNumNodes / 2) );
+        EXPECT_LT( engine->nodeIdAllocator().alloc().id(), (int32_t)(options.maxNumNodes / 2) );
+
+        OSCPP::Client::DynamicPacket request(128);
+        request
+            .openMessage("/node/tree/statistics", 1)
+            .int32(requestId)
+            .closeMessage();
+        client.send(request.data(), request.size());
+
+        // The in-process engine hands out request ids from 1
+        EXPECT_NO_THROW( engine->getRealtimeMemoryStatistics() );
+
+        for (size_t i=0; i < 100 && numGroups.load() < 0; i++)
+            sleepFor(0.01);
+        // Give a misrouted reply time to arrive
+        sleepFor(0.05);
+    }
+
+    EXPECT_EQ( numGroups.load(), 1 );
+    EXPECT_EQ( numReplies.load(), 1u );
+    EXPECT_FALSE( unexpectedReply.load() );
+}
+
+TEST(Methcla_Engine, Shared_memory_client_send_should_time_out_when_the_request_queue_is_full)
+{
+    const char* name = "/methcla-tests";
+
+    Methcla::EngineOptions options;
+    options.sharedMemoryName = name;
+    // Not started: the engine doesn't read the shared request queue
+    Methcla::Engine engine(options);
+    Methcla::SharedMemoryEngine client(name);
+
+    OSCPP::Client::DynamicPacket request(128);
+    request
+        .openMessage("/node/tree/statistics", 1)
+        .int32(1)
+        .closeMessage();
+
+    for (size_t i=0; i < Methcla::detail::SharedMemoryTransport::kNumRequests; i++)
+        client.send(request.data(), request.size(), 0.);
+
+    EXPECT_THROW( client.send(request.data(), request.size(), 0.01), std::runtime_error );
+}
+
+#endif
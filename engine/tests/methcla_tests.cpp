@@ -19,7 +19,9 @@
 
 #include "gtest/gtest.h"
 
+#include <algorithm>
 #include <atomic>
+#include <functional>
 #include <iostream>
 #include <mutex>
 #include <thread>
@@ -116,7 +118,7 @@ TEST(Methcla_Utility_Worker, Queue_overflow_should_throw)
 
     const size_t queueSize = 1024;
 
-    Methcla::Utility::Worker<Command> worker(queueSize, false);
+    Methcla::Utility::Worker<Command> worker(queueSize);
 
     for (size_t i=0; i < worker.maxCapacity(); i++) {
         worker.sendToWorker(Command());
@@ -173,6 +175,430 @@ TEST(Methcla_Utility_WorkerThread, All_commands_should_be_executed)
     }
 }
 
+namespace test_Methcla_Utility_WorkerThread_lanes
+{
+    struct Command
+    {
+        void perform()
+        {
+            if (m_func) m_func();
+        }
+
+        std::function<void()> m_func;
+    };
+};
+
+TEST(Methcla_Utility_WorkerThread, Bulk_commands_should_not_block_latency_commands)
+{
+    using namespace Methcla::Utility;
+    using test_Methcla_Utility_WorkerThread_lanes::Command;
+
+    const size_t numBulk = 3;
+    const size_t numLatency = 10;
+
+    WorkerThread<Command> worker(16, 2);
+
+    Semaphore release, bulkDone, latencyDone;
+    std::atomic<size_t> numBulkRunning(0);
+    std::atomic<size_t> maxBulkRunning(0);
+
+    Command bulk;
+    bulk.m_func = [&](){
+        updateMaxQueueSize(maxBulkRunning, ++numBulkRunning);
+        release.wait();
+        numBulkRunning--;
+        bulkDone.post();
+    };
+    for (size_t i=0; i < numBulk; i++)
+        worker.sendToWorker(bulk, kWorkerBulkLane);
+
+    Command latency;
+    latency.m_func = [&](){ latencyDone.post(); };
+    for (size_t i=0; i < numLatency; i++)
+        worker.sendToWorker(latency);
+
+    // Blocks if the bulk commands occupy all threads
+    for (size_t i=0; i < numLatency; i++)
+        latencyDone.wait();
+
+    for (size_t i=0; i < numBulk; i++)
+        release.post();
+    for (size_t i=0; i < numBulk; i++)
+        bulkDone.wait();
+
+    EXPECT_EQ(maxBulkRunning.load(), 1u);
+}
+
+TEST(Methcla_Utility_MessageQueue, Messages_from_concurrent_senders_should_arrive_once_in_order)
+{
+    const size_t numMessages = 2000;
+
+    for (size_t threadCount=1; threadCount <= 8; threadCount *= 2) {
+        Methcla::Utility::MessageQueue<size_t> queue(256);
+
+        std::vector<std::thread> threads;
+        for (size_t t=0; t < threadCount; t++) {
+            threads.emplace_back([&queue,t,numMessages](){
+                for (size_t i=0; i < numMessages; i++) {
+                    const size_t msg = t * numMessages + i;
+                    for (;;) {
+                        try {
+                            queue.send(msg);
+                            break;
+                        } catch (std::runtime_error&) {
+                            std::this_thread::yield();
+                        }
+                    }
+                }
+            });
+        }
+
+        std::vector<size_t> next(threadCount, 0);
+        size_t received = 0;
+        while (received < threadCount * numMessages) {
+            size_t msg;
+            if (queue.next(msg)) {
+                const size_t t = msg / numMessages;
+                ASSERT_LT(t, threadCount);
+                ASSERT_EQ(msg % numMessages, next[t]);
+                next[t]++;
+                received++;
+            }
+        }
+
+        for (auto& t : threads) t.join();
+
+        size_t msg;
+        EXPECT_FALSE(queue.next(msg));
+    }
+}
+
+TEST(Methcla_Utility_MessageQueue, Statistics_should_track_size_and_high_water_mark)
+{
+    Methcla::Utility::MessageQueue<size_t> queue(16);
+
+    const size_t capacity = queue.statistics().capacity;
+    ASSERT_GE(capacity, 16u);
+
+    for (size_t i=0; i < capacity; i++) {
+        EXPECT_TRUE(queue.trySend(i));
+    }
+    EXPECT_FALSE(queue.trySend(capacity));
+
+    Methcla::Utility::QueueStatistics stats = queue.statistics();
+    EXPECT_EQ(stats.size, capacity);
+    EXPECT_EQ(stats.maxSize, capacity);
+
+    size_t msg;
+    for (size_t i=0; i < capacity / 2; i++) {
+        EXPECT_TRUE(queue.next(msg));
+    }
+
+    stats = queue.statistics();
+    EXPECT_EQ(stats.size, capacity - capacity / 2);
+    EXPECT_EQ(stats.maxSize, capacity);
+}
+
+#include "Methcla/Utility/ThreadPool.hpp"
+
+namespace test_Methcla_Utility_ThreadPool
+{
+    struct Tasks
+    {
+        std::vector<std::atomic<size_t>> counts;
+
+        Tasks(size_t n)
+            : counts(n)
+        {
+            for (auto& x : counts) x.store(0);
+        }
+
+        static void run(void* data, size_t task)
+        {
+            static_cast<Tasks*>(data)->counts[task]++;
+        }
+    };
+};
+
+TEST(Methcla_Utility_ThreadPool, All_tasks_should_be_executed_once)
+{
+    using test_Methcla_Utility_ThreadPool::Tasks;
+
+    for (size_t threadCount=1; threadCount <= 4; threadCount++) {
+        Methcla::Utility::ThreadPool pool(threadCount);
+        EXPECT_EQ(pool.numThreads(), threadCount);
+
+        for (size_t n : { 0, 1, 2, 3, 7, 64, 1000 }) {
+            for (size_t iter=0; iter < 100; iter++) {
+                Tasks tasks(n);
+                pool.run(Tasks::run, &tasks, n);
+                for (size_t i=0; i < n; i++) {
+                    ASSERT_EQ(tasks.counts[i].load(), 1u);
+                }
+            }
+        }
+    }
+}
+
+#include "Methcla/Audio/DSP.hpp"
+
+#include <vector>
+
+namespace test_Methcla_Audio_DSP
+{
+    using Methcla::Audio::sample_t;
+
+    // Deterministic test signal with distinct values per buffer.
+    static std::vector<sample_t> signal(size_t n, size_t seed)
+    {
+        std::vector<sample_t> result(n);
+        for (size_t i=0; i < n; i++)
+            result[i] = (sample_t)((i * 7 + seed * 13) % 29) / 29.f - 0.5f;
+        return result;
+    }
+};
+
+TEST(Methcla_Audio_DSP, Kernels_should_match_generic_implementation)
+{
+    using namespace Methcla::Audio;
+    using test_Methcla_Audio_DSP::signal;
+
+    const DSP::Kernels* generic = DSP::kernels(DSP::kGeneric);
+    ASSERT_TRUE( generic != nullptr );
+    ASSERT_TRUE( DSP::kernels(DSP::kernels().instructionSet) == &DSP::kernels() );
+
+    for (auto instructionSet : { DSP::kSSE2, DSP::kAVX2, DSP::kAVX512 }) {
+        const DSP::Kernels* kernels = DSP::kernels(instructionSet);
+        if (kernels == nullptr)
+            continue;
+        EXPECT_EQ(kernels->instructionSet, instructionSet);
+
+        // Cover remainders and unaligned buffers
+        for (size_t n : { 0, 1, 3, 4, 7, 8, 15, 16, 17, 31, 64, 67 }) {
+            for (size_t offset : { 0, 1, 3 }) {
+                const std::vector<sample_t> a = signal(n + offset, 1);
+                const std::vector<sample_t> b = signal(n + offset, 2);
+                const std::vector<sample_t> c = signal(n + offset, 3);
+                const sample_t* srcs[] = { a.data() + offset, b.data() + offset, c.data() + offset };
+
+                std::vector<sample_t> expected(b), actual(b);
+                generic->zero(expected.data() + offset, n);
+                kernels->zero(actual.data() + offset, n);
+                ASSERT_EQ(expected, actual);
+
+                expected = b; actual = b;
+                generic->copy(expected.data() + offset, a.data() + offset, n);
+                kernels->copy(actual.data() + offset, a.data() + offset, n);
+                ASSERT_EQ(expected, actual);
+
+                expected = b; actual = b;
+                generic->accumulate(expected.data() + offset, a.data() + offset, n);
+                kernels->accumulate(actual.data() + offset, a.data() + offset, n);
+                ASSERT_EQ(expected, actual);
+
+                expected = b; actual = b;
+                generic->mix(expected.data() + offset, a.data() + offset, 0.3f, n);
+                kernels->mix(actual.data() + offset, a.data() + offset, 0.3f, n);
+                for (size_t i=0; i < expected.size(); i++)
+                    ASSERT_FLOAT_EQ(expected[i], actual[i]);
+
+                for (size_t numSrcs=0; numSrcs <= 3; numSrcs++) {
+                    expected = b; actual = b;
+                    generic->sum(expected.data() + offset, srcs, numSrcs, n);
+                    kernels->sum(actual.data() + offset, srcs, numSrcs, n);
+                    for (size_t i=0; i < expected.size(); i++)
+                        ASSERT_FLOAT_EQ(expected[i], actual[i]);
+                }
+            }
+        }
+    }
+}
+
+TEST(Methcla_Audio_DSP, Interleaving_and_conversion_kernels_should_match_generic_implementation)
+{
+    using namespace Methcla::Audio;
+    using test_Methcla_Audio_DSP::signal;
+
+    const DSP::Kernels* generic = DSP::kernels(DSP::kGeneric);
+
+    for (auto instructionSet : { DSP::kSSE2, DSP::kAVX2, DSP::kAVX512 }) {
+        const DSP::Kernels* kernels = DSP::kernels(instructionSet);
+        if (kernels == nullptr)
+            continue;
+
+        for (size_t numFrames : { 0, 1, 5, 8, 13, 64, 67 }) {
+            for (size_t numChannels : { 1, 2, 3, 4, 8 }) {
+                const size_t offset = 3;
+                const std::vector<sample_t> interleaved = signal(numChannels * numFrames, 1);
+
+                std::vector<std::vector<sample_t>> expected(numChannels), actual(numChannels);
+                std::vector<sample_t*> expectedPtrs, actualPtrs;
+                for (size_t c=0; c < numChannels; c++) {
+                    expected[c] = actual[c] = signal(offset + numFrames, c);
+                    expectedPtrs.push_back(expected[c].data());
+                    actualPtrs.push_back(actual[c].data());
+                }
+                generic->deinterleave(expectedPtrs.data(), offset, interleaved.data(), numChannels, numFrames);
+                kernels->deinterleave(actualPtrs.data(), offset, interleaved.data(), numChannels, numFrames);
+                ASSERT_EQ(expected, actual);
+
+                std::vector<sample_t> result(numChannels * numFrames);
+                kernels->interleave(result.data(), actualPtrs.data(), offset, numChannels, numFrames);
+                ASSERT_EQ(interleaved, result);
+            }
+        }
+
+        // Include values out of range and exactly at the limits
+        std::vector<sample_t> samples = signal(67, 5);
+        samples[1] = 1.f; samples[2] = -1.f; samples[3] = 1.5f; samples[4] = -2.f;
+        samples[9] = 1.f; samples[10] = -1.f; samples[11] = 3.f; samples[12] = -3.f;
+        const size_t n = samples.size();
+
+        std::vector<int16_t> i16a(n), i16b(n);
+        generic->toInt16(i16a.data(), samples.data(), n);
+        kernels->toInt16(i16b.data(), samples.data(), n);
+        ASSERT_EQ(i16a, i16b);
+        EXPECT_EQ(i16a[1], 32767); EXPECT_EQ(i16a[4], -32768);
+
+        std::vector<DSP::Int24> i24a(n), i24b(n);
+        generic->toInt24(i24a.data(), samples.data(), n);
+        kernels->toInt24(i24b.data(), samples.data(), n);
+        for (size_t i=0; i < n; i++)
+            for (size_t k=0; k < 3; k++)
+                ASSERT_EQ(i24a[i].bytes[k], i24b[i].bytes[k]);
+
+        std::vector<int32_t> i32a(n), i32b(n);
+        generic->toInt32(i32a.data(), samples.data(), n);
+        kernels->toInt32(i32b.data(), samples.data(), n);
+        ASSERT_EQ(i32a, i32b);
+        EXPECT_GT(i32a[3], 0); EXPECT_EQ(i32a[4], INT32_MIN);
+
+        std::vector<sample_t> fa(n), fb(n);
+        generic->fromInt16(fa.data(), i16a.data(), n);
+        kernels->fromInt16(fb.data(), i16a.data(), n);
+        ASSERT_EQ(fa, fb);
+        generic->fromInt24(fa.data(), i24a.data(), n);
+        kernels->fromInt24(fb.data(), i24a.data(), n);
+        ASSERT_EQ(fa, fb);
+        for (size_t i=0; i < n; i++)
+            ASSERT_NEAR(std::max(-1.f, std::min(1.f, samples[i])), fa[i], 1.f/8388607.f);
+        generic->fromInt32(fa.data(), i32a.data(), n);
+        kernels->fromInt32(fb.data(), i32a.data(), n);
+        ASSERT_EQ(fa, fb);
+    }
+}
+
+TEST(Methcla_Audio_DSP, Interleaved_integer_samples_should_round_trip)
+{
+    using namespace Methcla::Audio;
+
+    // More frames than fit into a single conversion chunk
+    const size_t numChannels = 3;
+    const size_t numFrames = 1000;
+    std::vector<int16_t> input(numChannels * numFrames);
+    for (size_t i=0; i < input.size(); i++)
+        input[i] = (int16_t)(i * 37 - 20000);
+
+    std::vector<std::vector<sample_t>> channels(numChannels, std::vector<sample_t>(numFrames));
+    std::vector<sample_t*> ptrs;
+    for (auto& c : channels)
+        ptrs.push_back(c.data());
+
+    DSP::deinterleave(ptrs.data(), input.data(), numChannels, numFrames);
+    EXPECT_FLOAT_EQ(channels[1][2], (sample_t)input[2*numChannels+1] / 32768.f);
+
+    std::vector<int16_t> output(input.size());
+    DSP::interleave(output.data(), ptrs.data(), numChannels, numFrames);
+    ASSERT_EQ(input, output);
+}
+
+#include "Methcla/Audio/Scheduler.hpp"
+
+#include <random>
+
+TEST(Methcla_Audio_Scheduler, Items_should_be_drained_in_time_order)
+{
+    const double blockDuration = 64. / 44100.;
+    Methcla::Audio::Scheduler<size_t> scheduler(65536, 1. / blockDuration);
+
+    // Spread items over all levels of the wheel, including the overflow list
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> near(0., 10.);
+    std::uniform_real_distribution<double> far(10., 30000.);
+    std::vector<double> times;
+    for (size_t i=0; i < 30000; i++) {
+        const double t = i % 10 == 0 ? far(rng) : near(rng);
+        times.push_back(t);
+        // Equal times should be returned in insertion order
+        if (i % 3 == 0)
+            times.push_back(t);
+    }
+    for (size_t i=0; i < times.size(); i++) {
+        scheduler.push(times[i], i);
+    }
+
+    const size_t numItems = times.size();
+    size_t numDrained = 0;
+    size_t numNested = 0;
+    double prevTime = 0.;
+    size_t prevIndex = 0;
+
+    for (size_t block=0; !scheduler.isEmpty(); block++) {
+        const double currentTime = block * blockDuration;
+        const double nextTime = (block + 1) * blockDuration;
+        scheduler.advance(currentTime);
+        while (scheduler.isDue(nextTime)) {
+            const double t = scheduler.time();
+            const size_t index = scheduler.top();
+            scheduler.pop();
+            ASSERT_LT(t, nextTime);
+            ASSERT_GE(t, prevTime);
+            if (t == prevTime && index < numItems && prevIndex < numItems) {
+                ASSERT_GT(index, prevIndex);
+            }
+            if (index < numItems) {
+                ASSERT_EQ(times[index], t);
+                numDrained++;
+                // Nested items scheduled within the current block are drained immediately
+                if (index % 7 == 0 && t + blockDuration / 4. < nextTime) {
+                    scheduler.push(t + blockDuration / 4., numItems + index);
+                    numNested++;
+                }
+            } else {
+                numNested--;
+            }
+            prevTime = t;
+            prevIndex = index;
+        }
+        ASSERT_EQ(numNested, 0u);
+    }
+
+    EXPECT_EQ(numDrained, numItems);
+}
+
+TEST(Methcla_Audio_Scheduler, Late_items_should_be_due_in_the_current_block)
+{
+    Methcla::Audio::Scheduler<int> scheduler(4, 100.);
+
+    scheduler.advance(10.);
+    scheduler.push(10.5, 2);
+    scheduler.push(5., 1);
+    ASSERT_TRUE(scheduler.isDue(10.01));
+    EXPECT_EQ(scheduler.top(), 1);
+    scheduler.pop();
+    EXPECT_FALSE(scheduler.isDue(10.01));
+
+    // Jump far ahead
+    ASSERT_TRUE(scheduler.isDue(1000.));
+    EXPECT_EQ(scheduler.time(), 10.5);
+    scheduler.pop();
+    EXPECT_TRUE(scheduler.isEmpty());
+
+    for (int i=0; i < 4; i++)
+        scheduler.push(2000. + i, i);
+    EXPECT_THROW(scheduler.push(3000., 4), std::runtime_error);
+}
+
 #include "Methcla/Memory/Manager.hpp"
 
 TEST(Methcla_Memory_Manager, Alloc_free_should_be_noop)
@@ -190,3 +616,63 @@ TEST(Methcla_Memory_Manager, Alloc_free_should_be_noop)
     ASSERT_EQ(stats.freeNumBytes, memSize);
     ASSERT_EQ(stats.usedNumBytes, 0u);
 }
+
+TEST(Methcla_Memory_CommandPool, Freed_blocks_should_be_reused)
+{
+    using Methcla::Memory::CommandPool;
+
+    const size_t numBlocks = 16;
+    CommandPool pool(numBlocks);
+
+    std::vector<void*> blocks;
+    for (size_t i=0; i < numBlocks; i++)
+    {
+        void* ptr = pool.alloc(CommandPool::kBlockSize);
+        ASSERT_TRUE( ptr != nullptr );
+        blocks.push_back(ptr);
+    }
+    ASSERT_THROW(pool.alloc(1), std::bad_alloc);
+    ASSERT_THROW(pool.alloc(CommandPool::kBlockSize + 1), std::invalid_argument);
+
+    // Free from another thread
+    std::thread([&](){ for (void* ptr : blocks) pool.free(ptr); }).join();
+
+    for (size_t i=0; i < numBlocks; i++)
+    {
+        void* ptr = pool.alloc(1);
+        ASSERT_TRUE( std::find(blocks.begin(), blocks.end(), ptr) != blocks.end() );
+    }
+}
+
+#include "Methcla/IO/RequestCapture.hpp"
+
+TEST(Methcla_IO_RequestCapture, Captured_requests_should_be_read_back)
+{
+    using namespace Methcla::IO;
+
+    const std::string path = Methcla::Tests::outputFile("capture.osc");
+    const size_t numRequests = 100;
+
+    {
+        RequestCaptureWriter writer(path, 48000, 128);
+        for (size_t i=0; i < numRequests; i++)
+        {
+            std::vector<char> packet(4 * (i % 7 + 1), (char)i);
+            writer.write(0.5 * i, 0xfffffff0u + i, packet.data(), packet.size());
+        }
+    }
+
+    RequestCaptureReader reader(path);
+    ASSERT_EQ(reader.sampleRate(), 48000u);
+    ASSERT_EQ(reader.blockSize(), 128u);
+
+    CapturedRequest request;
+    for (size_t i=0; i < numRequests; i++)
+    {
+        ASSERT_TRUE(reader.read(request));
+        EXPECT_DOUBLE_EQ(request.time, 0.5 * i);
+        EXPECT_EQ(request.block, (uint32_t)(0xfffffff0u + i));
+        EXPECT_EQ(request.packet, std::vector<char>(4 * (i % 7 + 1), (char)i));
+    }
+    EXPECT_FALSE(reader.read(request));
+}
@@ -0,0 +1,195 @@
+// c++ -std=c++11 -O2 -pthread -I src -I external_libraries/boost -o build/bench_message_queue tools/bench_message_queue.cpp
+//
+// Measure request queue send throughput and latency with 1 to 16 concurrent
+// senders and a single reader. Messages are sent with trySend through
+// MessageQueueInterface, like EnvironmentImpl::trySend does, so the numbers
+// include the fill level bookkeeping. Utility::MessageQueue is compared with
+// the mutex protected single producer queue it replaced.
+
+#include "Methcla/Utility/MessageQueue.hpp"
+#include "Methcla/Utility/MessageQueueInterface.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <boost/lockfree/spsc_queue.hpp>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+using Methcla::Utility::MessageQueueInterface;
+using Methcla::Utility::QueueStatistics;
+
+// Utility::MessageQueue before the switch to LockFreeQueue: senders are
+// serialized by a mutex in front of a single producer queue. boost's
+// spsc_queue doesn't expose its fill level, so it is counted separately;
+// it holds one message less than its size.
+template <typename T> class LockedMessageQueue : public MessageQueueInterface<T>
+{
+public:
+    LockedMessageQueue(size_t queueSize)
+        : m_queue(queueSize)
+        , m_capacity(queueSize - 1)
+        , m_size(0)
+        , m_maxSize(0)
+    { }
+
+    void send(const T& msg) override
+    {
+        if (!trySend(msg)) throw std::runtime_error("Message queue overflow");
+    }
+
+    bool trySend(const T& msg) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queue.push(msg))
+        {
+            const size_t size = m_size.fetch_add(1, std::memory_order_relaxed) + 1;
+            Methcla::Utility::updateMaxQueueSize(m_maxSize, size);
+            return true;
+        }
+        return false;
+    }
+
+    bool next(T& msg) override
+    {
+        if (m_queue.pop(msg))
+        {
+            m_size.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    QueueStatistics statistics() const override
+    {
+        QueueStatistics result;
+        result.size = m_size.load(std::memory_order_relaxed);
+        result.maxSize = m_maxSize.load(std::memory_order_relaxed);
+        result.capacity = m_capacity;
+        return result;
+    }
+
+private:
+    boost::lockfree::spsc_queue<T> m_queue;
+    const size_t                   m_capacity;
+    std::mutex                     m_mutex;
+    std::atomic<size_t>            m_size;
+    std::atomic<size_t>            m_maxSize;
+};
+
+struct Result
+{
+    double              seconds;
+    std::vector<double> latencies;
+    size_t              maxSize;
+};
+
+template <class Queue> Result run(size_t numSenders, size_t numMessages, size_t queueSize)
+{
+    Queue impl(queueSize);
+    MessageQueueInterface<size_t>& queue = impl;
+    std::atomic<bool> start(false);
+    std::vector<std::vector<double>> latencies(numSenders);
+    std::vector<std::thread> senders;
+
+    for (size_t t=0; t < numSenders; t++)
+    {
+        latencies[t].reserve(numMessages);
+        senders.emplace_back([&,t](){
+            while (!start.load()) std::this_thread::yield();
+            for (size_t i=0; i < numMessages; i++)
+            {
+                const auto t0 = Clock::now();
+                // Retry while the reader catches up; only the duration of
+                // the successful send is counted.
+                auto t1 = t0;
+                bool sent = queue.trySend(i);
+                while (!sent)
+                {
+                    std::this_thread::yield();
+                    t1 = Clock::now();
+                    sent = queue.trySend(i);
+                }
+                const auto t2 = Clock::now();
+                latencies[t].push_back(std::chrono::duration<double,std::nano>(t2 - t1).count());
+            }
+        });
+    }
+
+    const size_t total = numSenders * numMessages;
+    const auto startTime = Clock::now();
+    start.store(true);
+
+    // The reader also polls the fill level now and then, like the engine
+    // statistics do.
+    size_t received = 0;
+    size_t maxSize = 0;
+    size_t msg;
+    while (received < total)
+    {
+        if (queue.next(msg) && (++received % 1024) == 0)
+            maxSize = std::max(maxSize, queue.statistics().size);
+    }
+
+    const auto endTime = Clock::now();
+    for (auto& t : senders) t.join();
+
+    Result result;
+    result.maxSize = std::max(maxSize, queue.statistics().maxSize);
+    result.seconds = std::chrono::duration<double>(endTime - startTime).count();
+    for (const auto& x : latencies)
+        result.latencies.insert(result.latencies.end(), x.begin(), x.end());
+    std::sort(result.latencies.begin(), result.latencies.end());
+    return result;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+template <class Queue> void report(const char* name, size_t numSenders, size_t numMessages, size_t queueSize)
+{
+    const Result r = run<Queue>(numSenders, numMessages, queueSize);
+    std::cout << std::setw(10) << name
+              << std::setw(8) << numSenders
+              << std::setw(14) << std::fixed << std::setprecision(0) << (r.latencies.size() / r.seconds)
+              << std::setw(10) << percentile(r.latencies, 0.5)
+              << std::setw(10) << percentile(r.latencies, 0.99)
+              << std::setw(10) << percentile(r.latencies, 0.999)
+              << std::setw(12) << r.latencies.back()
+              << std::setw(10) << r.maxSize
+              << std::endl;
+}
+
+int main(int argc, const char* const* argv)
+{
+    const size_t numMessages = argc > 1 ? std::atoi(argv[1]) : 100000;
+    const size_t queueSize = 8192;
+
+    std::cout << std::setw(10) << "queue"
+              << std::setw(8) << "senders"
+              << std::setw(14) << "msgs/s"
+              << std::setw(10) << "p50 ns"
+              << std::setw(10) << "p99 ns"
+              << std::setw(10) << "p99.9 ns"
+              << std::setw(12) << "max ns"
+              << std::setw(10) << "max size"
+              << std::endl;
+
+    for (size_t n : { 1, 2, 4, 8, 16 })
+    {
+        report<LockedMessageQueue<size_t>>("locked", n, numMessages, queueSize);
+        report<Methcla::Utility::MessageQueue<size_t>>("lockfree", n, numMessages, queueSize);
+    }
+
+    return 0;
+}
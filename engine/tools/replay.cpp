@@ -0,0 +1,177 @@
+// Copyright 2012-2014 Samplecount S.L.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Replay a request capture (Methcla_EngineOptions::capture_file) through an
+// engine and report the processing cost per audio block.
+//
+// Usage: methcla-replay [--realtime] [--tail SECONDS] FILE
+//
+// Requests are sent before the block they were received in originally,
+// relative to the block of the first request. Blocks are processed as fast as
+// possible unless --realtime is given, which paces them at the block rate.
+// Processing continues for --tail seconds (default 1) after the last request.
+//
+// Build with `./stir replay`.
+
+#include "Methcla/Audio/Engine.hpp"
+#include "Methcla/Exception.hpp"
+#include "Methcla/IO/RequestCapture.hpp"
+
+#include <methcla/plugins/node-control.h>
+#include <methcla/plugins/patch-cable.h>
+#include <methcla/plugins/sampler.h>
+#include <methcla/plugins/sine.h>
+#include <methcla/plugins/soundfile_api_dummy.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Methcla;
+using Methcla::Audio::sample_t;
+
+typedef std::chrono::steady_clock Clock;
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+int main(int argc, const char* const* argv)
+{
+    try
+    {
+        bool realtime = false;
+        double tail = 1.;
+        std::string path;
+
+        for (int i=1; i < argc; i++)
+        {
+            if (std::strcmp(argv[i], "--realtime") == 0)
+                realtime = true;
+            else if (std::strcmp(argv[i], "--tail") == 0 && i + 1 < argc)
+                tail = std::atof(argv[++i]);
+            else
+                path = argv[i];
+        }
+
+        if (path.empty())
+            throw std::runtime_error("Usage: methcla-replay [--realtime] [--tail SECONDS] FILE");
+
+        IO::RequestCaptureReader reader(path);
+        std::vector<IO::CapturedRequest> requests;
+        IO::CapturedRequest request;
+        while (reader.read(request))
+            requests.push_back(request);
+
+        if (requests.empty())
+        {
+            std::cout << "No requests in " << path << std::endl;
+            return 0;
+        }
+
+        Audio::Environment::Options options;
+        options.sampleRate = reader.sampleRate();
+        options.blockSize = reader.blockSize();
+        options.pluginLibraries = {
+            methcla_plugins_sine,
+            methcla_plugins_node_control,
+            methcla_plugins_patch_cable,
+            methcla_plugins_sampler,
+            methcla_soundfile_api_dummy
+        };
+
+        Audio::Environment env(
+            [](Methcla_LogLevel, const char* message) { std::cerr << message << std::endl; },
+            [](Methcla_RequestId, const void*, size_t) { },
+            options
+        );
+
+        const size_t blockSize = options.blockSize;
+        const double blockDuration = (double)blockSize / options.sampleRate;
+        const uint32_t firstBlock = requests.front().block;
+        const Methcla_Time startTime = requests.front().time;
+        const size_t numBlocks = (uint32_t)(requests.back().block - firstBlock) + 1
+                               + (size_t)(tail / blockDuration);
+
+        std::vector<std::vector<sample_t>> inputBuffers(options.numHardwareInputChannels, std::vector<sample_t>(blockSize, 0));
+        std::vector<std::vector<sample_t>> outputBuffers(options.numHardwareOutputChannels, std::vector<sample_t>(blockSize, 0));
+        std::vector<const sample_t*> inputs;
+        std::vector<sample_t*> outputs;
+        for (auto& buffer : inputBuffers)
+            inputs.push_back(buffer.data());
+        for (auto& buffer : outputBuffers)
+            outputs.push_back(buffer.data());
+
+        std::vector<double> costs;
+        costs.reserve(numBlocks);
+        size_t next = 0;
+        size_t numDropped = 0;
+        const Clock::time_point replayStart = Clock::now();
+
+        for (size_t block=0; block < numBlocks; block++)
+        {
+            while (next < requests.size() && (uint32_t)(requests[next].block - firstBlock) <= block)
+            {
+                try
+                {
+                    env.send(requests[next].packet.data(), requests[next].packet.size());
+                }
+                catch (Error&)
+                {
+                    numDropped++;
+                }
+                next++;
+            }
+
+            const Clock::time_point t0 = Clock::now();
+            env.process(startTime + block * blockDuration, blockSize, inputs.data(), outputs.data());
+            costs.push_back(std::chrono::duration<double,std::micro>(Clock::now() - t0).count());
+
+            if (realtime)
+                std::this_thread::sleep_until(replayStart + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>((block + 1) * blockDuration)));
+        }
+
+        const double budget = blockDuration * 1e6;
+        const size_t numOverruns = std::count_if(costs.begin(), costs.end(), [budget](double x) { return x > budget; });
+        double total = 0.;
+        for (double x : costs)
+            total += x;
+        std::sort(costs.begin(), costs.end());
+
+        std::cout << "Replayed " << requests.size() << " requests"
+                  << " (" << numDropped << " dropped) in " << numBlocks << " blocks"
+                  << " of " << blockSize << " frames at " << options.sampleRate << " Hz" << std::endl
+                  << "Block cost (us): mean " << total / costs.size()
+                  << ", median " << percentile(costs, 0.5)
+                  << ", p99 " << percentile(costs, 0.99)
+                  << ", max " << costs.back()
+                  << ", budget " << budget << std::endl
+                  << "Blocks over budget: " << numOverruns << std::endl;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}